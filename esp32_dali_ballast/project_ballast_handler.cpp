@@ -2,6 +2,7 @@
 #include "project_config.h"
 #include "base_diagnostics.h"
 #include "project_mqtt.h"
+#include "esp_cpu.h"
 #include <Preferences.h>
 
 Dali dali;
@@ -11,6 +12,8 @@ uint8_t recentMessagesIndex = 0;
 // Queue removed - DALI-2 backward frames have no retry mechanism
 unsigned long lastBusActivityTime = 0;
 bool busIsIdle = true;
+int64_t lastForwardStartUs = 0;  // Start bit of the frame being handled (esp_timer time)
+int64_t lastForwardEndUs = 0;  // End of the frame being answered (esp_timer time)
 
 unsigned long ballastRxCount = 0;
 unsigned long ballastTxCount = 0;
@@ -28,21 +31,39 @@ const uint32_t fade_times[] = {
     8000, 11310, 16000, 22630, 32000, 45250, 64000, 90510
 };
 
-uint8_t bus_is_high() {
-  return digitalRead(DALI_RX_PIN);
+// Cost of dali.timer() in CPU cycles: the maximum since boot and the average
+// over the last DALI_ISR_AVG_CALLS calls
+volatile uint32_t daliIsrCyclesMax = 0;
+volatile uint32_t daliIsrCyclesAvg = 0;
+static uint32_t isrCyclesSum = 0;
+static uint16_t isrCyclesCalls = 0;
+
+void ARDUINO_ISR_ATTR onTimer() {
+  uint32_t start = esp_cpu_get_cycle_count();
+  dali.timer();
+  uint32_t cycles = esp_cpu_get_cycle_count() - start;
+  if (cycles > daliIsrCyclesMax) daliIsrCyclesMax = cycles;
+  isrCyclesSum += cycles;
+  if (++isrCyclesCalls >= DALI_ISR_AVG_CALLS) {
+    daliIsrCyclesAvg = isrCyclesSum / isrCyclesCalls;
+    isrCyclesSum = 0;
+    isrCyclesCalls = 0;
+  }
 }
 
-void bus_set_low() {
-  digitalWrite(DALI_TX_PIN, LOW);
+#if DALI_RX_EDGE_CAPTURE
+void ARDUINO_ISR_ATTR onBusEdge() {
+  dali.edge(DaliIo::is_high());
 }
 
-void bus_set_high() {
-  digitalWrite(DALI_TX_PIN, HIGH);
+void ARDUINO_ISR_ATTR daliTimerStart() {
+  timerStart(timer);
 }
 
-void ARDUINO_ISR_ATTR onTimer() {
-  dali.timer();
+void ARDUINO_ISR_ATTR daliTimerStop() {
+  timerStop(timer);
 }
+#endif
 
 void ballastInit() {
   // CRITICAL: Load config FIRST before starting hardware
@@ -53,13 +74,20 @@ void ballastInit() {
   pinMode(DALI_TX_PIN, OUTPUT);
 
   // Initialize DALI library (but don't start timer yet)
-  dali.begin(bus_is_high, bus_set_high, bus_set_low);
+#if DALI_RX_EDGE_CAPTURE
+  dali.begin(daliTimerStart, daliTimerStop);
+#else
+  dali.begin();
+#endif
   
   // Start timer LAST - after config is loaded and DALI is initialized
   // This prevents receiving frames before address is set
   timer = timerBegin(DALI_TIMER_FREQ);
   timerAttachInterrupt(timer, &onTimer);
-  timerAlarm(timer, 1000, true, 0);
+  timerAlarm(timer, DALI_TIMER_FREQ / DALI_SAMPLE_HZ, true, 0);
+#if DALI_RX_EDGE_CAPTURE
+  attachInterrupt(DALI_RX_PIN, onBusEdge, CHANGE);
+#endif
 
   updateLED();
 
@@ -186,10 +214,20 @@ void saveBallastConfig() {
 #endif
 }
 
+// Drain the driver's receive queue. Frames are queued by the timer ISR, so
+// nothing is lost while the loop is held up by the web server or MQTT.
 void monitorDaliBus() {
+  dali.service();  // Completion callbacks of sent backward frames
+
   uint8_t rx_data[4];
-  uint8_t result = dali.rx(rx_data);
+  for (uint8_t i = 0; i < DALI_RX_QUEUE_SIZE; i++) {
+    uint8_t result = dali.rx(rx_data, &lastForwardStartUs, &lastForwardEndUs);
+    if (result < 2) break;  // Queue empty (or frame still being received)
+    handleBusFrame(rx_data, result);
+  }
+}
 
+void handleBusFrame(uint8_t* rx_data, uint8_t result) {
   // Handle received frames
   // DALI-1 control gear uses only 8-bit (backward) and 16-bit (forward) frames
   // 24-bit frames are either:
@@ -603,6 +641,8 @@ void processCommand(uint8_t addr_byte, uint8_t data_byte) {
 
   BallastMessage msg;
   msg.timestamp = millis();
+  msg.start_us = lastForwardStartUs;
+  msg.end_us = lastForwardEndUs;
   msg.is_query_response = false;
   msg.raw_bytes[0] = addr_byte;
   msg.raw_bytes[1] = data_byte;
@@ -1464,15 +1504,10 @@ void updateLED() {
   neopixelWrite(LED_PIN, c1, c2, c3);
 }
 
-void sendBackwardFrame(uint8_t data) {
-  // DALI requires backward frame within 7-22ms of forward frame
-  // Send immediately, don't queue
-  updateBusActivity();
-  
-  uint8_t response[1] = {data};
-  int result = dali.tx_wait(response, 8, QUERY_RESPONSE_TIMEOUT_MS);
-  
-  if (result >= 0) {
+// Result of a backward frame, called from dali.service()
+void onBackwardFrameSent(int16_t handle, int16_t result, void* ctx) {
+  uint8_t data = (uint8_t)(uintptr_t)ctx;
+  if (result == DALI_OK) {
     incrementTxCount();
 #ifdef DEBUG_SERIAL
     Serial.printf("[Ballast] Sent response: 0x%02X\n", data);
@@ -1480,7 +1515,22 @@ void sendBackwardFrame(uint8_t data) {
   } else {
     incrementErrorCount();
 #ifdef DEBUG_SERIAL
-    Serial.printf("[Ballast] Response transmission failed: 0x%02X\n", data);
+    Serial.printf("[Ballast] Response transmission failed: 0x%02X (%d)\n", data, result);
+#endif
+  }
+}
+
+void sendBackwardFrame(uint8_t data) {
+  // DALI requires the backward frame 5.5-10.5ms after the end of the forward frame.
+  // Handed to the timer ISR, which sends it inside that window (or drops it if the
+  // window has passed or another frame came in), the loop does not wait for it
+  updateBusActivity();
+  
+  int16_t handle = dali.reply(data, lastForwardEndUs, onBackwardFrameSent, (void*)(uintptr_t)data);
+  if (handle < 0) {
+    incrementErrorCount();
+#ifdef DEBUG_SERIAL
+    Serial.printf("[Ballast] Response could not be queued: 0x%02X (%d)\n", data, handle);
 #endif
   }
 }
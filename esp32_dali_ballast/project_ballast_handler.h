@@ -13,6 +13,10 @@ extern BallastMessage recentMessages[RECENT_MESSAGES_SIZE];
 extern uint8_t recentMessagesIndex;
 extern unsigned long lastBusActivityTime;
 extern bool busIsIdle;
+extern int64_t lastForwardStartUs;
+extern int64_t lastForwardEndUs;
+extern volatile uint32_t daliIsrCyclesMax;
+extern volatile uint32_t daliIsrCyclesAvg;
 
 extern unsigned long ballastRxCount;
 extern unsigned long ballastTxCount;
@@ -26,6 +30,7 @@ void ballastInit();
 void loadBallastConfig();
 void saveBallastConfig();
 void monitorDaliBus();
+void handleBusFrame(uint8_t* rx_data, uint8_t result);
 bool isForThisBallast(uint8_t addr_byte);
 bool isSpecialCommand(uint8_t addr_byte);
 void processCommand(uint8_t addr_byte, uint8_t data_byte);
@@ -36,6 +41,7 @@ void setLevel(uint8_t level);
 void updateFade();
 void updateLED();
 void sendBackwardFrame(uint8_t data);
+void onBackwardFrameSent(int16_t handle, int16_t result, void* ctx);
 bool isBusIdle();
 void updateBusActivity();
 uint8_t getStatusByte();
@@ -44,8 +50,4 @@ void recallScene(uint8_t scene);
 void storeScene(uint8_t scene, uint8_t level);
 uint8_t queryScene(uint8_t scene);
 
-uint8_t bus_is_high();
-void bus_set_low();
-void bus_set_high();
-
 #endif
@@ -105,6 +105,8 @@ struct BallastState {
 
 struct BallastMessage {
     unsigned long timestamp;
+    int64_t start_us;         // esp_timer time of the start bit, latched by the timer ISR
+    int64_t end_us;           // esp_timer time the frame ended on the bus
     bool is_query_response;   // true = query response sent, false = command received
     uint8_t raw_bytes[2];     // Received command
     uint8_t response_byte;    // Response sent (if query)
@@ -34,8 +34,21 @@
 
 #define DALI_TX_PIN 17
 #define DALI_RX_PIN 14
+#define DALI_TX_ACTIVE_HIGH 1  // the transceiver pulls the bus low while the tx pin is high
 #define DALI_TIMER_FREQ 9600000
 
+// Samples per bit of the sampling receiver: 4, 8 or 16. The timer interrupt
+// runs 1200 * DALI_OVERSAMPLE times per second, fewer samples cost less CPU,
+// more give the decoder finer edge timing
+#define DALI_OVERSAMPLE 8
+
+// DALI receive backend: 0 = sample the bus in the timer interrupt,
+// 1 = capture rx pin edges, the timer only runs while the bus is busy
+#define DALI_RX_EDGE_CAPTURE 0
+
+// Timer ISR cost on the diagnostics page: average over this many calls (1 s of sampling)
+#define DALI_ISR_AVG_CALLS (1200 * DALI_OVERSAMPLE)
+
 // Onboard LED pin (WS2812 RGB LED on Waveshare ESP32-S3-PICO)
 #define LED_PIN 21
 #define LED_COUNT 1
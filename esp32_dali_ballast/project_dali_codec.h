@@ -0,0 +1,532 @@
+// Manchester encode/decode helpers for the Dali driver.
+//
+// The lookup tables are generated at compile time (constexpr) and placed in
+// DRAM, and the helpers used by the timer ISR are force-inlined so they end
+// up in IRAM with it. Nothing in here touches the hardware, so the same code
+// builds on the host (tools/dali_sim).
+#ifndef PROJECT_DALI_CODEC_H
+#define PROJECT_DALI_CODEC_H
+
+#include <inttypes.h>
+
+#include "esp_attr.h"
+
+// samples per bit taken by the sampling receiver (timer() runs at 1200 * DALI_OVERSAMPLE Hz):
+// 4, 8 or 16, fewer is less ISR load, more is finer edge timing. The fixed window
+// decoders below (dali_man_decode, DaliManStream) are for 8x only, the phase locked
+// decoder takes the factor as a template parameter
+#ifndef DALI_OVERSAMPLE
+#define DALI_OVERSAMPLE 8
+#endif
+#define DALI_SAMPLE_HZ (1200 * DALI_OVERSAMPLE)
+
+//-------------------------------------------------------------------
+// manchester decode
+/*
+
+Prefectly matched transmitter and sampling: 8 samples per bit
+---------+   +---+   +-------+       +-------+   +------------------------
+         |   |   |   |       |       |       |   |
+         +---+   +---+       +-------+       +---+
+sample-> 012345670123456701234567012345670123456701234567012345670
+sync->   ^       ^       ^       ^       ^       ^       ^       ^
+decode-> start   1       1       0       1       0       stop    stop
+
+
+slow transmitter: 9 samples per bit
+---------+   +----+    +--------+        +--------+   +------------------------
+         |   |    |    |        |        |        |   |
+         +---+    +----+        +--------+        +---+
+sample-> 0123456780123456780123456780123456780123456780123456780123456780
+sync->   ^        ^        ^        ^        ^        ^        ^        ^
+decode-> start    1        1        0        1        0        stop     stop
+
+*/
+
+// compute weight for a 8 bit sample i
+constexpr uint8_t dali_man_weight(uint8_t i)
+{
+    int8_t w = 0;
+    w += ((i >> 7) & 1) ? 1 : -1;
+    w += ((i >> 6) & 1) ? 2 : -2; // put more weight in middle
+    w += ((i >> 5) & 1) ? 2 : -2; // put more weight in middle
+    w += ((i >> 4) & 1) ? 1 : -1;
+    w -= ((i >> 3) & 1) ? 1 : -1;
+    w -= ((i >> 2) & 1) ? 2 : -2; // put more weight in middle
+    w -= ((i >> 1) & 1) ? 2 : -2; // put more weight in middle
+    w -= ((i >> 0) & 1) ? 1 : -1;
+    // w at this point:
+    // w = -12 perfect manchester encoded value 1
+    //...
+    // w =  -2 very weak value 1
+    // w =   0 unknown (all samples high or low)
+    //...
+    // w =  12 perfect manchester encoded value 0
+
+    w *= 2;
+    if (w < 0)
+        w = -w + 1;
+    return w;
+}
+
+// expand a data byte to 16 half bits, MSB first: bit value 1 -> 10, bit value 0 -> 01
+constexpr uint16_t dali_man_expand(uint8_t b)
+{
+    uint16_t hb = 0;
+    for (uint8_t i = 0; i < 8; i++)
+        hb = (hb << 2) | ((b & (0x80 >> i)) ? 0x2 : 0x1);
+    return hb;
+}
+
+struct DaliManWeightTable {
+    uint8_t w[256];
+};
+
+struct DaliManExpandTable {
+    uint16_t hb[256];
+};
+
+constexpr DaliManWeightTable dali_make_weight_table()
+{
+    DaliManWeightTable t = {};
+    for (int i = 0; i < 256; i++)
+        t.w[i] = dali_man_weight(i);
+    return t;
+}
+
+constexpr DaliManExpandTable dali_make_expand_table()
+{
+    DaliManExpandTable t = {};
+    for (int i = 0; i < 256; i++)
+        t.hb[i] = dali_man_expand(i);
+    return t;
+}
+
+static constexpr DRAM_ATTR DaliManWeightTable dali_man_weight_lut = dali_make_weight_table();
+static constexpr DRAM_ATTR DaliManExpandTable dali_man_expand_lut = dali_make_expand_table();
+
+static_assert(dali_man_weight_lut.w[0x0F] == 25, "perfect 1 (low, high) has maximum weight, odd");
+static_assert(dali_man_weight_lut.w[0xF0] == 24, "perfect 0 (high, low) has maximum weight, even");
+static_assert(dali_man_weight_lut.w[0xFF] == 0, "idle has no weight");
+static_assert(dali_man_expand_lut.hb[0xA5] == 0x9966, "10100101 -> 10 01 10 01 01 10 01 10");
+
+#define DALI_MAN_BIT0 0 // bit value 0
+#define DALI_MAN_BIT1 1 // bit value 1
+#define DALI_MAN_STOP 2 // 8 high samples: stop bit
+#define DALI_MAN_COLLISION 3 // 8 low samples: collision
+
+// decode one manchester bit from 10 samples, oldest in bit 9. win holds the
+// samples from one before the nominal bit start up to one after the nominal
+// bit end, so the bit can be taken 7, 8 or 9 samples after the previous one,
+// whichever gives the strongest manchester weight (+/-1 sample per bit)
+// step returns the number of samples to the next bit
+FORCE_INLINE_ATTR uint8_t dali_man_bit(uint16_t win, uint8_t* step)
+{
+    uint8_t s7 = win >> 2; // nominal oversample rate - 1
+    uint8_t s8 = win >> 1; // nominal oversample rate
+    uint8_t s9 = win; // nominal oversample rate + 1
+
+    // stop bit: received high (non-asserted) bus for 8 samples
+    // collision: received low (asserted) bus for 8 samples
+    // the +1 window wins over the -1 window, which wins over the nominal one
+    if (s9 == 0xFF)
+        return DALI_MAN_STOP;
+    if (s9 == 0x00)
+        return DALI_MAN_COLLISION;
+    if (s7 == 0xFF)
+        return DALI_MAN_STOP;
+    if (s7 == 0x00)
+        return DALI_MAN_COLLISION;
+    if (s8 == 0xFF)
+        return DALI_MAN_STOP;
+    if (s8 == 0x00)
+        return DALI_MAN_COLLISION;
+
+    uint8_t weightmax = dali_man_weight_lut.w[s8]; // weight of maximum
+    uint8_t pmax = 8; // position of maximum
+    uint8_t w = dali_man_weight_lut.w[s7];
+    if (weightmax < w) { // when equal keep pmax=8, the nominal oversample baud rate
+        weightmax = w;
+        pmax = 7;
+    }
+    w = dali_man_weight_lut.w[s9];
+    if (weightmax < w) { // when equal keep previous value
+        weightmax = w;
+        pmax = 9;
+    }
+    *step = pmax;
+    return weightmax & 1; // databit is bit0 of weight
+}
+
+// store decoded bit number dbitlen (0 is the start bit, which is not stored)
+// a partial last byte ends up right aligned
+FORCE_INLINE_ATTR void dali_man_store(uint8_t* ddata, uint8_t dbitlen, uint8_t bit)
+{
+    if (dbitlen > 0) { // ignore start bit
+        uint8_t bytepos = (dbitlen - 1) >> 3;
+        uint8_t bitpos = (dbitlen - 1) & 0x7;
+        if (bitpos == 0)
+            ddata[bytepos] = 0; // empty data before storing first bit
+        ddata[bytepos] = (ddata[bytepos] << 1) | bit;
+    }
+}
+
+// decode 8 times oversampled encoded data, MSB of edata[0] is the oldest sample
+// returns bitlen of decoded data, or 0 on collision
+inline uint8_t dali_man_decode(const volatile uint8_t* edata, uint16_t ebitlen, uint8_t* ddata)
+{
+    uint8_t dbitlen = 0;
+    uint16_t ebitpos = 1;
+    while (ebitpos + 1 < ebitlen) {
+        // load the 10 samples starting at ebitpos - 1, right aligned
+        uint8_t pos = (ebitpos - 1) >> 3;
+        uint8_t shift = (ebitpos - 1) & 0x7;
+        uint32_t win = ((uint32_t)edata[pos] << 16) | ((uint32_t)edata[pos + 1] << 8);
+        if (shift > 6)
+            win |= edata[pos + 2];
+        win = ((win << shift) >> 14) & 0x3FF;
+
+        uint8_t step;
+        uint8_t bit = dali_man_bit(win, &step);
+        if (bit == DALI_MAN_STOP)
+            break;
+        if (bit == DALI_MAN_COLLISION)
+            return 0;
+        dali_man_store(ddata, dbitlen, bit);
+        dbitlen++;
+        ebitpos += step; // jump to next mancheter bit, skipping over number of samples with max weight
+    }
+    if (dbitlen > 1)
+        dbitlen--;
+    return dbitlen;
+}
+
+//-------------------------------------------------------------------
+// streaming manchester decode
+//
+// Same decision as dali_man_decode(), but fed one sample at a time so it can
+// run in the timer ISR: a bit is resolved as soon as the last sample of its
+// +1 window has arrived, and the frame is complete at the first stop window,
+// about one bit time after the last edge instead of after 2 idle bits.
+
+#define DALI_MAN_STREAM_BUSY 0 // need more samples
+#define DALI_MAN_STREAM_DONE 1 // stop bit received, frame in data/len
+#define DALI_MAN_STREAM_ERROR 2 // collision, or more than 32 data bits
+
+struct DaliManStream {
+    uint16_t win; // last 16 samples, LSB is newest
+    uint16_t cnt; // number of samples received
+    uint16_t next; // sample count at which the next bit window is complete
+    uint8_t dbitlen; // decoded bits, incl start bit
+    uint8_t data[4]; // decoded data, partial last byte right aligned
+};
+
+// call with the first sample of a frame (the falling edge of the start bit)
+FORCE_INLINE_ATTR void dali_man_stream_begin(DaliManStream* s)
+{
+    s->win = 0;
+    s->cnt = 0;
+    s->next = 1 + 9; // bit at ebitpos 1 needs samples 0..9
+    s->dbitlen = 0;
+}
+
+// push one sample (1 = bus high), returns DALI_MAN_STREAM_xxx
+FORCE_INLINE_ATTR uint8_t dali_man_stream_push(DaliManStream* s, uint8_t busishigh)
+{
+    s->win = (s->win << 1) | busishigh;
+    s->cnt++;
+    if (s->cnt != s->next)
+        return DALI_MAN_STREAM_BUSY;
+
+    uint8_t step;
+    uint8_t bit = dali_man_bit(s->win & 0x3FF, &step);
+    if (bit == DALI_MAN_STOP)
+        return DALI_MAN_STREAM_DONE;
+    if (bit == DALI_MAN_COLLISION || s->dbitlen > 32)
+        return DALI_MAN_STREAM_ERROR;
+    dali_man_store(s->data, s->dbitlen, bit);
+    s->dbitlen++;
+    s->next += step;
+    return DALI_MAN_STREAM_BUSY;
+}
+
+// number of data bits after DALI_MAN_STREAM_DONE (0 or 1 is a decode error, as with dali_man_decode)
+FORCE_INLINE_ATTR uint8_t dali_man_stream_len(const DaliManStream* s)
+{
+    return s->dbitlen > 1 ? s->dbitlen - 1 : s->dbitlen;
+}
+
+//-------------------------------------------------------------------
+// phase locked manchester decode
+//
+// Fed one sample at a time like DaliManStream, but instead of choosing the
+// best of three fixed bit windows it follows the sender's clock: every edge
+// is timed against the predicted position of the next mid-bit transition,
+// and the error pulls the phase, the half bit period and the rise delay
+// (an alpha-beta tracking loop). A sender at the edge of the +/-10%
+// tolerance, one drifting within the frame, or one whose transceiver
+// stretches the low pulses stays locked across long frames.
+//
+// At 8x and 16x a median of 3 filter in front removes single sample spikes
+// (at 4x a half bit is only 2 samples, a short one would be filtered out).
+// The period and rise delay start out from the first falling edge after the
+// start bit (2 or 3 TE after it), falling to falling edge times are not
+// affected by the rise delay. Time is counted in 1/16 samples.
+//
+// sync->  start           mid             mid             mid
+//         v               v               v               v
+// ----+       +-------+       +---+   +-------+       +-----------
+//     |       |       |       |   |   |       |       |
+//     +-------+       +-------+   +---+       +-------+
+//                                 ^   ^
+//                          boundary   mid: +/- TE/2 window around the prediction
+//
+// An edge is a mid-bit transition when it falls within +/-TE/2 of the
+// prediction and a bit boundary transition when it falls within +/-TE/2 of
+// one TE before it; anything else is an error. margin is the smallest
+// distance of any edge of the frame from the edge of its window:
+// 255 = every edge exactly where predicted, 0 = on the limit.
+//
+// Returns DALI_MAN_STREAM_DONE when no mid-bit edge came by one TE after the
+// predicted one with the bus high: that is the end of the first stop bit, as
+// with DaliManStream (plus the filter delay).
+
+#define DALI_MAN_PLL_WEAK 64 // margin below this: the frame was decoded, but barely
+
+// decoder timing at OVS samples per bit
+template <uint8_t OVS>
+struct DaliManPllTiming {
+    static_assert(OVS == 4 || OVS == 8 || OVS == 16, "oversampling factor must be 4, 8 or 16");
+    static constexpr int16_t te = 8 * OVS; // nominal half bit, OVS / 2 samples of 16
+    static constexpr int16_t te_min = te - te / 4; // -25%, DALI allows +/-10%
+    static constexpr int16_t te_max = te + te / 4; // +25%
+    static constexpr bool filter = OVS >= 8; // median of 3 filter
+    static constexpr uint16_t delay_us = filter ? 833 / OVS : 0; // the filter delays every edge by one sample
+};
+
+struct DaliManPll {
+    uint8_t raw; // last 2 raw samples
+    uint8_t level; // filtered bus level
+    uint8_t dbitlen; // decoded bits, incl start bit
+    uint8_t margin; // smallest edge margin so far
+    uint16_t t; // time of the current sample
+    uint16_t mid; // predicted time of the next mid-bit edge, 0 before the start bit
+    uint16_t t0; // time of the start bit's falling edge
+    uint16_t t1; // time of the start bit's mid-bit edge
+    int16_t te; // half bit period estimate
+    int16_t rise; // rising edges come this much later than falling ones
+    int16_t fall; // timing error of the last falling edge
+    uint8_t data[4]; // decoded data, partial last byte right aligned
+};
+
+// call with the first sample of a frame (the falling edge of the start bit)
+template <uint8_t OVS = DALI_OVERSAMPLE>
+FORCE_INLINE_ATTR void dali_man_pll_begin(DaliManPll* p)
+{
+    p->raw = 0x3; // idle before the frame
+    p->level = 1;
+    p->dbitlen = 0;
+    p->margin = 255;
+    p->t = 0;
+    p->mid = 0;
+    p->t0 = 0;
+    p->t1 = 0;
+    p->te = DaliManPllTiming<OVS>::te;
+    p->rise = 0;
+    p->fall = 0;
+}
+
+FORCE_INLINE_ATTR int16_t dali_man_pll_clamp(int16_t v, int16_t lo, int16_t hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// keep the smallest margin of an edge err away from the center of its +/-te/2 window
+FORCE_INLINE_ATTR void dali_man_pll_margin(DaliManPll* p, int16_t err)
+{
+    if (err < 0)
+        err = -err;
+    int16_t m = (p->te >> 1) - err;
+    if (m <= 0)
+        m = 0;
+    else
+        m = (int16_t)(((uint32_t)m * 510) / p->te); // (te/2 - |err|) / (te/2) * 255
+    if (m < p->margin)
+        p->margin = m;
+}
+
+// the first falling edge after the start bit came n TE after the start bit fell:
+// period from the two falling edges (weighted with the nominal one, a sample is
+// 2 / OVS TE), rise delay from the start bit's low half, taken at half weight
+template <uint8_t OVS>
+FORCE_INLINE_ATTR void dali_man_pll_lock(DaliManPll* p, uint16_t tedge, uint8_t n)
+{
+    typedef DaliManPllTiming<OVS> T;
+    int16_t te = ((int16_t)(tedge - p->t0) + 2 * T::te) / (n + 2);
+    p->te = dali_man_pll_clamp(te, T::te_min, T::te_max);
+    p->rise = dali_man_pll_clamp(((int16_t)(p->t1 - p->t0) - p->te) / 2, -(p->te >> 2), p->te >> 2);
+    p->fall = 0;
+}
+
+// pull phase, period and rise delay towards an edge that came err late
+template <uint8_t OVS>
+FORCE_INLINE_ATTR void dali_man_pll_track(DaliManPll* p, uint8_t rising, int16_t err)
+{
+    if (rising)
+        p->rise = dali_man_pll_clamp(p->rise + (err - p->fall) / 4, -(p->te >> 2), p->te >> 2);
+    else
+        p->fall = err;
+    p->te = dali_man_pll_clamp(p->te + err / 8, DaliManPllTiming<OVS>::te_min, DaliManPllTiming<OVS>::te_max);
+    p->mid += err * 5 / 8; // divisions round towards 0: shifts would bias the loop
+}
+
+// push one sample (1 = bus high), returns DALI_MAN_STREAM_xxx
+template <uint8_t OVS = DALI_OVERSAMPLE>
+FORCE_INLINE_ATTR uint8_t dali_man_pll_push(DaliManPll* p, uint8_t busishigh)
+{
+    uint8_t level = busishigh;
+    if (DaliManPllTiming<OVS>::filter) {
+        // median of the last 3 samples
+        uint8_t r = ((p->raw << 1) | busishigh) & 0x7;
+        p->raw = r & 0x3;
+        level = (r == 0x3 || r >= 0x5) ? 1 : 0;
+    }
+    p->t += 16;
+
+    if (level == p->level) {
+        if (p->mid == 0 || (int16_t)(p->t - p->mid) <= p->te)
+            return DALI_MAN_STREAM_BUSY;
+        // no mid-bit edge: stop bit, or the bus is held low
+        return level ? DALI_MAN_STREAM_DONE : DALI_MAN_STREAM_ERROR;
+    }
+
+    // edge between the previous sample and this one
+    p->level = level;
+    uint16_t tedge = p->t - 8;
+    if (p->mid == 0) {
+        if (level)
+            return DALI_MAN_STREAM_BUSY; // spike before the start bit
+        p->t0 = tedge; // falling edge of the start bit: its mid-bit edge follows one TE later
+        p->mid = tedge + p->te;
+        return DALI_MAN_STREAM_BUSY;
+    }
+    int16_t err = (int16_t)(tedge - p->mid);
+    if (level)
+        err -= p->rise;
+    int16_t half = p->te >> 1;
+    if (err < -half) {
+        // bit boundary transition, one TE before the mid-bit one
+        err += p->te;
+        if (err < -half)
+            return DALI_MAN_STREAM_ERROR;
+        dali_man_pll_margin(p, err);
+        if (p->dbitlen == 1 && !level) {
+            dali_man_pll_lock<OVS>(p, tedge, 2); // the first data bit is a 1
+            p->mid = p->t0 + 3 * p->te;
+        } else {
+            dali_man_pll_track<OVS>(p, level, err);
+        }
+        return DALI_MAN_STREAM_BUSY;
+    }
+    if (err > half)
+        return DALI_MAN_STREAM_ERROR;
+
+    // mid-bit transition: the level after it is the bit value, the start bit rises
+    if (p->dbitlen == 0 && !level)
+        return DALI_MAN_STREAM_ERROR;
+    if (p->dbitlen > 32)
+        return DALI_MAN_STREAM_ERROR;
+    dali_man_pll_margin(p, err);
+    dali_man_store(p->data, p->dbitlen, level);
+    p->dbitlen++;
+    if (p->dbitlen == 1) {
+        p->t1 = tedge;
+        p->mid = tedge + 2 * p->te;
+    } else if (p->dbitlen == 2 && !level) {
+        dali_man_pll_lock<OVS>(p, tedge, 3); // the first data bit is a 0
+        p->mid = p->t0 + 5 * p->te;
+    } else {
+        dali_man_pll_track<OVS>(p, level, err);
+        p->mid += 2 * p->te;
+    }
+    return DALI_MAN_STREAM_BUSY;
+}
+
+// number of data bits after DALI_MAN_STREAM_DONE (0 or 1 is a decode error, as with dali_man_decode)
+FORCE_INLINE_ATTR uint8_t dali_man_pll_len(const DaliManPll* p)
+{
+    return p->dbitlen > 1 ? p->dbitlen - 1 : p->dbitlen;
+}
+
+//-------------------------------------------------------------------
+// pulse duration manchester decode (edge capture backend)
+//
+// Fed with the duration of every pulse between two bus edges. A pulse is one
+// or two half bits (TE) long; the half bits are paired into manchester bits.
+// Limits follow IEC 62386-101 receiver tolerances, widened a little for the
+// transceiver's asymmetric rise/fall times.
+
+#define DALI_TE_US 417 // half bit time at 1200 baud
+#define DALI_EDGE_MIN_US 200 // shorter pulses are glitches
+#define DALI_EDGE_1TE_MAX_US 625 // 1.5 TE
+#define DALI_EDGE_2TE_MAX_US 1050 // 2.5 TE
+#define DALI_EDGE_STOP_US DALI_EDGE_2TE_MAX_US // high for longer than any data pulse: stop bits
+
+struct DaliEdgeDecoder {
+    uint8_t hbcnt; // half bits received, incl the 2 of the start bit
+    uint8_t first; // first half of the bit being received (hbcnt odd)
+    uint8_t dbitlen; // decoded data bits
+    uint8_t data[4]; // decoded data, partial last byte right aligned
+};
+
+// call at the falling edge of the start bit
+FORCE_INLINE_ATTR void dali_edge_begin(DaliEdgeDecoder* d)
+{
+    d->hbcnt = 0;
+    d->first = 0;
+    d->dbitlen = 0;
+}
+
+// add one half bit, returns DALI_MAN_STREAM_BUSY or DALI_MAN_STREAM_ERROR
+FORCE_INLINE_ATTR uint8_t dali_edge_hb(DaliEdgeDecoder* d, uint8_t level)
+{
+    uint8_t n = d->hbcnt++;
+    if (n < 2) // start bit: low, high
+        return (level == n) ? DALI_MAN_STREAM_BUSY : DALI_MAN_STREAM_ERROR;
+    if ((n & 1) == 0) {
+        d->first = level;
+        return DALI_MAN_STREAM_BUSY;
+    }
+    if (level == d->first || d->dbitlen >= 32)
+        return DALI_MAN_STREAM_ERROR; // no transition in the middle of the bit, or frame too long
+    dali_man_store(d->data, d->dbitlen + 1, level); // low, high is a 1
+    d->dbitlen++;
+    return DALI_MAN_STREAM_BUSY;
+}
+
+// a pulse of level (1 = bus high) lasting dur_us has ended
+// returns DALI_MAN_STREAM_BUSY or DALI_MAN_STREAM_ERROR
+FORCE_INLINE_ATTR uint8_t dali_edge_pulse(DaliEdgeDecoder* d, uint8_t level, uint32_t dur_us)
+{
+    if (dur_us < DALI_EDGE_MIN_US || dur_us > DALI_EDGE_2TE_MAX_US)
+        return DALI_MAN_STREAM_ERROR;
+    if (dali_edge_hb(d, level) != DALI_MAN_STREAM_BUSY)
+        return DALI_MAN_STREAM_ERROR;
+    if (dur_us > DALI_EDGE_1TE_MAX_US)
+        return dali_edge_hb(d, level);
+    return DALI_MAN_STREAM_BUSY;
+}
+
+// the bus has been high for DALI_EDGE_STOP_US after the last edge
+// returns DALI_MAN_STREAM_DONE or DALI_MAN_STREAM_ERROR
+FORCE_INLINE_ATTR uint8_t dali_edge_stop(DaliEdgeDecoder* d)
+{
+    // the second (high) half of a trailing 1 bit merges into the stop bits
+    if ((d->hbcnt & 1) && dali_edge_hb(d, 1) != DALI_MAN_STREAM_BUSY)
+        return DALI_MAN_STREAM_ERROR;
+    if (d->hbcnt < 2)
+        return DALI_MAN_STREAM_ERROR;
+    return DALI_MAN_STREAM_DONE;
+}
+
+#endif
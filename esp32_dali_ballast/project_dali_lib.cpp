@@ -35,9 +35,35 @@ Changelog:
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include <string.h>
 
-// timing
-#define BEFORE_CMD_IDLE_MS 13 // require 13ms idle time before sending a cmd()
+// samples per half bit (TE) of the sampling receiver and the transmitter
+#define SAMPLES_PER_TE (DALI_OVERSAMPLE / 2)
+
+// edge capture receiver: stop timer() after this many idle ticks (3.3 ms)
+#define EDGE_TIMER_IDLE_TICKS (4 * DALI_OVERSAMPLE)
+
+// reply window of a transaction, from the end of its forward frame: wait for the
+// start of the reply a little longer than the latest start, 26 ms when a reply is being received
+#define REPLY_START_US (DALI_SETTLE_FWD_BWD_MAX_US + 1000)
+#define REPLY_END_US 26000
+
+// a received frame ends where its 2 stop bits end, as for a transmitted one: the
+// stream decoder finishes one filter delay after the first stop bit, the edge decoder
+// DALI_EDGE_STOP_US after the last edge (the stop bits follow the last edge, or the
+// high half of a 1 bit)
+#define RX_STOP_REST_US (2 * DALI_TE_US - DaliManPllTiming<DALI_OVERSAMPLE>::delay_us)
+#define EDGE_STOP_END_US (4 * DALI_TE_US)
+
+// forward frame settling windows of the DALI-2 priorities 1..5 in us, from the end of the last frame, read by the timer isr
+static const DRAM_ATTR uint16_t settle_min_us[5] = { 13500, 14900, 16300, 17900, 19500 };
+static const DRAM_ATTR uint16_t settle_max_us[5] = { 14700, 16200, 17700, 19300, 21200 };
+
+// DaliSearch::step, see find_addr_step()
+#define SEARCH_START 0   // next step starts a search at low
+#define SEARCH_BOUNDS 1  // binary search over the bounds
+#define SEARCH_BISECT 2  // binary search between low and high
+#define SEARCH_RECHECK 3 // no COMPARE answered no: is gear left below start?
 
 // busstate
 #define IDLE 0
@@ -48,17 +74,27 @@ Changelog:
 
 static const char* TAG = "qqqdali";
 
-void Dali::begin(uint8_t (*bus_is_high)(), void (*bus_set_low)(), void (*bus_set_high)())
+void Dali::begin()
+{
+    begin(nullptr, nullptr);
+}
+
+// edge capture backend: edge() is called on every rx pin change and timer()
+// only runs (started/stopped through the hooks) while the bus is busy
+void Dali::begin(void (*timer_start)(), void (*timer_stop)())
 {
-    this->bus_is_high = bus_is_high;
-    this->bus_set_low = bus_set_low;
-    this->bus_set_high = bus_set_high;
+    this->timer_start = timer_start;
+    this->timer_stop = timer_stop;
+    timer_on = 1;
+    edge_head = 0;
+    edge_tail = 0;
+    edge_level = 1;
     _init();
 }
 
 void IRAM_ATTR Dali::_set_busstate_idle()
 {
-    bus_set_high();
+    DaliIo::set_high();
     idlecnt = 0;
     busstate = IDLE;
 }
@@ -67,7 +103,23 @@ void Dali::_init()
 {
     _set_busstate_idle();
     rxstate = EMPTY;
+    rxq_head = 0;
+    rxq_tail = 0;
+    rxoverrun = 0;
+    rxweak = 0;
     txcollision = 0;
+    xfer_head = 0;
+    xfer_cur = 0;
+    xfer_tail = 0;
+    bus_end_us = 0;
+    bus_end_len = 0;
+    xfer_collisions = 0;
+    cap_mode = DALI_CAPTURE_OFF;
+    cap_buf = nullptr;
+    cap_head = 0;
+    rng = (uint32_t)esp_timer_get_time() ^ (uint32_t)(uintptr_t)this;
+    if (!rng)
+        rng = 1;
 }
 
 uint32_t IRAM_ATTR Dali::milli()
@@ -77,12 +129,21 @@ uint32_t IRAM_ATTR Dali::milli()
     return esp_timer_get_time() / 1000LL;
 }
 
-// timer interrupt service routine, called 9600 times per second
+// timer interrupt service routine, called DALI_SAMPLE_HZ (9600 at 8x) times per second
 void IRAM_ATTR Dali::timer()
 {
+    if (xfer_cur != xfer_head)
+        _xfer_timer(); // start or follow the current transaction
+
+    if (timer_start && (busstate == IDLE || busstate == RX)) {
+        _edge_timer(); // edge capture backend: receive from the captured edges
+        return;
+    }
 
     // get bus sample
-    uint8_t busishigh = (bus_is_high() ? 1 : 0); // bus_high is 1 on high (non-asserted), 0 on low (asserted)
+    uint8_t busishigh = (DaliIo::is_high() ? 1 : 0); // bus_high is 1 on high (non-asserted), 0 on low (asserted)
+    if (cap_mode == DALI_CAPTURE_WINDOW)
+        _capture_sample(busishigh);
 
     // // //millis update
     // // ticks++;
@@ -103,11 +164,13 @@ void IRAM_ATTR Dali::timer()
         rxpos = 0;
         rxbitcnt = 0;
         rxidle = 0;
+        rxstart_us = esp_timer_get_time();
+        dali_man_pll_begin(&rxdec);
         rxstate = RECEIVING;
         busstate = RX;
         // fall-thru to RX
     case RX:
-        // store sample
+        // store sample (raw samples are kept for debugging)
         rxbyte = (rxbyte << 1) | busishigh;
         rxbitcnt++;
         if (rxbitcnt == 8) {
@@ -117,13 +180,26 @@ void IRAM_ATTR Dali::timer()
                 rxpos = DALI_RX_BUF_SIZE - 1;
             rxbitcnt = 0;
         }
+        // decode on the fly, the frame is complete as soon as the stop bit is seen
+        if (rxstate == RECEIVING) {
+            uint8_t r = dali_man_pll_push(&rxdec, busishigh);
+            if (r == DALI_MAN_STREAM_DONE)
+                _rx_complete(rxdec.data, dali_man_pll_len(&rxdec), rxdec.margin, esp_timer_get_time() + RX_STOP_REST_US);
+            else if (r == DALI_MAN_STREAM_ERROR)
+                _rx_complete(rxdec.data, 0, 0, esp_timer_get_time());
+        }
         // check for reception of 2 stop bits
         if (busishigh) {
             rxidle++;
-            if (rxidle >= 16) {
+            if (rxidle >= 4 * SAMPLES_PER_TE) {
                 rxdata[rxpos] = 0xFF;
                 rxpos++;
-                rxstate = COMPLETED;
+                if (rxstate == RECEIVING)
+                    _rx_complete(rxdec.data, dali_man_pll_len(&rxdec), rxdec.margin, esp_timer_get_time());
+                if (cap_mode == DALI_CAPTURE_FRAMES)
+                    _capture_frame();
+                if (bus_end_len < 3)
+                    _bus_end(0, esp_timer_get_time()); // no valid frame: the bus is free from now
                 _set_busstate_idle();
                 break;
             }
@@ -134,6 +210,7 @@ void IRAM_ATTR Dali::timer()
     case TX:
         if (txhbcnt >= txhblen) {
             // all bits transmitted, go back to IDLE
+            _bus_end((txhblen - 6) >> 1, esp_timer_get_time());
             _set_busstate_idle();
         } else {
             // check for collisions (transmitting high but bus is low)
@@ -142,7 +219,7 @@ void IRAM_ATTR Dali::timer()
                     || (txcollisionhandling == DALI_TX_COLLISSION_AUTO && txhblen != 2 + 8 + 4) // handle only if not transmitting 8 bits (2+8+4 half bits)
                     )
                 && (txhigh && !busishigh) // transmitting high, but bus is low
-                && (txspcnt == 1 || txspcnt == 2)) // in middle of transmitting low period
+                && txspcnt >= 1 && txspcnt <= SAMPLES_PER_TE / 2) // in middle of transmitting low period
             {
                 if (txcollision != 0xFF)
                     txcollision++;
@@ -151,69 +228,238 @@ void IRAM_ATTR Dali::timer()
                 return;
             }
 
-            // send data bits (MSB first) to bus every 4th sample time
+            // send data bits (MSB first) to bus every SAMPLES_PER_TE sample times
             if (txspcnt == 0) {
                 // send bit
                 uint8_t pos = txhbcnt >> 3;
                 uint8_t bitmask = 1 << (7 - (txhbcnt & 0x7));
                 if (txhbdata[pos] & bitmask) {
-                    bus_set_low();
+                    DaliIo::set_low();
                     txhigh = 0;
                 } else {
-                    bus_set_high();
+                    DaliIo::set_high();
                     txhigh = 1;
                 }
                 // update half bit counter
                 txhbcnt++;
-                // next transmit in 4 sample times
-                txspcnt = 4;
+                // next transmit in SAMPLES_PER_TE sample times
+                txspcnt = SAMPLES_PER_TE;
             }
             txspcnt--;
         }
         break;
     case COLLISION_TX:
-        // keep bus low for 16 samples = 4 TE
-        bus_set_low();
+        // keep bus low for 4 TE
+        DaliIo::set_low();
         txspcnt++;
-        if (txspcnt >= 16)
+        if (txspcnt >= 4 * SAMPLES_PER_TE) {
+            _bus_end(0, esp_timer_get_time());
             _set_busstate_idle();
+        }
         break;
     }
 }
 
-// push 2 half bits into the half bit transmit buffer, MSB first, 0x0=stop, 0x1= bit value 0, 0x2= bit value 1/start
-void Dali::_tx_push_2hb(uint8_t hb)
+//-------------------------------------------------------------------
+// edge capture backend
+
+// rx pin change interrupt, busishigh is the level after the edge
+void IRAM_ATTR Dali::edge(uint8_t busishigh)
+{
+    if (busstate == TX || busstate == COLLISION_TX)
+        return; // own transmission
+    uint8_t next = (edge_head + 1) & (DALI_EDGE_BUF_SIZE - 1);
+    if (next == edge_tail) {
+        edge_overflow = 1; // timer() is not keeping up, drop the frame
+        return;
+    }
+    edge_us[edge_head] = esp_timer_get_time();
+    edge_lvl[edge_head] = busishigh ? 1 : 0;
+    edge_head = next;
+    _timer_on();
+}
+
+// called from the rx pin interrupt, timer() and submit(), which may run on the
+// other core: the caller's store (edge_head, xfer_head) must be visible before
+// timer_on is read, as _edge_timer() stores timer_on before it reads them
+void IRAM_ATTR Dali::_timer_on()
+{
+    __sync_synchronize();
+    if (timer_start && !timer_on) {
+        timer_on = 1;
+        timer_start();
+    }
+}
+
+// called from timer() instead of the sampling receiver
+void IRAM_ATTR Dali::_edge_timer()
+{
+    int64_t now = esp_timer_get_time();
+
+    // decode the captured edges
+    while (edge_tail != edge_head) {
+        uint8_t i = edge_tail;
+        uint32_t t = edge_us[i];
+        uint8_t level = edge_lvl[i];
+        edge_tail = (i + 1) & (DALI_EDGE_BUF_SIZE - 1);
+        if (level == edge_level)
+            continue; // missed an edge in between, keep the older one
+
+        if (busstate == IDLE) {
+            if (level == 0) { // falling edge: start bit
+                rxstart_us = now - (int64_t)(uint32_t)((uint32_t)now - t);
+                dali_edge_begin(&edgedec);
+                rxstate = RECEIVING;
+                busstate = RX;
+            }
+        } else if (rxstate == RECEIVING) {
+            if (edge_overflow || dali_edge_pulse(&edgedec, edge_level, t - edge_last_us) != DALI_MAN_STREAM_BUSY)
+                _rx_complete(edgedec.data, 0, 0, now);
+        }
+        edge_last_us = t;
+        edge_level = level;
+        idlecnt = 0;
+    }
+    edge_overflow = 0;
+
+    if (busstate == RX) {
+        // end of frame: no edge for longer than any data pulse
+        if ((uint32_t)now - edge_last_us > DALI_EDGE_STOP_US) {
+            if (edge_level) {
+                if (rxstate == RECEIVING) {
+                    int64_t end_us = now - (int64_t)(uint32_t)((uint32_t)now - edge_last_us) + EDGE_STOP_END_US;
+                    if (edgedec.hbcnt & 1)
+                        end_us += DALI_TE_US; // trailing 1 bit: its high half comes first
+                    _rx_complete(edgedec.data, dali_edge_stop(&edgedec) == DALI_MAN_STREAM_DONE ? edgedec.dbitlen : 0, 255, end_us);
+                }
+                if (bus_end_len < 3)
+                    _bus_end(0, now);
+                _set_busstate_idle();
+            } else if (rxstate == RECEIVING) {
+                _rx_complete(edgedec.data, 0, 0, now); // bus held low: collision
+            }
+        }
+        return;
+    }
+
+    // bus idle: count idle time like the sampling receiver, stop the timer once
+    // idle long enough and no transaction is waiting for the bus
+    if (idlecnt < EDGE_TIMER_IDLE_TICKS || xfer_cur != xfer_head) {
+        if (idlecnt != 0xff)
+            idlecnt++;
+        return;
+    }
+    idlecnt = 0xff; // stays idle until the next edge
+    timer_on = 0;
+    timer_stop();
+    __sync_synchronize(); // timer_on is stored before edge_head and xfer_head are read again
+    if (edge_tail != edge_head || xfer_cur != xfer_head)
+        _timer_on(); // an edge or a transaction came in while stopping
+}
+
+// queue a decoded frame for rx(), len 0 on decode error
+// single producer (timer) / single consumer (rx) ring, a full queue drops the new frame
+void IRAM_ATTR Dali::_rx_complete(const uint8_t* data, uint8_t len, uint8_t margin, int64_t end_us)
+{
+    rxstate = COMPLETED;
+    _bus_end(len, end_us);
+    if (len > 2 && margin < DALI_MAN_PLL_WEAK && rxweak != 0xFFFFFFFF)
+        rxweak++;
+    if (xfer_cur != xfer_head) {
+        // backward frame of the current transaction: goes to the transaction, not the queue
+        // a forward frame (16 bits and up) is another master's, the gear did not answer:
+        // it ends the transaction and is still queued for rx()
+        DaliXfer* x = &xfer[xfer_cur & (DALI_XFER_SLOTS - 1)];
+        if (x->state == DALI_XFER_WAIT_REPLY) {
+            if (len >= 16) {
+                _xfer_done(x, -DALI_RESULT_NO_REPLY);
+            } else {
+                x->reply_us = (int32_t)(rxstart_us - x->phase_us);
+                if (len < 3)
+                    _xfer_done(x, -DALI_RESULT_COLLISION);
+                else if (len == 8)
+                    _xfer_done(x, data[0]);
+                else
+                    _xfer_done(x, -DALI_RESULT_INVALID_REPLY);
+                return;
+            }
+        }
+    }
+    uint8_t next = (rxq_head + 1) & (DALI_RX_QUEUE_SIZE - 1);
+    if (next == rxq_tail) {
+        if (rxoverrun != 0xFFFFFFFF)
+            rxoverrun++;
+        return;
+    }
+    DaliRxFrame* f = &rxq[rxq_head];
+    for (uint8_t i = 0; i < 4; i++)
+        f->data[i] = data[i];
+    f->len = len;
+    f->margin = margin;
+    f->start_us = rxstart_us;
+    f->end_us = bus_end_us;
+    __sync_synchronize(); // frame is written before it is published
+    rxq_head = next;
+}
+
+// a frame ended on the bus, the settling time before the next frame counts from here
+void IRAM_ATTR Dali::_bus_end(uint8_t len, int64_t end_us)
+{
+    bus_end_us = end_us;
+    bus_end_len = len;
+}
+
+uint8_t Dali::rx_queued()
+{
+    return (rxq_head - rxq_tail) & (DALI_RX_QUEUE_SIZE - 1);
+}
+
+// push cnt half bits into the half bit transmit buffer, hb is MSB first (bit 15 is sent first)
+// 0x0=stop, 0x1= bit value 0, 0x2= bit value 1/start per half bit pair
+// txhblen is at most 2+3*16 when called, so pos+2 stays inside txhbdata[9]
+void IRAM_ATTR Dali::_tx_push_hb(uint16_t hb, uint8_t cnt)
 {
     uint8_t pos = txhblen >> 3;
-    uint8_t shift = 6 - (txhblen & 0x7);
-    txhbdata[pos] |= hb << shift;
-    txhblen += 2;
+    uint32_t v = (uint32_t)hb << (8 - (txhblen & 0x7));
+    txhbdata[pos] |= v >> 16;
+    txhbdata[pos + 1] |= v >> 8;
+    txhbdata[pos + 2] |= v;
+    txhblen += cnt;
 }
 
 // non-blocking transmit
 // transmit if bus is IDLE, without checking hold off times, sends start+stop bits
+// not while transactions are pending, those are transmitted by timer()
 uint8_t Dali::tx(uint8_t* data, uint8_t bitlen)
 {
     if (bitlen > 32)
         return DALI_RESULT_FRAME_TOO_LONG;
-    if (busstate != IDLE)
+    if (busstate != IDLE || edge_tail != edge_head || xfer_cur != xfer_head)
         return DALI_RESULT_BUS_NOT_IDLE;
+    _tx_start(data, bitlen);
+    _timer_on();
+    return DALI_OK;
+}
 
+// fill the half bit buffer and start transmitting, bus must be IDLE
+void IRAM_ATTR Dali::_tx_start(const uint8_t* data, uint8_t bitlen)
+{
     // clear data
     for (uint8_t i = 0; i < 9; i++)
         txhbdata[i] = 0;
 
     // push data in transmit buffer
     txhblen = 0;
-    _tx_push_2hb(0x2); // start bit
-    // data bits MSB first
-    for (uint8_t i = 0; i < bitlen; i++) {
-        uint8_t pos = i >> 3;
-        uint8_t mask = 1 << (7 - (i & 0x7));
-        _tx_push_2hb(data[pos] & mask ? 0x2 : 0x1);
+    _tx_push_hb(0x8000, 2); // start bit
+    // data bits MSB first, a byte at a time through the expansion table
+    for (uint8_t i = 0; i < bitlen; i += 8) {
+        uint8_t n = (bitlen - i < 8) ? bitlen - i : 8;
+        uint16_t hb = dali_man_expand_lut.hb[data[i >> 3]];
+        if (n < 8)
+            hb &= 0xFFFF << (16 - 2 * n); // drop unused low bits of a partial byte
+        _tx_push_hb(hb, 2 * n);
     }
-    _tx_push_2hb(0x0); // stop bit
-    _tx_push_2hb(0x0); // stop bit
+    txhblen += 4; // 2 stop bits, buffer is already cleared
 
     // setup tx vars
     txhbcnt = 0;
@@ -221,7 +467,6 @@ uint8_t Dali::tx(uint8_t* data, uint8_t bitlen)
     txcollision = 0;
     rxstate = EMPTY;
     busstate = TX;
-    return DALI_OK;
 }
 
 uint8_t Dali::tx_state()
@@ -235,165 +480,401 @@ uint8_t Dali::tx_state()
     return DALI_OK;
 }
 
-//-------------------------------------------------------------------
-// manchester decode
-/*
-
-Prefectly matched transmitter and sampling: 8 samples per bit
----------+   +---+   +-------+       +-------+   +------------------------
-         |   |   |   |       |       |       |   |
-         +---+   +---+       +-------+       +---+
-sample-> 012345670123456701234567012345670123456701234567012345670
-sync->   ^       ^       ^       ^       ^       ^       ^       ^
-decode-> start   1       1       0       1       0       stop    stop
-
-
-slow transmitter: 9 samples per bit
----------+   +----+    +--------+        +--------+   +------------------------
-         |   |    |    |        |        |        |   |
-         +---+    +----+        +--------+        +---+
-sample-> 0123456780123456780123456780123456780123456780123456780123456780
-sync->   ^        ^        ^        ^        ^        ^        ^        ^
-decode-> start    1        1        0        1        0        stop     stop
-
-*/
-
-// compute weight for a 8 bit sample i
-uint8_t Dali::_man_weight(uint8_t i)
-{
-    int8_t w = 0;
-    w += ((i >> 7) & 1) ? 1 : -1;
-    w += ((i >> 6) & 1) ? 2 : -2; // put more weight in middle
-    w += ((i >> 5) & 1) ? 2 : -2; // put more weight in middle
-    w += ((i >> 4) & 1) ? 1 : -1;
-    w -= ((i >> 3) & 1) ? 1 : -1;
-    w -= ((i >> 2) & 1) ? 2 : -2; // put more weight in middle
-    w -= ((i >> 1) & 1) ? 2 : -2; // put more weight in middle
-    w -= ((i >> 0) & 1) ? 1 : -1;
-    // w at this point:
-    // w = -12 perfect manchester encoded value 1
-    //...
-    // w =  -2 very weak value 1
-    // w =   0 unknown (all samples high or low)
-    //...
-    // w =  12 perfect manchester encoded value 0
-
-    w *= 2;
-    if (w < 0)
-        w = -w + 1;
-    return w;
-}
-
-// call with bitpos <= DALI_RX_BUF_SIZE*8-8;
-uint8_t Dali::_man_sample(volatile uint8_t* edata, uint16_t bitpos, uint8_t* stop_coll)
-{
-    uint8_t pos = bitpos >> 3;
-    uint8_t shift = bitpos & 0x7;
-    uint8_t sample = (edata[pos] << shift) | (edata[pos + 1] >> (8 - shift));
-
-    // stop bit: received high (non-asserted) bus for last 8 samples
-    if (sample == 0xFF)
-        *stop_coll = 1;
-
-    // collision: received low (asserted) bus for last 8 samples
-    if (sample == 0x00)
-        *stop_coll = 2;
-
-    return sample;
-}
-
-// decode 8 times oversampled encoded data
-// returns bitlen of decoded data, or 0 on collision
-uint8_t Dali::_man_decode(volatile uint8_t* edata, uint8_t ebitlen, uint8_t* ddata)
-{
-    uint8_t dbitlen = 0;
-    uint16_t ebitpos = 1;
-    while (ebitpos + 1 < ebitlen) {
-        uint8_t stop_coll = 0;
-        // weight at nominal oversample rate
-        uint8_t sample = _man_sample(edata, ebitpos, &stop_coll);
-        uint8_t weightmax = _man_weight(sample); // weight of maximum
-        uint8_t pmax = 8; // position of maximum
-
-        // weight at nominal oversample rate - 1
-        sample = _man_sample(edata, ebitpos - 1, &stop_coll);
-        uint8_t w = _man_weight(sample);
-        if (weightmax < w) { // when equal keep pmax=8, the nominal oversample baud rate
-            weightmax = w;
-            pmax = 7;
-        }
+// non-blocking receive, returns the oldest queued frame:
+// returns 0 empty, 1 if busy receiving, 2 decode error, >2 number of bits received
+// the frame is decoded in timer(), start_us and end_us (optional) get the esp_timer time of its
+// start bit and of its end, pass end_us to reply() to answer the frame
+uint8_t Dali::rx(uint8_t* ddata, int64_t* start_us, int64_t* end_us, uint8_t* margin)
+{
+    uint8_t tail = rxq_tail;
+    if (tail == rxq_head)
+        return (rxstate == RECEIVING) ? 1 : 0;
+    __sync_synchronize(); // read the frame after seeing it published
+    DaliRxFrame* f = &rxq[tail];
+    uint8_t dlen = f->len;
+    for (uint8_t i = 0; i < ((dlen + 7) >> 3); i++)
+        ddata[i] = f->data[i];
+    if (start_us)
+        *start_us = f->start_us;
+    if (end_us)
+        *end_us = f->end_us;
+    if (margin)
+        *margin = f->margin;
+    __sync_synchronize(); // done reading before the slot is released
+    rxq_tail = (tail + 1) & (DALI_RX_QUEUE_SIZE - 1);
 
-        // weight at nominal oversample rate + 1
-        sample = _man_sample(edata, ebitpos + 1, &stop_coll);
-        w = _man_weight(sample);
-        if (weightmax < w) { // when equal keep previous value
-            weightmax = w;
-            pmax = 9;
+#ifdef DALI_DEBUG
+    if (dlen != 8) {
+        // raw samples are those of the most recent frame
+        ESP_LOGI(TAG, "RX: len=%d", rxpos * 8);
+        char buffer[80];
+        for (uint8_t i = 0; i < rxpos; i++) {
+            for (uint8_t m = 0x80, j = 0; m != 0x00; m >>= 1, j++) {
+                buffer[j] = (rxdata[i] & m) ? '1' : '0';
+            }
+            buffer[8] = '\0';
+            ESP_LOGI(TAG, "%s", buffer);
         }
 
-        // handle stop/collision
-        if (stop_coll == 1)
-            break; // stop
-        if (stop_coll == 2)
-            return 0; // collison
-
-        // store mancheter bit
-        if (dbitlen > 0) { // ignore start bit
-            uint8_t bytepos = (dbitlen - 1) >> 3;
-            uint8_t bitpos = (dbitlen - 1) & 0x7;
-            if (bitpos == 0)
-                ddata[bytepos] = 0; // empty data before storing first bit
-            ddata[bytepos] = (ddata[bytepos] << 1) | (weightmax & 1); // get databit from bit0 of weight
+        ESP_LOGI(TAG, "decoded: len=%d", dlen);
+        for (uint8_t i = 0; i < dlen; i++) {
+            buffer[i] = (ddata[i >> 3] & (1 << (7 - (i & 0x7)))) ? '1' : '0';
         }
-        dbitlen++;
-        ebitpos += pmax; // jump to next mancheter bit, skipping over number of samples with max weight
+        buffer[dlen] = '\0';
+        ESP_LOGI(TAG, "%s", buffer);
     }
-    if (dbitlen > 1)
-        dbitlen--;
-    return dbitlen;
+#endif
+
+    if (dlen < 3)
+        return 2;
+    return dlen;
 }
 
-// non-blocking receive,
-// returns 0 empty, 1 if busy receiving, 2 decode error, >2 number of bits received
-uint8_t Dali::rx(uint8_t* ddata)
+//-------------------------------------------------------------------
+// asynchronous transactions
+//
+// submit() fills a slot of a ring indexed by sequence number, timer() runs the
+// slots in order: wait for the settling time of the transaction's priority
+// after the last frame on the bus, transmit (retrying collisions with a random
+// backoff until the timeout), then wait for the reply window. Another master
+// with a higher priority (shorter settling time) starts first, this one then
+// sees the bus busy and measures its settling time again from that frame. The timeout counts from the moment a transaction reaches the head of
+// the ring, not from submit(). service() runs the callbacks of
+// finished transactions from the main loop and frees their slots. The handle
+// is the sequence number, its state and result stay readable until the slot
+// is reused DALI_XFER_SLOTS submits later.
+
+// queue a frame, returns a handle >= 0 or negative DALI_RESULT_xxx
+// flags DALI_XFER_REPLY: receive a backward frame, the result is the reply byte
+// DALI_XFER_TWICE: configuration command, sent twice as one transaction
+// DALI_XFER_PRIORITY(p): settling window of priority p
+int16_t Dali::submit(uint8_t* data, uint8_t bitlen, uint8_t flags, DaliXferCallback cb, void* ctx, uint32_t timeout_ms)
 {
-    switch (rxstate) {
-    case EMPTY:
-        return 0;
-    case RECEIVING:
-        return 1;
-    case COMPLETED:
-        rxstate = EMPTY;
-        uint8_t dlen = _man_decode(rxdata, rxpos * 8, ddata);
+    return _submit(data, bitlen, flags, cb, ctx, timeout_ms, 0);
+}
 
+int16_t Dali::_submit(const uint8_t* data, uint8_t bitlen, uint8_t flags, DaliXferCallback cb, void* ctx, uint32_t timeout_ms, int64_t phase_us)
+{
+    if (bitlen > 32)
+        return -DALI_RESULT_DATA_TOO_LONG;
+    uint8_t seq = xfer_head;
+    if ((uint8_t)(seq - xfer_tail) >= DALI_XFER_SLOTS)
+        return -DALI_RESULT_QUEUE_FULL;
+    DaliXfer* x = &xfer[seq & (DALI_XFER_SLOTS - 1)];
+    for (uint8_t i = 0; i < 4; i++)
+        x->data[i] = (i < ((bitlen + 7) >> 3)) ? data[i] : 0;
+    x->bitlen = bitlen;
+    x->flags = flags;
+    x->seq = seq;
+    x->result = 0;
+    x->timeout_us = timeout_ms * 1000;
+    x->submit_us = esp_timer_get_time();
+    x->start_us = 0;
+    x->phase_us = phase_us;
+    x->collisions = 0;
+    x->sent = 0;
+    x->settle_from_us = -1;
+    x->reply_us = -1;
+    x->cb = cb;
+    x->ctx = ctx;
+    x->state = DALI_XFER_QUEUED;
+    __sync_synchronize(); // slot is written before it is published
+    xfer_head = seq + 1;
+    _timer_on();
+    return seq;
+}
+
+// forward frame cmd0 cmd1 and its reply, like tx_wait_rx()
+int16_t Dali::tx_async(uint8_t cmd0, uint8_t cmd1, DaliXferCallback cb, void* ctx, uint32_t timeout_ms, uint8_t priority)
+{
 #ifdef DALI_DEBUG
-        if (dlen != 8) {
-            ESP_LOGI(TAG, "RX: len=%d", rxpos * 8);
-            char buffer[80];
-            for (uint8_t i = 0; i < rxpos; i++) {
-                for (uint8_t m = 0x80, j = 0; m != 0x00; m >>= 1, j++) {
-                    buffer[j] = (rxdata[i] & m) ? '1' : '0';
-                }
-                buffer[8] = '\0';
-                ESP_LOGI(TAG, "%s", buffer);
-            }
+    ESP_LOGI(TAG, "TX%1X%1X%1X%1X", cmd0 >> 4, cmd0 & 0xF, cmd1 >> 4, cmd1 & 0xF);
+#endif
+    uint8_t data[2] = { cmd0, cmd1 };
+    return submit(data, 16, DALI_XFER_REPLY | DALI_XFER_PRIORITY(priority), cb, ctx, timeout_ms);
+}
 
-            ESP_LOGI(TAG, "decoded: len=%d", dlen);
-            for (uint8_t i = 0; i < dlen; i++) {
-                buffer[i] = (ddata[i >> 3] & (1 << (7 - (i & 0x7)))) ? '1' : '0';
-            }
-            buffer[dlen] = '\0';
-            ESP_LOGI(TAG, "%s", buffer);
+// xorshift32, only has to keep masters sharing the bus from picking the same times
+uint32_t IRAM_ATTR Dali::_rand()
+{
+    uint32_t x = rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng = x;
+    return x;
+}
+
+// settling time before a forward frame: a random point in the window of its
+// priority, so equal priorities rarely start together. After a collision the
+// window is widened by a random backoff, doubling up to 16 ms.
+uint32_t IRAM_ATTR Dali::_settle_us(uint8_t flags, uint8_t collisions)
+{
+    uint8_t p = (flags >> 4) & 0x07;
+    if (p < 1 || p > 5)
+        p = DALI_PRIORITY_USER;
+    uint32_t us = settle_min_us[p - 1] + _rand() % (settle_max_us[p - 1] - settle_min_us[p - 1] + 1);
+    if (collisions)
+        us += _rand() % ((1000UL << (collisions < 4 ? collisions : 4)) + 1);
+    return us;
+}
+
+// backward frame answering a received forward frame, fwd_end_us is its end from rx()
+// sent 5.5 ms after the forward frame, dropped with DALI_RESULT_TIMEOUT if another
+// frame came in between or the reply window (10.5 ms) has passed
+int16_t Dali::reply(uint8_t data, int64_t fwd_end_us, DaliXferCallback cb, void* ctx)
+{
+    return _submit(&data, 8, DALI_XFER_BACKWARD, cb, ctx, DALI_SETTLE_FWD_BWD_MAX_US / 1000 + 1, fwd_end_us);
+}
+
+uint8_t Dali::xfer_state(int16_t handle)
+{
+    if (handle < 0)
+        return DALI_XFER_FREE;
+    DaliXfer* x = &xfer[handle & (DALI_XFER_SLOTS - 1)];
+    if (x->seq != (uint8_t)handle)
+        return DALI_XFER_FREE;
+    return x->state;
+}
+
+int16_t Dali::xfer_result(int16_t handle)
+{
+    if (handle < 0)
+        return handle;
+    if (xfer_state(handle) != DALI_XFER_DONE)
+        return -DALI_RESULT_TIMEOUT;
+    return xfer[handle & (DALI_XFER_SLOTS - 1)].result;
+}
+
+// blocking wait, negative handles (submit errors) are passed through. Sleeps a
+// tick between checks, so lower priority tasks on the same core (and its idle
+// task, which feeds the watchdog) keep running while the frame is on the bus
+int16_t Dali::xfer_wait(int16_t handle)
+{
+    if (handle < 0)
+        return handle;
+    DaliXfer* x = &xfer[handle & (DALI_XFER_SLOTS - 1)];
+    uint32_t start_ms = milli();
+    uint32_t limit_ms = x->timeout_us / 1000 + 100; // timer() finishes it before, unless it is not running
+    uint8_t cur = xfer_cur;
+    while (xfer_busy(handle)) {
+        if (cur != xfer_cur) {
+            cur = xfer_cur; // transactions ahead of this one are moving, restart the safety timer
+            start_ms = milli();
         }
-#endif
+        if (milli() - start_ms > limit_ms)
+            return -DALI_RESULT_TIMEOUT;
+        vTaskDelay(1);
+    }
+    int16_t rv = xfer_result(handle);
+    service();
+    return rv;
+}
 
-        if (dlen < 3)
-            return 2;
-        return dlen;
+void Dali::service()
+{
+    while (xfer_tail != xfer_cur) {
+        __sync_synchronize(); // read the slot after seeing it finished
+        DaliXfer* x = &xfer[xfer_tail & (DALI_XFER_SLOTS - 1)];
+        DaliXferCallback cb = x->cb;
+        void* ctx = x->ctx;
+        int16_t handle = x->seq;
+        int16_t result = x->result;
+        uint8_t data[4] = { x->data[0], x->data[1], x->data[2], x->data[3] };
+        uint8_t bitlen = x->bitlen;
+        uint8_t flags = x->flags;
+        int32_t reply_us = x->reply_us;
+        xfer_tail = xfer_tail + 1; // free the slot first, the callback may submit
+        if (reply_hook && (flags & DALI_XFER_REPLY))
+            reply_hook(data, bitlen, result, reply_us);
+        if (cb)
+            cb(handle, result, ctx);
+    }
+}
+
+// transaction engine, called from timer() while a transaction is pending
+void IRAM_ATTR Dali::_xfer_timer()
+{
+    DaliXfer* x = &xfer[xfer_cur & (DALI_XFER_SLOTS - 1)];
+    int64_t now = esp_timer_get_time();
+    switch (x->state) {
+    case DALI_XFER_QUEUED:
+        if (!x->start_us)
+            x->start_us = now;
+        if (now - x->start_us > x->timeout_us) {
+            _xfer_done(x, -DALI_RESULT_TIMEOUT);
+            break;
+        }
+        if (x->flags & DALI_XFER_BACKWARD) {
+            // only while the forward frame it answers is the last frame on the bus
+            if (bus_end_us != x->phase_us || now - x->phase_us > DALI_SETTLE_FWD_BWD_MAX_US) {
+                _xfer_done(x, -DALI_RESULT_TIMEOUT);
+                break;
+            }
+            if (now - x->phase_us < DALI_SETTLE_FWD_BWD_MIN_US)
+                break;
+        } else if (x->sent) {
+            // second frame of a send-twice pair: if another frame came in between
+            // or 100 ms have passed, the control gear would not take the pair, start over
+            if (bus_end_us != x->phase_us || now - x->phase_us > DALI_TWICE_MAX_US) {
+                x->sent = 0;
+                x->settle_from_us = -1;
+                break;
+            }
+            if (now - x->phase_us < x->settle_us)
+                break;
+        } else {
+            // settling time after the last frame on the bus, drawn again for every
+            // frame so no master keeps losing; the backoff only applies after a
+            // collision, and after a backward frame the priority window is moved
+            // down to start at 2.4 ms
+            if (x->settle_from_us != bus_end_us) {
+                x->settle_from_us = bus_end_us;
+                x->settle_us = _settle_us(x->flags, bus_end_len ? 0 : x->collisions);
+            }
+            if (now - bus_end_us < ((bus_end_len == 8) ? x->settle_us - (DALI_SETTLE_FWD_FWD_US - DALI_SETTLE_BWD_FWD_US) : x->settle_us))
+                break;
+        }
+        if (busstate != IDLE || edge_tail != edge_head)
+            break;
+        _tx_start(x->data, x->bitlen);
+        x->state = DALI_XFER_TX;
+        break;
+    case DALI_XFER_TX:
+        if (busstate != IDLE)
+            break; // transmitting, or holding the bus low after a collision
+        if (txcollision) {
+            txcollision = 0;
+            if (x->collisions != 0xFF)
+                x->collisions++;
+            if (xfer_collisions != 0xFFFFFFFF)
+                xfer_collisions++;
+            x->sent = 0; // a send-twice pair starts over
+            x->state = DALI_XFER_QUEUED; // retry until timeout, after a random backoff
+            break;
+        }
+        x->phase_us = bus_end_us; // end of the frame just sent
+        if ((x->flags & DALI_XFER_TWICE) && !x->sent) {
+            // repeat in the priority 1 window, before any other master may start
+            x->sent = 1;
+            x->settle_us = _settle_us(DALI_XFER_PRIORITY(1), 0);
+            x->state = DALI_XFER_QUEUED;
+            break;
+        }
+        if (x->flags & DALI_XFER_REPLY)
+            x->state = DALI_XFER_WAIT_REPLY;
+        else
+            _xfer_done(x, DALI_OK);
+        break;
+    case DALI_XFER_WAIT_REPLY:
+        // a reply is handed over by _rx_complete()
+        if (now - x->phase_us > ((rxstate == RECEIVING) ? REPLY_END_US : REPLY_START_US))
+            _xfer_done(x, -DALI_RESULT_NO_REPLY);
+        break;
     }
+}
+
+void IRAM_ATTR Dali::_xfer_done(DaliXfer* x, int16_t result)
+{
+    x->result = result;
+    x->state = DALI_XFER_DONE;
+    __sync_synchronize(); // result is written before the slot is released to service()
+    xfer_cur = xfer_cur + 1;
+}
+
+//=================================================================
+// RAW SAMPLE CAPTURE
+//=================================================================
+
+// timer() of the sampling receiver stores samples in the ring: one record per
+// received frame (the rxdata samples the decoders ran on, and their result),
+// or every sample in back-to-back records for a window of bus time
+uint8_t Dali::capture_start(uint8_t mode, DaliCaptureRecord* buf, uint16_t records)
+{
+    if (timer_start || !buf || !records || (records & (records - 1)))
+        return 1;
+    capture_stop();
+    cap_buf = buf;
+    cap_size = records;
+    cap_head = 0;
+    cap_bits = 0;
+    cap_pos = 0;
+    __sync_synchronize(); // ring is set up before timer() sees the mode
+    cap_mode = mode;
     return 0;
 }
 
+void Dali::capture_stop()
+{
+    cap_mode = DALI_CAPTURE_OFF;
+    __sync_synchronize();
+}
+
+void IRAM_ATTR Dali::_capture_sample(uint8_t busishigh)
+{
+    DaliCaptureRecord* r = &cap_buf[cap_head & (cap_size - 1)];
+    if (!cap_pos && !cap_bits)
+        r->start_us = (uint32_t)esp_timer_get_time();
+    cap_byte = (cap_byte << 1) | busishigh;
+    if (++cap_bits < 8)
+        return;
+    cap_bits = 0;
+    r->samples[cap_pos++] = cap_byte;
+    if (cap_pos < DALI_RX_BUF_SIZE)
+        return;
+    cap_pos = 0;
+    r->nbytes = DALI_RX_BUF_SIZE;
+    r->len = 0;
+    r->margin = 0;
+    r->mode = DALI_CAPTURE_WINDOW;
+    __sync_synchronize(); // record is written before it is published
+    cap_head = cap_head + 1;
+}
+
+void IRAM_ATTR Dali::_capture_frame()
+{
+    DaliCaptureRecord* r = &cap_buf[cap_head & (cap_size - 1)];
+    r->start_us = (uint32_t)rxstart_us;
+    r->nbytes = rxpos;
+    r->len = bus_end_len;
+    r->mode = DALI_CAPTURE_FRAMES;
+    r->margin = rxdec.margin;
+    for (uint8_t i = 0; i < 4; i++)
+        r->data[i] = rxdec.data[i];
+    for (uint8_t i = 0; i < rxpos; i++)
+        r->samples[i] = rxdata[i];
+    __sync_synchronize(); // record is written before it is published
+    cap_head = cap_head + 1;
+}
+
+// the slot at cap_head may be half written, so the ring keeps cap_size - 1
+// records; the ones timer() overwrote while copying are dropped again
+uint16_t Dali::capture_read(uint32_t* pos, DaliCaptureRecord* dst, uint16_t max)
+{
+    if (!cap_buf)
+        return 0;
+    uint32_t head = cap_head;
+    __sync_synchronize();
+    uint32_t oldest = (head >= cap_size) ? head - cap_size + 1 : 0;
+    if (*pos < oldest)
+        *pos = oldest;
+    uint16_t n = 0;
+    while (n < max && *pos + n < head) {
+        dst[n] = cap_buf[(*pos + n) & (cap_size - 1)];
+        n++;
+    }
+    __sync_synchronize();
+    head = cap_head;
+    oldest = (head >= cap_size) ? head - cap_size + 1 : 0;
+    uint16_t lost = 0;
+    if (*pos < oldest)
+        lost = (oldest - *pos < n) ? oldest - *pos : n;
+    for (uint16_t i = lost; i < n; i++)
+        dst[i - lost] = dst[i];
+    *pos += n;
+    return n - lost;
+}
+
 //=================================================================
 // HIGH LEVEL FUNCTIONS
 //=================================================================
@@ -403,42 +884,8 @@ uint8_t Dali::tx_wait(uint8_t* data, uint8_t bitlen, uint32_t timeout_ms)
 {
     if (bitlen > 32)
         return DALI_RESULT_DATA_TOO_LONG;
-    uint32_t start_ms = milli();
-    while (1) {
-        // wait for 10ms idle
-        while (idlecnt < BEFORE_CMD_IDLE_MS) {
-            // Serial.print('w');
-            if (milli() - start_ms > timeout_ms)
-                return DALI_RESULT_TIMEOUT;
-        }
-        // try transmit
-        while (tx(data, bitlen) != DALI_OK) {
-            // Serial.print('w');
-            if (milli() - start_ms > timeout_ms)
-                return DALI_RESULT_TIMEOUT;
-        }
-        // wait for completion
-        uint8_t rv;
-        while (1) {
-            rv = tx_state();
-            if (rv != DALI_RESULT_TRANSMITTING)
-                break;
-            if (milli() - start_ms > timeout_ms)
-                return DALI_RESULT_TIMEOUT;
-        }
-        // exit if transmit was ok
-        if (rv == DALI_OK) {
-            int64_t start_us = esp_timer_get_time();
-            // wait for some time idle
-            while (esp_timer_get_time() - start_us < 1000)
-                __asm__ __volatile__("nop");
-
-            // Serial.print('o');
-            return DALI_OK;
-        }
-        // not ok (for example collision) - retry until timeout
-    }
-    return DALI_RESULT_TIMEOUT;
+    int16_t rv = xfer_wait(submit(data, bitlen, 0, nullptr, nullptr, timeout_ms));
+    return (rv < 0) ? -rv : DALI_OK;
 }
 
 // blocking transmit 2 byte command, receive 1 byte reply (if a reply was sent)
@@ -446,86 +893,66 @@ uint8_t Dali::tx_wait(uint8_t* data, uint8_t bitlen, uint32_t timeout_ms)
 // returns <0 with negative result code
 int16_t Dali::tx_wait_rx(uint8_t cmd0, uint8_t cmd1, uint32_t timeout_ms)
 {
-#ifdef DALI_DEBUG
-    ESP_LOGI(TAG, "TX%1X%1X%1X%1X", cmd0 >> 4, cmd0 & 0xF, cmd1 >> 4, cmd1 & 0xF);
-#endif
+    return xfer_wait(tx_async(cmd0, cmd1, nullptr, nullptr, timeout_ms));
+}
 
-    uint8_t data[4];
-    data[0] = cmd0;
-    data[1] = cmd1;
-    int16_t rv = tx_wait(data, 16, timeout_ms);
-    if (rv)
-        return -rv;
-    ;
-
-    // wait up to 10 ms for start of reply, additional 15ms for receive to complete
-    uint32_t rx_start_ms = milli();
-    uint32_t rx_timeout_ms = 10;
-    while (1) {
-        rv = rx(data);
-        switch (rv) {
-        case 0:
-            break; // nothing received yet, wait
-        case 1:
-            rx_timeout_ms = 25;
-            break; // extend timeout, wait for RX completion
-        case 2:
-            return -DALI_RESULT_COLLISION; // report collision
-        default:
-            if (rv == 8)
-                return data[0];
-            else
-                return -DALI_RESULT_INVALID_REPLY;
-        }
-        if (milli() - rx_start_ms > rx_timeout_ms)
-            return -DALI_RESULT_NO_REPLY;
-    }
-    return -DALI_RESULT_NO_REPLY; // should not get here
+void Dali::set_level(uint8_t level, uint8_t adr)
+{
+    xfer_wait(set_level_async(level, adr));
 }
 
-// check YAAAAAA: 0000 0000 to 0011 1111 adr, 0100 0000 to 0100 1111 group, x111 1111 broadcast
-uint8_t Dali::_check_yaaaaaa(uint8_t yaaaaaa)
+int16_t Dali::set_level_async(uint8_t level, uint8_t adr, DaliXferCallback cb, void* ctx, uint8_t priority)
 {
-    return (yaaaaaa <= 0b01001111 || yaaaaaa == 0b01111111 || yaaaaaa == 0b11111111);
+    return send(dali_arc_frame(dali_addr(adr), level), cb, ctx, priority); // DAPC has no reply
 }
 
-void Dali::set_level(uint8_t level, uint8_t adr)
+// forward frame of cmd(): special commands take arg as their data byte, others as the address
+DaliCmdFrame Dali::_cmd_frame(uint16_t cmd, uint8_t arg)
 {
-    if (_check_yaaaaaa(adr))
-        tx_wait_rx(adr << 1, level);
+    if (cmd & 0x0100)
+        return dali_special_frame(cmd, arg);
+    return dali_cmd_frame(cmd, dali_addr(arg));
 }
 
-int16_t Dali::cmd(uint16_t cmd, uint8_t arg)
+// returns the reply byte for queries, DALI_OK for commands without reply
+// the default priority is DALI_PRIORITY_CONFIG: the blocking calls are used for configuration
+int16_t Dali::cmd(uint16_t cmd, uint8_t arg, uint8_t priority)
 {
-    // Serial.print("dali_cmd[");Serial.print(cmd,HEX);Serial.print(",");Serial.print(arg,HEX);Serial.print(")");
-    uint8_t cmd0, cmd1;
-    if (cmd & 0x0100) {
-        // special commands: MUST NOT have YAAAAAAX pattern for cmd
-        // Serial.print(" SPC");
-        if (!_check_yaaaaaa(cmd >> 1)) {
-            cmd0 = cmd;
-            cmd1 = arg;
-        } else {
-            return DALI_RESULT_INVALID_CMD;
-        }
-    } else {
-        // regular commands: MUST have YAAAAAA pattern for arg
+    return xfer_wait(send(_cmd_frame(cmd, arg), nullptr, nullptr, priority));
+}
 
-        // Serial.print(" REG");
-        if (_check_yaaaaaa(arg)) {
-            cmd0 = arg << 1 | 1;
-            cmd1 = cmd;
-        } else {
-            return DALI_RESULT_INVALID_CMD;
-        }
-    }
-    if (cmd & 0x0200) {
-        // Serial.print(" REPEAT");
-        tx_wait_rx(cmd0, cmd1);
-    }
-    int16_t rv = tx_wait_rx(cmd0, cmd1);
-    // Serial.print(" rv=");Serial.println(rv);
-    return rv;
+int16_t Dali::cmd_async(uint16_t cmd, uint8_t arg, DaliXferCallback cb, void* ctx, uint8_t priority)
+{
+    return send(_cmd_frame(cmd, arg), cb, ctx, priority);
+}
+
+// returns the reply byte for queries, DALI_OK for commands without reply
+int16_t Dali::cmd24(uint8_t adr, uint8_t inst, uint8_t opcode, uint8_t priority)
+{
+    return xfer_wait(cmd24_async(adr, inst, opcode, nullptr, nullptr, priority));
+}
+
+int16_t Dali::cmd24_async(uint8_t adr, uint8_t inst, uint8_t opcode, DaliXferCallback cb, void* ctx, uint8_t priority)
+{
+    return send(dali_cmd24_frame(adr, inst, opcode), cb, ctx, priority);
+}
+
+// the frame was encoded and checked when it was built, it is queued as it is
+int16_t Dali::send(const DaliCmdFrame& frame, DaliXferCallback cb, void* ctx, uint8_t priority)
+{
+    if (!frame.bitlen)
+        return -DALI_RESULT_INVALID_CMD;
+    return _submit(frame.data, frame.bitlen, frame.flags | DALI_XFER_PRIORITY(priority), cb, ctx, 500, 0);
+}
+
+// the frame is left aligned in the transaction, like tx() expects it
+int16_t Dali::frame_async(DaliFrame frame, uint8_t flags, DaliXferCallback cb, void* ctx)
+{
+    if (frame.bitlen < 1 || frame.bitlen > 32)
+        return -DALI_RESULT_DATA_TOO_LONG;
+    uint32_t v = frame.value << (32 - frame.bitlen);
+    uint8_t data[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    return submit(data, frame.bitlen, flags, cb, ctx);
 }
 
 uint8_t Dali::set_operating_mode(uint8_t v, uint8_t adr)
@@ -553,6 +980,14 @@ uint8_t Dali::set_power_on_level(uint8_t v, uint8_t adr)
     return _set_value(DALI_SET_POWER_ON_LEVEL, DALI_QUERY_POWER_ON_LEVEL, v, adr);
 }
 
+// store a scene level, returns 0 on success
+uint8_t Dali::set_scene_level(uint8_t scene, uint8_t v, uint8_t adr)
+{
+    if (scene > 15)
+        return 1;
+    return _set_value(DALI_SET_SCENE0 + scene, DALI_QUERY_SCENE0_LEVEL + scene, v, adr);
+}
+
 // set a parameter value, returns 0 on success
 uint8_t Dali::_set_value(uint16_t setcmd, uint16_t getcmd, uint8_t v, uint8_t adr)
 {
@@ -630,39 +1065,163 @@ uint8_t Dali::query_short_address()
     return cmd(DALI_QUERY_SHORT_ADDRESS, 0x00) >> 1;
 }
 
-// find addr with binary search
-uint32_t Dali::find_addr()
-{
-    uint32_t adr = 0x800000;
-    uint32_t addsub = 0x400000;
-    uint32_t adr_last = adr;
-    set_searchaddr(adr);
-
-    while (addsub) {
-        set_searchaddr_diff(adr, adr_last);
-        adr_last = adr;
-        // Serial.print("cmpadr=");
-        // Serial.print(adr,HEX);
-        uint8_t cmp = compare(); // returns 1 if searchadr > adr
-        // Serial.print("cmp ");
-        // Serial.print(adr,HEX);
-        // Serial.print(" = ");
-        // Serial.println(cmp);
-        if (cmp)
-            adr -= addsub;
-        else
-            adr += addsub;
-        addsub >>= 1;
-    }
-    set_searchaddr_diff(adr, adr_last);
-    adr_last = adr;
-    if (!compare()) {
-        adr++;
-        set_searchaddr_diff(adr, adr_last);
+// new search: nothing withdrawn yet, the search address the control gear
+// holds is unknown. The top of the address space is the first bound.
+void Dali::search_begin(DaliSearch *s)
+{
+    s->low = 0;
+    s->sent = DALI_SEARCH_NONE;
+    s->bound[0] = 0xFFFFFF;
+    s->nbound = 1;
+    s->nwithdrawn = 0;
+    s->retries = 0;
+    s->step = SEARCH_START;
+}
+
+void Dali::_search_set(DaliSearch *s, uint32_t adr)
+{
+    if (s->sent == DALI_SEARCH_NONE)
+        set_searchaddr(adr);
+    else
+        set_searchaddr_diff(adr, s->sent);
+    s->sent = adr;
+}
+
+uint8_t Dali::_search_compare(DaliSearch *s, uint32_t adr)
+{
+    _search_set(s, adr);
+    return compare();
+}
+
+// bounds are pushed in descending order, a full stack drops the second
+// largest one (the largest is the top of the address space)
+void Dali::_search_bound(DaliSearch *s, uint32_t adr)
+{
+    if (s->nbound == DALI_SEARCH_BOUNDS) {
+        memmove(s->bound + 1, s->bound + 2, (DALI_SEARCH_BOUNDS - 2) * sizeof(s->bound[0]));
+        s->nbound--;
     }
+    s->bound[s->nbound++] = adr;
+}
+
+// find the lowest random address left. Every COMPARE that answered yes
+// during earlier searches left a bound; the ones below low only held
+// withdrawn control gear. A binary search over the rest finds the smallest
+// bound that still holds one (COMPARE answering no at a bound also clears
+// all bounds below it), then a binary search between the bound below it and
+// that bound finds the address. Control gear close together shares most of
+// the search, and as it stays in a small range mostly only SEARCHADDRL
+// changes.
+uint32_t Dali::find_addr(DaliSearch *s)
+{
+    uint32_t adr;
+    while ((adr = find_addr_step(s)) == DALI_SEARCH_BUSY)
+        ;
     return adr;
 }
 
+// one step of find_addr(): at most one COMPARE (with the search address
+// bytes that changed) or one repeated WITHDRAW, the rest of the search is
+// kept in s. A caller with other work, or a task watchdog, calls it again
+// while it returns DALI_SEARCH_BUSY.
+uint32_t Dali::find_addr_step(DaliSearch *s)
+{
+    switch (s->step) {
+    case SEARCH_START:
+        s->start = s->low;
+        while (s->nbound && s->bound[s->nbound - 1] < s->low)
+            s->nbound--;
+        // bound[0 .. lo-1] answered yes, bound[hi ..] no
+        s->lo = 0;
+        s->hi = s->nbound;
+        s->step = SEARCH_BOUNDS;
+        // fall through
+    case SEARCH_BOUNDS:
+        if (s->lo < s->hi) {
+            uint8_t m = (s->lo + s->hi) / 2;
+            if (_search_compare(s, s->bound[m])) {
+                s->lo = m + 1;
+            } else {
+                s->low = s->bound[m] + 1; // nothing left up to this bound
+                s->hi = m;
+            }
+            return DALI_SEARCH_BUSY;
+        }
+        s->nbound = s->lo;
+        if (!s->lo) {
+            s->low = DALI_SEARCH_NONE;
+            s->step = SEARCH_START;
+            return DALI_SEARCH_NONE;
+        }
+        // COMPARE answered yes at high, nothing is left below low
+        s->high = s->bound[s->lo - 1];
+        s->step = SEARCH_BISECT;
+        // fall through
+    case SEARCH_BISECT:
+        if (s->low < s->high) {
+            uint32_t mid = s->low + (s->high - s->low) / 2;
+            if (_search_compare(s, mid)) {
+                s->high = mid;
+                _search_bound(s, mid);
+            } else {
+                s->low = mid + 1;
+            }
+            return DALI_SEARCH_BUSY;
+        }
+        // Without a single no, the search ends where it started. A control
+        // gear that missed its WITHDRAW answers yes everywhere above its
+        // random address: if it is there, start again from the top.
+        if (s->high == s->start && s->start > 0) {
+            s->step = SEARCH_RECHECK;
+            return DALI_SEARCH_BUSY;
+        }
+        break;
+    case SEARCH_RECHECK:
+        if (_search_compare(s, s->start - 1)) {
+            s->low = 0;
+            s->bound[0] = 0xFFFFFF;
+            s->nbound = 1;
+            s->step = SEARCH_START;
+            return DALI_SEARCH_BUSY;
+        }
+        break;
+    }
+
+    s->step = SEARCH_START;
+    _search_set(s, s->high); // select it for PROGRAM SHORT ADDRESS and WITHDRAW
+
+    // Found again: it already got its short address, only the WITHDRAW
+    // was lost. Repeat it rather than have the caller program the gear a
+    // second time. If no new device turns up in between, the search ends
+    // after DALI_SEARCH_RETRIES.
+    if (_search_withdrawn(s, s->high)) {
+        if (++s->retries > DALI_SEARCH_RETRIES) {
+            s->low = DALI_SEARCH_NONE;
+            return DALI_SEARCH_NONE;
+        }
+        withdraw(s);
+        return DALI_SEARCH_BUSY;
+    }
+    s->retries = 0;
+    return s->high;
+}
+
+bool Dali::_search_withdrawn(DaliSearch *s, uint32_t adr)
+{
+    for (uint8_t i = 0; i < s->nwithdrawn; i++)
+        if (s->withdrawn[i] == adr)
+            return true;
+    return false;
+}
+
+void Dali::withdraw(DaliSearch *s)
+{
+    cmd(DALI_WITHDRAW, 0x00);
+    if (!_search_withdrawn(s, s->sent) && s->nwithdrawn < DALI_SEARCH_WITHDRAWN)
+        s->withdrawn[s->nwithdrawn++] = s->sent;
+    s->low = s->sent + 1;
+}
+
 // init_arg=11111111 : all without short address
 // init_arg=00000000 : all
 // init_arg=0AAAAAA1 : only for this shortadr
@@ -691,8 +1250,10 @@ uint8_t Dali::commission(uint8_t init_arg)
     }
 
     // find random addresses and assign unused short addresses
+    DaliSearch search;
+    search_begin(&search);
     while (1) {
-        uint32_t adr = find_addr();
+        uint32_t adr = find_addr(&search);
         if (adr > 0xffffff)
             break; // no more random addresses found -> exit
 
@@ -714,7 +1275,7 @@ uint8_t Dali::commission(uint8_t init_arg)
         // Serial.println(query_short_address()); //TODO check read adr, handle if not the same...
 
         // remove the device from the search
-        cmd(DALI_WITHDRAW, 0x00);
+        withdraw(&search);
         vTaskDelay(1);
     }
 
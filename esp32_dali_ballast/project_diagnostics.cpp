@@ -16,6 +16,10 @@ std::vector<DiagnosticSection> appDiagnosticSections() {
   ballastSection.items.push_back({tr("Lámpa állapota", "Lamp Status"), ballastState.lamp_arc_power_on ? tr("BE", "ON") : tr("KI", "OFF")});
   ballastSection.items.push_back({tr("Fényváltás fut", "Fade Running"), ballastState.fade_running ? tr("Igen", "Yes") : tr("Nem", "No")});
   ballastSection.items.push_back({tr("Busz üresjáratban", "Bus Idle"), busIsIdle ? tr("Igen", "Yes") : tr("Nem", "No")});
+  ballastSection.items.push_back({tr("Vételi sor", "RX Queue"), String(dali.rx_queued()) + " / " + String(DALI_RX_QUEUE_SIZE - 1)});
+  ballastSection.items.push_back({tr("Vételi sor túlcsordulás", "RX Queue Overruns"), String(dali.rxoverrun)});
+  ballastSection.items.push_back({tr("Gyenge vett keretek", "RX Weak Frames"), String(dali.rxweak)});
+  ballastSection.items.push_back({tr("Időzítő megszakítás ciklusok", "Timer ISR Cycles"), String(daliIsrCyclesAvg) + tr(" átl. / ", " avg / ") + String(daliIsrCyclesMax) + " max"});
   sections.push_back(ballastSection);
 
   DiagnosticSection mqttSection;
@@ -37,7 +41,12 @@ String appDiagnosticsJSON() {
   json += "\"actual_level\":" + String(ballastState.actual_level) + ",";
   json += "\"lamp_on\":" + String(ballastState.lamp_arc_power_on ? "true" : "false") + ",";
   json += "\"fade_running\":" + String(ballastState.fade_running ? "true" : "false") + ",";
-  json += "\"bus_idle\":" + String(busIsIdle ? "true" : "false");
+  json += "\"bus_idle\":" + String(busIsIdle ? "true" : "false") + ",";
+  json += "\"rx_queued\":" + String(dali.rx_queued()) + ",";
+  json += "\"rx_overruns\":" + String(dali.rxoverrun) + ",";
+  json += "\"rx_weak\":" + String(dali.rxweak) + ",";
+  json += "\"isr_cycles_avg\":" + String(daliIsrCyclesAvg) + ",";
+  json += "\"isr_cycles_max\":" + String(daliIsrCyclesMax);
   json += "},";
   json += "\"mqtt\":{";
   json += "\"enabled\":" + String(mqtt_enabled ? "true" : "false") + ",";
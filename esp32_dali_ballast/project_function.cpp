@@ -344,6 +344,8 @@ void handleAPIRecent() {
 
     if (json.length() > 1) json += ",";
     json += "{\"timestamp\":" + String(msg.timestamp) + ",";
+    json += "\"start_us\":" + String(msg.start_us) + ",";
+    json += "\"end_us\":" + String(msg.end_us) + ",";
     json += "\"command_type\":\"" + msg.command_type + "\",";
     json += "\"address\":" + String(msg.address) + ",";
     json += "\"value\":" + String(msg.value) + ",";
@@ -47,6 +47,8 @@ void publishBallastCommand(const BallastMessage& msg) {
   String topic = mqtt_prefix + "command";
   String json = "{";
   json += "\"timestamp\":" + String(msg.timestamp) + ",";
+  json += "\"start_us\":" + String(msg.start_us) + ",";
+  json += "\"end_us\":" + String(msg.end_us) + ",";
   json += "\"source\":\"" + msg.source + "\",";
   json += "\"command_type\":\"" + msg.command_type + "\",";
   json += "\"address\":" + String(msg.address) + ",";
@@ -105,10 +107,10 @@ String appMqttTopicsHTML() {
   html += "<p style=\"margin:0 0 8px 0;font-size:12px;color:var(--text-secondary);\">" + String(tr("Publikálva, amikor az előtét DALI parancsot kap a buszról", "Published when ballast receives DALI commands from the bus")) + "</p>";
   html += "<details style=\"margin:8px 0;padding:8px;background:var(--bg-primary);border-radius:4px;\">";
   html += "<summary style=\"cursor:pointer;color:var(--accent-green);font-weight:500;\">▸ " + String(tr("Példa: Szintbeállító parancs", "Example: Set Level Command")) + "</summary>";
-  html += "<pre style=\"background:var(--bg-secondary);padding:12px;border-radius:6px;overflow-x:auto;margin:8px 0;font-size:12px;\">{<br>  \"timestamp\": 1234567890,<br>  \"source\": \"bus\",<br>  \"command_type\": \"set_brightness\",<br>  \"address\": 0,<br>  \"value\": 128,<br>  \"value_percent\": 50.4,<br>  \"raw\": \"0180\",<br>  \"description\": \"Set to 128 (50.4%)\"<br>}</pre></details>";
+  html += "<pre style=\"background:var(--bg-secondary);padding:12px;border-radius:6px;overflow-x:auto;margin:8px 0;font-size:12px;\">{<br>  \"timestamp\": 1234567890,<br>  \"start_us\": 81234567,<br>  \"end_us\": 81250397,<br>  \"source\": \"bus\",<br>  \"command_type\": \"set_brightness\",<br>  \"address\": 0,<br>  \"value\": 128,<br>  \"value_percent\": 50.4,<br>  \"raw\": \"0180\",<br>  \"description\": \"Set to 128 (50.4%)\"<br>}</pre></details>";
   html += "<details style=\"margin:8px 0;padding:8px;background:var(--bg-primary);border-radius:4px;\">";
   html += "<summary style=\"cursor:pointer;color:var(--accent-green);font-weight:500;\">▸ " + String(tr("Példa: Lekérdezés válasza", "Example: Query Response")) + "</summary>";
-  html += "<pre style=\"background:var(--bg-secondary);padding:12px;border-radius:6px;overflow-x:auto;margin:8px 0;font-size:12px;\">{<br>  \"timestamp\": 1234567891,<br>  \"source\": \"bus\",<br>  \"command_type\": \"query_actual_level\",<br>  \"address\": 0,<br>  \"is_query_response\": true,<br>  \"response\": \"0x80\",<br>  \"value\": 128,<br>  \"value_percent\": 50.4,<br>  \"raw\": \"01A0\",<br>  \"description\": \"Query actual level: 128 (50.4%)\"<br>}</pre></details>";
+  html += "<pre style=\"background:var(--bg-secondary);padding:12px;border-radius:6px;overflow-x:auto;margin:8px 0;font-size:12px;\">{<br>  \"timestamp\": 1234567891,<br>  \"start_us\": 81534012,<br>  \"end_us\": 81549842,<br>  \"source\": \"bus\",<br>  \"command_type\": \"query_actual_level\",<br>  \"address\": 0,<br>  \"is_query_response\": true,<br>  \"response\": \"0x80\",<br>  \"value\": 128,<br>  \"value_percent\": 50.4,<br>  \"raw\": \"01A0\",<br>  \"description\": \"Query actual level: 128 (50.4%)\"<br>}</pre></details>";
 
   html += "<p style=\"margin:12px 0 4px 0;color:var(--text-secondary);\"><strong>" + String(tr("Konfiguráció:", "Configuration:")) + "</strong> <code style=\"background:var(--bg-primary);padding:2px 6px;border-radius:3px;font-family:monospace;\">" + mqtt_prefix + "config</code></p>";
   html += "<p style=\"margin:0 0 8px 0;font-size:12px;color:var(--text-secondary);\">" + String(tr("Az előtét konfigurációja publikálva csatlakozáskor és változáskor", "Ballast configuration published on connect and when changed")) + "</p>";
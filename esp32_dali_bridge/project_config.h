@@ -35,13 +35,68 @@
 
 #define DALI_TX_PIN 17
 #define DALI_RX_PIN 14
+#define DALI_TX_ACTIVE_HIGH 1  // the transceiver pulls the bus low while the tx pin is high
 #define DALI_TIMER_FREQ 9600000
 
-// DALI timing and queue settings
-#define DALI_MIN_INTERVAL_MS 50
-#define COMMAND_QUEUE_SIZE 50
+// Samples per bit of the sampling receiver: 4, 8 or 16. The timer interrupt
+// runs 1200 * DALI_OVERSAMPLE times per second, fewer samples cost less CPU,
+// more give the decoder finer edge timing
+#define DALI_OVERSAMPLE 8
+
+// DALI receive backend: 0 = sample the bus in the timer interrupt,
+// 1 = capture rx pin edges, the timer only runs while the bus is busy
+#define DALI_RX_EDGE_CAPTURE 0
+
+// Timer ISR cost on the diagnostics page: average over this many calls (1 s of sampling)
+#define DALI_ISR_AVG_CALLS (1200 * DALI_OVERSAMPLE)
+
+// DALI queue settings
+#define COMMAND_QUEUE_SIZE 64     // power of two (lock-free queue), one per priority
+
+// Command priorities: entries each priority may hold before commands of that
+// priority are refused (up to COMMAND_QUEUE_SIZE), and the wait after which a
+// command is taken as if it had the next higher priority (two steps for a low
+// one after twice the time), so a stream of urgent commands does not starve
+// the rest.
+#define COMMAND_QUEUE_LIMIT_HIGH 16
+#define COMMAND_QUEUE_LIMIT_NORMAL 64
+#define COMMAND_QUEUE_LIMIT_LOW 32
+#define COMMAND_QUEUE_AGE_MS 1000
 #define RECENT_MESSAGES_SIZE 20
 
+// DALI task: receive drain, command queue, scan and commissioning run in their
+// own task on the core the Arduino loop (web server, WiFi client, MQTT) does not
+// use. Frames and progress go back to the loop through an event queue.
+#define DALI_TASK_CORE 0
+#define DALI_TASK_PRIORITY 5
+#define DALI_TASK_STACK 6144
+#define DALI_TASK_PERIOD_MS 1
+#define DALI_EVENT_QUEUE_SIZE 32  // power of two
+
+// Background health poller: QUERY STATUS to the known short addresses at
+// polling priority while the driver has nothing else to send. The interval of
+// an address doubles with every unchanged answer, from DALI_POLL_FAST_MS up to
+// DALI_POLL_SLOW_MS (DALI_POLL_FAILED_MS while it reports a failure); a change
+// starts it over. DALI_POLL_LOST missing replies in a row report it missing.
+#define DALI_POLL_ENABLE 1
+#define DALI_POLL_FAST_MS 2000
+#define DALI_POLL_SLOW_MS 60000
+#define DALI_POLL_FAILED_MS 10000
+#define DALI_POLL_LOST 3
+
+// Device state cache: query commands are answered from the cache while the
+// value is younger than this. Actual level and status change without
+// configuration, the poller refreshes the status at least every
+// DALI_POLL_SLOW_MS; the other fields only change by commands we see.
+#define DALI_STATE_LIVE_AGE_MS (DALI_POLL_SLOW_MS + 5000)
+#define DALI_STATE_CONFIG_AGE_MS 3600000
+
+// Sniffed traffic: a backward frame answers the forward frame before it only
+// if it starts this long after its end (IEC 62386-101 reply settling time,
+// 5.5 to 10.5 ms, with the receiver tolerance of 2.4 to 12.4 ms)
+#define DALI_SNIFF_REPLY_MIN_US 2400
+#define DALI_SNIFF_REPLY_MAX_US 12400
+
 // Bus monitoring settings
 #define BUS_IDLE_TIMEOUT_MS 150
 #define BUS_ACTIVITY_WINDOW_MS 500
@@ -51,6 +106,16 @@
 // Passive device discovery
 #define DALI_MAX_ADDRESSES 64
 
+// Reply latency histograms (end of our forward frame to the start of the reply):
+// bucket 0 is below 5.5 ms, then 1 ms buckets, the last one takes everything later
+#define REPLY_HIST_BUCKETS 7
+#define REPLY_HIST_FIRST_US 5500
+#define REPLY_HIST_BUCKET_US 1000
+
+// Raw sample capture ring (needs the sampling receiver), 52 bytes per record:
+// one record per received frame, or 33 ms of bus time in window mode
+#define DALI_CAPTURE_RECORDS 512
+
 // MQTT Monitor Filter Configuration
 struct MonitorFilter {
     bool enable_dapc;           // Direct Arc Power Control (brightness)
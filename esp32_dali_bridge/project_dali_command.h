@@ -0,0 +1,118 @@
+#ifndef PROJECT_DALI_COMMAND_H
+#define PROJECT_DALI_COMMAND_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Commands of the web UI and MQTT. The command name is resolved to a
+// DaliCommandOp once, when the command comes in; the queue entry is a 16 byte
+// POD that goes through the lock-free queue without touching the heap, and the
+// DALI task dispatches on the op through daliCommandTable[]
+// (project_dali_handler.cpp). Host code (tools/dali_sim) includes this header
+// without Arduino.
+enum DaliCommandOp : uint8_t {
+  DALI_OP_INVALID = 0,
+  DALI_OP_SET_BRIGHTNESS,
+  DALI_OP_OFF,
+  DALI_OP_MAX,
+  DALI_OP_RECALL_MAX,
+  DALI_OP_RECALL_MIN,
+  DALI_OP_UP,
+  DALI_OP_DOWN,
+  DALI_OP_STEP_UP,
+  DALI_OP_STEP_DOWN,
+  DALI_OP_GO_TO_SCENE,
+  DALI_OP_RESET,
+  DALI_OP_QUERY_STATUS,
+  DALI_OP_QUERY_LAMP_FAILURE,
+  DALI_OP_QUERY_LAMP_POWER_ON,
+  DALI_OP_QUERY_ACTUAL_LEVEL,
+  DALI_OP_QUERY_MAX_LEVEL,
+  DALI_OP_QUERY_MIN_LEVEL,
+  DALI_OP_QUERY_DEVICE_TYPE,
+  DALI_OP_QUERY_SCENE_LEVEL,
+  DALI_OP_SET_RGB,
+  DALI_OP_SET_RGBW,
+  DALI_OP_SET_COLOR_TEMP,
+  DALI_OP_DEVICE_COMMAND,
+  DALI_OP_RAW,
+  DALI_OP_COUNT
+};
+
+// Address types of 24-bit device commands (IEC 62386-103)
+enum DaliAddressType : uint8_t {
+  DALI_ADDRESS_SHORT = 0,
+  DALI_ADDRESS_GROUP,
+  DALI_ADDRESS_BROADCAST,
+  DALI_ADDRESS_UNADDRESSED,
+  DALI_ADDRESS_SPECIAL,
+  DALI_ADDRESS_UNKNOWN
+};
+
+// Scheduling priority of a queued command, DaliCommand.priority. Each has its
+// own queue; the DALI task takes the highest one, a command that waited
+// COMMAND_QUEUE_AGE_MS competes one priority higher (project_config.h).
+#define DALI_COMMAND_PRIORITY_HIGH 0    // Emergency and safety commands (all off)
+#define DALI_COMMAND_PRIORITY_NORMAL 1  // Web UI and MQTT default
+#define DALI_COMMAND_PRIORITY_LOW 2     // Bulk and background work
+#define DALI_COMMAND_PRIORITIES 3
+
+#define DALI_COMMAND_REPLY 0x01  // raw: wait for a backward frame
+#define DALI_COMMAND_TWICE 0x02  // raw: send-twice pair
+
+struct DaliCommand {
+  uint8_t op;                   // DaliCommandOp
+  uint8_t address;              // 0..63, 0xFF broadcast; device_command: as address_type says
+  uint8_t address_type;         // device_command: DaliAddressType
+  uint8_t priority;             // DALI_COMMAND_PRIORITY_xxx, higher values are taken as LOW
+  uint32_t queued_at;           // millis()
+  union {                       // Arguments, by op
+    uint8_t level;              // set_brightness
+    uint8_t scene;              // go_to_scene, query_scene_level
+    struct {
+      uint8_t r, g, b, w;
+    } color;                    // set_rgb, set_rgbw
+    uint16_t color_temp_kelvin; // set_color_temp
+    struct {
+      uint8_t instance;         // Instance byte (DALI24_INSTANCE(n), DALI24_DEVICE, ...)
+      uint8_t opcode;           // Opcode byte (special commands: data byte)
+    } device;                   // device_command
+    struct {
+      uint32_t frame;           // Frame bits, right aligned
+      uint8_t bits;             // 16, 24 or 25
+      uint8_t flags;            // DALI_COMMAND_REPLY / DALI_COMMAND_TWICE
+    } raw;                      // raw
+  };
+};
+static_assert(sizeof(DaliCommand) == 16, "queue entry should stay 16 bytes");
+
+// Command names of the web UI and MQTT, indexed by DaliCommandOp
+static const char* const daliCommandNames[DALI_OP_COUNT] = {
+  "", "set_brightness", "off", "max", "recall_max", "recall_min", "up", "down", "step_up", "step_down",
+  "go_to_scene", "reset", "query_status", "query_lamp_failure", "query_lamp_power_on", "query_actual_level",
+  "query_max_level", "query_min_level", "query_device_type", "query_scene_level", "set_rgb", "set_rgbw",
+  "set_color_temp", "device_command", "raw"
+};
+
+// DALI_OP_INVALID if the name is not a command
+inline uint8_t daliCommandOp(const char* name) {
+  for (uint8_t op = 1; op < DALI_OP_COUNT; op++) {
+    if (!strcmp(name, daliCommandNames[op])) return op;
+  }
+  return DALI_OP_INVALID;
+}
+
+inline const char* daliCommandName(uint8_t op) {
+  return op < DALI_OP_COUNT ? daliCommandNames[op] : "";
+}
+
+// DALI_ADDRESS_UNKNOWN if the name is not an address type
+inline uint8_t daliAddressType(const char* name) {
+  static const char* const names[] = { "short", "group", "broadcast", "unaddressed", "special" };
+  for (uint8_t t = 0; t < DALI_ADDRESS_UNKNOWN; t++) {
+    if (!strcmp(name, names[t])) return t;
+  }
+  return DALI_ADDRESS_UNKNOWN;
+}
+
+#endif
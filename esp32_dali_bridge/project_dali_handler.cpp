@@ -3,23 +3,60 @@
 #include "base_diagnostics.h"
 #include "project_mqtt.h"
 #include "esp_task_wdt.h"
+#include "esp_cpu.h"
+#include "project_dali_queue.h"
 
 Dali dali;
 DaliMessage recentMessages[RECENT_MESSAGES_SIZE];
 uint8_t recentMessagesIndex = 0;
-DaliCommand commandQueue[COMMAND_QUEUE_SIZE];
-uint8_t queueHead = 0;
-uint8_t queueTail = 0;
-unsigned long lastDaliCommandTime = 0;
 unsigned long lastBusActivityTime = 0;
 bool busIsIdle = true;
+int16_t daliCommandHandle = -1;  // Last transaction of the command on the bus (-1 = none)
+DaliScanResult scanResult;
+DaliScanProgress scanProgress;
 CommissioningProgress commissioningProgress;
 PassiveDevice passiveDevices[DALI_MAX_ADDRESSES];
-uint8_t lastQueriedAddress = 255;  // Track last address that was queried (for passive discovery)
+ReplyStats replyStats[DALI_MAX_ADDRESSES];
+DaliDeviceState deviceState[DALI_MAX_ADDRESSES];
+DaliQueueStats commandQueueStats[DALI_COMMAND_PRIORITIES];
+DaliCaptureRecord* captureRing = nullptr;  // Allocated on the first capture, the ISR may still write to it after a stop
 
 unsigned long daliRxCount = 0;
 unsigned long daliTxCount = 0;
 unsigned long daliErrorCount = 0;
+unsigned long daliEventOverflow = 0;
+
+// The DALI task owns the driver, the scan and the commissioning run. The web
+// server and MQTT hand it commands and requests through lock-free queues and
+// flags, and get frames and progress back through the event queue. The
+// loop-side copies (recentMessages, scanResult, commissioningProgress,
+// passiveDevices) are only touched by the loop.
+TaskHandle_t daliTaskHandle = NULL;
+static DaliMpscQueue<DaliCommand, COMMAND_QUEUE_SIZE> commandQueue[DALI_COMMAND_PRIORITIES];  // By DALI_COMMAND_PRIORITY_xxx
+static const uint8_t commandQueueLimit[DALI_COMMAND_PRIORITIES] = {
+  COMMAND_QUEUE_LIMIT_HIGH, COMMAND_QUEUE_LIMIT_NORMAL, COMMAND_QUEUE_LIMIT_LOW
+};
+static std::atomic<uint8_t> commandQueueCount[DALI_COMMAND_PRIORITIES];  // Entries reserved by producers, see enqueueDaliCommand()
+static DaliMpscQueue<DaliEvent, DALI_EVENT_QUEUE_SIZE> eventQueue;
+static std::atomic<uint8_t> scanRequest(0);           // SCAN_REQUEST_xxx bits
+static std::atomic<int16_t> commissionRequest(-1);    // Start address, -1 = none
+static bool scanPending = false;                      // Loop side: requested, SCAN_DONE not seen yet
+static CommissioningReport commissioning;             // DALI task side of commissioningProgress
+static DaliSearch commissionSearch;                   // DALI task side, see updateDaliCommissioning()
+static uint8_t commissionStart = 0;                   // First short address of the run
+static uint8_t commissionVerify = 0;                  // Next address to verify
+static uint32_t commissionWaitUntil = 0;              // End of the wait after RANDOMISE
+static DaliPollEntry pollState[DALI_MAX_ADDRESSES];   // DALI task side, see updateDaliPoller()
+static uint64_t pollKnown = 0;                        // Short addresses the poller cycles through
+static uint8_t pollNext = 0;                          // Round robin position
+static int16_t pollHandle = -1;                       // QUERY STATUS on the bus (-1 = none)
+static uint8_t pollAddress = 0;
+static bool pollReplyReady = false;
+static int16_t pollReply = 0;
+static DaliPendingQuery pendingQuery = {};            // Loop side, see pairBusFrame()
+
+#define SCAN_REQUEST_START 0x01
+#define SCAN_REQUEST_PUBLISH 0x02
 
 void incrementRxCount() { daliRxCount++; }
 void incrementTxCount() { daliTxCount++; }
@@ -27,21 +64,39 @@ void incrementErrorCount() { daliErrorCount++; }
 
 hw_timer_t *timer = NULL;
 
-uint8_t bus_is_high() {
-  return digitalRead(DALI_RX_PIN);
+// Cost of dali.timer() in CPU cycles: the maximum since boot and the average
+// over the last DALI_ISR_AVG_CALLS calls
+volatile uint32_t daliIsrCyclesMax = 0;
+volatile uint32_t daliIsrCyclesAvg = 0;
+static uint32_t isrCyclesSum = 0;
+static uint16_t isrCyclesCalls = 0;
+
+void ARDUINO_ISR_ATTR onTimer() {
+  uint32_t start = esp_cpu_get_cycle_count();
+  dali.timer();
+  uint32_t cycles = esp_cpu_get_cycle_count() - start;
+  if (cycles > daliIsrCyclesMax) daliIsrCyclesMax = cycles;
+  isrCyclesSum += cycles;
+  if (++isrCyclesCalls >= DALI_ISR_AVG_CALLS) {
+    daliIsrCyclesAvg = isrCyclesSum / isrCyclesCalls;
+    isrCyclesSum = 0;
+    isrCyclesCalls = 0;
+  }
 }
 
-void bus_set_low() {
-  digitalWrite(DALI_TX_PIN, LOW);
+#if DALI_RX_EDGE_CAPTURE
+void ARDUINO_ISR_ATTR onBusEdge() {
+  dali.edge(DaliIo::is_high());
 }
 
-void bus_set_high() {
-  digitalWrite(DALI_TX_PIN, HIGH);
+void ARDUINO_ISR_ATTR daliTimerStart() {
+  timerStart(timer);
 }
 
-void ARDUINO_ISR_ATTR onTimer() {
-  dali.timer();
+void ARDUINO_ISR_ATTR daliTimerStop() {
+  timerStop(timer);
 }
+#endif
 
 void daliInit() {
 #ifdef DEBUG_SERIAL
@@ -53,17 +108,245 @@ void daliInit() {
 
   timer = timerBegin(DALI_TIMER_FREQ);
   timerAttachInterrupt(timer, &onTimer);
-  timerAlarm(timer, 1000, true, 0);
+  timerAlarm(timer, DALI_TIMER_FREQ / DALI_SAMPLE_HZ, true, 0);
 
-  dali.begin(bus_is_high, bus_set_high, bus_set_low);
+#if DALI_RX_EDGE_CAPTURE
+  dali.begin(daliTimerStart, daliTimerStop);
+  attachInterrupt(DALI_RX_PIN, onBusEdge, CHANGE);
+#else
+  dali.begin();
+#endif
   
   clearPassiveDevices();
+  memset(replyStats, 0, sizeof(replyStats));
+  dali.reply_hook = onDaliReply;
+
+  // The timer interrupt stays on the loop's core, where it was allocated: the
+  // WiFi stack runs on the other one and would add to its latency
+  xTaskCreatePinnedToCore(daliTask, "dali", DALI_TASK_STACK, NULL, DALI_TASK_PRIORITY, &daliTaskHandle, DALI_TASK_CORE);
 
 #ifdef DEBUG_SERIAL
-  Serial.println("DALI initialized");
+  Serial.printf("DALI initialized, task on core %d\n", DALI_TASK_CORE);
 #endif
 }
 
+// DALI engine: drains the receive queue, feeds the driver from the command
+// queue and runs scans and commissioning, independent of the web server and
+// MQTT in the loop
+void daliTask(void* arg) {
+  esp_task_wdt_add(NULL);
+  for (;;) {
+    esp_task_wdt_reset();
+    monitorDaliBus();
+    processCommandQueue();
+    takeDaliRequests();
+    updateDaliScan();
+    updateDaliCommissioning();
+    updateDaliPoller();
+    vTaskDelay(pdMS_TO_TICKS(DALI_TASK_PERIOD_MS));
+  }
+}
+
+// Scan and commissioning requests of the loop. A scan and a commissioning run
+// do not share the bus: each one waits for the other to finish. The request
+// stays set while commissioning runs, finishCommissioning() clears it.
+static bool commissioningRunning();
+void takeDaliRequests() {
+  if (commissioningRunning()) return;
+  uint8_t scan = scanRequest.exchange(0);
+  if (scan & SCAN_REQUEST_START) {
+    startDaliScan(scan & SCAN_REQUEST_PUBLISH);
+  }
+  if (commissionRequest.load() >= 0 && !scanProgress.running) {
+    startCommissioning(commissionRequest.load());
+  }
+}
+
+bool requestDaliScan(bool publish) {
+  bool started = !scanPending;
+  scanPending = true;
+  scanRequest.fetch_or(SCAN_REQUEST_START | (publish ? SCAN_REQUEST_PUBLISH : 0));
+  return started;
+}
+
+// Returns false if a commissioning run is already requested or running. The
+// loop-side progress is reset right away, so a poll before the DALI task gets
+// to the request does not see the end of the previous run.
+bool requestCommissioning(uint8_t start_address) {
+  int16_t none = -1;
+  if (!commissionRequest.compare_exchange_strong(none, start_address)) return false;
+  commissioningProgress.state = COMM_INITIALIZING;
+  commissioningProgress.start_timestamp = millis();
+  commissioningProgress.devices_found = 0;
+  commissioningProgress.devices_programmed = 0;
+  commissioningProgress.next_free_address = start_address;
+  commissioningProgress.status_message = "Starting commissioning...";
+  commissioningProgress.progress_percent = 0;
+  clearDeviceState(0xFF);  // INITIALISE 0x00: every short address may change
+  return true;
+}
+
+// Called by the DALI task, frames and progress are dropped (and counted) if
+// the loop falls behind
+static void pushDaliEvent(const DaliEvent& ev) {
+  if (!eventQueue.push(ev)) daliEventOverflow++;
+}
+
+static void pushFrameEvent(const uint8_t* data, uint8_t length, bool is_tx, int64_t start_us, int64_t end_us) {
+  DaliEvent ev = {};
+  ev.type = DALI_EVENT_FRAME;
+  memcpy(ev.data, data, length);
+  ev.length = length;
+  ev.is_tx = is_tx;
+  ev.start_us = start_us;
+  ev.end_us = end_us;
+  pushDaliEvent(ev);
+}
+
+static void reportCommissioningProgress() {
+  DaliEvent ev = {};
+  ev.type = DALI_EVENT_COMMISSIONING;
+  ev.progress = commissioning;
+  pushDaliEvent(ev);
+}
+
+static String commissioningMessage(const CommissioningReport& report) {
+  switch (report.message) {
+    case COMM_MSG_INITIALISE: return "Sending INITIALISE command...";
+    case COMM_MSG_INITIALISE_FAILED: return "Failed to send INITIALISE";
+    case COMM_MSG_RANDOMISE: return "Sending RANDOMISE command...";
+    case COMM_MSG_RANDOMISE_FAILED: return "Failed to send RANDOMISE";
+    case COMM_MSG_SEARCH_BEGIN: return "Searching for devices...";
+    case COMM_MSG_SEARCHING: return "Searching for device...";
+    case COMM_MSG_PROGRAMMING: return "Programming device " + String(report.devices_found);
+    case COMM_MSG_NO_FREE_ADDRESS: return "No free addresses available";
+    case COMM_MSG_NONE_FOUND: return "No unaddressed devices found";
+    case COMM_MSG_VERIFYING: return "Verifying programmed addresses...";
+    case COMM_MSG_COMPLETE: return "Commissioning complete! Programmed " + String(report.devices_programmed) + " devices";
+  }
+  return "";
+}
+
+// Events of the DALI task, called from the loop: monitor, scan result and
+// commissioning progress, published over MQTT from here
+void processDaliEvents() {
+  DaliEvent ev;
+  for (uint8_t i = 0; i < DALI_EVENT_QUEUE_SIZE && eventQueue.pop(ev); i++) {
+    switch (ev.type) {
+      case DALI_EVENT_FRAME:
+        handleBusFrame(ev);
+        break;
+      case DALI_EVENT_SCAN_START:
+        scanResult.scan_timestamp = ev.value;
+        scanResult.devices.clear();
+        scanResult.total_found = 0;
+        break;
+      case DALI_EVENT_SCAN_DEVICE: {
+        DaliDevice device;
+        device.address = ev.data[0];
+        device.type = "short";
+        device.status = "ok";
+        device.lamp_failure = ev.flag;
+        device.min_level = ev.data[1];
+        device.max_level = ev.data[2];
+        scanResult.devices.push_back(device);
+        scanResult.total_found++;
+        break;
+      }
+      case DALI_EVENT_SCAN_DONE:
+        scanPending = false;
+        if (ev.flag) {
+          publishScanResult(scanResult);
+        }
+        break;
+      case DALI_EVENT_COMMISSIONING:
+        commissioningProgress.state = ev.progress.state;
+        commissioningProgress.start_timestamp = ev.progress.start_timestamp;
+        commissioningProgress.devices_found = ev.progress.devices_found;
+        commissioningProgress.devices_programmed = ev.progress.devices_programmed;
+        commissioningProgress.current_address = ev.progress.current_address;
+        commissioningProgress.next_free_address = ev.progress.next_free_address;
+        commissioningProgress.current_random_address = ev.progress.current_random_address;
+        commissioningProgress.status_message = commissioningMessage(ev.progress);
+        commissioningProgress.progress_percent = ev.progress.progress_percent;
+        publishCommissioningProgress(commissioningProgress);
+        break;
+      case DALI_EVENT_STATUS: {
+        uint8_t address = ev.data[0];
+        int16_t status = ev.flag ? -1 : ev.data[1];
+        if (status >= 0) {
+          passiveDevices[address].last_seen = millis();
+          passiveDevices[address].flags = (passiveDevices[address].flags & ~0x02) | 0x01 | (status & 0x02);
+        }
+        publishDeviceStatus(address, status, ev.value ? ev.data[2] : -1);
+        break;
+      }
+      case DALI_EVENT_REPLY:
+        updateDeviceState(ev.data[0] >> 1, ev.data[1], ev.value);
+        break;
+    }
+  }
+}
+
+uint8_t daliCommandQueueDepth() {
+  uint8_t depth = 0;
+  for (uint8_t p = 0; p < DALI_COMMAND_PRIORITIES; p++) depth += commandQueue[p].size();
+  return depth;
+}
+
+uint8_t daliCommandQueueDepth(uint8_t priority) {
+  return (priority < DALI_COMMAND_PRIORITIES) ? commandQueue[priority].size() : 0;
+}
+
+uint8_t daliCommandQueueLimit(uint8_t priority) {
+  if (priority >= DALI_COMMAND_PRIORITIES) return 0;
+  return (commandQueueLimit[priority] < COMMAND_QUEUE_SIZE) ? commandQueueLimit[priority] : COMMAND_QUEUE_SIZE;
+}
+
+// Reply monitor of the driver, called from dali.service() for every query we
+// sent: short addresses are 0AAAAAA1 in both 16 and 24-bit forward frames
+void onDaliReply(const uint8_t* fwd, uint8_t bitlen, int16_t result, int32_t reply_us) {
+  if ((bitlen != 16 && bitlen != 24) || (fwd[0] & 0x81) != 0x01) return;
+  ReplyStats& st = replyStats[fwd[0] >> 1];
+  if (result >= 0) addPolledDevice(fwd[0] >> 1);
+  if (result >= 0 && bitlen == 16 && daliQueryDecoded(fwd[1])) {
+    DaliEvent ev = {};
+    ev.type = DALI_EVENT_REPLY;
+    ev.data[0] = fwd[0];
+    ev.data[1] = fwd[1];
+    ev.length = 2;
+    ev.value = result;
+    pushDaliEvent(ev);
+  }
+  if (reply_us < 0) {
+    if (result == -DALI_RESULT_NO_REPLY) st.no_reply++;  // others never made it onto the bus
+    return;
+  }
+  if (result < 0) {
+    st.garbled++;
+    return;
+  }
+  uint8_t bucket = 0;
+  if (reply_us >= REPLY_HIST_FIRST_US) {
+    bucket = 1 + (reply_us - REPLY_HIST_FIRST_US) / REPLY_HIST_BUCKET_US;
+    if (bucket >= REPLY_HIST_BUCKETS) bucket = REPLY_HIST_BUCKETS - 1;
+  }
+  st.buckets[bucket]++;
+}
+
+// Raw sample capture: DALI_CAPTURE_FRAMES, DALI_CAPTURE_WINDOW or DALI_CAPTURE_OFF
+bool setDaliCapture(uint8_t mode) {
+  if (mode == DALI_CAPTURE_OFF) {
+    dali.capture_stop();
+    return true;
+  }
+  if (!captureRing) {
+    captureRing = (DaliCaptureRecord*)malloc(DALI_CAPTURE_RECORDS * sizeof(DaliCaptureRecord));
+    if (!captureRing) return false;
+  }
+  return dali.capture_start(mode, captureRing, DALI_CAPTURE_RECORDS) == 0;
+}
+
 // Passive device discovery functions
 void clearPassiveDevices() {
   memset(passiveDevices, 0, sizeof(passiveDevices));
@@ -92,21 +375,360 @@ void updatePassiveDevice(uint8_t address, const DaliMessage& msg) {
   }
 }
 
-// Called when we see a query command to an address - remember it for response matching
-void trackQueryAddress(uint8_t address) {
-  if (address < DALI_MAX_ADDRESSES) {
-    lastQueriedAddress = address;
+// How validateDaliCommand() checks the address of a command
+#define DALI_CHECK_FORCED 0  // Only sent with force
+#define DALI_CHECK_GEAR 1    // Short address or broadcast
+#define DALI_CHECK_SHORT 2   // Short address (queries)
+#define DALI_CHECK_DEVICE 3  // 24-bit device command, by address_type
+#define DALI_CHECK_RAW 4     // Raw frame
+
+// Builds the last frame of a command, frames before it are sent from here
+typedef DaliCmdFrame (*DaliCommandBuild)(const DaliCommand& cmd, DaliAddr adr, uint16_t command);
+
+struct DaliCommandInfo {
+  uint8_t check;           // DALI_CHECK_xxx
+  uint16_t command;        // DALI_xxx command (scene commands: scene 0), for build
+  DaliCommandBuild build;  // nullptr: the command to the address
+};
+
+static DaliCmdFrame buildArc(const DaliCommand& cmd, DaliAddr adr, uint16_t command) {
+  return dali_arc_frame(adr, cmd.level);
+}
+
+static DaliCmdFrame buildScene(const DaliCommand& cmd, DaliAddr adr, uint16_t command) {
+  return dali_cmd_frame(command + cmd.scene, adr);
+}
+
+// Sends the DTR / SET TEMPORARY frames ahead of a DT8 ACTIVATE; false as soon as one
+// is refused, the ACTIVATE must not follow then (it would apply stale DTR contents)
+static bool sendDt8Frames(const DaliCmdFrame* frames, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (dali.send(frames[i]) < 0) return false;
+  }
+  return true;
+}
+
+// DT8: Set RGB color (requires DTR0=R, DTR1=G, DTR2=B)
+static DaliCmdFrame buildRgb(const DaliCommand& cmd, DaliAddr adr, uint16_t command) {
+  const DaliCmdFrame frames[] = {
+    dali_special<DALI_DATA_TRANSFER_REGISTER0>(cmd.color.r),
+    dali_special<DALI_DATA_TRANSFER_REGISTER1>(cmd.color.g),
+    dali_special<DALI_DATA_TRANSFER_REGISTER2>(cmd.color.b),
+    dali_cmd<DALI_DT8_SET_TEMPORARY_RGB_DIMLEVEL>(adr),
+  };
+  if (!sendDt8Frames(frames, 4)) return DALI_CMD_FRAME_INVALID;
+  return dali_cmd<DALI_DT8_ACTIVATE>(adr);
+}
+
+// DT8: Set RGBW color (R, G, B in RGB command, then W separately)
+static DaliCmdFrame buildRgbw(const DaliCommand& cmd, DaliAddr adr, uint16_t command) {
+  const DaliCmdFrame frames[] = {
+    dali_special<DALI_DATA_TRANSFER_REGISTER0>(cmd.color.r),
+    dali_special<DALI_DATA_TRANSFER_REGISTER1>(cmd.color.g),
+    dali_special<DALI_DATA_TRANSFER_REGISTER2>(cmd.color.b),
+    dali_cmd<DALI_DT8_SET_TEMPORARY_RGB_DIMLEVEL>(adr),
+    dali_special<DALI_DATA_TRANSFER_REGISTER0>(cmd.color.w),
+    dali_cmd<DALI_DT8_SET_TEMPORARY_WAF_DIMLEVEL>(adr),
+  };
+  if (!sendDt8Frames(frames, 6)) return DALI_CMD_FRAME_INVALID;
+  return dali_cmd<DALI_DT8_ACTIVATE>(adr);
+}
+
+// DT8: Set color temperature (requires DTR0=LSB, DTR1=MSB of mirek value)
+static DaliCmdFrame buildColorTemp(const DaliCommand& cmd, DaliAddr adr, uint16_t command) {
+  if (cmd.color_temp_kelvin == 0) return DALI_CMD_FRAME_INVALID;
+  uint16_t mirek = 1000000 / cmd.color_temp_kelvin;  // Convert Kelvin to mirek
+  const DaliCmdFrame frames[] = {
+    dali_special<DALI_DATA_TRANSFER_REGISTER0>(mirek & 0xFF),
+    dali_special<DALI_DATA_TRANSFER_REGISTER1>((mirek >> 8) & 0xFF),
+    dali_cmd<DALI_DT8_SET_TEMPORARY_COLOUR_TEMPERATURE>(adr),
+  };
+  if (!sendDt8Frames(frames, 3)) return DALI_CMD_FRAME_INVALID;
+  return dali_cmd<DALI_DT8_ACTIVATE>(adr);
+}
+
+// 24-bit frame: address byte, instance byte, opcode
+static DaliCmdFrame buildDevice(const DaliCommand& cmd, DaliAddr adr, uint16_t command) {
+  return dali_cmd24_frame(deviceAddressByte(cmd.address_type, cmd.address), cmd.device.instance, cmd.device.opcode);
+}
+
+// Indexed by DaliCommandOp, names in daliCommandNames[] (project_dali_command.h)
+static const DaliCommandInfo daliCommandTable[DALI_OP_COUNT] = {
+  { DALI_CHECK_FORCED, 0, nullptr },                                  // DALI_OP_INVALID
+  { DALI_CHECK_GEAR, 0, buildArc },                                   // set_brightness
+  { DALI_CHECK_GEAR, DALI_OFF, nullptr },
+  { DALI_CHECK_GEAR, DALI_RECALL_MAX_LEVEL, nullptr },                // max
+  { DALI_CHECK_GEAR, DALI_RECALL_MAX_LEVEL, nullptr },
+  { DALI_CHECK_GEAR, DALI_RECALL_MIN_LEVEL, nullptr },
+  { DALI_CHECK_GEAR, DALI_UP, nullptr },
+  { DALI_CHECK_GEAR, DALI_DOWN, nullptr },
+  { DALI_CHECK_GEAR, DALI_STEP_UP, nullptr },
+  { DALI_CHECK_GEAR, DALI_STEP_DOWN, nullptr },
+  { DALI_CHECK_GEAR, DALI_GO_TO_SCENE0, buildScene },
+  { DALI_CHECK_GEAR, DALI_RESET, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_STATUS, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_LAMP_FAILURE, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_LAMP_POWER_ON, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_ACTUAL_LEVEL, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_MAX_LEVEL, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_MIN_LEVEL, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_DEVICE_TYPE, nullptr },
+  { DALI_CHECK_SHORT, DALI_QUERY_SCENE_LEVEL, buildScene },
+  { DALI_CHECK_FORCED, 0, buildRgb },
+  { DALI_CHECK_FORCED, 0, buildRgbw },
+  { DALI_CHECK_FORCED, 0, buildColorTemp },
+  { DALI_CHECK_DEVICE, 0, buildDevice },
+  { DALI_CHECK_RAW, 0, nullptr },                                     // raw, sent by processCommandQueue()
+};
+
+// Device state cache, loop side. Filled from the replies to our own queries
+// (user commands, scan and poller, through the driver's reply monitor), from
+// query / reply pairs seen on the bus and from the level commands anyone
+// sends. Configuration commands only drop the fields they change: they take
+// effect when sent twice, and DTR0 may have been written before we listened.
+
+// Cache field a 16-bit query opcode answers, -1 if none
+int8_t daliStateField(uint8_t opcode) {
+  switch (opcode) {
+    case DALI_QUERY_STATUS: return DALI_STATE_STATUS;
+    case DALI_QUERY_DEVICE_TYPE: return DALI_STATE_DEVICE_TYPE;
+    case DALI_QUERY_ACTUAL_LEVEL: return DALI_STATE_ACTUAL_LEVEL;
+    case DALI_QUERY_MAX_LEVEL: return DALI_STATE_MAX_LEVEL;
+    case DALI_QUERY_MIN_LEVEL: return DALI_STATE_MIN_LEVEL;
+    case DALI_QUERY_POWER_ON_LEVEL: return DALI_STATE_POWER_ON_LEVEL;
+    case DALI_QUERY_SYSTEM_FAILURE_LEVEL: return DALI_STATE_SYSTEM_FAILURE_LEVEL;
+    case DALI_QUERY_FADE_TIME_FADE_RATE: return DALI_STATE_FADE;
+    case DALI_QUERY_GROUPS_0_7: return DALI_STATE_GROUPS_0_7;
+    case DALI_QUERY_GROUPS_8_15: return DALI_STATE_GROUPS_8_15;
+    case DALI_QUERY_PHYSICAL_MINIMUM_LEVEL: return DALI_STATE_PHYSICAL_MIN_LEVEL;
+    case DALI_QUERY_VERSION_NUMBER: return DALI_STATE_VERSION;
+    case DALI_QUERY_CONTENT_DTR0: return DALI_STATE_DTR0;
+    case DALI_QUERY_CONTENT_DTR1: return DALI_STATE_DTR1;
+    case DALI_QUERY_CONTENT_DTR2: return DALI_STATE_DTR2;
+  }
+  if (opcode >= DALI_QUERY_SCENE_LEVEL && opcode < DALI_QUERY_SCENE_LEVEL + 16) {
+    return DALI_STATE_SCENE0 + (opcode - DALI_QUERY_SCENE_LEVEL);
+  }
+  return -1;
+}
+
+static void setDeviceState(uint8_t address, uint8_t field, uint8_t value) {
+  deviceState[address].value[field] = value;
+  deviceState[address].verified[field] = millis() | 1;  // 0 is unknown
+}
+
+// Queries whose reply updateDeviceState() decodes: the cache fields and the
+// YES answers that are a bit of the status byte
+bool daliQueryDecoded(uint8_t opcode) {
+  return daliStateField(opcode) >= 0 || opcode == DALI_QUERY_LAMP_FAILURE || opcode == DALI_QUERY_LAMP_POWER_ON;
+}
+
+// Reply to a query to a short address
+void updateDeviceState(uint8_t address, uint8_t opcode, uint8_t reply) {
+  if (address >= DALI_MAX_ADDRESSES) return;
+  DaliDeviceState& st = deviceState[address];
+  int8_t field = daliStateField(opcode);
+  if (field >= 0) {
+    setDeviceState(address, field, reply);
+  } else if (opcode == DALI_QUERY_LAMP_FAILURE && reply == 0xFF) {
+    st.value[DALI_STATE_STATUS] |= 0x02;  // Only the bit, the rest of the status is as old as it was
+  } else if (opcode == DALI_QUERY_LAMP_POWER_ON && reply == 0xFF) {
+    st.value[DALI_STATE_STATUS] |= 0x04;
+  }
+}
+
+// 255 clears every address
+void clearDeviceState(uint8_t address) {
+  if (address == 0xFF) {
+    memset(deviceState, 0, sizeof(deviceState));
+  } else if (address < DALI_MAX_ADDRESSES) {
+    memset(&deviceState[address], 0, sizeof(DaliDeviceState));
+  }
+}
+
+// Value of a known field and its age
+bool getDeviceState(uint8_t address, uint8_t field, uint8_t* value, uint32_t* age_ms) {
+  if (address >= DALI_MAX_ADDRESSES || field >= DALI_STATE_FIELDS) return false;
+  const DaliDeviceState& st = deviceState[address];
+  if (!st.verified[field]) return false;
+  *value = st.value[field];
+  *age_ms = millis() - st.verified[field];
+  return true;
+}
+
+// What a command does to one device
+static void applyDeviceCommand(uint8_t address, bool dapc, uint8_t opcode) {
+  DaliDeviceState& st = deviceState[address];
+  uint8_t level = 0;
+  bool known = true;
+
+  if (dapc || opcode == DALI_OFF) {
+    level = dapc ? opcode : 0;
+    if (level == 255) return;  // MASK: no change
+    // The gear keeps a level between its min and max level
+    if (level > 0 && st.verified[DALI_STATE_MIN_LEVEL] && level < st.value[DALI_STATE_MIN_LEVEL]) {
+      level = st.value[DALI_STATE_MIN_LEVEL];
+    }
+    if (level > 0 && st.verified[DALI_STATE_MAX_LEVEL] && level > st.value[DALI_STATE_MAX_LEVEL]) {
+      level = st.value[DALI_STATE_MAX_LEVEL];
+    }
+  } else if (opcode == DALI_RECALL_MAX_LEVEL || opcode == DALI_RECALL_MIN_LEVEL) {
+    uint8_t field = (opcode == DALI_RECALL_MAX_LEVEL) ? DALI_STATE_MAX_LEVEL : DALI_STATE_MIN_LEVEL;
+    known = st.verified[field] != 0;
+    level = st.value[field];
+  } else if (opcode >= DALI_GO_TO_SCENE0 && opcode < DALI_GO_TO_SCENE0 + 16) {
+    uint8_t field = DALI_STATE_SCENE0 + (opcode - DALI_GO_TO_SCENE0);
+    if (st.verified[field] && st.value[field] == 255) return;  // Not in the scene
+    known = st.verified[field] != 0;
+    level = st.value[field];
+  } else if (opcode < 0x20) {
+    known = false;  // UP, DOWN, STEP: relative to a level we may not know
+  } else if (opcode == (DALI_RESET & 0xFF) || opcode == (DALI_SET_SHORT_ADDRESS & 0xFF)) {
+    memset(&st, 0, sizeof(st));
+    return;
+  } else if (opcode >= (DALI_SET_MAX_LEVEL & 0xFF) && opcode <= (DALI_SET_FADE_RATE & 0xFF)) {
+    static const uint8_t fields[] = { DALI_STATE_MAX_LEVEL, DALI_STATE_MIN_LEVEL, DALI_STATE_SYSTEM_FAILURE_LEVEL,
+                                      DALI_STATE_POWER_ON_LEVEL, DALI_STATE_FADE, DALI_STATE_FADE };
+    st.verified[fields[opcode - (DALI_SET_MAX_LEVEL & 0xFF)]] = 0;
+    return;
+  } else if (opcode >= (DALI_SET_SCENE0 & 0xFF) && opcode <= (DALI_REMOVE_FROM_SCENE15 & 0xFF)) {
+    st.verified[DALI_STATE_SCENE0 + (opcode & 0x0F)] = 0;
+    return;
+  } else if (opcode >= (DALI_ADD_TO_GROUP0 & 0xFF) && opcode <= (DALI_REMOVE_FROM_GROUP15 & 0xFF)) {
+    st.verified[(opcode & 0x08) ? DALI_STATE_GROUPS_8_15 : DALI_STATE_GROUPS_0_7] = 0;
+    return;
+  } else {
+    return;  // Queries and commands that change nothing we keep
+  }
+
+  if (known) {
+    setDeviceState(address, DALI_STATE_ACTUAL_LEVEL, level);
+  } else {
+    st.verified[DALI_STATE_ACTUAL_LEVEL] = 0;
+  }
+}
+
+// 16-bit forward frame seen on the bus or sent by us: YAAAAAAS, group
+// 100GGGGS or broadcast 1111111S, S = 0 for a direct arc power level, or a
+// DTR special command
+void trackDeviceCommand(uint8_t address_byte, uint8_t opcode) {
+  bool dapc = !(address_byte & 0x01);
+  if (address_byte < 0x80) {
+    applyDeviceCommand(address_byte >> 1, dapc, opcode);
+  } else if (address_byte >= 0xFE) {
+    for (uint8_t a = 0; a < DALI_MAX_ADDRESSES; a++) applyDeviceCommand(a, dapc, opcode);
+  } else if (address_byte < 0xA0) {
+    uint8_t group = (address_byte >> 1) & 0x0F;
+    uint8_t field = (group < 8) ? DALI_STATE_GROUPS_0_7 : DALI_STATE_GROUPS_8_15;
+    for (uint8_t a = 0; a < DALI_MAX_ADDRESSES; a++) {
+      DaliDeviceState& st = deviceState[a];
+      if (st.verified[field] && !(st.value[field] & (1 << (group & 7)))) continue;
+      if (!st.verified[field] && (dapc || opcode < 0x20)) {
+        st.verified[DALI_STATE_ACTUAL_LEVEL] = 0;  // May be a member, the level is not known any more
+      } else {
+        applyDeviceCommand(a, dapc, opcode);  // A member, or a configuration command that only drops fields
+      }
+    }
+  } else if (address_byte == (DALI_DATA_TRANSFER_REGISTER0 & 0xFF) || address_byte == (DALI_DATA_TRANSFER_REGISTER1 & 0xFF) ||
+           address_byte == (DALI_DATA_TRANSFER_REGISTER2 & 0xFF)) {
+    // Every control gear takes the value, kept for the addresses we know of
+    uint8_t field = (address_byte == (DALI_DATA_TRANSFER_REGISTER0 & 0xFF)) ? DALI_STATE_DTR0 :
+                    (address_byte == (DALI_DATA_TRANSFER_REGISTER1 & 0xFF)) ? DALI_STATE_DTR1 : DALI_STATE_DTR2;
+    for (uint8_t a = 0; a < DALI_MAX_ADDRESSES; a++) {
+      if (passiveDevices[a].last_seen > 0 || deviceState[a].verified[DALI_STATE_STATUS]) setDeviceState(a, field, opcode);
+    }
+  }
+  // Other special commands (0xA1..0xFD) address no single device
+}
+
+// Pairing of sniffed traffic, loop side. Another master's query is answered
+// by the backward frame that starts inside the reply window after its end;
+// a backward frame at any other time answers nothing we can tell. Only
+// frames that can be answered are remembered: 16-bit queries (opcode 0x90
+// and up) and the special commands COMPARE, VERIFY SHORT ADDRESS and QUERY
+// SHORT ADDRESS. Of the 24-bit frames only device and instance queries
+// (dali_cmd24_flags) are paired, and not decoded: event messages and 24-bit
+// commands get no reply.
+
+static bool isAnswerable(const uint8_t* data, uint8_t bits) {
+  if (bits == 24) {
+    uint8_t flags = dali_cmd24_flags(data[0], data[1], data[2]);
+    return flags != 0xFF && (flags & DALI_XFER_REPLY);
+  }
+  uint8_t address_byte = data[0];
+  uint8_t opcode = data[1];
+  if (address_byte >= 0xA0 && address_byte <= 0xFD) {
+    return address_byte == (DALI_COMPARE & 0xFF) || address_byte == (DALI_VERIFY_SHORT_ADDRESS & 0xFF) ||
+           address_byte == (DALI_QUERY_SHORT_ADDRESS & 0xFF);
+  }
+  return (address_byte & 0x01) && opcode >= DALI_QUERY_STATUS;
+}
+
+// Reply paired with the forward frame it answers
+static void handlePairedReply(const DaliPendingQuery& q, uint8_t reply) {
+  if (q.bits != 16) return;
+  if (q.address_byte == (DALI_QUERY_SHORT_ADDRESS & 0xFF)) {
+    if ((reply & 0x81) == 0x01) {
+      passiveDevices[reply >> 1].last_seen = millis();  // The selected gear, 0AAAAAA1
+      passiveDevices[reply >> 1].flags |= 0x01;
+    }
+    return;
+  }
+  if (q.address_byte >= 0x80) return;  // Group or broadcast: any number of devices answered
+
+  uint8_t address = q.address_byte >> 1;
+  updateDeviceState(address, q.opcode, reply);
+
+  PassiveDevice& dev = passiveDevices[address];
+  dev.last_seen = millis();
+  dev.flags |= 0x01;  // Bit 0 = responded to query
+  if (q.opcode == DALI_QUERY_ACTUAL_LEVEL) dev.last_level = reply;
+  if (q.opcode == DALI_QUERY_DEVICE_TYPE) dev.device_type = reply;
+  if (q.opcode == DALI_QUERY_STATUS) dev.flags = (dev.flags & ~0x02) | (reply & 0x02);
+  if (q.opcode == DALI_QUERY_LAMP_FAILURE) dev.flags |= 0x02;
+}
+
+// Every frame received from the bus, in order
+void pairBusFrame(const DaliEvent& ev) {
+  if (pendingQuery.open) {
+    pendingQuery.open = false;
+    int64_t gap = ev.start_us - pendingQuery.end_us;
+    if (ev.length == 1 && gap >= DALI_SNIFF_REPLY_MIN_US && gap <= DALI_SNIFF_REPLY_MAX_US) {
+      handlePairedReply(pendingQuery, ev.data[0]);
+      return;
+    }
+  }
+  if ((ev.length == 2 || ev.length == 3) && isAnswerable(ev.data, ev.length * 8)) {
+    pendingQuery.open = true;
+    pendingQuery.address_byte = ev.data[0];
+    pendingQuery.opcode = ev.data[1];
+    pendingQuery.bits = ev.length * 8;
+    pendingQuery.end_us = ev.end_us;
   }
 }
 
-// Called when we see a backward frame (response) - mark the last queried address as having a device
-void handleResponse(const DaliMessage& msg) {
-  if (lastQueriedAddress < DALI_MAX_ADDRESSES) {
-    passiveDevices[lastQueriedAddress].last_seen = millis();
-    passiveDevices[lastQueriedAddress].last_level = msg.parsed.level;
-    passiveDevices[lastQueriedAddress].flags |= 0x01;  // Bit 0 = responded to query
-    lastQueriedAddress = 255;  // Reset
+// Query command of the web UI / MQTT answered from the cache if the answer is
+// fresh enough. reply = -1 is a NO (no backward frame).
+bool answerQueryFromCache(const DaliCommand& cmd, int16_t* reply, uint32_t* age_ms) {
+  if (cmd.op >= DALI_OP_COUNT || daliCommandTable[cmd.op].check != DALI_CHECK_SHORT || cmd.address >= DALI_MAX_ADDRESSES) {
+    return false;
   }
+
+  // LAMP FAILURE and LAMP POWER ON are bits of the status
+  uint16_t opcode = daliCommandTable[cmd.op].command;
+  bool yes_no = (opcode == DALI_QUERY_LAMP_FAILURE || opcode == DALI_QUERY_LAMP_POWER_ON);
+  if (cmd.op == DALI_OP_QUERY_SCENE_LEVEL) opcode += cmd.scene;
+  int8_t field = yes_no ? DALI_STATE_STATUS : daliStateField(opcode);
+  uint8_t value;
+  if (field < 0 || !getDeviceState(cmd.address, field, &value, age_ms)) return false;
+  uint32_t limit = (field == DALI_STATE_ACTUAL_LEVEL || field == DALI_STATE_STATUS) ? DALI_STATE_LIVE_AGE_MS
+                                                                                    : DALI_STATE_CONFIG_AGE_MS;
+  if (*age_ms > limit) return false;
+
+  *reply = value;
+  if (opcode == DALI_QUERY_LAMP_FAILURE) *reply = (value & 0x02) ? 0xFF : -1;
+  if (opcode == DALI_QUERY_LAMP_POWER_ON) *reply = (value & 0x04) ? 0xFF : -1;
+  return true;
 }
 
 String getAddressPrefix(String address_type, uint8_t address) {
@@ -122,6 +744,8 @@ String getAddressPrefix(String address_type, uint8_t address) {
 DaliMessage parseDaliMessage(uint8_t* bytes, uint8_t length, bool is_tx) {
   DaliMessage msg;
   msg.timestamp = millis();
+  msg.start_us = 0;
+  msg.end_us = 0;
   msg.is_tx = is_tx;
   msg.source = "bus";
   msg.length = length;
@@ -159,19 +783,48 @@ DaliMessage parseDaliMessage(uint8_t* bytes, uint8_t length, bool is_tx) {
     } else if (addr_byte == 0xFD) {
       msg.parsed.address_type = "broadcast_unaddressed";
       msg.parsed.address = 0xFD;
-    } else if ((addr_byte & 0x01) == 0x01) {
+    } else if (addr_byte == DALI24_SPECIAL) {
+      msg.parsed.address_type = "special";
+      msg.parsed.address = DALI24_SPECIAL;
+    } else if ((addr_byte & 0x81) == 0x01) {
       // Short address: 0AAAAAA1
       msg.parsed.address_type = "device_short";
       msg.parsed.address = (addr_byte >> 1) & 0x3F;
-    } else if ((addr_byte & 0x81) == 0x80) {
-      // Group address: 100GGGG0
+    } else if ((addr_byte & 0xC1) == 0x81) {
+      // Group address: 10GGGGG1
       msg.parsed.address_type = "device_group";
-      msg.parsed.address = (addr_byte >> 1) & 0x0F;
+      msg.parsed.address = (addr_byte >> 1) & 0x1F;
     } else {
       msg.parsed.address_type = "unknown";
       msg.parsed.address = addr_byte;
     }
     
+    // Special commands: the instance byte is the command, the opcode byte its data
+    if (addr_byte == DALI24_SPECIAL) {
+      String special_str;
+      switch (inst_byte) {
+        case DALI24_TERMINATE: special_str = "Terminate"; break;
+        case DALI24_INITIALISE: special_str = "Initialise"; break;
+        case DALI24_RANDOMISE: special_str = "Randomise"; break;
+        case DALI24_COMPARE: special_str = "Compare"; break;
+        case DALI24_WITHDRAW: special_str = "Withdraw"; break;
+        case DALI24_SEARCHADDRH: special_str = "SearchAddrH"; break;
+        case DALI24_SEARCHADDRM: special_str = "SearchAddrM"; break;
+        case DALI24_SEARCHADDRL: special_str = "SearchAddrL"; break;
+        case DALI24_PROGRAM_SHORT_ADDRESS: special_str = "ProgramShortAddress"; break;
+        case DALI24_VERIFY_SHORT_ADDRESS: special_str = "VerifyShortAddress"; break;
+        case DALI24_QUERY_SHORT_ADDRESS: special_str = "QueryShortAddress"; break;
+        case DALI24_WRITE_MEMORY_LOCATION: special_str = "WriteMemoryLocation"; break;
+        case DALI24_WRITE_MEMORY_LOCATION_NO_REPLY: special_str = "WriteMemoryLocationNoReply"; break;
+        case DALI24_DTR0: special_str = "DTR0"; break;
+        case DALI24_DTR1: special_str = "DTR1"; break;
+        case DALI24_DTR2: special_str = "DTR2"; break;
+        default: special_str = "Special_0x" + String(inst_byte, HEX); break;
+      }
+      msg.description = "DALI-2 " + special_str + " (" + String(opcode) + ")";
+      return msg;
+    }
+
     // Decode instance byte (0xFE = device command, not instance-specific)
     String inst_str;
     if (inst_byte == 0xFE) {
@@ -182,7 +835,7 @@ DaliMessage parseDaliMessage(uint8_t* bytes, uint8_t length, bool is_tx) {
       inst_str = "instance_" + String(inst_byte & 0x1F);
     } else if ((inst_byte & 0xE0) == 0x80) {
       inst_str = "instance_group_" + String(inst_byte & 0x1F);
-    } else if ((inst_byte & 0xE0) == 0x60) {
+    } else if ((inst_byte & 0xE0) == 0xC0) {
       inst_str = "instance_type_" + String(inst_byte & 0x1F);
     } else {
       inst_str = "inst_0x" + String(inst_byte, HEX);
@@ -229,8 +882,19 @@ DaliMessage parseDaliMessage(uint8_t* bytes, uint8_t length, bool is_tx) {
     return msg;
   }
 
+  if (length == 4) {
+    // 25-bit (or longer) forward frame, e.g. a raw frame sent through the queue
+    msg.parsed.type = "extended_frame";
+    msg.description = "Extended frame: 0x";
+    for (uint8_t i = 0; i < 4; i++) {
+      if (bytes[i] < 0x10) msg.description += "0";
+      msg.description += String(bytes[i], HEX);
+    }
+    return msg;
+  }
+
   if (length != 2) {
-    msg.description = "Invalid frame (" + String(length) + " bytes) - Expected 1, 2, or 3-byte frame";
+    msg.description = "Invalid frame (" + String(length) + " bytes) - Expected 1 to 4-byte frame";
     return msg;
   }
 
@@ -535,109 +1199,156 @@ DaliMessage parseDaliMessage(uint8_t* bytes, uint8_t length, bool is_tx) {
 }
 
 bool validateDaliCommand(const DaliCommand& cmd) {
-  if (cmd.command_type == "set_brightness") {
-    if (cmd.address > 63 && cmd.address != 0xFF) return false;
-    if (cmd.level > 254) return false;
-    return true;
-  } else if (cmd.command_type == "off" || cmd.command_type == "max" ||
-             cmd.command_type == "up" || cmd.command_type == "down" ||
-             cmd.command_type == "step_up" || cmd.command_type == "step_down" ||
-             cmd.command_type == "recall_max" || cmd.command_type == "recall_min" ||
-             cmd.command_type == "reset") {
-    if (cmd.address > 63 && cmd.address != 0xFF) return false;
-    return true;
-  } else if (cmd.command_type == "go_to_scene") {
-    if (cmd.address > 63 && cmd.address != 0xFF) return false;
-    if (cmd.scene > 15) return false;
-    return true;
-  } else if (cmd.command_type == "query_status" ||
-             cmd.command_type == "query_lamp_failure" ||
-             cmd.command_type == "query_lamp_power_on" ||
-             cmd.command_type == "query_actual_level" ||
-             cmd.command_type == "query_max_level" ||
-             cmd.command_type == "query_min_level" ||
-             cmd.command_type == "query_device_type" ||
-             cmd.command_type == "query_scene_level") {
-    if (cmd.address > 63) return false;
-    if (cmd.command_type == "query_scene_level" && cmd.scene > 15) return false;
-    return true;
-  } else if (cmd.command_type == "raw") {
-    return true;
+  if (cmd.op >= DALI_OP_COUNT) return false;
+  switch (daliCommandTable[cmd.op].check) {
+    case DALI_CHECK_GEAR:
+      if (cmd.address > 63 && cmd.address != 0xFF) return false;
+      break;
+    case DALI_CHECK_SHORT:
+      if (cmd.address > 63) return false;
+      break;
+    case DALI_CHECK_DEVICE:
+      return deviceAddressByte(cmd.address_type, cmd.address) != 0;
+    case DALI_CHECK_RAW:
+      if (cmd.raw.bits != 16 && cmd.raw.bits != 24 && cmd.raw.bits != 25) return false;
+      return (cmd.raw.frame >> cmd.raw.bits) == 0;
+    default:
+      return false;
+  }
+  if (cmd.op == DALI_OP_SET_BRIGHTNESS) return cmd.level <= 254;
+  if (cmd.op == DALI_OP_GO_TO_SCENE || cmd.op == DALI_OP_QUERY_SCENE_LEVEL) return cmd.scene <= 15;
+  return true;
+}
+
+// Address byte of a 24-bit device command, 0 if the address does not fit its type
+uint8_t deviceAddressByte(uint8_t address_type, uint8_t address) {
+  switch (address_type) {
+    case DALI_ADDRESS_SHORT: return address <= 63 ? DALI24_SHORT(address) : 0;
+    case DALI_ADDRESS_GROUP: return address <= 31 ? DALI24_GROUP(address) : 0;
+    case DALI_ADDRESS_BROADCAST: return DALI24_BROADCAST;
+    case DALI_ADDRESS_UNADDRESSED: return DALI24_BROADCAST_UNADDRESSED;
+    case DALI_ADDRESS_SPECIAL: return DALI24_SPECIAL;
   }
+  return 0;
+}
 
-  return false;
+// Instance byte of a 24-bit device command. Special commands carry the
+// command number in the instance byte, it is passed through unchanged.
+uint8_t deviceInstanceByte(uint8_t address_type, const String& instance_type, uint8_t instance) {
+  if (address_type == DALI_ADDRESS_SPECIAL) return instance;
+  if (instance_type == "number") return DALI24_INSTANCE(instance);
+  if (instance_type == "group") return DALI24_INSTANCE_GROUP(instance);
+  if (instance_type == "type") return DALI24_INSTANCE_TYPE(instance);
+  if (instance_type == "all") return DALI24_INSTANCE_BROADCAST;
+  return DALI24_DEVICE;
 }
 
-bool enqueueDaliCommand(const DaliCommand& cmd) {
-  uint8_t nextTail = (queueTail + 1) % COMMAND_QUEUE_SIZE;
-  if (nextTail == queueHead) {
+// Raw frame from a hex string, bits = 0 takes the length from the number of digits
+void setRawFrame(DaliCommand& cmd, const String& hex, uint8_t bits) {
+  cmd.raw.frame = strtoul(hex.c_str(), nullptr, 16);
+  if (bits == 0) {
+    bits = (hex.length() <= 4) ? 16 : (hex.length() <= 6) ? 24 : 25;
+  }
+  cmd.raw.bits = bits;
+}
+
+static bool refuseDaliCommand(uint8_t p) {
 #ifdef DEBUG_SERIAL
-    Serial.println("Command queue full!");
+  Serial.printf("Command queue full (priority %d)!\n", p);
 #endif
-    incrementErrorCount();
-    return false;
-  }
+  commandQueueStats[p].refused++;
+  incrementErrorCount();
+  return false;
+}
 
-  commandQueue[queueTail] = cmd;
-  queueTail = nextTail;
+// Any task: the command is picked up by the DALI task. Each priority has its
+// own queue and is refused once it holds its limit, so a burst of low priority
+// work cannot fill the room an urgent command needs. The entry is reserved on
+// the counter of its priority before it is pushed, so producers racing each
+// other cannot go over the limit; the DALI task gives it back after the pop.
+bool enqueueDaliCommand(const DaliCommand& cmd) {
+  uint8_t p = (cmd.priority < DALI_COMMAND_PRIORITIES) ? cmd.priority : DALI_COMMAND_PRIORITY_LOW;
+  uint8_t limit = daliCommandQueueLimit(p);
+  uint8_t n = commandQueueCount[p].load();
+  do {
+    if (n >= limit) return refuseDaliCommand(p);
+  } while (!commandQueueCount[p].compare_exchange_weak(n, n + 1));
+  if (!commandQueue[p].push(cmd)) {
+    commandQueueCount[p].fetch_sub(1);
+    return refuseDaliCommand(p);
+  }
+  commandQueueStats[p].queued++;
   
 #ifdef DEBUG_SERIAL
   Serial.printf("[Queue] Enqueued %s cmd to addr %d (priority=%d, queue size=%d)\n",
-                cmd.command_type.c_str(), cmd.address, cmd.priority,
-                (queueTail >= queueHead) ? (queueTail - queueHead) : (COMMAND_QUEUE_SIZE - queueHead + queueTail));
+                daliCommandName(cmd.op), cmd.address, p, commandQueue[p].size());
 #endif
   
   return true;
 }
 
+// Drain the driver's receive queue, called by the DALI task. Frames are queued
+// by the timer ISR and handed on to the loop as events, parsing and publishing
+// them is left to the loop.
 void monitorDaliBus() {
+  dali.service();  // Completion callbacks of finished transactions
+
   uint8_t rx_data[4];  // Buffer for up to 32 bits (4 bytes)
-  uint8_t result = dali.rx(rx_data);
+  int64_t start_us, end_us;  // Latched by the timer ISR, not when the task gets to the frame
+  for (uint8_t i = 0; i < DALI_RX_QUEUE_SIZE; i++) {
+    uint8_t result = dali.rx(rx_data, &start_us, &end_us);
+    if (result < 2) break;  // Queue empty (or frame still being received)
+    if (result > 2) {
+      updateBusActivity();
+      incrementRxCount();
+      pushFrameEvent(rx_data, (result + 7) / 8, false, start_us, end_us);
+    }
+  }
+}
 
-  if (result > 2) {
-    uint8_t num_bytes = (result + 7) / 8;
-    
-    updateBusActivity();
+// Frame event in the loop: our own frames only go to the monitor, bus frames
+// also to the recent messages and the passive device tracking
+void handleBusFrame(const DaliEvent& ev) {
+  DaliMessage msg = parseDaliMessage((uint8_t*)ev.data, ev.length, ev.is_tx);
+  if (ev.length == 2) trackDeviceCommand(ev.data[0], ev.data[1]);
+  if (ev.is_tx) {
+    msg.source = "self";
+    publishMonitor(msg);
+    return;
+  }
 
+  uint8_t num_bytes = ev.length;
+  const uint8_t* rx_data = ev.data;
 #ifdef DEBUG_SERIAL
-    Serial.printf("[DALI] Bus activity detected: %d bits, bytes: 0x%02X", result, rx_data[0]);
-    if (num_bytes > 1) Serial.printf(" 0x%02X", rx_data[1]);
-    if (num_bytes > 2) Serial.printf(" 0x%02X", rx_data[2]);
-    Serial.println();
+  Serial.printf("[DALI] Bus activity detected: %d bytes: 0x%02X", num_bytes, rx_data[0]);
+  if (num_bytes > 1) Serial.printf(" 0x%02X", rx_data[1]);
+  if (num_bytes > 2) Serial.printf(" 0x%02X", rx_data[2]);
+  Serial.println();
 #endif
 
-    incrementRxCount();
-    DaliMessage msg = parseDaliMessage(rx_data, num_bytes, false);
-    msg.source = "bus";
-    
-    // Capture raw bit samples from DALI library for debugging
-    // rxdata contains 8 samples per byte (8x oversampling), MSB is oldest
-    // We'll convert the decoded bytes to a bit string for easier analysis
-    String raw_bits = "";
-    for (int i = 0; i < num_bytes; i++) {
-      for (int b = 7; b >= 0; b--) {
-        raw_bits += ((rx_data[i] >> b) & 1) ? "1" : "0";
-      }
-      if (i < num_bytes - 1) raw_bits += " ";
-    }
-    msg.raw_bits = raw_bits;
-
-    recentMessages[recentMessagesIndex] = msg;
-    recentMessagesIndex = (recentMessagesIndex + 1) % RECENT_MESSAGES_SIZE;
-
-    // Passive device tracking:
-    // - Track query commands to remember which address was queried
-    // - When a response comes, mark that address as having a real device
-    if (msg.parsed.type == "response") {
-      // Backward frame - a device responded!
-      handleResponse(msg);
-    } else if (msg.parsed.address_type == "short" && msg.parsed.address < DALI_MAX_ADDRESSES) {
-      // Forward frame to a specific address - track it for response matching
-      trackQueryAddress(msg.parsed.address);
+  msg.source = "bus";
+  msg.start_us = ev.start_us;
+  msg.end_us = ev.end_us;
+  
+  // Capture raw bit samples from DALI library for debugging
+  // rxdata contains 8 samples per byte (8x oversampling), MSB is oldest
+  // We'll convert the decoded bytes to a bit string for easier analysis
+  String raw_bits = "";
+  for (int i = 0; i < num_bytes; i++) {
+    for (int b = 7; b >= 0; b--) {
+      raw_bits += ((rx_data[i] >> b) & 1) ? "1" : "0";
     }
-
-    publishMonitor(msg);
+    if (i < num_bytes - 1) raw_bits += " ";
   }
+  msg.raw_bits = raw_bits;
+
+  recentMessages[recentMessagesIndex] = msg;
+  recentMessagesIndex = (recentMessagesIndex + 1) % RECENT_MESSAGES_SIZE;
+
+  // Passive device tracking and the state cache: queries and their replies
+  pairBusFrame(ev);
+
+  publishMonitor(msg);
 }
 
 void updateBusActivity() {
@@ -656,290 +1367,115 @@ bool isBusIdle() {
   return busIsIdle;
 }
 
-void processCommandQueue() {
-  if (queueHead == queueTail) return;
-  
-  if (!isBusIdle()) {
-#ifdef DEBUG_SERIAL
-    static unsigned long lastIdleWarnTime = 0;
-    if (millis() - lastIdleWarnTime > 1000) {
-      Serial.printf("[Queue] Waiting for bus idle (last activity: %lums ago)...\n", 
-                    millis() - lastBusActivityTime);
-      lastIdleWarnTime = millis();
-    }
-#endif
-    return;
+// Completion of the last frame of a queued command, called from dali.service()
+void onDaliCommandDone(int16_t handle, int16_t result, void* ctx) {
+  if (result >= 0) {
+    incrementRxCount();  // Reply received
   }
-  
-  if (!canSendDaliCommand()) {
-    return;
+  updateBusActivity();
+}
+
+// The queue the next command comes from, -1 if all are empty. The highest
+// priority goes first, but a command competes one priority higher for every
+// COMMAND_QUEUE_AGE_MS it has waited, and between equals the one that waited
+// longest goes: a low priority command is not held up for more than twice
+// COMMAND_QUEUE_AGE_MS by any stream of newer commands. *aged is set if it
+// goes ahead of a higher priority this way.
+static int8_t nextCommandPriority(bool* aged) {
+  uint32_t now = millis();
+  int8_t best = -1;
+  int8_t first = -1;
+  uint8_t bestRank = 0;
+  int32_t bestWait = 0;
+  for (uint8_t p = 0; p < DALI_COMMAND_PRIORITIES; p++) {
+    const DaliCommand* cmd = commandQueue[p].peek();
+    if (!cmd) continue;
+    if (first < 0) first = p;
+    int32_t wait = (int32_t)(now - cmd->queued_at);
+    if (wait < 0) wait = 0;  // Stamped after now on the other core
+    uint32_t steps = wait / COMMAND_QUEUE_AGE_MS;
+    uint8_t rank = (steps >= p) ? 0 : p - steps;
+    if (best < 0 || rank < bestRank || (rank == bestRank && wait > bestWait)) {
+      best = p;
+      bestRank = rank;
+      bestWait = wait;
+    }
   }
+  *aged = (best != first);
+  return best;
+}
+
+// Commands are handed to the driver's transaction engine and sent by the timer
+// ISR. The engine sends its transactions in the order they were submitted, so
+// the next command is only taken once the engine is empty: a command handed
+// over early could not be overtaken by an urgent one queued after it. The task
+// gets there within a period, well inside the settling time before the next
+// frame may start (2.4 ms after a backward frame, 13.5 ms after a forward one),
+// so the bus does not idle any longer for it.
+void processCommandQueue() {
+  if (dali.xfer_pending()) return;
+
+  bool aged;
+  int8_t p = nextCommandPriority(&aged);
+  DaliCommand cmd;
+  if (p < 0 || !commandQueue[p].pop(cmd)) return;
+  commandQueueCount[p].fetch_sub(1);
 
-  DaliCommand cmd = commandQueue[queueHead];
-  queueHead = (queueHead + 1) % COMMAND_QUEUE_SIZE;
+  DaliQueueStats& st = commandQueueStats[p];
+  int32_t wait = (int32_t)(millis() - cmd.queued_at);
+  if (wait < 0) wait = 0;
+  st.sent++;
+  st.wait_total_ms += wait;
+  if ((uint32_t)wait > st.wait_max_ms) st.wait_max_ms = wait;
+  if (aged) st.aged++;
 
 #ifdef DEBUG_SERIAL
   Serial.printf("[DALI] Processing command: %s to address %d (waited %lums in queue)\n", 
-                cmd.command_type.c_str(), cmd.address, millis() - cmd.queued_at);
+                daliCommandName(cmd.op), cmd.address, millis() - cmd.queued_at);
 #endif
 
-  uint8_t data_byte = cmd.level;
-  uint8_t sent_bytes[2];
-  
   updateBusActivity();
-  lastDaliCommandTime = millis();
 
-  if (cmd.command_type == "set_brightness") {
-    // DAPC: address byte has bit 0 = 0
-    sent_bytes[0] = (cmd.address << 1);
-    sent_bytes[1] = data_byte;
-    dali.set_level(data_byte, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "off") {
-    // Command: address byte has bit 0 = 1
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_OFF;
-    dali.cmd(DALI_OFF, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "max") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_RECALL_MAX_LEVEL;
-    dali.cmd(DALI_RECALL_MAX_LEVEL, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "up") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_UP;
-    dali.cmd(DALI_UP, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "down") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_DOWN;
-    dali.cmd(DALI_DOWN, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "step_up") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_STEP_UP;
-    dali.cmd(DALI_STEP_UP, cmd.address);
+  if (cmd.op == DALI_OP_RAW) {
+    DaliFrame frame = { cmd.raw.frame, cmd.raw.bits };
+    uint8_t flags = DALI_XFER_PRIORITY(DALI_PRIORITY_USER);
+    if (cmd.raw.flags & DALI_COMMAND_REPLY) flags |= DALI_XFER_REPLY;
+    if (cmd.raw.flags & DALI_COMMAND_TWICE) flags |= DALI_XFER_TWICE;
+    daliCommandHandle = dali.frame_async(frame, flags, onDaliCommandDone);
     incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "step_down") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_STEP_DOWN;
-    dali.cmd(DALI_STEP_DOWN, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "recall_max") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_RECALL_MAX_LEVEL;
-    dali.cmd(DALI_RECALL_MAX_LEVEL, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "recall_min") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_RECALL_MIN_LEVEL;
-    dali.cmd(DALI_RECALL_MIN_LEVEL, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "go_to_scene") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_GO_TO_SCENE + cmd.scene;
-    dali.cmd(DALI_GO_TO_SCENE + cmd.scene, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "reset") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_RESET;
-    dali.cmd(DALI_RESET, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "query_status") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_STATUS;
-    int16_t result = dali.cmd(DALI_QUERY_STATUS, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
-    }
-  } else if (cmd.command_type == "query_lamp_failure") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_LAMP_FAILURE;
-    int16_t result = dali.cmd(DALI_QUERY_LAMP_FAILURE, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
-    }
-  } else if (cmd.command_type == "query_lamp_power_on") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_LAMP_POWER_ON;
-    int16_t result = dali.cmd(DALI_QUERY_LAMP_POWER_ON, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
+    // Monitor bytes as rx() delivers them: whole bytes first, a partial last byte right aligned
+    uint8_t frame_bytes[4];
+    uint8_t num_bytes = (cmd.raw.bits + 7) / 8;
+    for (uint8_t i = 0; i < num_bytes; i++) {
+      int8_t shift = cmd.raw.bits - 8 * (i + 1);
+      frame_bytes[i] = (shift >= 0) ? (cmd.raw.frame >> shift) & 0xFF : cmd.raw.frame & ((1 << (8 + shift)) - 1);
     }
-  } else if (cmd.command_type == "query_actual_level") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_ACTUAL_LEVEL;
-    int16_t result = dali.cmd(DALI_QUERY_ACTUAL_LEVEL, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
-    }
-  } else if (cmd.command_type == "query_max_level") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_MAX_LEVEL;
-    int16_t result = dali.cmd(DALI_QUERY_MAX_LEVEL, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
-    }
-  } else if (cmd.command_type == "query_min_level") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_MIN_LEVEL;
-    int16_t result = dali.cmd(DALI_QUERY_MIN_LEVEL, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
-    }
-  } else if (cmd.command_type == "query_device_type") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_DEVICE_TYPE;
-    int16_t result = dali.cmd(DALI_QUERY_DEVICE_TYPE, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
-    }
-  } else if (cmd.command_type == "query_scene_level") {
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_QUERY_SCENE_LEVEL + cmd.scene;
-    int16_t result = dali.cmd(DALI_QUERY_SCENE_LEVEL + cmd.scene, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-    if (result >= 0) {
-      incrementRxCount();
-    }
-  } else if (cmd.command_type == "set_rgb") {
-    // DT8: Set RGB color (requires DTR0=R, DTR1=G, DTR2=B)
-    dali.cmd(DALI_SET_DTR0 | 0x100, cmd.color_r);  // Special command
-    delay(5);
-    dali.cmd(DALI_SET_DTR1 | 0x100, cmd.color_g);
-    delay(5);
-    dali.cmd(DALI_SET_DTR2 | 0x100, cmd.color_b);
-    delay(5);
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_DT8_SET_TEMPORARY_RGB_DIMLEVEL;
-    dali.cmd(DALI_DT8_SET_TEMPORARY_RGB_DIMLEVEL, cmd.address);
-    delay(5);
-    dali.cmd(DALI_DT8_ACTIVATE, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "set_rgbw") {
-    // DT8: Set RGBW color (R, G, B in RGB command, then W separately)
-    dali.cmd(DALI_SET_DTR0 | 0x100, cmd.color_r);
-    delay(5);
-    dali.cmd(DALI_SET_DTR1 | 0x100, cmd.color_g);
-    delay(5);
-    dali.cmd(DALI_SET_DTR2 | 0x100, cmd.color_b);
-    delay(5);
-    dali.cmd(DALI_DT8_SET_TEMPORARY_RGB_DIMLEVEL, cmd.address);
-    delay(5);
-    dali.cmd(DALI_SET_DTR0 | 0x100, cmd.color_w);
-    delay(5);
-    dali.cmd(DALI_DT8_SET_TEMPORARY_WAF_DIMLEVEL, cmd.address);
-    delay(5);
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_DT8_ACTIVATE;
-    dali.cmd(DALI_DT8_ACTIVATE, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
-  } else if (cmd.command_type == "set_color_temp") {
-    // DT8: Set color temperature (requires DTR0=LSB, DTR1=MSB of mirek value)
-    uint16_t mirek = 1000000 / cmd.color_temp_kelvin;  // Convert Kelvin to mirek
-    dali.cmd(DALI_SET_DTR0 | 0x100, mirek & 0xFF);
-    delay(5);
-    dali.cmd(DALI_SET_DTR1 | 0x100, (mirek >> 8) & 0xFF);
-    delay(5);
-    sent_bytes[0] = (cmd.address << 1) | 1;
-    sent_bytes[1] = DALI_DT8_SET_TEMPORARY_COLOUR_TEMPERATURE;
-    dali.cmd(DALI_DT8_SET_TEMPORARY_COLOUR_TEMPERATURE, cmd.address);
-    delay(5);
-    dali.cmd(DALI_DT8_ACTIVATE, cmd.address);
-    incrementTxCount();
-    DaliMessage msg = parseDaliMessage(sent_bytes, 2, true);
-    msg.source = "self";
-    publishMonitor(msg);
+    pushFrameEvent(frame_bytes, num_bytes, true, 0, 0);
+    return;
   }
-
-  updateBusActivity();
-}
-
-bool canSendDaliCommand() {
-  return (millis() - lastDaliCommandTime) >= DALI_MIN_INTERVAL_MS;
+  if (cmd.op == DALI_OP_INVALID || cmd.op >= DALI_OP_COUNT) return;
+
+  // The address was checked by validateDaliCommand() when the command was queued,
+  // every frame of the command is built from it without checking it again. The
+  // last frame is sent with the completion callback and echoed to the monitor
+  // byte for byte as it was queued.
+  const DaliCommandInfo& info = daliCommandTable[cmd.op];
+  DaliAddr adr = dali_addr(cmd.address);
+  DaliCmdFrame frame = info.build ? info.build(cmd, adr, info.command) : dali_cmd_frame(info.command, adr);
+  if (!frame.bitlen) return;
+
+  daliCommandHandle = dali.send(frame, onDaliCommandDone);
+  incrementTxCount();
+  pushFrameEvent(frame.data, frame.nbytes(), true, 0, 0);
 }
 
 void sendDaliCommand(uint8_t address, uint8_t level) {
-  DaliCommand cmd;
-  cmd.command_type = "set_brightness";
+  DaliCommand cmd = {};
+  cmd.op = DALI_OP_SET_BRIGHTNESS;
   cmd.address = address;
-  cmd.address_type = (address == 0xFF) ? "broadcast" : "short";
   cmd.level = level;
-  cmd.force = false;
   cmd.queued_at = millis();
-  cmd.priority = 1;
-  cmd.retry_count = 0;
+  cmd.priority = DALI_COMMAND_PRIORITY_NORMAL;
 
   enqueueDaliCommand(cmd);
 }
@@ -949,436 +1485,455 @@ void addRecentMessage(const DaliMessage& msg) {
   recentMessagesIndex = (recentMessagesIndex + 1) % RECENT_MESSAGES_SIZE;
 }
 
-DaliScanResult scanDaliDevices() {
-  DaliScanResult result;
-  result.scan_timestamp = millis() / 1000;
-  result.total_found = 0;
+// Background scan: one query at a time, the next one is queued from the loop
+// when the previous one has finished
+//
+// IEC 62386-102 has no query for a range of short addresses (groups are the
+// user's configuration, and the random address search costs about 60 frames
+// per device), so the scan first asks the whole bus with a broadcast and
+// stops there if nobody answers. Otherwise every short address gets one
+// QUERY STATUS. The driver retries frames lost to a collision itself, so no
+// reply is an answer and an empty address costs a single query; only the
+// addresses found by the last scan are asked a second time. Any activity in
+// the reply window counts: a garbled reply is several control gear sharing
+// the address, or noise if MIN and MAX LEVEL then get no reply at all. Lamp
+// failure is bit 1 of the status.
+
+void onScanReply(int16_t handle, int16_t result, void* ctx) {
+  scanProgress.reply = result;
+  scanProgress.reply_ready = true;
+  scanProgress.handle = -1;
+}
 
+static void finishDaliScan() {
+  scanProgress.running = false;
+  scanProgress.known = scanProgress.found_mask;
+  if (scanProgress.address >= 64) {
+    pollKnown &= scanProgress.found_mask;  // A full sweep: drop what is gone
+  } else {
+    pollKnown = 0;  // Nobody answered the broadcast
+  }
+  for (uint8_t a = 0; a < DALI_MAX_ADDRESSES; a++) {
+    if (scanProgress.found_mask & (1ULL << a)) addPolledDevice(a);
+  }
 #ifdef DEBUG_SERIAL
-  Serial.println("Scanning DALI bus for devices...");
-  Serial.println("Using bus arbitration - waiting for idle periods between queries");
+  Serial.printf("Scan complete: %d devices found\n", scanProgress.found);
 #endif
+  DaliEvent ev = {};
+  ev.type = DALI_EVENT_SCAN_DONE;
+  ev.flag = scanProgress.publish;
+  pushDaliEvent(ev);
+}
 
-  for (uint8_t addr = 0; addr < 64; addr++) {
-    esp_task_wdt_reset();
-    
-    // Retry up to 3 times per address to handle bus collisions
-    int16_t rv = -1;
-    for (uint8_t retry = 0; retry < 3 && rv < 0; retry++) {
-      // Wait for longer idle period on busy bus (200ms instead of 100ms)
-      unsigned long waitStart = millis();
-      while (!isBusIdle() && (millis() - waitStart < 5000)) {
-        delay(10);
+void nextScanAddress() {
+  scanProgress.step = SCAN_QUERY_STATUS;
+  scanProgress.retry = 0;
+  scanProgress.garbled = false;
+  scanProgress.address++;
+  if (scanProgress.address < 64) return;
+  finishDaliScan();
+}
+
+static bool scanAnswered(int16_t rv) {
+  return rv >= 0 || rv == -DALI_RESULT_COLLISION || rv == -DALI_RESULT_INVALID_REPLY;
+}
+
+void handleScanReply() {
+  int16_t rv = scanProgress.reply;
+  DaliDevice& device = scanProgress.device;
+
+  switch (scanProgress.step) {
+    case SCAN_QUERY_PRESENT:
+      if (scanAnswered(rv)) {
+        scanProgress.step = SCAN_QUERY_STATUS;
+        scanProgress.address = 0;
+        scanProgress.retry = 0;
+        scanProgress.garbled = false;
+      } else if (++scanProgress.retry >= 2) {
+        finishDaliScan();  // Nobody on the bus
       }
-      
-      if (!isBusIdle()) {
+      break;
+    case SCAN_QUERY_STATUS:
+      if (scanAnswered(rv)) {
+        device.address = scanProgress.address;
+        device.type = "short";
+        device.status = "ok";
+        device.lamp_failure = rv >= 0 && (rv & 0x02);
+        device.min_level = 0;
+        device.max_level = 254;
+        scanProgress.garbled = rv < 0;  // Needs activity on MIN or MAX LEVEL
+        scanProgress.step = SCAN_QUERY_MIN_LEVEL;
+      } else if (rv == -DALI_RESULT_NO_REPLY && (scanProgress.known & (1ULL << scanProgress.address))
+                 && scanProgress.retry == 0) {
+        scanProgress.retry++;  // Found by the last scan, ask once more
+      } else if (rv != -DALI_RESULT_NO_REPLY && ++scanProgress.retry < 3) {
+        // The query did not make it onto the bus, try again
 #ifdef DEBUG_SERIAL
-        if (retry == 2) {
-          Serial.printf("Scan timeout waiting for bus idle at address %d after %d retries\n", addr, retry + 1);
-        }
+        Serial.printf("Address %d query failed (attempt %d/3), retrying...\n", scanProgress.address, scanProgress.retry);
 #endif
-        continue;
-      }
-      
-      // Wait extra time to ensure bus is really idle (avoid collision with Zennio)
-      delay(50);
-      
-      // Check idle again after delay
-      if (!isBusIdle()) {
-        continue;
-      }
-      
-      updateBusActivity();
-      rv = dali.cmd(DALI_QUERY_STATUS, addr);
-      
-#ifdef DEBUG_SERIAL
-      if (rv < 0 && retry < 2) {
-        Serial.printf("Address %d query failed (attempt %d/3), retrying...\n", addr, retry + 1);
-      }
-#endif
-    }
-
-    if (rv >= 0) {
-      DaliDevice device;
-      device.address = addr;
-      device.type = "short";
-      device.status = "ok";
-      device.lamp_failure = false;
-      device.min_level = 0;
-      device.max_level = 254;
-
-      esp_task_wdt_reset();
-
-      delay(DALI_MIN_INTERVAL_MS);
-      unsigned long queryWaitStart = millis();
-      while (!isBusIdle() && (millis() - queryWaitStart < 5000)) {
-        delay(10);
-      }
-      updateBusActivity();
-      int16_t lamp_failure_rv = dali.cmd(DALI_QUERY_LAMP_FAILURE, addr);
-      if (lamp_failure_rv > 0) {
-        device.lamp_failure = true;
+      } else {
+        nextScanAddress();
       }
-
-      delay(DALI_MIN_INTERVAL_MS);
-      queryWaitStart = millis();
-      while (!isBusIdle() && (millis() - queryWaitStart < 5000)) {
-        delay(10);
+      break;
+    case SCAN_QUERY_MIN_LEVEL:
+      if (rv >= 0) {
+        device.min_level = (uint8_t)rv;
       }
-      updateBusActivity();
-      int16_t min_level_rv = dali.cmd(DALI_QUERY_MIN_LEVEL, addr);
-      if (min_level_rv >= 0) {
-        device.min_level = (uint8_t)min_level_rv;
+      if (scanAnswered(rv)) scanProgress.garbled = false;
+      scanProgress.step = SCAN_QUERY_MAX_LEVEL;
+      break;
+    case SCAN_QUERY_MAX_LEVEL:
+      if (rv >= 0) {
+        device.max_level = (uint8_t)rv;
       }
-
-      delay(DALI_MIN_INTERVAL_MS);
-      queryWaitStart = millis();
-      while (!isBusIdle() && (millis() - queryWaitStart < 5000)) {
-        delay(10);
+      if (scanAnswered(rv)) scanProgress.garbled = false;
+      if (scanProgress.garbled) {
+        nextScanAddress();  // Noise, nobody there
+        break;
       }
-      updateBusActivity();
-      int16_t max_level_rv = dali.cmd(DALI_QUERY_MAX_LEVEL, addr);
-      if (max_level_rv >= 0) {
-        device.max_level = (uint8_t)max_level_rv;
+      scanProgress.found++;
+      scanProgress.found_mask |= 1ULL << device.address;
+      {
+        DaliEvent ev = {};
+        ev.type = DALI_EVENT_SCAN_DEVICE;
+        ev.data[0] = device.address;
+        ev.data[1] = device.min_level;
+        ev.data[2] = device.max_level;
+        ev.flag = device.lamp_failure;
+        pushDaliEvent(ev);
       }
-
-      result.devices.push_back(device);
-      result.total_found++;
-
 #ifdef DEBUG_SERIAL
-      Serial.printf("Found device at address %d (status=0x%x, min=%d, max=%d)\n",
-                    addr, rv, device.min_level, device.max_level);
+      Serial.printf("Found device at address %d (min=%d, max=%d)\n",
+                    device.address, device.min_level, device.max_level);
 #endif
+      nextScanAddress();
+      break;
+  }
+}
 
-      delay(DALI_MIN_INTERVAL_MS);
-    }
+// Start a background scan of the bus in the DALI task, returns
+// false if one is already running (publish is then added to the running scan).
+// The loop asks for one with requestDaliScan().
+bool startDaliScan(bool publish) {
+  if (scanProgress.running) {
+    scanProgress.publish |= publish;
+    return false;
   }
 
 #ifdef DEBUG_SERIAL
-  Serial.printf("Scan complete: %d devices found\n", result.total_found);
+  Serial.println("Scanning DALI bus for devices...");
 #endif
-  return result;
+
+  DaliEvent ev = {};
+  ev.type = DALI_EVENT_SCAN_START;
+  ev.value = millis() / 1000;
+  pushDaliEvent(ev);
+
+  scanProgress.running = true;
+  scanProgress.found = 0;
+  scanProgress.found_mask = 0;
+  scanProgress.publish = publish;
+  scanProgress.step = SCAN_QUERY_PRESENT;
+  scanProgress.address = 0;
+  scanProgress.retry = 0;
+  scanProgress.handle = -1;
+  scanProgress.reply_ready = false;
+  return true;
 }
 
-bool sendCommissioningCommand(uint8_t command, uint8_t data) {
-  const int MAX_RETRIES = 10;
-  const unsigned long SHORT_IDLE_TIMEOUT = 50;
-  
-  for (int retry = 0; retry < MAX_RETRIES; retry++) {
-    unsigned long waitStart = millis();
-    while (!isBusIdle() && (millis() - waitStart < SHORT_IDLE_TIMEOUT)) {
-      delay(5);
-    }
-    
-    if (isBusIdle()) {
-      updateBusActivity();
-      uint8_t addr_byte = 0xA5;
-      int16_t result = dali.cmd(command, data);
-      delay(DALI_MIN_INTERVAL_MS);
-      
-      if (result >= 0) {
-#ifdef DEBUG_SERIAL
-        if (retry > 0) {
-          Serial.printf("[Commissioning] Command sent after %d retries\n", retry);
-        }
-#endif
-        return true;
-      }
-    }
-    
-    delay(20);
+// Loop side: true from the request until the result is in scanResult
+bool isDaliScanRunning() {
+  return scanPending;
+}
+
+// Advance the scan by at most one query, called by the DALI task
+void updateDaliScan() {
+  if (!scanProgress.running || scanProgress.handle >= 0) return;
+
+  if (scanProgress.reply_ready) {
+    scanProgress.reply_ready = false;
+    handleScanReply();
+    return;
   }
-  
-#ifdef DEBUG_SERIAL
-  Serial.println("[Commissioning] Failed to send command after retries");
-#endif
-  return false;
+
+  // The driver waits for the settling time after other traffic on the bus,
+  // so the next query is queued as soon as the previous one has finished.
+  // Polling priority: user commands and other masters go first
+  static const uint16_t queries[] = {
+    DALI_QUERY_CONTROL_GEAR_PRESENT, DALI_QUERY_STATUS, DALI_QUERY_MIN_LEVEL, DALI_QUERY_MAX_LEVEL
+  };
+  uint8_t address = (scanProgress.step == SCAN_QUERY_PRESENT) ? DALI_BROADCAST_ADDR : scanProgress.address;
+  int16_t handle = dali.cmd_async(queries[scanProgress.step], address, onScanReply, nullptr, DALI_PRIORITY_POLL);
+  if (handle < 0) return;  // No free transaction slot, try again next loop
+  scanProgress.handle = handle;
+  updateBusActivity();
 }
 
-int16_t queryCommissioning(uint8_t command) {
-  const int MAX_RETRIES = 3;
-  const unsigned long SHORT_IDLE_TIMEOUT = 50;
-  
-  for (int retry = 0; retry < MAX_RETRIES; retry++) {
-    unsigned long waitStart = millis();
-    while (!isBusIdle() && (millis() - waitStart < SHORT_IDLE_TIMEOUT)) {
-      delay(5);
+// Background health poller: one QUERY STATUS at a time to the short addresses
+// found by a scan, programmed by commissioning or answering any of our
+// queries, at polling priority and only while the driver has nothing else to
+// send, so it fills the idle bus slots. The status byte has the failure, lamp
+// on, fade and power cycle bits. An address that changed, stopped answering or
+// reports a failure is asked again soon; a stable one less and less often.
+
+void onPollReply(int16_t handle, int16_t result, void* ctx) {
+  pollReply = result;
+  pollReplyReady = true;
+  pollHandle = -1;
+}
+
+// DALI task: start polling an address, asked right away if it is new
+void addPolledDevice(uint8_t address) {
+  if (address >= DALI_MAX_ADDRESSES || (pollKnown & (1ULL << address))) return;
+  pollKnown |= 1ULL << address;
+  DaliPollEntry& e = pollState[address];
+  e.due_ms = millis();
+  e.interval_ms = DALI_POLL_FAST_MS;
+  e.status = -1;
+  e.misses = 0;
+}
+
+uint8_t daliPolledCount() {
+  return __builtin_popcountll(pollKnown);
+}
+
+static void pushStatusEvent(uint8_t address, int16_t status, int16_t previous) {
+  DaliEvent ev = {};
+  ev.type = DALI_EVENT_STATUS;
+  ev.data[0] = address;
+  ev.data[1] = status < 0 ? 0 : status;
+  ev.data[2] = previous < 0 ? 0 : previous;
+  ev.flag = status < 0;
+  ev.value = previous >= 0;
+  pushDaliEvent(ev);
+}
+
+static void handlePollReply() {
+  int16_t rv = pollReply;
+  DaliPollEntry& e = pollState[pollAddress];
+  uint32_t now = millis();
+
+  if (rv >= 0) {
+    e.misses = 0;
+    if (rv != e.status) {
+      pushStatusEvent(pollAddress, rv, e.status);
+      e.status = rv;
+      e.interval_ms = DALI_POLL_FAST_MS;
+    } else {
+      e.interval_ms *= 2;
+      uint32_t limit = (rv & 0x03) ? DALI_POLL_FAILED_MS : DALI_POLL_SLOW_MS;  // Gear or lamp failure
+      if (e.interval_ms > limit) e.interval_ms = limit;
     }
-    
-    if (isBusIdle()) {
-      updateBusActivity();
-      uint8_t addr_byte = 0xA1;
-      int16_t result = dali.cmd(command, addr_byte);
-      delay(DALI_MIN_INTERVAL_MS);
-      
-      if (command == DALI_COMPARE) {
-        if (result == 0xFF) return 1;
-        if (result == -1) return 0;
-        if (result < 0) return 1;
-      } else {
-        if (result >= 0) return result;
-      }
+  } else if (rv == -DALI_RESULT_NO_REPLY) {
+    if (e.misses < 255) e.misses++;
+    if (e.misses == DALI_POLL_LOST && e.status >= 0) {
+      pushStatusEvent(pollAddress, -1, e.status);
+      e.status = -1;
     }
-    
-    delay(20);
+    // Ask again soon until it counts as missing, then look for it coming back now and then
+    e.interval_ms = (e.misses < DALI_POLL_LOST) ? DALI_POLL_FAST_MS : DALI_POLL_SLOW_MS;
+  } else {
+    e.interval_ms = DALI_POLL_FAST_MS;  // Garbled or not sent, try again soon
   }
-  
-  return (command == DALI_COMPARE) ? 0 : -1;
+  e.due_ms = now + e.interval_ms;
 }
 
-void commissionDevices(uint8_t start_address) {
-  esp_task_wdt_reset();
-  
-  commissioningProgress.state = COMM_INITIALIZING;
-  commissioningProgress.start_timestamp = millis();
-  commissioningProgress.devices_found = 0;
-  commissioningProgress.devices_programmed = 0;
-  commissioningProgress.current_address = 0;
-  commissioningProgress.next_free_address = start_address;
-  commissioningProgress.status_message = "Starting commissioning...";
-  commissioningProgress.progress_percent = 0;
-  
-  publishCommissioningProgress(commissioningProgress);
+// Called by the DALI task, at most one poll query on the bus
+void updateDaliPoller() {
+#if DALI_POLL_ENABLE
+  if (pollHandle >= 0) return;
+  if (pollReplyReady) {
+    pollReplyReady = false;
+    handlePollReply();
+    return;
+  }
+  if (!pollKnown || scanProgress.running || commissioningRunning() || dali.xfer_pending() || daliCommandQueueDepth()) return;
+
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < DALI_MAX_ADDRESSES; i++) {
+    uint8_t a = (pollNext + i) & (DALI_MAX_ADDRESSES - 1);
+    if (!(pollKnown & (1ULL << a)) || (int32_t)(now - pollState[a].due_ms) < 0) continue;
+    int16_t handle = dali.cmd_async(DALI_QUERY_STATUS, a, onPollReply, nullptr, DALI_PRIORITY_POLL);
+    if (handle < 0) return;
+    pollHandle = handle;
+    pollAddress = a;
+    pollNext = a + 1;
+    return;
+  }
+#endif
+}
+
+// Commissioning in the DALI task, one step per pass of the task loop like the
+// scan: one COMPARE of the search (Dali::find_addr_step()), programming the
+// device it found, or the verification of one address. The steps use the
+// driver's blocking calls, which sleep while their few frames are on the bus;
+// between steps the task feeds its watchdog, drains the receive queue and
+// sends queued commands.
+
+static bool commissioningRunning() {
+  return commissioning.state >= COMM_INITIALIZING && commissioning.state <= COMM_VERIFYING;
+}
+
+static void finishCommissioning(CommissioningState state, CommissioningMessage message) {
+  commissioning.state = state;
+  commissioning.message = message;
+  if (state == COMM_COMPLETE) commissioning.progress_percent = 100;
+  reportCommissioningProgress();
+  commissionRequest.store(-1);
+}
+
+// The loop asks for it with requestCommissioning()
+void startCommissioning(uint8_t start_address) {
+  commissioning.state = COMM_INITIALIZING;
+  commissioning.start_timestamp = millis();
+  commissioning.devices_found = 0;
+  commissioning.devices_programmed = 0;
+  commissioning.current_address = 0;
+  commissioning.next_free_address = start_address;
+  commissioning.message = COMM_MSG_INITIALISE;
+  commissioning.progress_percent = 5;
+  commissionStart = start_address;
+  reportCommissioningProgress();
   
 #ifdef DEBUG_SERIAL
   Serial.println("[Commissioning] Starting DALI commissioning process");
   Serial.printf("[Commissioning] Starting address: %d\n", start_address);
 #endif
 
-  esp_task_wdt_reset();
-  
-  commissioningProgress.status_message = "Sending INITIALISE command...";
-  commissioningProgress.progress_percent = 5;
-  publishCommissioningProgress(commissioningProgress);
-  
-  if (!sendCommissioningCommand(DALI_INITIALISE, 0x00)) {
-    commissioningProgress.state = COMM_ERROR;
-    commissioningProgress.status_message = "Failed to send INITIALISE";
-    publishCommissioningProgress(commissioningProgress);
+  // The driver keeps the settling times between frames and retries collisions
+  updateBusActivity();
+  if (dali.cmd(DALI_INITIALISE, 0x00) < 0) {
+    finishCommissioning(COMM_ERROR, COMM_MSG_INITIALISE_FAILED);
     return;
   }
-  delay(100);
   
-  commissioningProgress.status_message = "Sending RANDOMISE command...";
-  commissioningProgress.progress_percent = 10;
-  publishCommissioningProgress(commissioningProgress);
+  commissioning.message = COMM_MSG_RANDOMISE;
+  commissioning.progress_percent = 10;
+  reportCommissioningProgress();
   
-  if (!sendCommissioningCommand(DALI_RANDOMISE, 0x00)) {
-    commissioningProgress.state = COMM_ERROR;
-    commissioningProgress.status_message = "Failed to send RANDOMISE";
-    publishCommissioningProgress(commissioningProgress);
+  if (dali.cmd(DALI_RANDOMISE, 0x00) < 0) {
+    finishCommissioning(COMM_ERROR, COMM_MSG_RANDOMISE_FAILED);
     return;
   }
-  delay(100);
-  
-#ifdef DEBUG_SERIAL
-  Serial.println("[Commissioning] Waiting 100ms after RANDOMISE for devices to generate random addresses");
-#endif
-  
-  commissioningProgress.state = COMM_SEARCHING;
-  commissioningProgress.status_message = "Searching for devices...";
-  commissioningProgress.progress_percent = 15;
-  publishCommissioningProgress(commissioningProgress);
-  
-  esp_task_wdt_reset();
-  
-  std::vector<uint32_t> foundDevices;
-  
-  while (true) {
-    esp_task_wdt_reset();
-    
-    uint32_t addr = 0;
-    
-    commissioningProgress.status_message = "Searching for device...";
-    commissioningProgress.progress_percent = 15 + (foundDevices.size() * 10);
-    publishCommissioningProgress(commissioningProgress);
-    
-#ifdef DEBUG_SERIAL
-    Serial.println("[Commissioning] Starting binary search for device");
-#endif
-    
-    for (uint32_t i = 0; i < 24; i++) {
-      esp_task_wdt_reset();
-      
-      uint32_t bit = 1 << (23 - i);
-      addr |= bit;
-      
-      commissioningProgress.current_random_address = addr;
-      
-      uint8_t searchH = (addr >> 16) & 0xFF;
-      uint8_t searchM = (addr >> 8) & 0xFF;
-      uint8_t searchL = addr & 0xFF;
-      
-      if (!sendCommissioningCommand(DALI_SEARCHADDRH, searchH)) goto commission_error;
-      if (!sendCommissioningCommand(DALI_SEARCHADDRM, searchM)) goto commission_error;
-      if (!sendCommissioningCommand(DALI_SEARCHADDRL, searchL)) goto commission_error;
-      
-      int16_t compareResult = queryCommissioning(DALI_COMPARE);
-      
-      if (compareResult == 1) {
-        addr &= ~bit;
-      } else {
-        addr |= bit;
-      }
-    }
-    
-    uint8_t searchH = (addr >> 16) & 0xFF;
-    uint8_t searchM = (addr >> 8) & 0xFF;
-    uint8_t searchL = addr & 0xFF;
-    
-    if (!sendCommissioningCommand(DALI_SEARCHADDRH, searchH)) break;
-    if (!sendCommissioningCommand(DALI_SEARCHADDRM, searchM)) break;
-    if (!sendCommissioningCommand(DALI_SEARCHADDRL, searchL)) break;
-    
-    int16_t finalCompare = queryCommissioning(DALI_COMPARE);
-    if (finalCompare != 1) {
-      addr++;
-    }
-    
-    if (!sendCommissioningCommand(DALI_SEARCHADDRH, (addr >> 16) & 0xFF)) break;
-    if (!sendCommissioningCommand(DALI_SEARCHADDRM, (addr >> 8) & 0xFF)) break;
-    if (!sendCommissioningCommand(DALI_SEARCHADDRL, addr & 0xFF)) break;
-    
-    int16_t deviceFound = queryCommissioning(DALI_COMPARE);
-    if (deviceFound != 1) {
-      break;
+  // IEC 62386-102: the new random address is ready 100 ms after RANDOMISE
+  commissionWaitUntil = millis() + 100;
+}
+
+// Search for the next device one COMPARE at a time, program it while the
+// search address still selects it, then withdraw it. The search keeps the
+// bounds the previous device left, see Dali::find_addr(), so no second pass
+// over the random addresses is needed.
+static void commissionNextDevice() {
+  if (commissioning.next_free_address <= 63) {
+    if (commissioning.state != COMM_SEARCHING) {
+      commissioning.state = COMM_SEARCHING;
+      commissioning.message = COMM_MSG_SEARCHING;
+      commissioning.progress_percent = 15 + commissioning.devices_found;
+      if (commissioning.progress_percent > 85) commissioning.progress_percent = 85;
+      reportCommissioningProgress();
     }
-    
-    foundDevices.push_back(addr);
-    commissioningProgress.devices_found++;
-    
+
+    updateBusActivity();
+    uint32_t randomAddr = dali.find_addr_step(&commissionSearch);
+    if (randomAddr == DALI_SEARCH_BUSY) return;
+    if (randomAddr <= 0xFFFFFF) {
+      uint8_t newAddress = commissioning.next_free_address;
+      commissioning.devices_found++;
+      commissioning.current_address = newAddress;
+      commissioning.current_random_address = randomAddr;
+      commissioning.state = COMM_PROGRAMMING;
+      commissioning.message = COMM_MSG_PROGRAMMING;
+      reportCommissioningProgress();
+
 #ifdef DEBUG_SERIAL
-    Serial.printf("[Commissioning] Found device with random address 0x%06X\n", addr);
+      Serial.printf("[Commissioning] Found device with random address 0x%06X -> address %d\n",
+                    randomAddr, newAddress);
 #endif
-    
-    esp_task_wdt_reset();
-    
-    if (!sendCommissioningCommand(DALI_WITHDRAW, 0x00)) break;
+
+      dali.program_short_address(newAddress);
+      dali.withdraw(&commissionSearch);
+      addPolledDevice(newAddress);
+
+      commissioning.devices_programmed++;
+      commissioning.next_free_address++;
+      return;
+    }
+  } else {
+    commissioning.message = COMM_MSG_NO_FREE_ADDRESS;
+    reportCommissioningProgress();
   }
-  
-  commission_error:
-  ;
-  
+
+  dali.cmd(DALI_TERMINATE, 0x00);
+
 #ifdef DEBUG_SERIAL
-  Serial.printf("[Commissioning] Search complete. Found %d devices\n", foundDevices.size());
+  Serial.printf("[Commissioning] Search complete. Found %d devices\n", commissioning.devices_found);
 #endif
-  
-  if (foundDevices.size() == 0) {
-    commissioningProgress.state = COMM_COMPLETE;
-    commissioningProgress.status_message = "No unaddressed devices found";
-    commissioningProgress.progress_percent = 100;
-    publishCommissioningProgress(commissioningProgress);
-    return;
-  }
-  
-  commissioningProgress.state = COMM_PROGRAMMING;
-  
-  esp_task_wdt_reset();
-  
-  if (!sendCommissioningCommand(DALI_INITIALISE, 0x00)) {
-    commissioningProgress.state = COMM_ERROR;
-    commissioningProgress.status_message = "Failed to re-initialize";
-    publishCommissioningProgress(commissioningProgress);
+
+  if (commissioning.devices_found == 0) {
+    finishCommissioning(COMM_COMPLETE, COMM_MSG_NONE_FOUND);
     return;
   }
-  delay(100);
-  
-  for (size_t i = 0; i < foundDevices.size(); i++) {
-    esp_task_wdt_reset();
-    uint32_t randomAddr = foundDevices[i];
-    uint8_t newAddress = commissioningProgress.next_free_address;
-    
-    if (newAddress > 63) {
-      commissioningProgress.state = COMM_ERROR;
-      commissioningProgress.status_message = "No free addresses available";
-      publishCommissioningProgress(commissioningProgress);
-      break;
-    }
-    
-    commissioningProgress.current_address = newAddress;
-    commissioningProgress.current_random_address = randomAddr;
-    commissioningProgress.status_message = "Programming device " + String(i + 1) + "/" + String(foundDevices.size());
-    commissioningProgress.progress_percent = 60 + ((i * 30) / foundDevices.size());
-    publishCommissioningProgress(commissioningProgress);
-    
-#ifdef DEBUG_SERIAL
-    Serial.printf("[Commissioning] Programming device %d/%d (random 0x%06X -> address %d)\n",
-                  i + 1, foundDevices.size(), randomAddr, newAddress);
-#endif
-    
-    uint8_t searchH = (randomAddr >> 16) & 0xFF;
-    uint8_t searchM = (randomAddr >> 8) & 0xFF;
-    uint8_t searchL = randomAddr & 0xFF;
-    
-    if (!sendCommissioningCommand(DALI_SEARCHADDRH, searchH)) break;
-    if (!sendCommissioningCommand(DALI_SEARCHADDRM, searchM)) break;
-    if (!sendCommissioningCommand(DALI_SEARCHADDRL, searchL)) break;
-    
-    uint8_t programData = (newAddress << 1) | 0x01;
-    if (!sendCommissioningCommand(DALI_PROGRAM_SHORT_ADDRESS, programData)) break;
-    
-    delay(200);
-    
-    commissioningProgress.devices_programmed++;
-    commissioningProgress.next_free_address++;
-  }
-  
-  commissioningProgress.state = COMM_VERIFYING;
-  commissioningProgress.status_message = "Verifying programmed addresses...";
-  commissioningProgress.progress_percent = 90;
-  publishCommissioningProgress(commissioningProgress);
-  
-  esp_task_wdt_reset();
+
+  commissioning.state = COMM_VERIFYING;
+  commissioning.message = COMM_MSG_VERIFYING;
+  commissioning.progress_percent = 90;
+  commissionVerify = commissionStart;
+  reportCommissioningProgress();
   
 #ifdef DEBUG_SERIAL
   Serial.println("[Commissioning] Verifying programmed addresses...");
 #endif
-  
-  delay(100);
-  
-  for (uint8_t addr = start_address; addr < commissioningProgress.next_free_address; addr++) {
-    esp_task_wdt_reset();
-    
-    bool verified = false;
-    for (int retry = 0; retry < 5; retry++) {
-      unsigned long waitStart = millis();
-      while (!isBusIdle() && (millis() - waitStart < 50)) {
-        delay(5);
-      }
-      
-      if (isBusIdle()) {
-        updateBusActivity();
-        int16_t result = dali.cmd(DALI_QUERY_STATUS, addr);
-        if (result >= 0) {
-          verified = true;
-#ifdef DEBUG_SERIAL
-          Serial.printf("[Commissioning] Verified device at address %d\n", addr);
-#endif
-          break;
-        }
-      }
-      delay(20);
-    }
-    
-    if (!verified) {
+}
+
+// No reply is an answer; only a query that did not make it onto the bus is repeated
+static void commissionVerifyNext() {
+  if (commissionVerify >= commissioning.next_free_address) {
+    finishCommissioning(COMM_COMPLETE, COMM_MSG_COMPLETE);
 #ifdef DEBUG_SERIAL
-      Serial.printf("[Commissioning] WARNING: Device at address %d not responding\n", addr);
+    Serial.printf("[Commissioning] Complete! Programmed %d devices (addresses %d-%d)\n",
+                  commissioning.devices_programmed, commissionStart,
+                  commissioning.next_free_address - 1);
 #endif
-    }
-    delay(DALI_MIN_INTERVAL_MS);
+    return;
+  }
+
+  uint8_t addr = commissionVerify++;
+  updateBusActivity();
+  int16_t result = dali.cmd(DALI_QUERY_STATUS, addr);
+  for (uint8_t retry = 0; retry < 2 && result < 0 && result != -DALI_RESULT_NO_REPLY; retry++) {
+    result = dali.cmd(DALI_QUERY_STATUS, addr);
   }
-  
-  esp_task_wdt_reset();
-  
-  commissioningProgress.state = COMM_COMPLETE;
-  commissioningProgress.status_message = "Commissioning complete! Programmed " + 
-                                         String(commissioningProgress.devices_programmed) + " devices";
-  commissioningProgress.progress_percent = 100;
-  publishCommissioningProgress(commissioningProgress);
   
 #ifdef DEBUG_SERIAL
-  Serial.printf("[Commissioning] Complete! Programmed %d devices (addresses %d-%d)\n",
-                commissioningProgress.devices_programmed, start_address, 
-                commissioningProgress.next_free_address - 1);
+  if (result >= 0) {
+    Serial.printf("[Commissioning] Verified device at address %d\n", addr);
+  } else {
+    Serial.printf("[Commissioning] WARNING: Device at address %d not responding\n", addr);
+  }
 #endif
 }
+
+// Advance commissioning by one step, called by the DALI task
+void updateDaliCommissioning() {
+  if (!commissioningRunning()) return;
+
+  switch (commissioning.state) {
+    case COMM_INITIALIZING:
+      if ((int32_t)(millis() - commissionWaitUntil) < 0) return;
+      dali.search_begin(&commissionSearch);
+      commissioning.state = COMM_SEARCHING;
+      commissioning.message = COMM_MSG_SEARCH_BEGIN;
+      commissioning.progress_percent = 15;
+      reportCommissioningProgress();
+      break;
+    case COMM_SEARCHING:
+    case COMM_PROGRAMMING:
+      commissionNextDevice();
+      break;
+    case COMM_VERIFYING:
+      commissionVerifyNext();
+      break;
+    default:
+      break;
+  }
+}
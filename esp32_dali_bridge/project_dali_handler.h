@@ -9,45 +9,76 @@
 extern Dali dali;
 extern DaliMessage recentMessages[RECENT_MESSAGES_SIZE];
 extern uint8_t recentMessagesIndex;
-extern DaliCommand commandQueue[COMMAND_QUEUE_SIZE];
-extern uint8_t queueHead;
-extern uint8_t queueTail;
-extern unsigned long lastDaliCommandTime;
 extern unsigned long lastBusActivityTime;
 extern bool busIsIdle;
 extern CommissioningProgress commissioningProgress;
+extern DaliScanResult scanResult;
+extern DaliScanProgress scanProgress;
 extern PassiveDevice passiveDevices[DALI_MAX_ADDRESSES];
+extern ReplyStats replyStats[DALI_MAX_ADDRESSES];
+extern DaliQueueStats commandQueueStats[DALI_COMMAND_PRIORITIES];
+extern DaliDeviceState deviceState[DALI_MAX_ADDRESSES];
 
 extern unsigned long daliRxCount;
 extern unsigned long daliTxCount;
 extern unsigned long daliErrorCount;
+extern unsigned long daliEventOverflow;
+extern TaskHandle_t daliTaskHandle;
+extern volatile uint32_t daliIsrCyclesMax;
+extern volatile uint32_t daliIsrCyclesAvg;
 
 void incrementRxCount();
 void incrementTxCount();
 void incrementErrorCount();
 
 void daliInit();
+void daliTask(void* arg);
+void takeDaliRequests();
+bool requestDaliScan(bool publish);
+bool requestCommissioning(uint8_t start_address);
+void processDaliEvents();
+uint8_t daliCommandQueueDepth();
+uint8_t daliCommandQueueDepth(uint8_t priority);
+uint8_t daliCommandQueueLimit(uint8_t priority);
 void updatePassiveDevice(uint8_t address, const DaliMessage& msg);
 void clearPassiveDevices();
 uint8_t getPassiveDeviceCount();
+int8_t daliStateField(uint8_t opcode);
+bool daliQueryDecoded(uint8_t opcode);
+void pairBusFrame(const DaliEvent& ev);
+void updateDeviceState(uint8_t address, uint8_t opcode, uint8_t reply);
+void trackDeviceCommand(uint8_t address_byte, uint8_t opcode);
+void clearDeviceState(uint8_t address);
+bool getDeviceState(uint8_t address, uint8_t field, uint8_t* value, uint32_t* age_ms);
+bool answerQueryFromCache(const DaliCommand& cmd, int16_t* reply, uint32_t* age_ms);
 DaliMessage parseDaliMessage(uint8_t* bytes, uint8_t length, bool is_tx);
 bool validateDaliCommand(const DaliCommand& cmd);
+uint8_t deviceAddressByte(uint8_t address_type, uint8_t address);
+uint8_t deviceInstanceByte(uint8_t address_type, const String& instance_type, uint8_t instance);
+void setRawFrame(DaliCommand& cmd, const String& hex, uint8_t bits);
 bool enqueueDaliCommand(const DaliCommand& cmd);
 void processCommandQueue();
-bool canSendDaliCommand();
+void onDaliCommandDone(int16_t handle, int16_t result, void* ctx);
+void onDaliReply(const uint8_t* fwd, uint8_t bitlen, int16_t result, int32_t reply_us);
+bool setDaliCapture(uint8_t mode);
 bool isBusIdle();
 void updateBusActivity();
 void monitorDaliBus();
+void handleBusFrame(const DaliEvent& ev);
 void performDaliScan();
 void sendDaliCommand(uint8_t address, uint8_t level);
 void addRecentMessage(const DaliMessage& msg);
-DaliScanResult scanDaliDevices();
-void commissionDevices(uint8_t start_address);
-bool sendCommissioningCommand(uint8_t command, uint8_t data);
-int16_t queryCommissioning(uint8_t command);
-
-uint8_t bus_is_high();
-void bus_set_low();
-void bus_set_high();
+bool startDaliScan(bool publish);
+bool isDaliScanRunning();
+void updateDaliScan();
+void onScanReply(int16_t handle, int16_t result, void* ctx);
+void onPollReply(int16_t handle, int16_t result, void* ctx);
+void handleScanReply();
+void nextScanAddress();
+void updateDaliPoller();
+void addPolledDevice(uint8_t address);
+uint8_t daliPolledCount();
+void startCommissioning(uint8_t start_address);
+void updateDaliCommissioning();
 
 #endif
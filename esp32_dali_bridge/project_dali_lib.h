@@ -24,6 +24,44 @@ Changelog:
 
 #include "esp_attr.h"
 
+#ifdef ESP_PLATFORM
+#include "project_config.h" //DALI_OVERSAMPLE, and the pins of the bus IO policy below
+#endif
+#include "project_dali_codec.h"
+
+//-------------------------------------------------
+//BUS IO POLICY
+//timer(), edge() and the tx path drive and sample the bus through DaliIo, a class of static functions
+//picked at compile time so the compiler inlines them into the interrupt handlers
+//  DaliIo::is_high()  returns !=0 if DALI bus is in high (non-asserted) state
+//  DaliIo::set_low()  set DALI bus in low (asserted) state
+//  DaliIo::set_high() set DALI bus in high (released) state
+#ifdef ESP_PLATFORM
+#include "soc/soc.h"
+#include "soc/soc_caps.h"
+#include "soc/gpio_reg.h"
+
+//direct GPIO register access, the pins must be set up with pinMode() before begin()
+//TX_ACTIVE_HIGH: the transceiver pulls the bus low while the tx pin is high
+template<uint8_t TX, uint8_t RX, bool TX_ACTIVE_HIGH>
+struct DaliIoGpio {
+  static_assert(TX < SOC_GPIO_PIN_COUNT && RX < SOC_GPIO_PIN_COUNT, "DaliIoGpio: no such GPIO");
+  static inline IRAM_ATTR uint8_t is_high() {
+    return (REG_READ(RX < 32 ? GPIO_IN_REG : GPIO_IN1_REG) >> (RX & 31)) & 1;
+  }
+  static inline IRAM_ATTR void set_low() { _tx(TX_ACTIVE_HIGH); }
+  static inline IRAM_ATTR void set_high() { _tx(!TX_ACTIVE_HIGH); }
+  static inline IRAM_ATTR void _tx(bool pin_high) {
+    if (pin_high) REG_WRITE(TX < 32 ? GPIO_OUT_W1TS_REG : GPIO_OUT1_W1TS_REG, 1UL << (TX & 31));
+    else REG_WRITE(TX < 32 ? GPIO_OUT_W1TC_REG : GPIO_OUT1_W1TC_REG, 1UL << (TX & 31));
+  }
+};
+
+typedef DaliIoGpio<DALI_TX_PIN, DALI_RX_PIN, DALI_TX_ACTIVE_HIGH> DaliIo;
+#else
+#include "dali_io_host.h" //host builds provide DaliIo themselves (tools/dali_sim/shim)
+#endif
+
 //-------------------------------------------------
 //LOW LEVEL DRIVER DEFINES
 #define DALI_BAUD 1200
@@ -42,6 +80,7 @@ Changelog:
 #define DALI_RESULT_DATA_TOO_LONG    103 //Trying to send too many bytes (max 3)
 #define DALI_RESULT_INVALID_CMD      104 //The cmd argument in the call to cmd() was invalid
 #define DALI_RESULT_INVALID_REPLY    105 //cmd() received an invalid reply (not 8 bits)
+#define DALI_RESULT_QUEUE_FULL       106 //submit(): all transaction slots are in use
 
 
 //tx collision handling
@@ -49,33 +88,319 @@ Changelog:
 #define DALI_TX_COLLISSION_OFF 1  //don't handle tx collisions
 #define DALI_TX_COLLISSION_ON 2   //handle all tx collisions
 
-#define DALI_RX_BUF_SIZE 40
+#define DALI_RX_BUF_SIZE (5 * DALI_OVERSAMPLE) //samples of 40 bits, 8 per byte
+#define DALI_EDGE_BUF_SIZE 16 //captured edges, power of 2
+#define DALI_RX_QUEUE_SIZE 8 //decoded frames queued between timer() and rx(), power of 2
+#define DALI_XFER_SLOTS 16 //transactions queued between submit() and timer(), power of 2
+
+//IEC 62386-101 settling times in us, measured from the end of the previous frame on the bus
+#define DALI_SETTLE_FWD_BWD_MIN_US 5500  //forward frame -> its backward frame
+#define DALI_SETTLE_FWD_BWD_MAX_US 10500 //a backward frame starting later is no reply
+#define DALI_SETTLE_BWD_FWD_US 2400      //backward frame -> next forward frame
+#define DALI_SETTLE_FWD_FWD_US 13500     //forward frame (without reply) -> next forward frame
+
+//DALI-2 multi-master transmit priority, selects the forward frame settling window:
+//1: 13.5-14.7 ms, 2: 14.9-16.2 ms, 3: 16.3-17.7 ms, 4: 17.9-19.3 ms, 5: 19.5-21.2 ms
+#define DALI_PRIORITY_USER 2   //interactive commands (switches, UI, MQTT)
+#define DALI_PRIORITY_CONFIG 3 //configuration and commissioning
+#define DALI_PRIORITY_POLL 5   //background polling, yields to everything else
+
+//decoded frame, as queued by timer()
+struct DaliRxFrame {
+  uint8_t data[4];   //partial last byte right aligned
+  uint8_t len;       //number of bits, 0 on decode error
+  uint8_t margin;    //decoder confidence 0..255, see DaliManPll (255 with the edge capture receiver)
+  int64_t start_us;  //esp_timer time of the start bit
+  int64_t end_us;    //esp_timer time the frame ended (stop condition seen)
+};
+
+//asynchronous transactions
+#define DALI_XFER_REPLY 0x01    //submit() flag: receive a backward frame after the forward frame
+#define DALI_XFER_BACKWARD 0x02 //this is a backward frame, see reply()
+#define DALI_XFER_TWICE 0x04    //submit() flag: send-twice pair, the frame is repeated at priority 1 with nothing in between
+#define DALI_TWICE_MAX_US 100000 //both frames of a send-twice pair within 100 ms, or the control gear ignores them
+#define DALI_XFER_PRIORITY(p) (((p) & 0x07) << 4) //submit() flag: transmit priority 1..5, DALI_PRIORITY_USER if not given
+
+//transaction state, see xfer_state()
+#define DALI_XFER_FREE 0       //unknown handle, or its slot was reused
+#define DALI_XFER_QUEUED 1     //waiting for the bus to be idle
+#define DALI_XFER_TX 2         //transmitting
+#define DALI_XFER_WAIT_REPLY 3 //waiting for the backward frame
+#define DALI_XFER_DONE 4       //finished, result is valid
+
+//completion callback, called from service(): result is the reply byte, DALI_OK, or negative DALI_RESULT_xxx
+typedef void (*DaliXferCallback)(int16_t handle, int16_t result, void *ctx);
+
+//reply monitor, called from service() for every transaction that waited for a backward frame:
+//fwd/bitlen is the forward frame, reply_us the time from its end to the start bit of the reply (-1: none)
+typedef void (*DaliReplyHook)(const uint8_t *fwd, uint8_t bitlen, int16_t result, int32_t reply_us);
+
+//transaction slot, written by submit(), run by timer()
+struct DaliXfer {
+  uint8_t data[4];
+  uint8_t bitlen;
+  uint8_t flags;              //DALI_XFER_xxx flags
+  uint8_t seq;                //handle of the transaction in this slot
+  volatile uint8_t state;     //DALI_XFER_xxx state
+  volatile int16_t result;
+  uint32_t timeout_us;        //waiting for the bus, from start_us to the end of transmission
+  int64_t submit_us;
+  int64_t start_us;           //first run by timer(), 0 before
+  int64_t phase_us;           //end of the forward frame (for a backward frame: the one it answers)
+  uint32_t settle_us;         //settling time drawn from the priority window, plus collision backoff
+  int64_t settle_from_us;     //bus_end_us it was drawn for, a new frame on the bus draws again
+  uint8_t collisions;         //transmit attempts lost to a collision
+  uint8_t sent;               //DALI_XFER_TWICE: 1 after the first frame of the pair
+  int32_t reply_us;           //DALI_XFER_REPLY: end of the forward frame to the start of the reply, -1 if none came
+  DaliXferCallback cb;
+  void *ctx;
+};
+
+//24-bit forward frames (IEC 62386-103 control devices): address byte, instance byte, opcode
+#define DALI24_SHORT(a) ((uint8_t)(((a) & 0x3F) << 1 | 0x01))        //0AAAAAA1 device short address 0..63
+#define DALI24_GROUP(g) ((uint8_t)(0x81 | ((g) & 0x1F) << 1))        //10GGGGG1 device group 0..31
+#define DALI24_SPECIAL 0xC1                                          //special command, the instance byte is the command
+#define DALI24_BROADCAST_UNADDRESSED 0xFD                            //devices without short address
+#define DALI24_BROADCAST 0xFF                                        //all devices
+#define DALI24_INSTANCE(n) ((uint8_t)((n) & 0x1F))                   //000NNNNN instance number 0..31
+#define DALI24_INSTANCE_GROUP(g) ((uint8_t)(0x80 | ((g) & 0x1F)))    //100GGGGG instance group 0..31
+#define DALI24_INSTANCE_TYPE(t) ((uint8_t)(0xC0 | ((t) & 0x1F)))     //110TTTTT instance type 0..31
+#define DALI24_DEVICE 0xFE                                           //device command, not for an instance
+#define DALI24_INSTANCE_BROADCAST 0xFF                               //all instances
+
+//special commands, sent as DALI24_SPECIAL, command, data
+#define DALI24_TERMINATE 0x00
+#define DALI24_INITIALISE 0x01
+#define DALI24_RANDOMISE 0x02
+#define DALI24_COMPARE 0x03
+#define DALI24_WITHDRAW 0x04
+#define DALI24_SEARCHADDRH 0x05
+#define DALI24_SEARCHADDRM 0x06
+#define DALI24_SEARCHADDRL 0x07
+#define DALI24_PROGRAM_SHORT_ADDRESS 0x08
+#define DALI24_VERIFY_SHORT_ADDRESS 0x09
+#define DALI24_QUERY_SHORT_ADDRESS 0x0A
+#define DALI24_WRITE_MEMORY_LOCATION 0x20
+#define DALI24_WRITE_MEMORY_LOCATION_NO_REPLY 0x21
+#define DALI24_DTR0 0x30
+#define DALI24_DTR1 0x31
+#define DALI24_DTR2 0x32
+
+//a forward frame of any length, for frame_async()
+struct DaliFrame {
+  uint32_t value;  //frame bits, right aligned: the first bit sent is bit (bitlen-1)
+  uint8_t bitlen;  //16, 24 or 25 (1..32 accepted)
+};
+
+constexpr DaliFrame dali_frame16(uint8_t adr, uint8_t opcode) { return DaliFrame{ (uint32_t)adr << 8 | opcode, 16 }; }
+constexpr DaliFrame dali_frame24(uint8_t adr, uint8_t inst, uint8_t opcode) { return DaliFrame{ (uint32_t)adr << 16 | (uint32_t)inst << 8 | opcode, 24 }; }
+constexpr DaliFrame dali_frame25(uint32_t value) { return DaliFrame{ value & 0x1FFFFFF, 25 }; }
+
+//-------------------------------------------------
+//TYPED COMMAND FRAMES
+//A DaliCmdFrame is a 16 or 24-bit forward frame encoded together with its reply and send-twice
+//traits. The address is checked once, when the DaliAddr is made, and the command when the frame is
+//built: by static_assert for the template builders, which take the command as a constant, or by
+//returning an invalid frame (bitlen 0) for the runtime ones. send() queues the bytes as they are,
+//and the same bytes can be echoed to a bus monitor, so what is shown is what was sent.
+
+//address of a 16-bit command, the YAAAAAA part of the address byte YAAAAAAS
+struct DaliAddr {
+  uint8_t yaaaaaa; //0..63 short address, 0x40..0x4F group, 0x7F broadcast, DALI_ADDR_INVALID
+};
+#define DALI_ADDR_INVALID 0xFF
+
+//runtime addresses, as cmd() and set_level() take them: 0..63 short, 64..79 group 0..15, 0x7F or 0xFF broadcast
+constexpr DaliAddr dali_addr(uint8_t adr) { return DaliAddr{ (uint8_t)(adr <= 0x4F ? adr : (adr & 0x7F) == 0x7F ? 0x7F : DALI_ADDR_INVALID) }; }
+constexpr DaliAddr dali_broadcast() { return DaliAddr{ 0x7F }; }
+template<uint8_t A> constexpr DaliAddr dali_short() { static_assert(A < 64, "short address is 0..63"); return DaliAddr{ A }; }
+template<uint8_t G> constexpr DaliAddr dali_group() { static_assert(G < 16, "group is 0..15"); return DaliAddr{ (uint8_t)(0x40 | G) }; }
+
+//command categories (IEC 62386-102), from a DALI_xxx command define: bit8 special command, bit9 send twice
+#define DALI_CMD_CONTROL 0 //0..31 arc power control and scenes
+#define DALI_CMD_CONFIG 1  //32..143 configuration, sent twice
+#define DALI_CMD_APP 2     //224..236 application extended commands (e.g. DT8), without reply
+#define DALI_CMD_QUERY 3   //144..223, 237..255 queries, answered by a backward frame
+#define DALI_CMD_SPECIAL 4 //special commands, the first byte is the command and the second its data
+
+constexpr uint8_t dali_cmd_kind(uint16_t cmd) {
+  return (cmd & 0x0100) ? DALI_CMD_SPECIAL : (uint8_t)cmd < 32 ? DALI_CMD_CONTROL : (uint8_t)cmd < 144 ? DALI_CMD_CONFIG
+    : ((uint8_t)cmd >= 224 && (uint8_t)cmd < 237) ? DALI_CMD_APP : DALI_CMD_QUERY;
+}
+//queries, and the special commands answered by the control gear: COMPARE, VERIFY SHORT ADDRESS,
+//QUERY SHORT ADDRESS, WRITE MEMORY LOCATION
+constexpr bool dali_cmd_reply(uint16_t cmd) {
+  return dali_cmd_kind(cmd) == DALI_CMD_QUERY || ((cmd & 0x0100)
+    && ((uint8_t)cmd == 0xA9 || (uint8_t)cmd == 0xB9 || (uint8_t)cmd == 0xBB || (uint8_t)cmd == 0xC7));
+}
+constexpr uint8_t dali_cmd_flags(uint16_t cmd) { return (dali_cmd_reply(cmd) ? DALI_XFER_REPLY : 0) | ((cmd & 0x0200) ? DALI_XFER_TWICE : 0); }
+//the repeat bit is set for configuration commands, INITIALISE and RANDOMISE, and for nothing else
+constexpr bool dali_cmd_twice_ok(uint16_t cmd) {
+  return ((cmd & 0x0200) != 0) == ((cmd & 0x0100) ? ((uint8_t)cmd == 0xA5 || (uint8_t)cmd == 0xA7) : dali_cmd_kind(cmd) == DALI_CMD_CONFIG);
+}
+//reply and send-twice of a 24-bit device command, from the opcode ranges of IEC 62386-103:
+//device 0x00..0x2F configuration, 0x30..0x4F queries; instance 0x60..0x7F configuration, 0x80..0x9F queries
+//0xFF for event messages (address bit 0 clear) and reserved address bytes
+constexpr uint8_t dali_cmd24_flags(uint8_t adr, uint8_t inst, uint8_t opcode) {
+  return (!(adr & 0x01) || (adr > DALI24_SPECIAL && adr < DALI24_BROADCAST_UNADDRESSED)) ? 0xFF
+    : adr == DALI24_SPECIAL ? ((inst == DALI24_INITIALISE || inst == DALI24_RANDOMISE) ? DALI_XFER_TWICE
+        : (inst == DALI24_COMPARE || inst == DALI24_VERIFY_SHORT_ADDRESS || inst == DALI24_QUERY_SHORT_ADDRESS
+           || inst == DALI24_WRITE_MEMORY_LOCATION) ? DALI_XFER_REPLY : 0)
+    : inst == DALI24_DEVICE ? (opcode < 0x30 ? DALI_XFER_TWICE : opcode < 0x50 ? DALI_XFER_REPLY : 0)
+    : (opcode >= 0x60 && opcode < 0x80) ? DALI_XFER_TWICE : (opcode >= 0x80 && opcode < 0xA0) ? DALI_XFER_REPLY : 0;
+}
+
+struct DaliCmdFrame {
+  uint8_t data[4]; //the frame as it is sent, first byte first
+  uint8_t bitlen;  //16 or 24, 0 if the address or the command was invalid
+  uint8_t flags;   //DALI_XFER_REPLY / DALI_XFER_TWICE, send() adds the priority
+  uint8_t nbytes() const { return bitlen >> 3; }
+};
+#define DALI_CMD_FRAME_INVALID DaliCmdFrame{ { 0, 0, 0, 0 }, 0, 0 }
+
+//runtime builders, an invalid argument gives an invalid frame
+constexpr DaliCmdFrame dali_arc_frame(DaliAddr adr, uint8_t level) { //direct arc power control (DAPC)
+  return adr.yaaaaaa == DALI_ADDR_INVALID ? DALI_CMD_FRAME_INVALID : DaliCmdFrame{ { (uint8_t)(adr.yaaaaaa << 1), level, 0, 0 }, 16, 0 };
+}
+constexpr DaliCmdFrame dali_cmd_frame(uint16_t cmd, DaliAddr adr) { //addressed command, not a special command
+  return (adr.yaaaaaa == DALI_ADDR_INVALID || cmd > 0x03FF || (cmd & 0x0100)) ? DALI_CMD_FRAME_INVALID
+    : DaliCmdFrame{ { (uint8_t)(adr.yaaaaaa << 1 | 1), (uint8_t)cmd, 0, 0 }, 16, dali_cmd_flags(cmd) };
+}
+constexpr DaliCmdFrame dali_special_frame(uint16_t cmd, uint8_t data) { //special command, the first byte must not look like an address
+  return (cmd > 0x03FF || !(cmd & 0x0100) || (uint8_t)cmd < 0xA0 || (uint8_t)cmd > 0xFD) ? DALI_CMD_FRAME_INVALID
+    : DaliCmdFrame{ { (uint8_t)cmd, data, 0, 0 }, 16, dali_cmd_flags(cmd) };
+}
+constexpr DaliCmdFrame dali_cmd24_frame(uint8_t adr, uint8_t inst, uint8_t opcode) { //24-bit device command, DALI24_xxx address/instance
+  return dali_cmd24_flags(adr, inst, opcode) == 0xFF ? DALI_CMD_FRAME_INVALID
+    : DaliCmdFrame{ { adr, inst, opcode, 0 }, 24, dali_cmd24_flags(adr, inst, opcode) };
+}
+
+//compile time builders, the command (and for 24-bit frames the whole frame) is a constant
+template<uint16_t CMD> constexpr DaliCmdFrame dali_cmd(DaliAddr adr) {
+  static_assert(CMD <= 0x03FF, "not a DALI_xxx command");
+  static_assert(!(CMD & 0x0100), "special command: use dali_special<>()");
+  static_assert(dali_cmd_twice_ok(CMD), "configuration commands 32..143 need the repeat bit 0x0200 (use the DALI_xxx define), other commands must not have it");
+  return dali_cmd_frame(CMD, adr);
+}
+template<uint16_t CMD> constexpr DaliCmdFrame dali_special(uint8_t data) {
+  static_assert(CMD <= 0x03FF && (CMD & 0x0100), "not a special command: use dali_cmd<>()");
+  static_assert((uint8_t)CMD >= 0xA0 && (uint8_t)CMD <= 0xFD, "special command byte in the address range");
+  static_assert(dali_cmd_twice_ok(CMD), "only INITIALISE and RANDOMISE are sent twice");
+  return dali_special_frame(CMD, data);
+}
+template<uint8_t ADR, uint8_t INST, uint8_t OPCODE> constexpr DaliCmdFrame dali_cmd24() {
+  static_assert(dali_cmd24_flags(ADR, INST, OPCODE) != 0xFF, "event message or reserved address byte");
+  return dali_cmd24_frame(ADR, INST, OPCODE);
+}
+
+//raw sample capture ("logic analyzer"), sampling receiver only, see capture_start()
+#define DALI_CAPTURE_OFF 0
+#define DALI_CAPTURE_FRAMES 1 //the samples of every received frame, from the start bit to the idle bus
+#define DALI_CAPTURE_WINDOW 2 //every sample, in back-to-back records of DALI_RX_BUF_SIZE bytes
+#define DALI_CAPTURE_MAGIC "DALICAP1"
+
+//capture record, also the record layout of a capture file
+struct DaliCaptureRecord {
+  uint32_t start_us;  //low 32 bits of the esp_timer time of the first sample
+  uint8_t nbytes;     //bytes of samples used
+  uint8_t len;        //DALI_CAPTURE_FRAMES: bits decoded by the driver (0 or 1 is a decode error)
+  uint8_t mode;       //DALI_CAPTURE_xxx the record was taken in
+  uint8_t margin;     //DALI_CAPTURE_FRAMES: decoder confidence margin
+  uint8_t data[4];    //DALI_CAPTURE_FRAMES: decoded data, partial last byte right aligned
+  uint8_t samples[DALI_RX_BUF_SIZE]; //8 samples per byte, MSB is oldest, 1 = bus high
+};
+
+//capture file: this header, then DaliCaptureRecords up to the end of the file
+struct DaliCaptureHeader {
+  char magic[8];        //DALI_CAPTURE_MAGIC, not 0 terminated
+  uint32_t record_size; //sizeof(DaliCaptureRecord)
+  uint32_t sample_hz;   //DALI_SAMPLE_HZ
+};
+
+//commissioning search, kept from one device to the next: every control gear
+//below low has been withdrawn, and bound[] holds the search addresses COMPARE
+//answered yes to (and the top of the address space), largest first. The next
+//search looks for the smallest bound still holding a device and starts from
+//there instead of from the top of the address space. withdrawn[] keeps the
+//random addresses found so far, so control gear that missed its WITHDRAW is
+//withdrawn again instead of being returned a second time.
+#define DALI_SEARCH_BOUNDS 24
+#define DALI_SEARCH_NONE 0x1000000  //find_addr(): no control gear left
+#define DALI_SEARCH_BUSY 0x2000000  //find_addr_step(): not done yet, call again
+#define DALI_SEARCH_WITHDRAWN 64    //one per short address
+#define DALI_SEARCH_RETRIES 3       //repeated WITHDRAWs without a new device in between before the search gives up
+struct DaliSearch {
+  uint32_t low;                         //lowest random address still in the search
+  uint32_t sent;                        //search address the control gear holds, DALI_SEARCH_NONE = not sent yet
+  uint32_t bound[DALI_SEARCH_BOUNDS];   //COMPARE answered yes at these, descending
+  uint8_t nbound;
+  uint8_t nwithdrawn;
+  uint8_t retries;                      //WITHDRAWs repeated since the last new device
+  uint8_t step;                         //where find_addr_step() goes on
+  uint8_t lo, hi;                       //find_addr_step(): bound[lo..hi-1] not compared yet
+  uint32_t start;                       //find_addr_step(): low when the search started
+  uint32_t high;                        //find_addr_step(): COMPARE answered yes here
+  uint32_t withdrawn[DALI_SEARCH_WITHDRAWN]; //random addresses withdrawn in this search
+};
 
 class Dali {
 public:
   //-------------------------------------------------
   //LOW LEVEL DRIVER PUBLIC
-  void begin(uint8_t (*bus_is_high)(), void (*bus_set_low)(), void (*bus_set_high)());
-  void timer(); //call this function every 104.167 us (1200 baud 8x oversampled)
+  void begin(); //the bus is driven and sampled through DaliIo
+  void begin(void (*timer_start)(), void (*timer_stop)()); //edge capture backend
+  void timer(); //call this function DALI_SAMPLE_HZ times per second (1200 baud DALI_OVERSAMPLE x oversampled, 104.167 us at 8x)
+  void edge(uint8_t busishigh); //edge capture backend: call this function on every rx pin change
+  uint8_t timer_running() { return timer_on; } //edge capture backend: 0 while timer() is stopped
   uint8_t tx(uint8_t *data, uint8_t bitlen);  //low level non-blocking transmit
-  uint8_t rx(uint8_t *data); //low level non-blocking receive
+  uint8_t rx(uint8_t *data, int64_t *start_us=nullptr, int64_t *end_us=nullptr, uint8_t *margin=nullptr); //low level non-blocking receive, optionally returns the esp_timer time of the start bit and frame end, and the decoder confidence margin
   uint8_t tx_state(); //low level tx state, returns DALI_RESULT_COLLISION, DALI_RESULT_TRANSMITTING or DALI_OK
   uint8_t txcollisionhandling; //collision handling DALI_TX_COLLISSION_AUTO,DALI_TX_COLLISSION_OFF,DALI_TX_COLLISSION_ON
   uint32_t milli(); //esp32 as 32-bit controller needs millis to be 32-bit to rollover correctly
-  Dali() : txcollisionhandling(DALI_TX_COLLISSION_AUTO), busstate(0), /* ticks(0), _milli(0), */ idlecnt(0) {}; //initialize variables
+  uint8_t rx_queued(); //number of frames waiting for rx()
+  volatile uint32_t rxoverrun; //frames dropped because the rx queue was full
+  volatile uint32_t rxweak; //frames decoded with a confidence margin below DALI_MAN_PLL_WEAK
+  volatile uint32_t xfer_collisions; //transaction frames lost to a collision and retried
+  DaliReplyHook reply_hook; //optional, see DaliReplyHook
+  Dali() : txcollisionhandling(DALI_TX_COLLISSION_AUTO), reply_hook(nullptr), busstate(0), /* ticks(0), _milli(0), */ idlecnt(0) {}; //initialize variables
 
   //-------------------------------------------------
   //HIGH LEVEL PUBLIC
   void     set_level(uint8_t level, uint8_t adr=0xFF); //set arc level
-  int16_t  cmd(uint16_t cmd, uint8_t arg); //execute DALI command, use a DALI_xxx command define as cmd argument, returns negative DALI_RESULT_xxx or reply byte
+  int16_t  cmd(uint16_t cmd, uint8_t arg, uint8_t priority=DALI_PRIORITY_CONFIG); //execute DALI command, use a DALI_xxx command define as cmd argument, returns negative DALI_RESULT_xxx or reply byte
   uint8_t  set_operating_mode(uint8_t v, uint8_t adr=0xFF); //returns 0 on success
   uint8_t  set_max_level(uint8_t v, uint8_t adr=0xFF); //returns 0 on success
   uint8_t  set_min_level(uint8_t v, uint8_t adr=0xFF); //returns 0 on success
   uint8_t  set_system_failure_level(uint8_t v, uint8_t adr=0xFF); //returns 0 on success
   uint8_t  set_power_on_level(uint8_t v, uint8_t adr=0xFF); //returns 0 on success
+  uint8_t  set_scene_level(uint8_t scene, uint8_t v, uint8_t adr=0xFF); //store level v (255 = remove from scene) in scene 0..15, returns 0 on success
   uint8_t  tx_wait(uint8_t* data, uint8_t bitlen, uint32_t timeout_ms=500); //blocking transmit bytes
   int16_t  tx_wait_rx(uint8_t cmd0, uint8_t cmd1, uint32_t timeout_ms=500); //blocking transmit and receive
 
+  //asynchronous transactions, run by timer(): submit returns a handle >=0 or negative DALI_RESULT_xxx
+  int16_t  submit(uint8_t *data, uint8_t bitlen, uint8_t flags=0, DaliXferCallback cb=nullptr, void *ctx=nullptr, uint32_t timeout_ms=500); //queue a frame
+  int16_t  tx_async(uint8_t cmd0, uint8_t cmd1, DaliXferCallback cb=nullptr, void *ctx=nullptr, uint32_t timeout_ms=500, uint8_t priority=DALI_PRIORITY_USER); //non-blocking tx_wait_rx()
+  int16_t  cmd_async(uint16_t cmd, uint8_t arg, DaliXferCallback cb=nullptr, void *ctx=nullptr, uint8_t priority=DALI_PRIORITY_USER); //non-blocking cmd()
+  int16_t  set_level_async(uint8_t level, uint8_t adr=0xFF, DaliXferCallback cb=nullptr, void *ctx=nullptr, uint8_t priority=DALI_PRIORITY_USER); //non-blocking set_level()
+  int16_t  frame_async(DaliFrame frame, uint8_t flags=0, DaliXferCallback cb=nullptr, void *ctx=nullptr); //queue a 16, 24 or 25 bit forward frame, flags as submit()
+  int16_t  send(const DaliCmdFrame &frame, DaliXferCallback cb=nullptr, void *ctx=nullptr, uint8_t priority=DALI_PRIORITY_USER); //queue a typed command frame as it was built, -DALI_RESULT_INVALID_CMD for an invalid one
+  int16_t  cmd24(uint8_t adr, uint8_t inst, uint8_t opcode, uint8_t priority=DALI_PRIORITY_CONFIG); //execute a 24-bit device command (DALI24_xxx address/instance), returns negative DALI_RESULT_xxx, reply byte or DALI_OK
+  int16_t  cmd24_async(uint8_t adr, uint8_t inst, uint8_t opcode, DaliXferCallback cb=nullptr, void *ctx=nullptr, uint8_t priority=DALI_PRIORITY_USER); //non-blocking cmd24()
+  int16_t  reply(uint8_t data, int64_t fwd_end_us, DaliXferCallback cb=nullptr, void *ctx=nullptr); //backward frame answering the forward frame that ended at fwd_end_us (see rx())
+  uint8_t  xfer_state(int16_t handle); //DALI_XFER_xxx state of a transaction
+  uint8_t  xfer_busy(int16_t handle) { uint8_t s = xfer_state(handle); return s != DALI_XFER_FREE && s != DALI_XFER_DONE; }
+  int16_t  xfer_result(int16_t handle); //result of a finished transaction, valid until its slot is reused
+  int16_t  xfer_wait(int16_t handle); //block until a transaction is done, returns its result
+  uint8_t  xfer_pending() { return xfer_head - xfer_tail; } //transactions submitted and not yet serviced
+  void     service(); //call from the main loop: runs the callbacks of finished transactions and frees their slots
+
+  //raw sample capture into a caller supplied ring of records (size a power of 2), the ring must stay allocated
+  uint8_t  capture_start(uint8_t mode, DaliCaptureRecord *buf, uint16_t records); //DALI_CAPTURE_xxx, returns 0 on success
+  void     capture_stop();
+  uint8_t  capture_mode() { return cap_mode; }
+  uint32_t capture_count() { return cap_head; } //records written since capture_start()
+  uint16_t capture_read(uint32_t *pos, DaliCaptureRecord *dst, uint16_t max); //copy records from index *pos on (moved up to the oldest one kept), advances *pos
+
   uint8_t read_memory_bank(uint8_t bank, uint8_t adr);
   uint8_t set_dtr0(uint8_t value, uint8_t adr);
   uint8_t set_dtr1(uint8_t value, uint8_t adr);
@@ -88,7 +413,10 @@ public:
   uint8_t  compare();
   void     program_short_address(uint8_t shortadr);
   uint8_t  query_short_address();
-  uint32_t find_addr();
+  void     search_begin(DaliSearch *s); //new search, after INITIALISE / RANDOMISE
+  uint32_t find_addr(DaliSearch *s); //lowest random address left, selected by the search address; DALI_SEARCH_NONE if none
+  uint32_t find_addr_step(DaliSearch *s); //find_addr() one COMPARE at a time, DALI_SEARCH_BUSY until it is done
+  void     withdraw(DaliSearch *s); //withdraw the control gear find_addr() selected, the next search starts above it
 
 private:
   //-------------------------------------------------
@@ -108,7 +436,45 @@ private:
   volatile uint8_t rxbyte;         //last 8 samples, MSB is oldest
   volatile uint8_t rxbitcnt;       //bitcnt in rxbyte
   volatile uint8_t rxidle;         //idle tick counter during RX
-
+  DaliManPll rxdec;                //phase locked manchester decoder, fed by timer()
+  volatile int64_t rxstart_us;     //esp_timer time of the start bit being received
+  DaliRxFrame rxq[DALI_RX_QUEUE_SIZE]; //decoded frames, written by timer(), read by rx()
+  volatile uint8_t rxq_head;       //next frame to write
+  volatile uint8_t rxq_tail;       //next frame to read
+
+  //EDGE CAPTURE RECEIVER
+  void (*timer_start)();           //start timer(), nullptr when using the sampling receiver
+  void (*timer_stop)();            //stop timer()
+  volatile uint8_t timer_on;       //timer() is running
+  volatile uint32_t edge_us[DALI_EDGE_BUF_SIZE]; //esp_timer time of captured edges, written by edge()
+  volatile uint8_t edge_lvl[DALI_EDGE_BUF_SIZE]; //bus level after each captured edge
+  volatile uint8_t edge_head;      //next edge to write
+  volatile uint8_t edge_tail;      //next edge to decode
+  volatile uint8_t edge_overflow;  //edges were dropped
+  uint32_t edge_last_us;           //time of the last decoded edge
+  uint8_t edge_level;              //bus level after the last decoded edge
+  DaliEdgeDecoder edgedec;         //pulse duration decoder
+
+  //SCHEDULER
+  volatile int64_t bus_end_us;     //esp_timer time the last frame on the bus ended, own or received
+  volatile uint8_t bus_end_len;    //its length in bits: 8 = backward frame, 0 = collision or decode error
+  uint32_t rng;                    //xorshift state for the settling windows and collision backoff
+
+  //TRANSACTIONS
+  DaliXfer xfer[DALI_XFER_SLOTS];  //transaction slots, indexed by sequence number
+  volatile uint8_t xfer_head;      //next sequence number to submit (main loop)
+  volatile uint8_t xfer_cur;       //transaction being run by timer()
+  volatile uint8_t xfer_tail;      //oldest transaction not yet serviced (main loop)
+
+
+  //RAW CAPTURE
+  volatile uint8_t cap_mode;       //DALI_CAPTURE_xxx
+  DaliCaptureRecord *cap_buf;      //ring of records
+  uint16_t cap_size;               //records in cap_buf, power of 2
+  volatile uint32_t cap_head;      //records written, the next one goes to cap_buf[cap_head & (cap_size - 1)]
+  uint8_t cap_byte;                //DALI_CAPTURE_WINDOW: samples being collected, MSB is oldest
+  uint8_t cap_bits;                //samples in cap_byte
+  uint8_t cap_pos;                 //bytes in the record being filled
 
   //TRANSMITTER
   volatile uint8_t txhbdata[9];    //half bit data to transmit (max 32 bits = 2+64+4 half bits = 9 bytes)
@@ -118,24 +484,30 @@ private:
   volatile uint8_t txhigh;         //currently bus is high
   volatile uint8_t txcollision;    //collision count (capped at 255)
 
-  //hardware abstraction layer
-  uint8_t (*bus_is_high)(); //returns !=0 if DALI bus is in high (non-asserted) state
-  void (*bus_set_low)(); //set DALI bus in low (asserted) state
-  void (*bus_set_high)(); //set DALI bus in high (released) state
-
   void _init();
   void _set_busstate_idle();
-  void _tx_push_2hb(uint8_t hb);
-
-
-  uint8_t _man_weight(uint8_t i);
-  uint8_t _man_sample(volatile uint8_t *edata, uint16_t bitpos, uint8_t *stop_coll);
-  uint8_t _man_decode(volatile uint8_t *edata, uint8_t ebitlen, uint8_t *ddata);
+  void _tx_push_hb(uint16_t hb, uint8_t cnt);
+  void _rx_complete(const uint8_t *data, uint8_t len, uint8_t margin, int64_t end_us);
+  void _bus_end(uint8_t len, int64_t end_us);
+  void _edge_timer();
+  void _timer_on();
+  void _tx_start(const uint8_t *data, uint8_t bitlen);
+  void _xfer_timer();
+  void _xfer_done(DaliXfer *x, int16_t result);
+  void _capture_sample(uint8_t busishigh);
+  void _capture_frame();
 
   //-------------------------------------------------
   //HIGH LEVEL PRIVATE
-  uint8_t _check_yaaaaaa(uint8_t yaaaaaa); //check for yaaaaaa pattern
   uint8_t _set_value(uint16_t setcmd, uint16_t getcmd, uint8_t v, uint8_t adr); //set a parameter value, returns 0 on success
+  DaliCmdFrame _cmd_frame(uint16_t cmd, uint8_t arg); //the forward frame of cmd()
+  uint32_t _rand();
+  uint32_t _settle_us(uint8_t flags, uint8_t collisions); //random settling time in the priority window
+  int16_t _submit(const uint8_t *data, uint8_t bitlen, uint8_t flags, DaliXferCallback cb, void *ctx, uint32_t timeout_ms, int64_t phase_us);
+  void _search_set(DaliSearch *s, uint32_t adr); //search address, only the bytes that changed
+  uint8_t _search_compare(DaliSearch *s, uint32_t adr); //COMPARE at adr
+  void _search_bound(DaliSearch *s, uint32_t adr); //remember a yes of COMPARE
+  bool _search_withdrawn(DaliSearch *s, uint32_t adr); //random address withdrawn earlier in this search
 
 };
 
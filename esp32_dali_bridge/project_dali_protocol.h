@@ -2,6 +2,8 @@
 #define PROJECT_DALI_PROTOCOL_H
 
 #include <Arduino.h>
+#include "project_config.h"
+#include "project_dali_command.h"
 
 #define DALI_OFF 0x00
 #define DALI_UP 0x01
@@ -68,6 +70,8 @@
 
 struct DaliMessage {
     unsigned long timestamp;
+    int64_t start_us;  // esp_timer time of the start bit, latched by the timer ISR (0 = own frame, not sent yet)
+    int64_t end_us;    // esp_timer time the frame ended on the bus (0 = own frame)
     uint8_t raw_bytes[4];
     uint8_t length;
     bool is_tx;
@@ -85,27 +89,6 @@ struct DaliMessage {
     } parsed;
 };
 
-struct DaliCommand {
-    String command_type;
-    uint8_t address;
-    String address_type;
-    uint8_t level;
-    uint8_t scene;
-    uint8_t group;
-    uint8_t fade_time;
-    uint8_t fade_rate;
-    bool force;
-    unsigned long queued_at;
-    uint8_t priority;
-    uint8_t retry_count;
-    // DT8 Color control fields
-    uint8_t color_r;
-    uint8_t color_g;
-    uint8_t color_b;
-    uint8_t color_w;
-    uint16_t color_temp_kelvin;
-};
-
 struct DaliDevice {
     uint8_t address;
     String type;
@@ -121,6 +104,30 @@ struct DaliScanResult {
     uint8_t total_found;
 };
 
+// Background scan: one query per step, advanced by updateDaliScan()
+enum DaliScanStep {
+    SCAN_QUERY_PRESENT = 0,    // Broadcast, is there any control gear at all
+    SCAN_QUERY_STATUS,
+    SCAN_QUERY_MIN_LEVEL,
+    SCAN_QUERY_MAX_LEVEL
+};
+
+struct DaliScanProgress {
+    bool running;
+    bool publish;              // Publish the result over MQTT when done
+    DaliScanStep step;
+    uint8_t address;
+    uint8_t retry;             // Failed attempts of the current query
+    bool garbled;              // Garbled QUERY STATUS reply, not confirmed yet
+    uint8_t found;             // Devices found so far
+    uint64_t found_mask;       // Their short addresses
+    uint64_t known;            // Short addresses found by the last scan
+    int16_t handle;            // Query on the bus (-1 = none)
+    bool reply_ready;          // Query finished, reply not yet handled
+    int16_t reply;
+    DaliDevice device;         // Device being queried
+};
+
 enum CommissioningState {
     COMM_IDLE = 0,
     COMM_INITIALIZING,
@@ -143,6 +150,119 @@ struct CommissioningProgress {
     int progress_percent;
 };
 
+// Status line of a commissioning report, the text is built loop-side
+enum CommissioningMessage {
+    COMM_MSG_INITIALISE = 0,
+    COMM_MSG_INITIALISE_FAILED,
+    COMM_MSG_RANDOMISE,
+    COMM_MSG_RANDOMISE_FAILED,
+    COMM_MSG_SEARCH_BEGIN,
+    COMM_MSG_SEARCHING,
+    COMM_MSG_PROGRAMMING,      // Device devices_found
+    COMM_MSG_NO_FREE_ADDRESS,
+    COMM_MSG_NONE_FOUND,
+    COMM_MSG_VERIFYING,
+    COMM_MSG_COMPLETE          // devices_programmed devices
+};
+
+// Commissioning progress as the DALI task reports it, POD so that it can go
+// through the event queue; processDaliEvents() turns it into CommissioningProgress
+struct CommissioningReport {
+    CommissioningState state;
+    CommissioningMessage message;
+    uint32_t start_timestamp;
+    uint8_t devices_found;
+    uint8_t devices_programmed;
+    uint8_t current_address;
+    uint8_t next_free_address;
+    uint32_t current_random_address;
+    uint8_t progress_percent;
+};
+
+// Reports of the DALI task to the loop, see processDaliEvents()
+enum DaliEventType {
+    DALI_EVENT_FRAME = 0,      // Frame received from the bus or sent by us
+    DALI_EVENT_SCAN_START,     // Scan started, value = timestamp (s)
+    DALI_EVENT_SCAN_DEVICE,    // Device found, data = address, min level, max level
+    DALI_EVENT_SCAN_DONE,      // Scan finished, flag = publish the result
+    DALI_EVENT_COMMISSIONING,  // Commissioning progress
+    DALI_EVENT_STATUS,         // Poller saw a status change, data = address, status, previous status;
+                               // flag = no reply (missing), value = 0 if there was no previous status
+    DALI_EVENT_REPLY           // Reply to one of our 16-bit queries, data = forward frame, value = reply
+};
+
+struct DaliEvent {
+    DaliEventType type;
+    uint8_t data[4];           // FRAME: frame bytes as rx() delivers them
+    uint8_t length;            // FRAME: bytes in data
+    bool is_tx;                // FRAME: sent by us
+    bool flag;                 // SCAN_DEVICE: lamp failure, SCAN_DONE: publish, STATUS: missing
+    uint32_t value;
+    int64_t start_us;          // FRAME: latched by the timer ISR
+    int64_t end_us;
+    CommissioningReport progress;    // COMMISSIONING
+};
+
+// Health poller state of one short address, DALI task side
+struct DaliPollEntry {
+    uint32_t due_ms;           // millis() of the next QUERY STATUS
+    uint32_t interval_ms;      // Doubles while the status stays the same
+    int16_t status;            // Last status byte, -1 = none yet or missing
+    uint8_t misses;            // QUERY STATUS without a reply in a row
+};
+
+// Cached state of one short address (loop side), see updateDeviceState()
+enum DaliStateField {
+    DALI_STATE_ACTUAL_LEVEL = 0,
+    DALI_STATE_MIN_LEVEL,
+    DALI_STATE_MAX_LEVEL,
+    DALI_STATE_POWER_ON_LEVEL,
+    DALI_STATE_SYSTEM_FAILURE_LEVEL,
+    DALI_STATE_FADE,           // Fade time << 4 | fade rate
+    DALI_STATE_DEVICE_TYPE,
+    DALI_STATE_GROUPS_0_7,     // Group membership bits
+    DALI_STATE_GROUPS_8_15,
+    DALI_STATE_PHYSICAL_MIN_LEVEL,
+    DALI_STATE_VERSION,
+    DALI_STATE_DTR0,           // Written by the DTR special commands to every device
+    DALI_STATE_DTR1,
+    DALI_STATE_DTR2,
+    DALI_STATE_STATUS,
+    DALI_STATE_SCENE0,         // 16 scene levels, 255 = not in the scene
+    DALI_STATE_FIELDS = DALI_STATE_SCENE0 + 16
+};
+
+struct DaliDeviceState {
+    uint8_t value[DALI_STATE_FIELDS];
+    uint32_t verified[DALI_STATE_FIELDS];  // millis() the value was last seen, 0 = unknown
+};
+
+// Last forward frame seen on the bus that can be answered, see pairBusFrame()
+struct DaliPendingQuery {
+    bool open;                 // Waiting for the reply window to pass
+    uint8_t address_byte;      // 16-bit: address byte (special commands: the command)
+    uint8_t opcode;            // 16-bit: opcode or special command data
+    uint8_t bits;              // 16 or 24
+    int64_t end_us;            // End of the forward frame, latched by the timer ISR
+};
+
+// Reply latency of one short address, fed by the driver's reply monitor
+struct ReplyStats {
+    uint32_t buckets[REPLY_HIST_BUCKETS];  // valid replies by latency, see REPLY_HIST_xxx
+    uint32_t no_reply;                     // query sent, nothing came back
+    uint32_t garbled;                      // something came back, but not an 8-bit backward frame
+};
+
+// Command queue counters of one priority, see processCommandQueue()
+struct DaliQueueStats {
+    uint32_t queued;         // accepted by enqueueDaliCommand()
+    uint32_t refused;        // over the limit of the priority, or the queue was full
+    uint32_t sent;           // taken by the DALI task
+    uint32_t aged;           // taken ahead of a higher priority because of its wait
+    uint32_t wait_total_ms;  // time from queued_at to being taken, over all sent
+    uint32_t wait_max_ms;
+};
+
 // Passive device discovery - minimal RAM (4 bytes per address = 256 bytes total)
 // Learned from bus traffic without active scanning
 struct PassiveDevice {
@@ -0,0 +1,80 @@
+#ifndef PROJECT_DALI_QUEUE_H
+#define PROJECT_DALI_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <utility>
+
+// Bounded lock-free queue between the DALI task and the web/MQTT side: any
+// number of producers, one consumer. Every slot carries a sequence number
+// (D. Vyukov's bounded queue): a producer claims a position with a CAS on the
+// tail, fills the slot and then hands it over by storing the next sequence
+// number, so the consumer never sees a half written entry and neither side
+// ever waits for the other. SIZE must be a power of two.
+template<typename T, uint16_t SIZE>
+class DaliMpscQueue {
+  static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "queue size must be a power of two");
+
+public:
+  DaliMpscQueue() : head(0), tail(0) {
+    for (uint32_t i = 0; i < SIZE; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  // Any task, returns false if the queue is full
+  bool push(const T& item) {
+    uint32_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& slot = slots[pos & (SIZE - 1)];
+      int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot.item = item;
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+        // Another producer took the position, pos now holds the new tail
+      } else if (diff < 0) {
+        return false;  // The consumer has not emptied this slot yet
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer task only, returns false if the queue is empty
+  bool pop(T& item) {
+    uint32_t pos = head.load(std::memory_order_relaxed);
+    Slot& slot = slots[pos & (SIZE - 1)];
+    if ((int32_t)(slot.seq.load(std::memory_order_acquire) - (pos + 1)) < 0) return false;
+    item = std::move(slot.item);  // Leaves no heap memory behind in the slot
+    slot.seq.store(pos + SIZE, std::memory_order_release);
+    head.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Consumer task only: the next entry without taking it, nullptr if the queue is empty
+  const T* peek() const {
+    uint32_t pos = head.load(std::memory_order_relaxed);
+    const Slot& slot = slots[pos & (SIZE - 1)];
+    if ((int32_t)(slot.seq.load(std::memory_order_acquire) - (pos + 1)) < 0) return nullptr;
+    return &slot.item;
+  }
+
+  // Entries queued or being written, for diagnostics from any task
+  uint16_t size() const {
+    uint32_t h = head.load(std::memory_order_acquire);  // Head first, it never passes the tail
+    uint32_t n = tail.load(std::memory_order_acquire) - h;
+    return (n > SIZE) ? SIZE : n;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    T item;
+  };
+  Slot slots[SIZE];
+  std::atomic<uint32_t> head;  // Next position to read, written by the consumer
+  std::atomic<uint32_t> tail;  // Next position to claim, advanced by the producers
+};
+
+#endif
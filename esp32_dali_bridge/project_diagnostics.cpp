@@ -5,19 +5,88 @@
 #include "project_dali_handler.h"
 #include "base_mqtt.h"
 
+// Bucket bounds of the reply latency histograms, e.g. "<5.5", "5.5-6.5", ">10.5" (ms)
+static String replyBucketLabel(uint8_t i) {
+  float lo = (REPLY_HIST_FIRST_US + (i - 1) * REPLY_HIST_BUCKET_US) / 1000.0;
+  float hi = (REPLY_HIST_FIRST_US + i * REPLY_HIST_BUCKET_US) / 1000.0;
+  if (i == 0) return "<" + String(hi, 1);
+  if (i == REPLY_HIST_BUCKETS - 1) return ">" + String(lo, 1);
+  return String(lo, 1) + "-" + String(hi, 1);
+}
+
+static String queuePriorityName(uint8_t p) {
+  if (p == DALI_COMMAND_PRIORITY_HIGH) return tr("sürgős", "high");
+  if (p == DALI_COMMAND_PRIORITY_NORMAL) return tr("normál", "normal");
+  return tr("alacsony", "low");
+}
+
+static uint32_t queueWaitAvg(const DaliQueueStats& st) {
+  return st.sent ? st.wait_total_ms / st.sent : 0;
+}
+
+static bool hasReplyStats(const ReplyStats& st) {
+  if (st.no_reply || st.garbled) return true;
+  for (uint8_t i = 0; i < REPLY_HIST_BUCKETS; i++) {
+    if (st.buckets[i]) return true;
+  }
+  return false;
+}
+
 std::vector<DiagnosticSection> appDiagnosticSections() {
   std::vector<DiagnosticSection> sections;
 
-  uint8_t queueSize = (queueTail >= queueHead) ? (queueTail - queueHead) : (COMMAND_QUEUE_SIZE - queueHead + queueTail);
+  uint8_t queueSize = daliCommandQueueDepth();
 
   DiagnosticSection daliSection;
   daliSection.title = tr("DALI diagnosztika", "DALI Diagnostics");
-  daliSection.items.push_back({tr("Busz állapot", "Bus State"), busIsIdle ? tr("Üresjárat", "Idle") : tr("Aktív", "Active")});
-  daliSection.items.push_back({tr("Parancssor", "Command Queue"), String(queueSize) + " / " + String(COMMAND_QUEUE_SIZE)});
+  daliSection.items.push_back({tr("Busz állapot", "Bus State"), isBusIdle() ? tr("Üresjárat", "Idle") : tr("Aktív", "Active")});
+  uint16_t queueLimit = 0;
+  for (uint8_t p = 0; p < DALI_COMMAND_PRIORITIES; p++) queueLimit += daliCommandQueueLimit(p);
+  daliSection.items.push_back({tr("Parancssor", "Command Queue"), String(queueSize) + " / " + String(queueLimit)});
   daliSection.items.push_back({tr("Passzív eszközök", "Passive Devices"), String(getPassiveDeviceCount())});
+  daliSection.items.push_back({tr("Figyelt eszközök", "Polled Devices"), String(daliPolledCount())});
+  daliSection.items.push_back({tr("Vételi sor", "RX Queue"), String(dali.rx_queued()) + " / " + String(DALI_RX_QUEUE_SIZE - 1)});
+  daliSection.items.push_back({tr("Vételi sor túlcsordulás", "RX Queue Overruns"), String(dali.rxoverrun)});
+  daliSection.items.push_back({tr("Gyenge vett keretek", "RX Weak Frames"), String(dali.rxweak)});
+  daliSection.items.push_back({tr("Időzítő megszakítás ciklusok", "Timer ISR Cycles"), String(daliIsrCyclesAvg) + tr(" átl. / ", " avg / ") + String(daliIsrCyclesMax) + " max"});
+  daliSection.items.push_back({tr("Adási ütközések", "TX Collisions"), String(dali.xfer_collisions)});
+  daliSection.items.push_back({tr("DALI taszk", "DALI Task"), String(tr("mag ", "core ")) + String(DALI_TASK_CORE) + ", " + String(uxTaskGetStackHighWaterMark(daliTaskHandle)) + tr(" bájt szabad verem", " bytes stack free")});
+  daliSection.items.push_back({tr("Eldobott események", "Dropped Events"), String(daliEventOverflow)});
   daliSection.items.push_back({tr("Utolsó aktivitás", "Last Activity"), String((millis() - lastBusActivityTime) / 1000) + tr(" mp-e", "s ago")});
   sections.push_back(daliSection);
 
+  DiagnosticSection queueSection;
+  queueSection.title = tr("Parancssor prioritások", "Command Queue Priorities");
+  queueSection.items.push_back({tr("Oszlopok", "Columns"), tr("sorban / korlát, elküldve, elutasítva, öregedéssel előre, várakozás átl. / max", "queued / limit, sent, refused, moved up by age, wait avg / max")});
+  for (uint8_t p = 0; p < DALI_COMMAND_PRIORITIES; p++) {
+    const DaliQueueStats& st = commandQueueStats[p];
+    String value = String(daliCommandQueueDepth(p)) + " / " + String(daliCommandQueueLimit(p)) + ", ";
+    value += String(st.sent) + ", " + String(st.refused) + ", " + String(st.aged) + ", ";
+    value += String(queueWaitAvg(st)) + " / " + String(st.wait_max_ms) + " ms";
+    queueSection.items.push_back({String(p) + " (" + queuePriorityName(p) + ")", value});
+  }
+  sections.push_back(queueSection);
+
+  DiagnosticSection replySection;
+  replySection.title = tr("Válaszidők (ms)", "Reply Latency (ms)");
+  String bounds = "";
+  for (uint8_t i = 0; i < REPLY_HIST_BUCKETS; i++) {
+    if (i > 0) bounds += " / ";
+    bounds += replyBucketLabel(i);
+  }
+  replySection.items.push_back({tr("Tartományok", "Buckets"), bounds + tr(" / nincs válasz / hibás", " / no reply / garbled")});
+  for (uint8_t a = 0; a < DALI_MAX_ADDRESSES; a++) {
+    const ReplyStats& st = replyStats[a];
+    if (!hasReplyStats(st)) continue;
+    String counts = "";
+    for (uint8_t i = 0; i < REPLY_HIST_BUCKETS; i++) {
+      counts += String(st.buckets[i]) + " / ";
+    }
+    counts += String(st.no_reply) + " / " + String(st.garbled);
+    replySection.items.push_back({String(tr("Cím ", "Address ")) + String(a), counts});
+  }
+  sections.push_back(replySection);
+
   DiagnosticSection mqttSection;
   mqttSection.title = tr("MQTT diagnosztika", "MQTT Diagnostics");
   mqttSection.items.push_back({tr("MQTT engedélyezve", "MQTT Enabled"), mqtt_enabled ? tr("Igen", "Yes") : tr("Nem", "No")});
@@ -30,15 +99,61 @@ std::vector<DiagnosticSection> appDiagnosticSections() {
 }
 
 String appDiagnosticsJSON() {
-  uint8_t queueSize = (queueTail >= queueHead) ? (queueTail - queueHead) : (COMMAND_QUEUE_SIZE - queueHead + queueTail);
+  uint8_t queueSize = daliCommandQueueDepth();
 
   String json = "{";
   json += "\"dali\":{";
-  json += "\"bus_idle\":" + String(busIsIdle ? "true" : "false") + ",";
+  json += "\"bus_idle\":" + String(isBusIdle() ? "true" : "false") + ",";
   json += "\"queue_size\":" + String(queueSize) + ",";
+  json += "\"queue_priorities\":[";
+  for (uint8_t p = 0; p < DALI_COMMAND_PRIORITIES; p++) {
+    const DaliQueueStats& st = commandQueueStats[p];
+    if (p > 0) json += ",";
+    json += "{\"priority\":" + String(p) + ",";
+    json += "\"depth\":" + String(daliCommandQueueDepth(p)) + ",";
+    json += "\"limit\":" + String(daliCommandQueueLimit(p)) + ",";
+    json += "\"queued\":" + String(st.queued) + ",";
+    json += "\"refused\":" + String(st.refused) + ",";
+    json += "\"sent\":" + String(st.sent) + ",";
+    json += "\"aged\":" + String(st.aged) + ",";
+    json += "\"wait_avg_ms\":" + String(queueWaitAvg(st)) + ",";
+    json += "\"wait_max_ms\":" + String(st.wait_max_ms) + "}";
+  }
+  json += "],";
   json += "\"passive_devices\":" + String(getPassiveDeviceCount()) + ",";
+  json += "\"polled_devices\":" + String(daliPolledCount()) + ",";
+  json += "\"rx_queued\":" + String(dali.rx_queued()) + ",";
+  json += "\"rx_overruns\":" + String(dali.rxoverrun) + ",";
+  json += "\"rx_weak\":" + String(dali.rxweak) + ",";
+  json += "\"isr_cycles_avg\":" + String(daliIsrCyclesAvg) + ",";
+  json += "\"isr_cycles_max\":" + String(daliIsrCyclesMax) + ",";
+  json += "\"tx_collisions\":" + String(dali.xfer_collisions) + ",";
+  json += "\"task_stack_free\":" + String(uxTaskGetStackHighWaterMark(daliTaskHandle)) + ",";
+  json += "\"event_overflow\":" + String(daliEventOverflow) + ",";
   json += "\"last_activity_ms\":" + String(millis() - lastBusActivityTime);
   json += "},";
+  json += "\"reply_latency\":{";
+  json += "\"bucket_us\":[";
+  for (uint8_t i = 1; i < REPLY_HIST_BUCKETS; i++) {
+    if (i > 1) json += ",";
+    json += String(REPLY_HIST_FIRST_US + (i - 1) * REPLY_HIST_BUCKET_US);
+  }
+  json += "],\"addresses\":[";
+  bool first = true;
+  for (uint8_t a = 0; a < DALI_MAX_ADDRESSES; a++) {
+    const ReplyStats& st = replyStats[a];
+    if (!hasReplyStats(st)) continue;
+    if (!first) json += ",";
+    first = false;
+    json += "{\"address\":" + String(a) + ",\"buckets\":[";
+    for (uint8_t i = 0; i < REPLY_HIST_BUCKETS; i++) {
+      if (i > 0) json += ",";
+      json += String(st.buckets[i]);
+    }
+    json += "],\"no_reply\":" + String(st.no_reply) + ",\"garbled\":" + String(st.garbled) + "}";
+  }
+  json += "]";
+  json += "},";
   json += "\"mqtt\":{";
   json += "\"enabled\":" + String(mqtt_enabled ? "true" : "false") + ",";
   json += "\"connected\":" + String(mqttClient.connected() ? "true" : "false") + ",";
@@ -17,11 +17,16 @@ void appInit() {
   server.on("/api/commission/progress", handleAPICommissionProgress);
   server.on("/api/recent", handleAPIRecent);
   server.on("/api/passive_devices", handleAPIPassiveDevices);
+  server.on("/api/device_state", handleAPIDeviceState);
+  server.on("/api/scan", handleAPIScan);
+  server.on("/api/capture", HTTP_GET, handleAPICapture);
+  server.on("/api/capture", HTTP_POST, handleAPICaptureControl);
 }
 
+// The DALI engine runs in its own task (daliTask), the loop only takes its
+// events: monitor frames, scan results and commissioning progress
 void appLoop() {
-  monitorDaliBus();
-  processCommandQueue();
+  processDaliEvents();
 }
 
 void handleFunctionPage() {
@@ -139,7 +144,12 @@ void handleFunctionPage() {
 
   html += "function scanDevices(){";
   html += "document.getElementById('scan-results').innerHTML='<p>" + String(tr("Keresés...", "Scanning...")) + "</p>';";
-  html += "fetch('/dali/scan',{method:'POST'}).then(r=>r.json()).then(d=>{";
+  html += "fetch('/dali/scan',{method:'POST'}).then(()=>setTimeout(pollScan,500))";
+  html += ".catch(e=>document.getElementById('scan-results').innerHTML='<p>" + String(tr("Hiba: ", "Error: ")) + "'+e+'</p>');";
+  html += "}";
+  html += "function pollScan(){";
+  html += "fetch('/api/scan').then(r=>r.json()).then(d=>{";
+  html += "if(d.running){document.getElementById('scan-results').innerHTML='<p>" + String(tr("Keresés... ", "Scanning... ")) + "'+d.address+'/64</p>';setTimeout(pollScan,500);return;}";
   html += "let html='<p>" + String(tr("Talált ", "Found ")) + "'+d.total_found+'" + String(tr(" eszközt:", " devices:")) + "</p><ul>';";
   html += "d.devices.forEach(dev=>html+='<li>" + String(tr("Cím ", "Address ")) + "'+dev.address+' - '+dev.status+'</li>');";
   html += "html+='</ul>';document.getElementById('scan-results').innerHTML=html;";
@@ -205,26 +215,45 @@ void handleFunctionPage() {
 void handleDALISend() {
   if (!checkAuth()) return;
 
-  String command = server.arg("command");
-  uint8_t address = server.arg("address").toInt();
-  uint8_t level = server.arg("level").toInt();
-  uint8_t scene = server.arg("scene").toInt();
-
-  DaliCommand cmd;
-  cmd.command_type = command;
-  cmd.address = address;
-  cmd.address_type = (address == 0xFF) ? "broadcast" : "short";
-  cmd.level = level;
-  cmd.scene = scene;
-  cmd.group = 0;
-  cmd.fade_time = 0;
-  cmd.fade_rate = 0;
-  cmd.force = false;
+  // The command name is resolved here, once; the arguments go to the fields of its op
+  DaliCommand cmd = {};
+  cmd.op = daliCommandOp(server.arg("command").c_str());
+  cmd.address = server.arg("address").toInt();
   cmd.queued_at = millis();
+  cmd.priority = server.hasArg("priority") ? server.arg("priority").toInt() : DALI_COMMAND_PRIORITY_NORMAL;
+
+  if (cmd.op == DALI_OP_SET_BRIGHTNESS) {
+    cmd.level = server.arg("level").toInt();
+  } else if (cmd.op == DALI_OP_GO_TO_SCENE || cmd.op == DALI_OP_QUERY_SCENE_LEVEL) {
+    cmd.scene = server.arg("scene").toInt();
+  } else if (cmd.op == DALI_OP_DEVICE_COMMAND) {
+    String address_type = server.hasArg("address_type") ? server.arg("address_type") : (cmd.address == 0xFF) ? "broadcast" : "short";
+    cmd.address_type = daliAddressType(address_type.c_str());
+    cmd.device.instance = deviceInstanceByte(cmd.address_type, server.arg("instance_type"), server.arg("instance").toInt());
+    cmd.device.opcode = server.arg("opcode").toInt();
+  } else if (cmd.op == DALI_OP_RAW) {
+    setRawFrame(cmd, server.arg("frame"), server.arg("bits").toInt());
+    if (server.arg("reply") == "1" || server.arg("reply") == "true") cmd.raw.flags |= DALI_COMMAND_REPLY;
+    if (server.arg("twice") == "1" || server.arg("twice") == "true") cmd.raw.flags |= DALI_COMMAND_TWICE;
+  }
 
   bool valid = validateDaliCommand(cmd);
   String json = "{";
-  if (valid && enqueueDaliCommand(cmd)) {
+  // Queries are answered from the device state cache unless cache=0
+  int16_t reply;
+  uint32_t age_ms;
+  bool cache = server.arg("cache") != "0" && server.arg("cache") != "false";
+  if (valid && cache && answerQueryFromCache(cmd, &reply, &age_ms)) {
+    String answer = (reply < 0) ? String(tr("Nem (nincs válasz)", "No (no reply)")) : "0x" + String(reply, HEX) + " (" + String(reply) + ")";
+    json += "\"success\":true,";
+    json += "\"cached\":true,";
+    json += "\"reply\":" + (reply < 0 ? String("null") : String(reply)) + ",";
+    json += "\"age_ms\":" + String(age_ms) + ",";
+    json += "\"title\":\"" + String(tr("✓ Válasz a gyorsítótárból", "✓ Answer from Cache")) + "\",";
+    json += "\"message\":\"" + answer + ", " + String(age_ms / 1000) + String(tr(" mp-es adat", " s old")) + "\"";
+    json += "}";
+    server.send(200, "application/json", json);
+  } else if (valid && enqueueDaliCommand(cmd)) {
     json += "\"success\":true,";
     json += "\"title\":\"" + String(tr("✓ Parancs elküldve", "✓ Command Sent")) + "\",";
     json += "\"message\":\"" + String(tr("A parancs sikeresen sorba állítva, hamarosan a DALI buszra kerül.", "Command queued successfully and will be sent to the DALI bus.")) + "\"";
@@ -239,16 +268,29 @@ void handleDALISend() {
   }
 }
 
+// The scan runs in the background, progress and result are polled from /api/scan
 void handleDALIScan() {
-  DaliScanResult result = scanDaliDevices();
+  bool started = requestDaliScan(false);
+
+  String json = "{";
+  json += "\"success\":true,";
+  json += "\"started\":" + String(started ? "true" : "false");
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+void handleAPIScan() {
+  if (!checkAuth()) return;
 
-  String json = "{\"scan_timestamp\":" + String(result.scan_timestamp) + ",\"devices\":[";
-  for (size_t i = 0; i < result.devices.size(); i++) {
+  String json = "{\"running\":" + String(isDaliScanRunning() ? "true" : "false") + ",";
+  json += "\"address\":" + String(scanProgress.address) + ",";
+  json += "\"scan_timestamp\":" + String(scanResult.scan_timestamp) + ",\"devices\":[";
+  for (size_t i = 0; i < scanResult.devices.size(); i++) {
     if (i > 0) json += ",";
-    const DaliDevice& dev = result.devices[i];
+    const DaliDevice& dev = scanResult.devices[i];
     json += "{\"address\":" + String(dev.address) + ",\"status\":\"ok\"}";
   }
-  json += "],\"total_found\":" + String(result.total_found) + "}";
+  json += "],\"total_found\":" + String(scanResult.total_found) + "}";
 
   server.send(200, "application/json", json);
 }
@@ -264,13 +306,14 @@ void handleDALICommission() {
   Serial.printf("[Web] Starting commissioning from address %d\n", start_address);
 #endif
 
+  // Runs in the DALI task, progress is polled from /api/commission/progress
+  bool started = requestCommissioning(start_address);
+
   String json = "{";
-  json += "\"success\":true,";
-  json += "\"message\":\"" + String(tr("Címzés elindítva", "Commissioning started")) + "\"";
+  json += "\"success\":" + String(started ? "true" : "false") + ",";
+  json += "\"message\":\"" + String(started ? tr("Címzés elindítva", "Commissioning started") : tr("A címzés már fut", "Commissioning already running")) + "\"";
   json += "}";
   server.send(200, "application/json", json);
-
-  commissionDevices(start_address);
 }
 
 void handleAPICommissionProgress() {
@@ -309,6 +352,8 @@ void handleAPIRecent() {
 
     if (json.length() > 1) json += ",";
     json += "{\"timestamp\":" + String(msg.timestamp) + ",";
+    json += "\"start_us\":" + String(msg.start_us) + ",";
+    json += "\"end_us\":" + String(msg.end_us) + ",";
     json += "\"is_tx\":" + String(msg.is_tx ? "true" : "false") + ",";
     json += "\"raw\":\"";
     for (int b = 0; b < msg.length; b++) {
@@ -345,3 +390,89 @@ void handleAPIPassiveDevices() {
 
   server.send(200, "application/json", json);
 }
+
+// Device state cache, all addresses with a known field or ?address=N.
+// Every known field is value and age in seconds.
+void handleAPIDeviceState() {
+  if (!checkAuth()) return;
+
+  static const char* const names[DALI_STATE_SCENE0] = {
+    "actual_level", "min_level", "max_level", "power_on_level", "system_failure_level",
+    "fade", "device_type", "groups_0_7", "groups_8_15", "physical_min_level", "version",
+    "dtr0", "dtr1", "dtr2", "status"
+  };
+  int16_t only = server.hasArg("address") ? server.arg("address").toInt() : -1;
+
+  String json = "{\"devices\":[";
+  bool first = true;
+  for (uint8_t a = 0; a < DALI_MAX_ADDRESSES; a++) {
+    if (only >= 0 && a != only) continue;
+    String fields = "";
+    String scenes = "";
+    for (uint8_t f = 0; f < DALI_STATE_FIELDS; f++) {
+      uint8_t value;
+      uint32_t age_ms;
+      if (!getDeviceState(a, f, &value, &age_ms)) continue;
+      String item = "{\"value\":" + String(value) + ",\"age\":" + String(age_ms / 1000) + "}";
+      if (f < DALI_STATE_SCENE0) {
+        fields += ",\"" + String(names[f]) + "\":" + item;
+      } else {
+        if (scenes.length() > 0) scenes += ",";
+        scenes += "\"" + String(f - DALI_STATE_SCENE0) + "\":" + item;
+      }
+    }
+    if (fields.length() == 0 && scenes.length() == 0) continue;
+    if (!first) json += ",";
+    first = false;
+    json += "{\"address\":" + String(a) + fields;
+    if (scenes.length() > 0) json += ",\"scenes\":{" + scenes + "}";
+    json += "}";
+  }
+  json += "]}";
+
+  server.send(200, "application/json", json);
+}
+
+// Raw sample capture as a binary file (DaliCaptureHeader, then the records), for tools/dali_sim/dali_replay
+void handleAPICapture() {
+  if (!checkAuth()) return;
+
+  DaliCaptureHeader header;
+  memcpy(header.magic, DALI_CAPTURE_MAGIC, sizeof(header.magic));
+  header.record_size = sizeof(DaliCaptureRecord);
+  header.sample_hz = DALI_SAMPLE_HZ;
+
+  server.sendHeader("Content-Disposition", "attachment; filename=\"dali_capture.bin\"");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/octet-stream", "");
+  server.sendContent((const char*)&header, sizeof(header));
+
+  // Copy a few records at a time, the ring keeps filling while we send
+  static DaliCaptureRecord chunk[8];
+  uint32_t pos = 0;
+  uint32_t end = dali.capture_count();
+  while (pos < end) {
+    uint16_t n = dali.capture_read(&pos, chunk, 8);
+    if (n == 0) break;
+    server.sendContent((const char*)chunk, n * sizeof(DaliCaptureRecord));
+  }
+  server.sendContent("");
+}
+
+// Start or stop the capture: mode=frames|window|off
+void handleAPICaptureControl() {
+  if (!checkAuth()) return;
+
+  String mode = server.arg("mode");
+  uint8_t m = DALI_CAPTURE_OFF;
+  if (mode == "frames") m = DALI_CAPTURE_FRAMES;
+  else if (mode == "window") m = DALI_CAPTURE_WINDOW;
+  bool ok = setDaliCapture(m);
+
+  String json = "{";
+  json += "\"success\":" + String(ok ? "true" : "false") + ",";
+  json += "\"mode\":\"" + String(dali.capture_mode() == DALI_CAPTURE_FRAMES ? "frames" : dali.capture_mode() == DALI_CAPTURE_WINDOW ? "window" : "off") + "\",";
+  json += "\"records\":" + String(dali.capture_count());
+  json += "}";
+  server.send(ok ? 200 : 400, "application/json", json);
+}
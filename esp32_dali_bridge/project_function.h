@@ -11,5 +11,9 @@ void handleDALICommission();
 void handleAPICommissionProgress();
 void handleAPIRecent();
 void handleAPIPassiveDevices();
+void handleAPIDeviceState();
+void handleAPIScan();
+void handleAPICapture();
+void handleAPICaptureControl();
 
 #endif
@@ -12,11 +12,11 @@ String appHomeHTML() {
   html += "<h2>" + String(tr("DALI busz állapota", "DALI Bus Status")) + "</h2>";
 
   html += "<div class=\"status\">";
-  html += "<div class=\"dot " + String(busIsIdle ? "green" : "yellow") + "\"></div>";
-  html += "<span>" + String(tr("Busz: ", "Bus: ")) + String(busIsIdle ? tr("Üresjárat", "Idle") : tr("Aktív", "Active")) + "</span>";
+  html += "<div class=\"dot " + String(isBusIdle() ? "green" : "yellow") + "\"></div>";
+  html += "<span>" + String(tr("Busz: ", "Bus: ")) + String(isBusIdle() ? tr("Üresjárat", "Idle") : tr("Aktív", "Active")) + "</span>";
   html += "</div>";
 
-  uint8_t queueSize = (queueTail >= queueHead) ? (queueTail - queueHead) : (COMMAND_QUEUE_SIZE - queueHead + queueTail);
+  uint8_t queueSize = daliCommandQueueDepth();
   html += "<div class=\"status\">";
   html += "<div class=\"dot " + String(queueSize > 0 ? "yellow" : "green") + "\"></div>";
   html += "<span>" + String(tr("Sor: ", "Queue: ")) + String(queueSize) + String(tr(" parancs", " commands")) + "</span>";
@@ -59,30 +59,56 @@ void appMqttMessage(const String& topic, const String& payload) {
       return;
     }
 
-    DaliCommand cmd;
-    cmd.command_type = doc["command"].as<String>();
+    // The command name is resolved here, once; the arguments go to the fields of its op
+    DaliCommand cmd = {};
+    cmd.op = daliCommandOp(doc["command"] | "");
     cmd.address = doc["address"] | 0;
-    cmd.level = doc["level"] | 254;
-    cmd.scene = doc["scene"] | 0;
-    cmd.force = doc["force"] | false;
     cmd.queued_at = millis();
-    cmd.priority = doc["priority"] | 1;
-    cmd.retry_count = 0;
-
-    if (doc.containsKey("level_percent")) {
-      float percent = doc["level_percent"].as<float>();
-      cmd.level = (uint8_t)((percent / 100.0) * 254.0);
+    cmd.priority = doc["priority"] | DALI_COMMAND_PRIORITY_NORMAL;
+    bool force = doc["force"] | false;
+
+    if (cmd.op == DALI_OP_SET_BRIGHTNESS) {
+      cmd.level = doc["level"] | 254;
+      if (doc.containsKey("level_percent")) {
+        float percent = doc["level_percent"].as<float>();
+        cmd.level = (uint8_t)((percent / 100.0) * 254.0);
+      }
+    } else if (cmd.op == DALI_OP_GO_TO_SCENE || cmd.op == DALI_OP_QUERY_SCENE_LEVEL) {
+      cmd.scene = doc["scene"] | 0;
+    } else if (cmd.op == DALI_OP_SET_RGB || cmd.op == DALI_OP_SET_RGBW) {
+      cmd.color.r = doc["r"] | 0;
+      cmd.color.g = doc["g"] | 0;
+      cmd.color.b = doc["b"] | 0;
+      cmd.color.w = doc["w"] | 0;
+    } else if (cmd.op == DALI_OP_SET_COLOR_TEMP) {
+      cmd.color_temp_kelvin = doc["kelvin"] | 0;
+    } else if (cmd.op == DALI_OP_DEVICE_COMMAND) {
+      // 24-bit device commands: address_type short/group/broadcast/unaddressed/special,
+      // instance_type number/group/type/all (device command if not given)
+      cmd.address_type = daliAddressType(doc["address_type"] | ((cmd.address == 0xFF) ? "broadcast" : "short"));
+      cmd.device.instance = deviceInstanceByte(cmd.address_type, doc["instance_type"] | "", doc["instance"] | 0);
+      cmd.device.opcode = doc["opcode"] | 0;
+    } else if (cmd.op == DALI_OP_RAW) {
+      // Raw frames: hex string, 16/24/25 bits
+      setRawFrame(cmd, doc["frame"] | "", doc["bits"] | 0);
+      if (doc["reply"] | false) cmd.raw.flags |= DALI_COMMAND_REPLY;
+      if (doc["twice"] | false) cmd.raw.flags |= DALI_COMMAND_TWICE;
     }
 
-    if (validateDaliCommand(cmd) || cmd.force) {
+    // Queries are answered from the device state cache unless "cache": false
+    int16_t reply;
+    uint32_t age_ms;
+    bool cache = doc["cache"] | true;
+    if (validateDaliCommand(cmd) && cache && answerQueryFromCache(cmd, &reply, &age_ms)) {
+      publishCachedReply(cmd, reply, age_ms);
+    } else if (validateDaliCommand(cmd) || force) {
       enqueueDaliCommand(cmd);
     }
   } else if (topic == mqtt_prefix + "scan/trigger") {
 #ifdef DEBUG_SERIAL
     Serial.println("[MQTT] Scan triggered");
 #endif
-    DaliScanResult result = scanDaliDevices();
-    publishScanResult(result);
+    requestDaliScan(true);  // Result is published on scan/result when the scan completes
   } else if (topic == mqtt_prefix + "commission/trigger") {
 #ifdef DEBUG_SERIAL
     Serial.println("[MQTT] Commissioning triggered");
@@ -92,7 +118,7 @@ void appMqttMessage(const String& topic, const String& payload) {
       start_address = payload.toInt();
       if (start_address > 63) start_address = 0;
     }
-    commissionDevices(start_address);
+    requestCommissioning(start_address);  // Progress is published on commission/progress
   }
 }
 
@@ -140,6 +166,8 @@ void publishMonitor(const DaliMessage& msg) {
   String topic = mqtt_prefix + "monitor";
   String json = "{";
   json += "\"timestamp\":" + String(msg.timestamp) + ",";
+  json += "\"start_us\":" + String(msg.start_us) + ",";
+  json += "\"end_us\":" + String(msg.end_us) + ",";
   json += "\"direction\":\"" + String(msg.is_tx ? "tx" : "rx") + "\",";
   json += "\"source\":\"" + msg.source + "\",";
   json += "\"raw\":\"" + bytesToHex((uint8_t*)msg.raw_bytes, msg.length) + "\",";
@@ -176,6 +204,51 @@ void publishScanResult(const DaliScanResult& result) {
   mqttPublish(topic, json, false);
 }
 
+// Query answered from the device state cache, reply -1 = NO. Nothing goes to
+// the bus, so the answer names the query it belongs to.
+void publishCachedReply(const DaliCommand& cmd, int16_t reply, uint32_t age_ms) {
+  if (!mqtt_enabled || !mqttClient.connected()) return;
+
+  String topic = mqtt_prefix + "reply";
+  String json = "{";
+  json += "\"address\":" + String(cmd.address) + ",";
+  json += "\"command\":\"" + String(daliCommandName(cmd.op)) + "\",";
+  if (cmd.op == DALI_OP_QUERY_SCENE_LEVEL) json += "\"scene\":" + String(cmd.scene) + ",";
+  json += "\"reply\":" + (reply < 0 ? String("null") : String(reply)) + ",";
+  json += "\"cached\":true,";
+  json += "\"age_ms\":" + String(age_ms) + ",";
+  json += "\"timestamp\":" + String(millis() / 1000);
+  json += "}";
+
+  mqttPublish(topic, json, false);
+}
+
+// Status change seen by the health poller, status / previous -1 = no reply
+void publishDeviceStatus(uint8_t address, int16_t status, int16_t previous) {
+  if (!mqtt_enabled || !mqttClient.connected()) return;
+
+  String topic = mqtt_prefix + "device/status";
+  String json = "{";
+  json += "\"address\":" + String(address) + ",";
+  json += "\"missing\":" + String(status < 0 ? "true" : "false") + ",";
+  json += "\"status\":" + (status < 0 ? String("null") : String(status)) + ",";
+  json += "\"previous\":" + (previous < 0 ? String("null") : String(previous));
+  if (status >= 0) {
+    // IEC 62386-102 status bits
+    json += ",\"gear_failure\":" + String((status & 0x01) ? "true" : "false");
+    json += ",\"lamp_failure\":" + String((status & 0x02) ? "true" : "false");
+    json += ",\"lamp_on\":" + String((status & 0x04) ? "true" : "false");
+    json += ",\"limit_error\":" + String((status & 0x08) ? "true" : "false");
+    json += ",\"fade_running\":" + String((status & 0x10) ? "true" : "false");
+    json += ",\"reset_state\":" + String((status & 0x20) ? "true" : "false");
+    json += ",\"power_cycle\":" + String((status & 0x80) ? "true" : "false");
+  }
+  json += ",\"timestamp\":" + String(millis() / 1000);
+  json += "}";
+
+  mqttPublish(topic, json, false);
+}
+
 void publishCommissioningProgress(const CommissioningProgress& progress) {
   if (!mqtt_enabled || !mqttClient.connected()) return;
 
@@ -220,7 +293,7 @@ String appMqttTopicsHTML() {
   html += String("<p style=\"margin:0 0 8px 0;font-size:12px;color:var(--text-secondary);\">") + tr("Publikálja a teljes DALI busz-forgalmat forrás mezővel (self/bus)", "Publishes all DALI bus activity with source field (self/bus)") + "</p>";
   html += "<details style=\"margin:8px 0;padding:8px;background:var(--bg-primary);border-radius:4px;\">";
   html += String("<summary style=\"cursor:pointer;color:var(--accent-green);font-weight:500;\">▸ ") + tr("Példa: Monitor üzenet", "Example: Monitor Message") + "</summary>";
-  html += "<pre style=\"background:var(--bg-secondary);padding:12px;border-radius:6px;overflow-x:auto;margin:8px 0;font-size:12px;\">{<br>  \"timestamp\": 1234567890,<br>  \"direction\": \"tx\",<br>  \"source\": \"self\",<br>  \"raw\": \"01FE\",<br>  \"parsed\": {<br>    \"type\": \"direct_arc_power\",<br>    \"address\": 0,<br>    \"level\": 254<br>  }<br>}</pre></details>";
+  html += "<pre style=\"background:var(--bg-secondary);padding:12px;border-radius:6px;overflow-x:auto;margin:8px 0;font-size:12px;\">{<br>  \"timestamp\": 1234567890,<br>  \"start_us\": 0,<br>  \"end_us\": 0,<br>  \"direction\": \"tx\",<br>  \"source\": \"self\",<br>  \"raw\": \"01FE\",<br>  \"parsed\": {<br>    \"type\": \"direct_arc_power\",<br>    \"address\": 0,<br>    \"level\": 254<br>  }<br>}</pre></details>";
 
   html += String("<p style=\"margin:12px 0 4px 0;color:var(--text-secondary);\"><strong>") + tr("Állapot", "Status") + ":</strong> <code style=\"background:var(--bg-primary);padding:2px 6px;border-radius:3px;font-family:monospace;\">" + mqtt_prefix + "status</code></p>";
   html += String("<p style=\"margin:0 0 8px 0;font-size:12px;color:var(--text-secondary);\">") + tr("Eszközállapot publikálva csatlakozáskor és rendszeres időközönként", "Device status published on connect and periodically") + "</p>";
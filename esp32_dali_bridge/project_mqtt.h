@@ -13,5 +13,7 @@ extern MonitorFilter monitorFilter;
 void publishMonitor(const DaliMessage& msg);
 void publishScanResult(const DaliScanResult& result);
 void publishCommissioningProgress(const CommissioningProgress& progress);
+void publishDeviceStatus(uint8_t address, int16_t status, int16_t previous);
+void publishCachedReply(const DaliCommand& cmd, int16_t reply, uint32_t age_ms);
 
 #endif
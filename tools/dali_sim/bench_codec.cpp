@@ -0,0 +1,268 @@
+// bench_codec - compare the table driven Manchester decoder with the original
+// shift-and-branch version, and the streaming (in-ISR) decoder with both.
+//
+// The decoders run on the same inputs: random sample buffers, and synthetic
+// frames at 7..9 samples per bit with optional sample noise. The tool fails
+// (exit 1) if any output differs, then reports ns/frame for each. The
+// streaming decoder only sees the synthetic frames (random buffers have no
+// start/stop structure) and rejects frames over 32 bits, where the batch
+// decoders would run past a 4 byte buffer.
+//
+// Example: bench_codec --frames 200000 --noise 0.02
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "project_dali_codec.h"
+
+#define BUF_SIZE 40 // DALI_RX_BUF_SIZE
+
+//-------------------------------------------------
+// reference: the decoder as it was in project_dali_lib.cpp, with ebitlen
+// widened to uint16_t (rxpos * 8 does not fit in 8 bits for 32-bit frames)
+namespace ref {
+
+static uint8_t man_weight(uint8_t i)
+{
+    int8_t w = 0;
+    w += ((i >> 7) & 1) ? 1 : -1;
+    w += ((i >> 6) & 1) ? 2 : -2;
+    w += ((i >> 5) & 1) ? 2 : -2;
+    w += ((i >> 4) & 1) ? 1 : -1;
+    w -= ((i >> 3) & 1) ? 1 : -1;
+    w -= ((i >> 2) & 1) ? 2 : -2;
+    w -= ((i >> 1) & 1) ? 2 : -2;
+    w -= ((i >> 0) & 1) ? 1 : -1;
+    w *= 2;
+    if (w < 0)
+        w = -w + 1;
+    return w;
+}
+
+static uint8_t man_sample(volatile uint8_t* edata, uint16_t bitpos, uint8_t* stop_coll)
+{
+    uint8_t pos = bitpos >> 3;
+    uint8_t shift = bitpos & 0x7;
+    uint8_t sample = (edata[pos] << shift) | (edata[pos + 1] >> (8 - shift));
+    if (sample == 0xFF)
+        *stop_coll = 1;
+    if (sample == 0x00)
+        *stop_coll = 2;
+    return sample;
+}
+
+static uint8_t man_decode(volatile uint8_t* edata, uint16_t ebitlen, uint8_t* ddata)
+{
+    uint8_t dbitlen = 0;
+    uint16_t ebitpos = 1;
+    while (ebitpos + 1 < ebitlen) {
+        uint8_t stop_coll = 0;
+        uint8_t sample = man_sample(edata, ebitpos, &stop_coll);
+        uint8_t weightmax = man_weight(sample);
+        uint8_t pmax = 8;
+        sample = man_sample(edata, ebitpos - 1, &stop_coll);
+        uint8_t w = man_weight(sample);
+        if (weightmax < w) {
+            weightmax = w;
+            pmax = 7;
+        }
+        sample = man_sample(edata, ebitpos + 1, &stop_coll);
+        w = man_weight(sample);
+        if (weightmax < w) {
+            weightmax = w;
+            pmax = 9;
+        }
+        if (stop_coll == 1)
+            break;
+        if (stop_coll == 2)
+            return 0;
+        if (dbitlen > 0) {
+            uint8_t bytepos = (dbitlen - 1) >> 3;
+            uint8_t bitpos = (dbitlen - 1) & 0x7;
+            if (bitpos == 0)
+                ddata[bytepos] = 0;
+            ddata[bytepos] = (ddata[bytepos] << 1) | (weightmax & 1);
+        }
+        dbitlen++;
+        ebitpos += pmax;
+    }
+    if (dbitlen > 1)
+        dbitlen--;
+    return dbitlen;
+}
+
+} // namespace ref
+
+//-------------------------------------------------
+// one captured frame, laid out like Dali::rxdata after reception.
+// one spare byte, the decoders may peek one byte past rxpos
+struct Capture {
+    uint8_t data[BUF_SIZE + 1];
+    uint8_t len; // bytes, like rxpos
+};
+
+// synthesize what Dali::timer() stores for a frame sent at spb samples per bit
+static Capture synth(std::mt19937& gen, int bits, double spb, double noise)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    uint8_t payload[4];
+    for (int i = 0; i < 4; i++)
+        payload[i] = gen();
+
+    // half bit levels, 1 = bus high: start, data, then 2 stop bits
+    std::vector<uint8_t> hb;
+    hb.push_back(0);
+    hb.push_back(1);
+    for (int i = 0; i < bits; i++) {
+        bool one = payload[i >> 3] & (0x80 >> (i & 7));
+        hb.push_back(one ? 0 : 1);
+        hb.push_back(one ? 1 : 0);
+    }
+    for (int i = 0; i < 4; i++)
+        hb.push_back(1);
+
+    Capture c;
+    memset(c.data, 0, sizeof(c.data));
+    c.len = 0;
+    double phase = unit(gen) * 0.5; // sampling phase inside the first sample
+    uint8_t rxbyte = 0, rxbitcnt = 0, rxidle = 0;
+    for (int s = 0;; s++) {
+        size_t h = (size_t)((s + phase) * 2.0 / spb);
+        uint8_t level = h < hb.size() ? hb[h] : 1;
+        if (noise > 0 && s > 0 && unit(gen) < noise)
+            level = !level;
+        rxbyte = (rxbyte << 1) | level;
+        if (++rxbitcnt == 8) {
+            c.data[c.len] = rxbyte;
+            if (c.len < BUF_SIZE - 1)
+                c.len++;
+            rxbitcnt = 0;
+        }
+        rxidle = level ? rxidle + 1 : 0;
+        if (rxidle >= 16)
+            break;
+    }
+    c.data[c.len++] = 0xFF;
+    return c;
+}
+
+static Capture random_capture(std::mt19937& gen)
+{
+    Capture c;
+    for (int i = 0; i < BUF_SIZE + 1; i++)
+        c.data[i] = gen();
+    c.len = 2 + gen() % (BUF_SIZE - 1);
+    return c;
+}
+
+// feed a capture to the streaming decoder the way Dali::timer() does
+static uint8_t stream_decode(const Capture& c, uint8_t* ddata)
+{
+    DaliManStream st;
+    dali_man_stream_begin(&st);
+    for (int i = 0; i < c.len * 8; i++) {
+        uint8_t r = dali_man_stream_push(&st, (c.data[i >> 3] >> (7 - (i & 7))) & 1);
+        if (r == DALI_MAN_STREAM_ERROR)
+            return 0;
+        if (r == DALI_MAN_STREAM_DONE)
+            break;
+    }
+    memcpy(ddata, st.data, 4);
+    return dali_man_stream_len(&st);
+}
+
+static double wall_s()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 100000;
+    double noise = 0.01;
+    uint32_t seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--frames")) frames = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--noise")) noise = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--seed")) seed = (uint32_t)strtoul(argv[i + 1], nullptr, 0);
+        else {
+            printf("usage: bench_codec [--frames N] [--noise P] [--seed N]\n");
+            return 2;
+        }
+    }
+
+    std::mt19937 gen(seed);
+    static const int bitlens[] = { 8, 16, 24, 25, 32 };
+    std::vector<Capture> caps;
+    caps.reserve(frames);
+    for (int f = 0; f < frames; f++) {
+        switch (f % 4) {
+        case 0:
+            caps.push_back(random_capture(gen));
+            break;
+        case 1: // clean, +/-10% clock
+            caps.push_back(synth(gen, bitlens[gen() % 5], 8.0 * (0.9 + 0.2 * (gen() % 1000) / 1000.0), 0));
+            break;
+        default: // noisy
+            caps.push_back(synth(gen, bitlens[gen() % 5], 8.0 * (0.9 + 0.2 * (gen() % 1000) / 1000.0), noise));
+            break;
+        }
+    }
+
+    // correctness
+    uint64_t mismatches = 0, decoded = 0, streamed = 0;
+    for (size_t f = 0; f < caps.size(); f++) {
+        Capture& c = caps[f];
+        uint8_t a[8] = { 0 }, b[8] = { 0 }; // noise can decode to more than 32 bits
+        uint8_t la = ref::man_decode(c.data, c.len * 8, a);
+        uint8_t lb = dali_man_decode(c.data, c.len * 8, b);
+        if (la != lb || memcmp(a, b, (la + 7) / 8) != 0) {
+            if (mismatches < 5)
+                printf("mismatch: ref len=%d new len=%d\n", la, lb);
+            mismatches++;
+        }
+        decoded += (la > 2);
+
+        if (f % 4 == 0)
+            continue;
+        uint8_t d[4] = { 0 };
+        uint8_t ls = stream_decode(c, d);
+        uint8_t lexp = la > 32 ? 0 : la;
+        if (ls != lexp || (ls > 2 && memcmp(a, d, (ls + 7) / 8) != 0)) {
+            if (mismatches < 5)
+                printf("mismatch: ref len=%d stream len=%d\n", la, ls);
+            mismatches++;
+        }
+        streamed++;
+    }
+
+    // timing, best of 5 passes
+    double best_ref = 1e9, best_new = 1e9;
+    volatile uint32_t sink = 0;
+    for (int pass = 0; pass < 5; pass++) {
+        uint8_t d[8];
+        double t0 = wall_s();
+        for (Capture& c : caps)
+            sink += ref::man_decode(c.data, c.len * 8, d) + d[0];
+        double t1 = wall_s();
+        for (Capture& c : caps)
+            sink += dali_man_decode(c.data, c.len * 8, d) + d[0];
+        double t2 = wall_s();
+        if (t1 - t0 < best_ref)
+            best_ref = t1 - t0;
+        if (t2 - t1 < best_new)
+            best_new = t2 - t1;
+    }
+
+    printf("bench_codec frames=%d noise=%g seed=%u (%llu decoded as frames)\n",
+           frames, noise, seed, (unsigned long long)decoded);
+    printf("  identical output  %s (%llu mismatches, %llu frames also streamed)\n", mismatches ? "NO" : "yes",
+           (unsigned long long)mismatches, (unsigned long long)streamed);
+    printf("  reference decoder %.1f ns/frame\n", 1e9 * best_ref / frames);
+    printf("  table decoder     %.1f ns/frame  (%.2fx)\n", 1e9 * best_new / frames, best_ref / best_new);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+// bench_edge - the pulse duration (edge capture) decoder against the
+// 8x oversampling decoder on synthetic DALI waveforms.
+//
+// The waveforms come from bench_wave.h. The edge list is fed to the pulse
+// decoder directly, and sampled at 9600 Hz for the streaming sample decoder.
+// Reports the decode error rate and host cost of both, and how many ISR calls
+// each needs per frame.
+//
+// Example: bench_edge --frames 100000 --skew 0.1 --jitter 20 --stretch 40
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bench_wave.h"
+#include "project_dali_codec.h"
+
+#define SAMPLE_NS 104167.0 // 1 / 9600 Hz
+
+// edge capture: what Dali::_edge_timer() does with the captured edges
+static uint8_t decode_edges(const Wave& w, uint8_t* data)
+{
+    DaliEdgeDecoder d;
+    dali_edge_begin(&d);
+    for (size_t i = 1; i < w.t_edge.size(); i++) {
+        uint32_t dur = (uint32_t)(w.t_edge[i] / 1000.0) - (uint32_t)(w.t_edge[i - 1] / 1000.0);
+        if (dali_edge_pulse(&d, w.lvl[i - 1], dur) != DALI_MAN_STREAM_BUSY)
+            return 0;
+    }
+    if (dali_edge_stop(&d) != DALI_MAN_STREAM_DONE)
+        return 0;
+    memcpy(data, d.data, 4);
+    return d.dbitlen;
+}
+
+// sampling: 9600 Hz samples starting at the first sample tick after the falling edge
+static uint8_t decode_samples(const Wave& w, double phase, uint8_t* data, uint32_t* nsamples)
+{
+    DaliManStream st;
+    dali_man_stream_begin(&st);
+    size_t e = 0;
+    uint8_t level = 1;
+    uint32_t n = 0;
+    for (double t = phase * SAMPLE_NS; t < w.end; t += SAMPLE_NS) {
+        while (e < w.t_edge.size() && w.t_edge[e] <= t)
+            level = w.lvl[e++];
+        n++;
+        uint8_t r = dali_man_stream_push(&st, level);
+        if (r == DALI_MAN_STREAM_ERROR)
+            return 0;
+        if (r == DALI_MAN_STREAM_DONE)
+            break;
+    }
+    *nsamples = n;
+    memcpy(data, st.data, 4);
+    return dali_man_stream_len(&st);
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 50000;
+    double skew = 0.0, jitter = 0.0, stretch = 0.0;
+    uint32_t seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--frames")) frames = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--skew")) skew = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--jitter")) jitter = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--stretch")) stretch = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--seed")) seed = (uint32_t)strtoul(argv[i + 1], nullptr, 0);
+        else {
+            printf("usage: bench_edge [--frames N] [--skew F] [--jitter US] [--stretch US] [--seed N]\n");
+            return 2;
+        }
+    }
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    static const int bitlens[] = { 8, 16, 24 };
+    std::vector<Wave> waves;
+    std::vector<double> phases;
+    waves.reserve(frames);
+    uint64_t edges = 0;
+    for (int f = 0; f < frames; f++) {
+        waves.push_back(make_wave(gen, bitlens[f % 3], skew, 0.0, jitter, stretch));
+        phases.push_back(unit(gen));
+        edges += waves.back().t_edge.size();
+    }
+
+    uint64_t ok_edge = 0, ok_sample = 0, samples = 0;
+    uint8_t d[4];
+    double t0 = wall_s();
+    for (const Wave& w : waves) {
+        uint8_t len = decode_edges(w, d);
+        ok_edge += (len == w.bits && same_frame(d, w.payload, w.bits));
+    }
+    double t1 = wall_s();
+    for (int f = 0; f < frames; f++) {
+        uint32_t n = 0;
+        uint8_t len = decode_samples(waves[f], phases[f], d, &n);
+        samples += n;
+        ok_sample += (len == waves[f].bits && same_frame(d, waves[f].payload, waves[f].bits));
+    }
+    double t2 = wall_s();
+
+    printf("bench_edge frames=%d skew=%+.3f jitter=%.1fus stretch=%.1fus\n", frames, skew, jitter, stretch);
+    printf("  edge capture  error rate %7.4f%%  %6.1f ns/frame  %5.1f edges/frame\n",
+           100.0 * (frames - ok_edge) / frames, 1e9 * (t1 - t0) / frames, (double)edges / frames);
+    printf("  8x sampling   error rate %7.4f%%  %6.1f ns/frame  %5.1f samples/frame (plus 9600/s while idle)\n",
+           100.0 * (frames - ok_sample) / frames, 1e9 * (t2 - t1) / frames, (double)samples / frames);
+    return 0;
+}
@@ -0,0 +1,191 @@
+// bench_ovs - decode error rate against CPU cost of the phase locked
+// Manchester decoder at 4x, 8x and 16x oversampling (DALI_OVERSAMPLE).
+//
+// Every waveform from bench_wave.h gets short noise spikes at random times
+// that invert the bus level while they last. The same waveform is then
+// sampled at 1200 * OVS Hz with a random phase for every factor and decoded
+// by dali_man_pll_push<OVS>(). Spikes are given per frame and in us, so they hit
+// every sample rate alike. Reports frames lost and decoded wrong, the host
+// cost per sample and per frame, and the timer() calls per second each factor
+// needs. --sweep repeats the run over a range of spike rates.
+//
+// Example: bench_ovs --frames 100000 --skew 0.08 --jitter 20 --stretch 40
+//          bench_ovs --sweep --spike-us 30 --jitter 10
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bench_wave.h"
+#include "project_dali_codec.h"
+
+struct Params {
+    int frames = 50000;
+    double skew = 0.0; // clock error, 0.1 = 10% slow
+    double jitter = 0.0; // us, uniform +/- per edge
+    double stretch = 0.0; // us, low pulses longer
+    double spikes = 0.0; // noise spikes per frame (Poisson mean)
+    double spike_us = 20.0; // length of a noise spike
+    uint32_t seed = 1;
+};
+
+struct Noisy {
+    Wave w;
+    std::vector<double> spike; // start of each noise spike
+    double phase; // 0..1 sample phase
+};
+
+static Noisy make_noisy(std::mt19937& gen, int bits, const Params& p)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    Noisy n;
+    n.w = make_wave(gen, bits, p.skew, 0.0, p.jitter, p.stretch);
+
+    // spikes anywhere after the start bit fell, until the stop bits are done
+    std::poisson_distribution<int> nspikes(p.spikes);
+    int k = p.spikes > 0 ? nspikes(gen) : 0;
+    for (int i = 0; i < k; i++)
+        n.spike.push_back(unit(gen) * n.w.end);
+    n.phase = unit(gen);
+    return n;
+}
+
+// samples of one waveform at OVS samples per bit, from the first sample tick after the falling edge
+template <uint8_t OVS>
+static void sample(const Noisy& n, double spike_ns, std::vector<uint8_t>& out)
+{
+    const Wave& w = n.w;
+    const double period = 2 * TE_NS / OVS;
+    out.clear();
+    size_t e = 0;
+    uint8_t level = 1;
+    for (double s = n.phase * period; s < w.end; s += period) {
+        while (e < w.t_edge.size() && w.t_edge[e] <= s)
+            level = w.lvl[e++];
+        uint8_t v = level;
+        for (double sp : n.spike)
+            if (s >= sp && s < sp + spike_ns)
+                v = !v;
+        out.push_back(v);
+    }
+}
+
+template <uint8_t OVS>
+static uint8_t decode(const std::vector<uint8_t>& samples, uint8_t* data, uint32_t* pushed)
+{
+    DaliManPll pll = {};
+    dali_man_pll_begin<OVS>(&pll);
+    uint32_t n = 0;
+    uint8_t r = DALI_MAN_STREAM_BUSY;
+    for (uint8_t s : samples) {
+        n++;
+        r = dali_man_pll_push<OVS>(&pll, s);
+        if (r != DALI_MAN_STREAM_BUSY)
+            break;
+    }
+    *pushed = n;
+    if (r != DALI_MAN_STREAM_DONE)
+        return 0;
+    memcpy(data, pll.data, 4);
+    return dali_man_pll_len(&pll);
+}
+
+struct Result {
+    uint64_t lost = 0, wrong = 0;
+    double samples_per_frame = 0;
+    double ns_sample = 0, ns_frame = 0;
+};
+
+template <uint8_t OVS>
+static Result run(const std::vector<Noisy>& waves, const Params& p)
+{
+    std::vector<std::vector<uint8_t>> samples(waves.size());
+    for (size_t i = 0; i < waves.size(); i++)
+        sample<OVS>(waves[i], p.spike_us * 1000.0, samples[i]);
+
+    Result r;
+    uint8_t d[4];
+    uint64_t pushed = 0;
+    for (size_t i = 0; i < waves.size(); i++) {
+        uint32_t n = 0;
+        uint8_t len = decode<OVS>(samples[i], d, &n);
+        pushed += n;
+        if (len != waves[i].w.bits)
+            r.lost++;
+        else if (!same_frame(d, waves[i].w.payload, waves[i].w.bits))
+            r.wrong++;
+    }
+
+    // timing, best of 3 passes
+    volatile uint32_t sink = 0;
+    double best = 1e9;
+    for (int pass = 0; pass < 3; pass++) {
+        uint32_t n;
+        double t0 = wall_s();
+        for (const std::vector<uint8_t>& s : samples)
+            sink += decode<OVS>(s, d, &n);
+        double t1 = wall_s();
+        if (t1 - t0 < best)
+            best = t1 - t0;
+    }
+    r.samples_per_frame = (double)pushed / waves.size();
+    r.ns_frame = 1e9 * best / waves.size();
+    r.ns_sample = 1e9 * best / pushed;
+    return r;
+}
+
+static void print_row(int ovs, const Result& r, int frames)
+{
+    printf("  %2dx  %5d/s  lost %7.4f%%  wrong %7.4f%%  %5.1f ns/sample  %6.1f ns/frame  %5.1f samples/frame\n",
+           ovs, 1200 * ovs, 100.0 * r.lost / frames, 100.0 * r.wrong / frames,
+           r.ns_sample, r.ns_frame, r.samples_per_frame);
+}
+
+int main(int argc, char** argv)
+{
+    Params p;
+    bool sweep = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sweep")) {
+            sweep = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            i = argc; // falls into usage below
+        else if (!strcmp(argv[i], "--frames")) p.frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--skew")) p.skew = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--jitter")) p.jitter = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--stretch")) p.stretch = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--spikes")) p.spikes = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--spike-us")) p.spike_us = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed")) p.seed = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        else
+            i = argc;
+        if (i >= argc) {
+            printf("usage: bench_ovs [--frames N] [--skew F] [--jitter US] [--stretch US] [--spikes N] [--spike-us US] [--seed N] [--sweep]\n");
+            return 2;
+        }
+    }
+
+    static const double sweep_spikes[] = { 0.0, 0.1, 0.3, 1.0, 3.0 };
+    int rounds = sweep ? 5 : 1;
+    printf("bench_ovs frames=%d skew=%+.3f jitter=%.1fus stretch=%.1fus spike=%.1fus, built with DALI_OVERSAMPLE %d\n",
+           p.frames, p.skew, p.jitter, p.stretch, p.spike_us, DALI_OVERSAMPLE);
+    for (int k = 0; k < rounds; k++) {
+        if (sweep)
+            p.spikes = sweep_spikes[k];
+        std::mt19937 gen(p.seed);
+        static const int bitlens[] = { 8, 16, 24, 25, 32 };
+        std::vector<Noisy> waves;
+        waves.reserve(p.frames);
+        for (int f = 0; f < p.frames; f++)
+            waves.push_back(make_noisy(gen, bitlens[f % 5], p));
+
+        printf(" %.2f spikes/frame\n", p.spikes);
+        print_row(4, run<4>(waves, p), p.frames);
+        print_row(8, run<8>(waves, p), p.frames);
+        print_row(16, run<16>(waves, p), p.frames);
+    }
+    return 0;
+}
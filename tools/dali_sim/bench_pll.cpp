@@ -0,0 +1,205 @@
+// bench_pll - the phase locked Manchester decoder against the fixed window
+// streaming decoder on a jittered synthetic corpus.
+//
+// Every waveform from bench_wave.h is sampled at 9600 Hz with a random phase
+// and optional sample noise, the way timer() sees it. Both decoders get the
+// same samples. Reports frames lost (decode error), frames decoded to the
+// wrong value, the host cost of each decoder and the confidence margins the
+// PLL decoder reported. --sweep repeats the run over a range of clock errors.
+//
+// Example: bench_pll --frames 100000 --skew 0.1 --jitter 20 --stretch 40
+//          bench_pll --sweep --jitter 30 --stretch 60
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bench_wave.h"
+#include "project_dali_codec.h"
+
+#define SAMPLE_NS 104167.0 // 1 / 9600 Hz
+
+struct Params {
+    int frames = 50000;
+    double skew = 0.0; // clock error, 0.1 = 10% slow
+    double drift = 0.0; // clock error change from the first to the last bit
+    double jitter = 0.0; // us, uniform +/- per edge
+    double stretch = 0.0; // us, low pulses longer
+    double noise = 0.0; // probability of a flipped sample
+    uint32_t seed = 1;
+};
+
+struct Frame {
+    uint8_t payload[4];
+    int bits;
+    std::vector<uint8_t> samples; // 1 = bus high, from the falling edge of the start bit
+};
+
+static Frame make_frame(std::mt19937& gen, int bits, const Params& p)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    Wave w = make_wave(gen, bits, p.skew, p.drift, p.jitter, p.stretch);
+    Frame fr;
+    fr.bits = bits;
+    memcpy(fr.payload, w.payload, 4);
+
+    // first sample tick after the falling edge
+    size_t e = 0;
+    uint8_t level = 1;
+    for (double s = unit(gen) * SAMPLE_NS; s < w.end; s += SAMPLE_NS) {
+        while (e < w.t_edge.size() && w.t_edge[e] <= s)
+            level = w.lvl[e++];
+        uint8_t v = level;
+        if (p.noise > 0 && !fr.samples.empty() && unit(gen) < p.noise)
+            v = !v;
+        fr.samples.push_back(v);
+    }
+    return fr;
+}
+
+// the fixed window decoder, as timer() ran it
+static uint8_t decode_stream(const Frame& fr, uint8_t* data)
+{
+    DaliManStream st = {};
+    dali_man_stream_begin(&st);
+    for (uint8_t s : fr.samples) {
+        uint8_t r = dali_man_stream_push(&st, s);
+        if (r == DALI_MAN_STREAM_ERROR)
+            return 0;
+        if (r == DALI_MAN_STREAM_DONE)
+            break;
+    }
+    memcpy(data, st.data, 4);
+    return dali_man_stream_len(&st);
+}
+
+static uint8_t decode_pll(const Frame& fr, uint8_t* data, uint8_t* margin)
+{
+    DaliManPll pll = {};
+    dali_man_pll_begin<8>(&pll);
+    for (uint8_t s : fr.samples) {
+        uint8_t r = dali_man_pll_push<8>(&pll, s);
+        if (r == DALI_MAN_STREAM_ERROR)
+            return 0;
+        if (r == DALI_MAN_STREAM_DONE)
+            break;
+    }
+    memcpy(data, pll.data, 4);
+    *margin = pll.margin;
+    return dali_man_pll_len(&pll);
+}
+
+struct Result {
+    uint64_t lost_stream = 0, wrong_stream = 0;
+    uint64_t lost_pll = 0, wrong_pll = 0;
+    uint64_t weak = 0; // decoded by the PLL with a margin under DALI_MAN_PLL_WEAK
+    uint64_t margin_hist[8] = { 0 }; // correctly decoded frames by margin / 32
+    double ns_stream = 0, ns_pll = 0;
+};
+
+static Result run(const Params& p)
+{
+    std::mt19937 gen(p.seed);
+    static const int bitlens[] = { 8, 16, 24, 25, 32 };
+    std::vector<Frame> frames;
+    frames.reserve(p.frames);
+    for (int f = 0; f < p.frames; f++)
+        frames.push_back(make_frame(gen, bitlens[f % 5], p));
+
+    Result r;
+    uint8_t d[4];
+    for (const Frame& fr : frames) {
+        uint8_t len = decode_stream(fr, d);
+        if (len != fr.bits)
+            r.lost_stream++;
+        else if (!same_frame(d, fr.payload, fr.bits))
+            r.wrong_stream++;
+        uint8_t margin = 0;
+        len = decode_pll(fr, d, &margin);
+        if (len != fr.bits)
+            r.lost_pll++;
+        else if (!same_frame(d, fr.payload, fr.bits))
+            r.wrong_pll++;
+        else
+            r.margin_hist[margin >> 5]++;
+        if (len == fr.bits && margin < DALI_MAN_PLL_WEAK)
+            r.weak++;
+    }
+
+    // timing, best of 3 passes
+    volatile uint32_t sink = 0;
+    double best_stream = 1e9, best_pll = 1e9;
+    for (int pass = 0; pass < 3; pass++) {
+        uint8_t m;
+        double t0 = wall_s();
+        for (const Frame& fr : frames)
+            sink += decode_stream(fr, d);
+        double t1 = wall_s();
+        for (const Frame& fr : frames)
+            sink += decode_pll(fr, d, &m);
+        double t2 = wall_s();
+        if (t1 - t0 < best_stream)
+            best_stream = t1 - t0;
+        if (t2 - t1 < best_pll)
+            best_pll = t2 - t1;
+    }
+    r.ns_stream = 1e9 * best_stream / p.frames;
+    r.ns_pll = 1e9 * best_pll / p.frames;
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    Params p;
+    bool sweep = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sweep")) {
+            sweep = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            i = argc; // falls into usage below
+        else if (!strcmp(argv[i], "--frames")) p.frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--skew")) p.skew = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--drift")) p.drift = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--jitter")) p.jitter = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--stretch")) p.stretch = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--noise")) p.noise = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed")) p.seed = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        else
+            i = argc;
+        if (i >= argc) {
+            printf("usage: bench_pll [--frames N] [--skew F] [--drift F] [--jitter US] [--stretch US] [--noise P] [--seed N] [--sweep]\n");
+            return 2;
+        }
+    }
+
+    if (sweep) {
+        printf("bench_pll frames=%d drift=%+.3f jitter=%.1fus stretch=%.1fus noise=%g, lost / wrong %%\n",
+               p.frames, p.drift, p.jitter, p.stretch, p.noise);
+        printf("   skew    fixed window         pll\n");
+        for (int k = -6; k <= 6; k++) {
+            p.skew = k * 0.025;
+            Result r = run(p);
+            printf("  %+5.1f%%  %7.3f / %6.3f   %7.3f / %6.3f\n", 100.0 * p.skew,
+                   100.0 * r.lost_stream / p.frames, 100.0 * r.wrong_stream / p.frames,
+                   100.0 * r.lost_pll / p.frames, 100.0 * r.wrong_pll / p.frames);
+        }
+        return 0;
+    }
+
+    Result r = run(p);
+    printf("bench_pll frames=%d skew=%+.3f drift=%+.3f jitter=%.1fus stretch=%.1fus noise=%g\n",
+           p.frames, p.skew, p.drift, p.jitter, p.stretch, p.noise);
+    printf("  fixed window  lost %7.4f%%  wrong %7.4f%%  %6.1f ns/frame\n",
+           100.0 * r.lost_stream / p.frames, 100.0 * r.wrong_stream / p.frames, r.ns_stream);
+    printf("  pll           lost %7.4f%%  wrong %7.4f%%  %6.1f ns/frame  weak (margin < %d) %.4f%%\n",
+           100.0 * r.lost_pll / p.frames, 100.0 * r.wrong_pll / p.frames, r.ns_pll,
+           DALI_MAN_PLL_WEAK, 100.0 * r.weak / p.frames);
+    printf("  pll margin    ");
+    for (int i = 0; i < 8; i++)
+        printf(" %3d+:%5.1f%%", i * 32, 100.0 * r.margin_hist[i] / p.frames);
+    printf("\n");
+    return 0;
+}
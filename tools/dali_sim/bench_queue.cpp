@@ -0,0 +1,430 @@
+// bench_queue - heap allocations and host CPU time per command of the
+// bridge's command path, from the name of the command to the frame it puts
+// on the bus, with the old String based queue entry and the 16 byte
+// DaliCommand of project_dali_command.h.
+//
+// Both run through the real DaliMpscQueue (project_dali_queue.h) and build the
+// frame with the real project_dali_lib.h builders. The old path is mirrored
+// here as the bridge ran it: the name copied into the entry at ingress, the
+// validateDaliCommand() chain of String comparisons, the entry copied into
+// the queue slot and moved out of it, and the chain of String comparisons of
+// processCommandQueue(). The String is a model of the esp32 Arduino core's
+// WString: up to 10 characters are kept in the object (SSO_SIZE 11 on the
+// 32-bit target), longer ones on the heap; copy assignment reuses a buffer
+// that is big enough, a move takes the buffer along. Every heap allocation
+// of the run is counted, the model's and any operator new.
+//
+// Example: bench_queue --commands 1000000
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+#include "project_dali_command.h"
+#include "project_dali_lib.h"
+#include "project_dali_queue.h"
+
+#define QUEUE_SIZE 64 // COMMAND_QUEUE_SIZE of the bridge
+
+static uint64_t heap_allocs = 0;
+
+void* operator new(size_t n)
+{
+    heap_allocs++;
+    void* p = malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// esp32 Arduino String, as far as the command path uses it
+class String {
+public:
+    String() { sso[0] = 0; }
+    String(const char* s) { set(s, strlen(s)); }
+    String(const String& o) { set(o.c_str(), o.len); }
+    String(String&& o) noexcept { take(o); }
+    ~String() { release(); }
+    String& operator=(const String& o)
+    {
+        if (this != &o)
+            set(o.c_str(), o.len);
+        return *this;
+    }
+    String& operator=(String&& o) noexcept
+    {
+        if (this != &o) {
+            release();
+            take(o);
+        }
+        return *this;
+    }
+    String& operator=(const char* s)
+    {
+        set(s, strlen(s));
+        return *this;
+    }
+    bool operator==(const char* s) const { return strcmp(c_str(), s) == 0; }
+    const char* c_str() const { return heap ? heap : sso; }
+
+private:
+    enum { SSO_SIZE = 11 };
+    char sso[SSO_SIZE];
+    char* heap = nullptr;
+    size_t cap = SSO_SIZE - 1;
+    size_t len = 0;
+
+    void set(const char* s, size_t n)
+    {
+        if (n > cap) { // reserve(): grows, never shrinks
+            release();
+            heap_allocs++;
+            heap = (char*)malloc(n + 1);
+            cap = n;
+        }
+        memmove(heap ? heap : sso, s, n + 1);
+        len = n;
+    }
+    void take(String& o)
+    {
+        memcpy(sso, o.sso, SSO_SIZE);
+        heap = o.heap;
+        cap = o.cap;
+        len = o.len;
+        o.heap = nullptr;
+        o.cap = SSO_SIZE - 1;
+        o.len = 0;
+        o.sso[0] = 0;
+    }
+    void release()
+    {
+        free(heap);
+        heap = nullptr;
+        cap = SSO_SIZE - 1;
+    }
+};
+
+// The queue entry before project_dali_command.h
+struct LegacyCommand {
+    String command_type;
+    uint8_t address;
+    String address_type;
+    uint8_t level;
+    uint8_t scene;
+    uint8_t group;
+    uint8_t fade_time;
+    uint8_t fade_rate;
+    bool force;
+    unsigned long queued_at;
+    uint8_t priority;
+    uint8_t retry_count;
+    uint8_t color_r;
+    uint8_t color_g;
+    uint8_t color_b;
+    uint8_t color_w;
+    uint16_t color_temp_kelvin;
+    uint8_t instance;
+    uint8_t opcode;
+    uint32_t frame;
+    uint8_t frame_bits;
+    bool reply;
+    bool twice;
+};
+
+// What a web UI or MQTT command looks like when it comes in
+struct Input {
+    const char* name;
+    uint8_t address;
+    uint8_t arg; // level or scene
+};
+
+static const Input inputs[] = {
+    { "set_brightness", 5, 128 },
+    { "off", 0xFF, 0 },
+    { "go_to_scene", 12, 3 },
+    { "query_status", 7, 0 },
+    { "query_actual_level", 7, 0 },
+    { "recall_max", 33, 0 },
+    { "step_down", 2, 0 },
+    { "device_command", 9, 0x30 },
+};
+#define INPUTS (sizeof(inputs) / sizeof(inputs[0]))
+
+// The old validateDaliCommand()
+static bool legacy_validate(const LegacyCommand& cmd)
+{
+    if (cmd.command_type == "set_brightness") {
+        if (cmd.address > 63 && cmd.address != 0xFF) return false;
+        if (cmd.level > 254) return false;
+        return true;
+    } else if (cmd.command_type == "off" || cmd.command_type == "max" ||
+               cmd.command_type == "up" || cmd.command_type == "down" ||
+               cmd.command_type == "step_up" || cmd.command_type == "step_down" ||
+               cmd.command_type == "recall_max" || cmd.command_type == "recall_min" ||
+               cmd.command_type == "reset") {
+        if (cmd.address > 63 && cmd.address != 0xFF) return false;
+        return true;
+    } else if (cmd.command_type == "go_to_scene") {
+        if (cmd.address > 63 && cmd.address != 0xFF) return false;
+        if (cmd.scene > 15) return false;
+        return true;
+    } else if (cmd.command_type == "query_status" ||
+               cmd.command_type == "query_lamp_failure" ||
+               cmd.command_type == "query_lamp_power_on" ||
+               cmd.command_type == "query_actual_level" ||
+               cmd.command_type == "query_max_level" ||
+               cmd.command_type == "query_min_level" ||
+               cmd.command_type == "query_device_type" ||
+               cmd.command_type == "query_scene_level") {
+        if (cmd.address > 63) return false;
+        if (cmd.command_type == "query_scene_level" && cmd.scene > 15) return false;
+        return true;
+    } else if (cmd.command_type == "device_command") {
+        return cmd.address_type == "short" && cmd.address <= 63;
+    } else if (cmd.command_type == "raw") {
+        if (cmd.frame_bits != 16 && cmd.frame_bits != 24 && cmd.frame_bits != 25) return false;
+        return (cmd.frame >> cmd.frame_bits) == 0;
+    }
+    return false;
+}
+
+// The old processCommandQueue() chain, up to the frame it sent
+static DaliCmdFrame legacy_dispatch(const LegacyCommand& cmd)
+{
+    if (cmd.command_type == "raw")
+        return DALI_CMD_FRAME_INVALID;
+    DaliAddr adr = dali_addr(cmd.address);
+    if (cmd.command_type == "set_brightness") return dali_arc_frame(adr, cmd.level);
+    else if (cmd.command_type == "off") return dali_cmd<DALI_OFF>(adr);
+    else if (cmd.command_type == "max" || cmd.command_type == "recall_max") return dali_cmd<DALI_RECALL_MAX_LEVEL>(adr);
+    else if (cmd.command_type == "recall_min") return dali_cmd<DALI_RECALL_MIN_LEVEL>(adr);
+    else if (cmd.command_type == "up") return dali_cmd<DALI_UP>(adr);
+    else if (cmd.command_type == "down") return dali_cmd<DALI_DOWN>(adr);
+    else if (cmd.command_type == "step_up") return dali_cmd<DALI_STEP_UP>(adr);
+    else if (cmd.command_type == "step_down") return dali_cmd<DALI_STEP_DOWN>(adr);
+    else if (cmd.command_type == "go_to_scene") return dali_cmd_frame(DALI_GO_TO_SCENE0 + cmd.scene, adr);
+    else if (cmd.command_type == "reset") return dali_cmd<DALI_RESET>(adr);
+    else if (cmd.command_type == "query_status") return dali_cmd<DALI_QUERY_STATUS>(adr);
+    else if (cmd.command_type == "query_lamp_failure") return dali_cmd<DALI_QUERY_LAMP_FAILURE>(adr);
+    else if (cmd.command_type == "query_lamp_power_on") return dali_cmd<DALI_QUERY_LAMP_POWER_ON>(adr);
+    else if (cmd.command_type == "query_actual_level") return dali_cmd<DALI_QUERY_ACTUAL_LEVEL>(adr);
+    else if (cmd.command_type == "query_max_level") return dali_cmd<DALI_QUERY_MAX_LEVEL>(adr);
+    else if (cmd.command_type == "query_min_level") return dali_cmd<DALI_QUERY_MIN_LEVEL>(adr);
+    else if (cmd.command_type == "query_device_type") return dali_cmd<DALI_QUERY_DEVICE_TYPE>(adr);
+    else if (cmd.command_type == "query_scene_level") return dali_cmd_frame(DALI_QUERY_SCENE0_LEVEL + cmd.scene, adr);
+    else if (cmd.command_type == "set_rgb" || cmd.command_type == "set_rgbw" || cmd.command_type == "set_color_temp")
+        return dali_cmd<DALI_DT8_ACTIVATE>(adr);
+    else if (cmd.command_type == "device_command") return dali_cmd24_frame(DALI24_SHORT(cmd.address), cmd.instance, cmd.opcode);
+    return DALI_CMD_FRAME_INVALID;
+}
+
+// The new path, as project_dali_handler.cpp has it: the address check and
+// the frame of each op from a table
+#define CHECK_GEAR 1
+#define CHECK_SHORT 2
+#define CHECK_DEVICE 3
+#define CHECK_RAW 4
+
+typedef DaliCmdFrame (*Build)(const DaliCommand& cmd, DaliAddr adr, uint16_t command);
+struct Info {
+    uint8_t check;
+    uint16_t command;
+    Build build;
+};
+
+static DaliCmdFrame build_arc(const DaliCommand& cmd, DaliAddr adr, uint16_t) { return dali_arc_frame(adr, cmd.level); }
+static DaliCmdFrame build_scene(const DaliCommand& cmd, DaliAddr adr, uint16_t c) { return dali_cmd_frame(c + cmd.scene, adr); }
+static DaliCmdFrame build_dt8(const DaliCommand&, DaliAddr adr, uint16_t) { return dali_cmd<DALI_DT8_ACTIVATE>(adr); }
+static DaliCmdFrame build_device(const DaliCommand& cmd, DaliAddr, uint16_t)
+{
+    return dali_cmd24_frame(DALI24_SHORT(cmd.address), cmd.device.instance, cmd.device.opcode);
+}
+
+static const Info table[DALI_OP_COUNT] = {
+    { 0, 0, nullptr },
+    { CHECK_GEAR, 0, build_arc },
+    { CHECK_GEAR, DALI_OFF, nullptr },
+    { CHECK_GEAR, DALI_RECALL_MAX_LEVEL, nullptr },
+    { CHECK_GEAR, DALI_RECALL_MAX_LEVEL, nullptr },
+    { CHECK_GEAR, DALI_RECALL_MIN_LEVEL, nullptr },
+    { CHECK_GEAR, DALI_UP, nullptr },
+    { CHECK_GEAR, DALI_DOWN, nullptr },
+    { CHECK_GEAR, DALI_STEP_UP, nullptr },
+    { CHECK_GEAR, DALI_STEP_DOWN, nullptr },
+    { CHECK_GEAR, DALI_GO_TO_SCENE0, build_scene },
+    { CHECK_GEAR, DALI_RESET, nullptr },
+    { CHECK_SHORT, DALI_QUERY_STATUS, nullptr },
+    { CHECK_SHORT, DALI_QUERY_LAMP_FAILURE, nullptr },
+    { CHECK_SHORT, DALI_QUERY_LAMP_POWER_ON, nullptr },
+    { CHECK_SHORT, DALI_QUERY_ACTUAL_LEVEL, nullptr },
+    { CHECK_SHORT, DALI_QUERY_MAX_LEVEL, nullptr },
+    { CHECK_SHORT, DALI_QUERY_MIN_LEVEL, nullptr },
+    { CHECK_SHORT, DALI_QUERY_DEVICE_TYPE, nullptr },
+    { CHECK_SHORT, DALI_QUERY_SCENE0_LEVEL, build_scene },
+    { 0, 0, build_dt8 },
+    { 0, 0, build_dt8 },
+    { 0, 0, build_dt8 },
+    { CHECK_DEVICE, 0, build_device },
+    { CHECK_RAW, 0, nullptr },
+};
+
+static bool pod_validate(const DaliCommand& cmd)
+{
+    if (cmd.op >= DALI_OP_COUNT)
+        return false;
+    switch (table[cmd.op].check) {
+    case CHECK_GEAR:
+        if (cmd.address > 63 && cmd.address != 0xFF) return false;
+        break;
+    case CHECK_SHORT:
+        if (cmd.address > 63) return false;
+        break;
+    case CHECK_DEVICE:
+        return cmd.address_type == DALI_ADDRESS_SHORT && cmd.address <= 63;
+    case CHECK_RAW:
+        if (cmd.raw.bits != 16 && cmd.raw.bits != 24 && cmd.raw.bits != 25) return false;
+        return (cmd.raw.frame >> cmd.raw.bits) == 0;
+    default:
+        return false;
+    }
+    if (cmd.op == DALI_OP_SET_BRIGHTNESS) return cmd.level <= 254;
+    if (cmd.op == DALI_OP_GO_TO_SCENE || cmd.op == DALI_OP_QUERY_SCENE_LEVEL) return cmd.scene <= 15;
+    return true;
+}
+
+static DaliCmdFrame pod_dispatch(const DaliCommand& cmd)
+{
+    if (cmd.op == DALI_OP_RAW || cmd.op == DALI_OP_INVALID || cmd.op >= DALI_OP_COUNT)
+        return DALI_CMD_FRAME_INVALID;
+    const Info& info = table[cmd.op];
+    DaliAddr adr = dali_addr(cmd.address);
+    return info.build ? info.build(cmd, adr, info.command) : dali_cmd_frame(info.command, adr);
+}
+
+static double wall_s()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result {
+    double ns_enqueue = 0, ns_dispatch = 0;
+    double allocs = 0; // per command
+    uint32_t sink = 0;
+};
+
+// As the bridge does it: the MQTT / web handler builds the command in a local
+// and enqueues it, the DALI task pops it into a local and sends it. Commands
+// come in bursts of half the queue.
+template <typename T, typename In, typename Out>
+static Result run(int commands, In ingress, Out dispatch)
+{
+    static DaliMpscQueue<T, QUEUE_SIZE> queue;
+    const int batch = QUEUE_SIZE / 2;
+    Result r;
+    uint64_t allocs0 = heap_allocs;
+    double t_in = 0, t_out = 0;
+    int done = 0;
+    while (done < commands) {
+        int n = (commands - done < batch) ? commands - done : batch;
+        double t0 = wall_s();
+        for (int i = 0; i < n; i++) {
+            T cmd;
+            ingress(inputs[(done + i) % INPUTS], cmd);
+            queue.push(cmd);
+        }
+        double t1 = wall_s();
+        for (int i = 0; i < n; i++) {
+            T cmd;
+            queue.pop(cmd);
+            r.sink += dispatch(cmd).bitlen;
+        }
+        double t2 = wall_s();
+        t_in += t1 - t0;
+        t_out += t2 - t1;
+        done += n;
+    }
+    r.allocs = (double)(heap_allocs - allocs0) / commands;
+    r.ns_enqueue = 1e9 * t_in / commands;
+    r.ns_dispatch = 1e9 * t_out / commands;
+    return r;
+}
+
+static void legacy_ingress(const Input& in, LegacyCommand& cmd)
+{
+    cmd.command_type = in.name;
+    cmd.address = in.address;
+    cmd.address_type = (in.address == 0xFF) ? "broadcast" : "short";
+    cmd.level = in.arg;
+    cmd.scene = in.arg & 0x0F;
+    cmd.instance = DALI24_DEVICE;
+    cmd.opcode = in.arg;
+    cmd.queued_at = 0;
+    cmd.priority = 1;
+    if (!legacy_validate(cmd))
+        cmd.command_type = "";
+}
+
+static void pod_ingress(const Input& in, DaliCommand& cmd)
+{
+    cmd = {};
+    cmd.op = daliCommandOp(in.name);
+    cmd.address = in.address;
+    cmd.priority = 1;
+    if (cmd.op == DALI_OP_SET_BRIGHTNESS)
+        cmd.level = in.arg;
+    else if (cmd.op == DALI_OP_GO_TO_SCENE)
+        cmd.scene = in.arg & 0x0F;
+    else if (cmd.op == DALI_OP_DEVICE_COMMAND) {
+        cmd.address_type = DALI_ADDRESS_SHORT;
+        cmd.device.instance = DALI24_DEVICE;
+        cmd.device.opcode = in.arg;
+    }
+    if (!pod_validate(cmd))
+        cmd.op = DALI_OP_INVALID;
+}
+
+static double total(const Result& r) { return r.ns_enqueue + r.ns_dispatch; }
+
+static void print_row(const char* name, size_t entry, const Result& r)
+{
+    printf("  %-7s %3zu bytes  %5.2f allocs/cmd  name to queue %6.1f ns  queue to frame %6.1f ns  total %6.1f ns/cmd\n",
+           name, entry, r.allocs, r.ns_enqueue, r.ns_dispatch, total(r));
+}
+
+int main(int argc, char** argv)
+{
+    int commands = 1000000;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--commands") && i + 1 < argc)
+            commands = atoi(argv[++i]);
+        else {
+            printf("usage: bench_queue [--commands N]\n");
+            return 2;
+        }
+    }
+
+    printf("bench_queue commands=%d, %zu command kinds, queue of %d\n", commands, INPUTS, QUEUE_SIZE);
+    // best of 3 runs each, the allocation count is the same every run
+    Result best_legacy, best_pod;
+    best_legacy.ns_enqueue = best_pod.ns_enqueue = 1e9;
+    for (int pass = 0; pass < 3; pass++) {
+        Result l = run<LegacyCommand>(commands, legacy_ingress, legacy_dispatch);
+        Result p = run<DaliCommand>(commands, pod_ingress, pod_dispatch);
+        if (total(l) < total(best_legacy))
+            best_legacy = l;
+        if (total(p) < total(best_pod))
+            best_pod = p;
+        if (l.sink != p.sink) {
+            printf("frames differ: %u / %u bits\n", l.sink, p.sink);
+            return 1;
+        }
+    }
+    print_row("String", sizeof(LegacyCommand), best_legacy);
+    print_row("POD", sizeof(DaliCommand), best_pod);
+    return 0;
+}
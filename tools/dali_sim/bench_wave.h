@@ -0,0 +1,86 @@
+// Synthetic DALI waveforms for the codec benches (bench_edge, bench_pll,
+// bench_ovs).
+//
+// Every frame is generated as a list of edge times with a transmitter clock
+// error, a clock drift across the frame, per-edge jitter and a rise/fall
+// asymmetry (the transceiver stretches low pulses). Time 0 is the falling edge
+// of the start bit, a trailing 0 bit gets its rising edge back to idle, and the
+// frame ends when the stop bits are done. Each bench samples or decodes the
+// edge list its own way.
+#ifndef BENCH_WAVE_H
+#define BENCH_WAVE_H
+
+#include <stdint.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#define TE_NS 416667.0 // half bit
+
+struct Wave {
+    uint8_t payload[4];
+    int bits;
+    std::vector<double> t_edge; // ns from the falling edge of the start bit
+    std::vector<uint8_t> lvl; // bus level after each edge
+    double end; // ns, stop bits done
+};
+
+// skew: clock error, 0.1 = 10% slow; drift: clock error change from the first
+// to the last bit; jitter_us: uniform +/- per edge; stretch_us: low pulses longer
+static Wave make_wave(std::mt19937& gen, int bits, double skew, double drift, double jitter_us, double stretch_us)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    Wave w;
+    w.bits = bits;
+    for (int i = 0; i < 4; i++)
+        w.payload[i] = gen();
+
+    // half bit levels: start, data, then the stop bits are the idle high level
+    std::vector<uint8_t> hb;
+    hb.push_back(0);
+    hb.push_back(1);
+    for (int i = 0; i < bits; i++) {
+        bool one = w.payload[i >> 3] & (0x80 >> (i & 7));
+        hb.push_back(one ? 0 : 1);
+        hb.push_back(one ? 1 : 0);
+    }
+
+    // edge times, the half bit period drifting from skew to skew + drift
+    double t = 0;
+    uint8_t level = 1;
+    for (size_t i = 0; i <= hb.size(); i++) {
+        uint8_t v = i < hb.size() ? hb[i] : 1; // trailing 0 bit: back to idle
+        if (v != level) {
+            double e = t + (unit(gen) * 2.0 - 1.0) * jitter_us * 1000.0;
+            if (v) // rising edge comes late: low pulses are stretched
+                e += stretch_us * 1000.0;
+            if (i == 0 || e < 0)
+                e = 0;
+            w.t_edge.push_back(e);
+            w.lvl.push_back(v);
+            level = v;
+        }
+        if (i < hb.size())
+            t += TE_NS * (1.0 + skew + drift * i / hb.size());
+    }
+    w.end = t + 4 * TE_NS * (1.0 + skew + drift);
+    return w;
+}
+
+// the first bits of rx and tx are equal
+static bool same_frame(const uint8_t* rx, const uint8_t* tx, int bits)
+{
+    for (int i = 0; i < (bits >> 3); i++)
+        if (rx[i] != tx[i])
+            return false;
+    int rem = bits & 7;
+    return !rem || (uint8_t)(rx[bits >> 3] << (8 - rem)) == (uint8_t)(tx[bits >> 3] & (0xFF << (8 - rem)));
+}
+
+static double wall_s()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
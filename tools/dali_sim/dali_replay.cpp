@@ -0,0 +1,308 @@
+// dali_replay - feed raw sample captures back through the Manchester decoders.
+//
+// Reads a capture file (GET /api/capture on the bridge, or dali_sim --capture)
+// and decodes every frame three times: with the batch decoder dali_man_decode()
+// the driver used to run on rxdata, with the fixed window streaming decoder
+// that replaced it, and with the phase locked decoder timer() runs now, fed
+// sample by sample. Frame records are checked against the result the driver
+// reported when it captured them; window records are first cut into frames
+// the way timer() does it (first low sample up to 2 bits of high samples).
+// Exits 1 if the phase locked decoder does not reproduce the recorded results,
+// or the two fixed window decoders disagree, so decoder changes can be checked
+// against field recordings. Frames only one of the streaming decoders gets are
+// counted, not failed. Reports ns/frame for all three decoders.
+//
+// Example: dali_replay capture.bin --dump 5
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "project_dali_lib.h"
+
+struct Frame {
+    uint8_t samples[DALI_RX_BUF_SIZE + 1]; // one spare byte, the batch decoder may peek one byte past the end
+    uint8_t nbytes;
+    uint32_t start_us;
+    bool recorded; // len/data hold what the driver decoded
+    uint8_t len;
+    uint8_t data[4];
+};
+
+struct Result {
+    uint8_t len;
+    uint8_t data[8]; // noise can decode to more than 32 bits
+    uint8_t margin; // phase locked decoder only
+};
+
+static bool read_capture(const char* path, std::vector<DaliCaptureRecord>& recs, uint32_t* sample_hz)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        printf("cannot open %s\n", path);
+        return false;
+    }
+    DaliCaptureHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, DALI_CAPTURE_MAGIC, sizeof(h.magic)) != 0
+        || h.record_size != sizeof(DaliCaptureRecord) || h.sample_hz != DALI_SAMPLE_HZ) {
+        printf("%s: not a capture file (or a different record layout or sample rate than DALI_OVERSAMPLE %d)\n", path, DALI_OVERSAMPLE);
+        fclose(f);
+        return false;
+    }
+    *sample_hz = h.sample_hz;
+    DaliCaptureRecord r;
+    while (fread(&r, sizeof(r), 1, f) == 1)
+        recs.push_back(r);
+    fclose(f);
+    return true;
+}
+
+// window records: one sample stream, cut into frames like timer() does
+struct Splitter {
+    bool rx = false;
+    Frame fr;
+    uint8_t byte = 0, bits = 0, idle = 0;
+
+    void push(uint8_t high, uint32_t t_us, std::vector<Frame>& out)
+    {
+        if (!rx) {
+            if (high)
+                return;
+            rx = true;
+            memset(&fr, 0, sizeof(fr));
+            fr.start_us = t_us;
+            bits = 0;
+            idle = 0;
+        }
+        byte = (byte << 1) | high;
+        if (++bits == 8) {
+            fr.samples[fr.nbytes] = byte;
+            if (fr.nbytes < DALI_RX_BUF_SIZE - 1) // rxpos sticks at the last byte, as in timer()
+                fr.nbytes++;
+            bits = 0;
+        }
+        idle = high ? idle + 1 : 0;
+        if (idle >= 2 * DALI_OVERSAMPLE) {
+            fr.samples[fr.nbytes++] = 0xFF;
+            fr.samples[fr.nbytes] = 0xFF;
+            out.push_back(fr);
+            rx = false;
+        }
+    }
+};
+
+static void load_frames(const std::vector<DaliCaptureRecord>& recs, uint32_t sample_hz,
+                        std::vector<Frame>& frames, uint32_t* gaps)
+{
+    Splitter sp;
+    double sample_us = 1e6 / sample_hz;
+    bool have_prev = false;
+    uint32_t next_us = 0;
+    for (const DaliCaptureRecord& r : recs) {
+        if (r.mode == DALI_CAPTURE_FRAMES) {
+            Frame fr;
+            memset(&fr, 0xFF, sizeof(fr));
+            uint8_t n = r.nbytes <= DALI_RX_BUF_SIZE ? r.nbytes : DALI_RX_BUF_SIZE;
+            memcpy(fr.samples, r.samples, n);
+            fr.nbytes = n;
+            fr.start_us = r.start_us;
+            fr.recorded = true;
+            fr.len = r.len;
+            memcpy(fr.data, r.data, 4);
+            frames.push_back(fr);
+            continue;
+        }
+        // a record that does not follow the previous one: records were lost
+        int32_t d = (int32_t)(r.start_us - next_us);
+        if (have_prev && (d > 500 || d < -500)) {
+            (*gaps)++;
+            sp.rx = false;
+        }
+        for (int i = 0; i < r.nbytes * 8; i++)
+            sp.push((r.samples[i >> 3] >> (7 - (i & 7))) & 1, r.start_us + (uint32_t)(i * sample_us), frames);
+        next_us = r.start_us + (uint32_t)(r.nbytes * 8 * sample_us);
+        have_prev = true;
+    }
+}
+
+static Result batch_decode(const Frame& fr)
+{
+    Result r;
+    memset(&r, 0, sizeof(r));
+    r.len = dali_man_decode((uint8_t*)fr.samples, fr.nbytes * 8, r.data);
+    return r;
+}
+
+// as timer() fed the decoder; a frame still open at the idle bus is taken as it is
+static Result stream_decode(const Frame& fr)
+{
+    Result r;
+    memset(&r, 0, sizeof(r));
+    DaliManStream st;
+    dali_man_stream_begin(&st);
+    for (int i = 0; i < fr.nbytes * 8; i++) {
+        uint8_t s = dali_man_stream_push(&st, (fr.samples[i >> 3] >> (7 - (i & 7))) & 1);
+        if (s == DALI_MAN_STREAM_ERROR)
+            return r;
+        if (s == DALI_MAN_STREAM_DONE)
+            break;
+    }
+    r.len = dali_man_stream_len(&st);
+    memcpy(r.data, st.data, 4);
+    return r;
+}
+
+// as timer() feeds the decoder now
+static Result pll_decode(const Frame& fr)
+{
+    Result r;
+    memset(&r, 0, sizeof(r));
+    DaliManPll pll;
+    dali_man_pll_begin(&pll);
+    for (int i = 0; i < fr.nbytes * 8; i++) {
+        uint8_t s = dali_man_pll_push(&pll, (fr.samples[i >> 3] >> (7 - (i & 7))) & 1);
+        if (s == DALI_MAN_STREAM_ERROR)
+            return r;
+        if (s == DALI_MAN_STREAM_DONE)
+            break;
+    }
+    r.len = dali_man_pll_len(&pll);
+    r.margin = pll.margin;
+    memcpy(r.data, pll.data, 4);
+    return r;
+}
+
+// decode errors (0 or 1 bit) are all the same
+static bool same_result(uint8_t alen, const uint8_t* a, uint8_t blen, const uint8_t* b)
+{
+    if (alen <= 1 || blen <= 1)
+        return alen <= 1 && blen <= 1;
+    return alen == blen && memcmp(a, b, (alen + 7) / 8) == 0;
+}
+
+static void dump(const char* what, const Frame& fr, const Result& b, const Result& s, const Result& p)
+{
+    printf("  %-9s t=%10u us  batch %2d bits %02X%02X%02X%02X  stream %2d bits %02X%02X%02X%02X"
+           "  pll %2d bits %02X%02X%02X%02X margin %3d",
+           what, fr.start_us, b.len, b.data[0], b.data[1], b.data[2], b.data[3],
+           s.len, s.data[0], s.data[1], s.data[2], s.data[3],
+           p.len, p.data[0], p.data[1], p.data[2], p.data[3], p.margin);
+    if (fr.recorded)
+        printf("  recorded %2d bits %02X%02X%02X%02X", fr.len, fr.data[0], fr.data[1], fr.data[2], fr.data[3]);
+    printf("\n            ");
+    for (int i = 0; i < fr.nbytes; i++)
+        for (int j = 7; j >= 0; j--)
+            putchar((fr.samples[i] >> j) & 1 ? '1' : '_');
+    printf("\n");
+}
+
+static double wall_s()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = nullptr;
+    int ndump = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--dump") && i + 1 < argc)
+            ndump = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else
+            path = nullptr, i = argc;
+    }
+    if (!path) {
+        printf("usage: dali_replay FILE [--dump N]\n");
+        return 2;
+    }
+
+    std::vector<DaliCaptureRecord> recs;
+    uint32_t sample_hz = 9600, gaps = 0;
+    if (!read_capture(path, recs, &sample_hz))
+        return 2;
+    std::vector<Frame> frames;
+    load_frames(recs, sample_hz, frames, &gaps);
+
+    uint64_t recorded = 0, regressions = 0, disagree = 0, errors = 0;
+    uint64_t recovered = 0, dropped = 0, differ = 0, weak = 0;
+    uint64_t bylen[4] = { 0 }; // 8, 16, 24, other
+    int dumped = 0, reported = 0;
+    for (const Frame& fr : frames) {
+        Result b = batch_decode(fr);
+        Result s = stream_decode(fr);
+        Result p = pll_decode(fr);
+        bool bad = false;
+        if (fr.recorded) {
+            recorded++;
+            if (!same_result(p.len, p.data, fr.len, fr.data)) {
+                regressions++;
+                bad = true;
+            }
+        }
+        if (b.len <= 32 && !same_result(b.len, b.data, s.len, s.data)) { // the stream decoder stops at 32 bits
+            disagree++;
+            bad = true;
+        }
+        if (p.len <= 1)
+            errors++;
+        else
+            bylen[p.len == 8 ? 0 : p.len == 16 ? 1 : p.len == 24 ? 2 : 3]++;
+        if (p.len > 1 && p.margin < DALI_MAN_PLL_WEAK)
+            weak++;
+        if (s.len <= 1 && p.len > 1)
+            recovered++;
+        else if (s.len > 1 && p.len <= 1)
+            dropped++;
+        else if (!same_result(s.len, s.data, p.len, p.data))
+            differ++;
+        if (bad && reported < 10) {
+            dump("MISMATCH", fr, b, s, p);
+            reported++;
+        } else if (dumped < ndump) {
+            dump("frame", fr, b, s, p);
+            dumped++;
+        }
+    }
+
+    // timing, best of 5 passes
+    double best_batch = 1e9, best_stream = 1e9, best_pll = 1e9;
+    volatile uint32_t sink = 0;
+    for (int pass = 0; pass < 5 && !frames.empty(); pass++) {
+        double t0 = wall_s();
+        for (const Frame& fr : frames)
+            sink += batch_decode(fr).len;
+        double t1 = wall_s();
+        for (const Frame& fr : frames)
+            sink += stream_decode(fr).len;
+        double t2 = wall_s();
+        for (const Frame& fr : frames)
+            sink += pll_decode(fr).len;
+        double t3 = wall_s();
+        if (t1 - t0 < best_batch)
+            best_batch = t1 - t0;
+        if (t2 - t1 < best_stream)
+            best_stream = t2 - t1;
+        if (t3 - t2 < best_pll)
+            best_pll = t3 - t2;
+    }
+
+    size_t n = frames.size() ? frames.size() : 1;
+    printf("dali_replay %s: %zu records, %zu frames (%llu with a recorded result), %u gaps\n",
+           path, recs.size(), frames.size(), (unsigned long long)recorded, gaps);
+    printf("  pll decoded     8 bit %llu  16 bit %llu  24 bit %llu  other %llu  errors %llu\n",
+           (unsigned long long)bylen[0], (unsigned long long)bylen[1], (unsigned long long)bylen[2],
+           (unsigned long long)bylen[3], (unsigned long long)errors);
+    printf("  pll decoder     %llu differ from the recorded result, %llu decoded with margin < %d\n",
+           (unsigned long long)regressions, (unsigned long long)weak, DALI_MAN_PLL_WEAK);
+    printf("  stream decoder  %llu differ from the batch decoder\n", (unsigned long long)disagree);
+    printf("  pll vs stream   %llu recovered, %llu lost, %llu decoded differently\n",
+           (unsigned long long)recovered, (unsigned long long)dropped, (unsigned long long)differ);
+    printf("  batch decoder   %.1f ns/frame\n", 1e9 * best_batch / n);
+    printf("  stream decoder  %.1f ns/frame\n", 1e9 * best_stream / n);
+    printf("  pll decoder     %.1f ns/frame\n", 1e9 * best_pll / n);
+    return (regressions || disagree) ? 1 : 0;
+}
@@ -0,0 +1,1245 @@
+// dali_sim - run the Dali driver against a virtual bus on Linux.
+//
+// Modes:
+//   stream   node 0 transmits random frames with tx(), the other nodes decode
+//            them with rx(); reports bus frames/sec, host decode cost and the
+//            decode error rate. --drain N only reads the receivers after
+//            every N frames, like a stalled main loop. --capture FILE records
+//            the first receiver's samples (--capture-mode frames|window) into
+//            a capture file for dali_replay.
+//   query    node 0 runs the blocking tx_wait_rx() against a responder node
+//            that answers every 16-bit forward frame with an 8-bit reply.
+//            --async N submits the queries with tx_async() instead, keeping
+//            up to N in flight, from a main loop that runs every 1 ms; both
+//            report the longest main loop stall.
+//   collide  nodes 0 and 1 start different frames on the same tick; reports
+//            how often tx_state() flags the collision.
+//   throughput  node 0 sends a mix of DAPC and query commands (every 4th is
+//            a query) to a control gear that answers the queries with reply().
+//            Runs the mix three ways and reports frames/sec: paced like the
+//            bridge used to (every command waits for a reply, then 150 ms of
+//            bus idle), blocking cmd() with the driver's settling times only,
+//            and pipelined cmd_async() with --async N (default 8) in flight.
+//   contend  two masters share the bus with a control gear: one polls it with
+//            back-to-back queries, the other sends --frames user commands at
+//            random 50..250 ms intervals. Runs once with both at the same
+//            priority and once with DALI_PRIORITY_POLL / DALI_PRIORITY_USER;
+//            reports the user command latency, polling rate and collisions.
+//   config   --frames configuration pushes (set_max_level(), set_scene_level():
+//            DTR0, verify, send-twice store, verify) to a control gear that only
+//            accepts a send-twice pair when nothing came in between. Compares a
+//            reply wait after every frame (the driver before the scheduler),
+//            the pair as two queued frames and the atomic DALI_XFER_TWICE pair,
+//            on a quiet bus and with a second master polling at user priority
+//            0..40 ms after each of its queries.
+//   commission  --devices N control gear (default: 1, 4, 16 and 64) are
+//            given short addresses with INITIALISE, RANDOMISE and the
+//            SEARCHADDR / COMPARE search. Runs the search three ways: as the
+//            bridge used to (all three search address bytes before every
+//            COMPARE, a full search from the top for every device, 50 ms
+//            pauses, programming in a second pass), the driver's old
+//            find_addr() (full search, changed bytes only) and the bounded
+//            search of find_addr(DaliSearch *), which starts from the bounds
+//            left by the previous device and backtracks. Reports forward
+//            frames, bus time and the control gear addressed correctly.
+//            --miss-withdraw P makes the control gear ignore a WITHDRAW with
+//            probability P; it then has to be withdrawn again, not given a
+//            second short address.
+//   scan     --devices N control gear (default: 0, 5, 30 and 64) on random
+//            short addresses are found three ways, from a 1 ms loop at
+//            polling priority like the bridge: the sweep of all 64 short
+//            addresses with 3 tries per empty address and a lamp failure
+//            query, a search of the random addresses with COMPARE plus
+//            QUERY SHORT ADDRESS, and a broadcast QUERY CONTROL GEAR PRESENT
+//            followed by a sweep with one try per empty address (the first
+//            scan of the bridge: it asks the addresses it found last time
+//            twice). Reports
+//            forward frames, bus time and the control gear found.
+//
+// --rx edge switches the receivers (stream) or the master (query) to the edge
+// capture receiver; the ISR line shows timer() + edge() calls per second.
+//
+// Example: dali_sim --mode stream --frames 2000 --skew 0.1 --jitter 5 --noise 0.001
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "sim_bus.h"
+
+struct Options {
+    std::string mode = "stream";
+    int frames = 1000;
+    int bits = 16;
+    int receivers = 1;
+    double skew = 0.0;    // transmitter clock skew
+    double rx_skew = 0.0; // receiver clock skew
+    double jitter = 0.0;  // us
+    double noise = 0.0;   // per-sample inversion probability
+    int gap_ms = 14;      // settling time between frames
+    bool edge = false;    // receivers use the edge capture backend
+    int drain = 1;        // stream: call rx() after every N frames
+    int async = 0;        // query: transactions in flight, 0 = blocking tx_wait_rx()
+    int devices = -1;     // commission, scan: control gear on the bus, -1 = the default list
+    double miss_withdraw = 0.0; // commission: probability that control gear ignores a WITHDRAW
+    std::string capture;  // stream: capture file of the first receiver
+    uint8_t capture_mode = DALI_CAPTURE_FRAMES;
+    uint32_t seed = 1;
+};
+
+static void usage()
+{
+    printf("usage: dali_sim [--mode stream|query|collide|throughput|contend|config|commission|scan] [--frames N] [--bits 8..32]\n"
+           "                [--receivers N] [--devices N] [--skew F] [--rx-skew F] [--jitter US]\n"
+           "                [--noise P] [--gap MS] [--seed N] [--rx sample|edge]\n"
+           "                [--drain N] [--async N] [--capture FILE] [--capture-mode frames|window]\n"
+           "                [--miss-withdraw P]\n");
+}
+
+static bool parse(int argc, char** argv, Options& o)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!strcmp(a, "-h") || !strcmp(a, "--help"))
+            return false;
+        if (!v)
+            return false;
+        if (!strcmp(a, "--mode")) o.mode = v;
+        else if (!strcmp(a, "--frames")) o.frames = atoi(v);
+        else if (!strcmp(a, "--bits")) o.bits = atoi(v);
+        else if (!strcmp(a, "--receivers")) o.receivers = atoi(v);
+        else if (!strcmp(a, "--devices")) o.devices = atoi(v);
+        else if (!strcmp(a, "--miss-withdraw")) o.miss_withdraw = atof(v);
+        else if (!strcmp(a, "--skew")) o.skew = atof(v);
+        else if (!strcmp(a, "--rx-skew")) o.rx_skew = atof(v);
+        else if (!strcmp(a, "--jitter")) o.jitter = atof(v);
+        else if (!strcmp(a, "--noise")) o.noise = atof(v);
+        else if (!strcmp(a, "--gap")) o.gap_ms = atoi(v);
+        else if (!strcmp(a, "--seed")) o.seed = (uint32_t)strtoul(v, nullptr, 0);
+        else if (!strcmp(a, "--rx")) o.edge = !strcmp(v, "edge");
+        else if (!strcmp(a, "--drain")) o.drain = atoi(v);
+        else if (!strcmp(a, "--async")) o.async = atoi(v);
+        else if (!strcmp(a, "--capture")) o.capture = v;
+        else if (!strcmp(a, "--capture-mode")) o.capture_mode = !strcmp(v, "window") ? DALI_CAPTURE_WINDOW : DALI_CAPTURE_FRAMES;
+        else return false;
+        i++;
+    }
+    return o.bits >= 1 && o.bits <= 32 && o.receivers >= 1 && o.frames > 0 && o.drain > 0
+        && o.devices >= -1 && o.devices <= 64
+        && o.async >= 0 && o.async <= DALI_XFER_SLOTS && (o.capture.empty() || !o.edge);
+}
+
+static double wall_s()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static bool same_bits(const uint8_t* a, const uint8_t* b, int bits)
+{
+    for (int i = 0; i < bits; i++) {
+        uint8_t m = 1 << (7 - (i & 7));
+        if ((a[i >> 3] & m) != (b[i >> 3] & m))
+            return false;
+    }
+    return true;
+}
+
+// rx() returns a partial last byte right aligned, tx() takes it left aligned
+static bool same_frame(const uint8_t* rx, const uint8_t* tx, int bits)
+{
+    uint8_t full = bits >> 3, rem = bits & 7;
+    if (!same_bits(rx, tx, full * 8))
+        return false;
+    return !rem || (uint8_t)(rx[full] << (8 - rem)) == (uint8_t)(tx[full] & (0xFF << (8 - rem)));
+}
+
+// wait for the transmitter to finish, then for the receivers' stop condition
+static void run_until_tx_done(SimBus& bus, Dali& tx)
+{
+    while (tx.tx_state() == DALI_RESULT_TRANSMITTING)
+        bus.step();
+    bus.run_for_us(2500);
+}
+
+// capture file, as the bridge serves it at /api/capture
+static bool write_capture(const std::string& path, const std::vector<DaliCaptureRecord>& recs)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    DaliCaptureHeader h;
+    memcpy(h.magic, DALI_CAPTURE_MAGIC, sizeof(h.magic));
+    h.record_size = sizeof(DaliCaptureRecord);
+    h.sample_hz = DALI_SAMPLE_HZ;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+        && fwrite(recs.data(), sizeof(DaliCaptureRecord), recs.size(), f) == recs.size();
+    return fclose(f) == 0 && ok;
+}
+
+//-------------------------------------------------
+static int mode_stream(const Options& o)
+{
+    SimBus bus(o.seed);
+    std::vector<Dali> nodes(1 + o.receivers);
+    SimNodeConfig txcfg;
+    txcfg.skew = o.skew;
+    txcfg.jitter_us = o.jitter;
+    txcfg.noise = o.noise;
+    bus.add_node(&nodes[0], txcfg);
+    for (int r = 1; r <= o.receivers; r++) {
+        SimNodeConfig rxcfg;
+        rxcfg.skew = o.rx_skew;
+        rxcfg.jitter_us = o.jitter;
+        rxcfg.noise = o.noise;
+        rxcfg.edge = o.edge;
+        bus.add_node(&nodes[r], rxcfg);
+    }
+
+    uint64_t ok = 0, bad = 0, missed = 0, decodes = 0;
+    double decode_s = 0;
+    double t0 = wall_s();
+    int64_t sim0 = bus.now_us();
+    uint8_t rx[4];
+    std::vector<std::array<uint8_t, 4>> sent; // frames since the receivers were last drained
+    std::vector<DaliCaptureRecord> ring(1024), captured;
+    uint32_t cap_pos = 0;
+    if (!o.capture.empty())
+        nodes[1].capture_start(o.capture_mode, ring.data(), ring.size());
+
+    for (int f = 0; f < o.frames; f++) {
+        std::array<uint8_t, 4> data;
+        for (int i = 0; i < 4; i++)
+            data[i] = bus.rng()() & 0xFF;
+        bus.run_for_us(o.gap_ms * 1000);
+        while (nodes[0].tx(data.data(), o.bits) != DALI_OK)
+            bus.step();
+        run_until_tx_done(bus, nodes[0]);
+        sent.push_back(data);
+        if (!o.capture.empty()) {
+            DaliCaptureRecord r[16];
+            while (uint16_t n = nodes[1].capture_read(&cap_pos, r, 16))
+                captured.insert(captured.end(), r, r + n);
+        }
+        if ((f + 1) % o.drain != 0 && f + 1 != o.frames)
+            continue;
+
+        // the receive queue keeps the oldest frames, frames beyond it are missed
+        for (int r = 1; r <= o.receivers; r++) {
+            for (size_t i = 0; i < sent.size(); i++) {
+                double d0 = wall_s();
+                uint8_t len = nodes[r].rx(rx);
+                decode_s += wall_s() - d0;
+                decodes++;
+                if (len == o.bits && same_frame(rx, sent[i].data(), o.bits))
+                    ok++;
+                else if (len <= 1)
+                    missed++;
+                else
+                    bad++;
+            }
+        }
+        sent.clear();
+    }
+    uint64_t overruns = 0;
+    for (int r = 1; r <= o.receivers; r++)
+        overruns += nodes[r].rxoverrun;
+
+    double wall = wall_s() - t0;
+    double sim = (bus.now_us() - sim0) / 1e6;
+    uint64_t total = ok + bad + missed;
+    printf("mode=stream bits=%d frames=%d receivers=%d skew=%+.3f rx_skew=%+.3f jitter=%.1fus noise=%g rx=%s\n",
+           o.bits, o.frames, o.receivers, o.skew, o.rx_skew, o.jitter, o.noise, o.edge ? "edge" : "sample");
+    printf("  bus time        %.3f s  (%.1f frames/s on the wire)\n", sim, o.frames / sim);
+    printf("  decoded ok      %llu / %llu\n", (unsigned long long)ok, (unsigned long long)total);
+    printf("  decode errors   %llu  missed %llu  error rate %.4f%%\n",
+           (unsigned long long)bad, (unsigned long long)missed, 100.0 * (bad + missed) / total);
+    printf("  rx queue        drained every %d frames, %llu overruns\n", o.drain, (unsigned long long)overruns);
+    printf("  host rx() cost  %.0f ns/frame  (%.0f decodes/s)\n",
+           1e9 * decode_s / decodes, decodes / decode_s);
+    printf("  receiver ISR    %.0f timer() + %.0f edge() calls/s\n",
+           bus.node(1).ticks / sim, bus.node(1).edges / sim);
+    printf("  host sim speed  %.0fx real time, %.1f Mticks/s\n",
+           sim / wall, bus.total_ticks() / wall / 1e6);
+    if (!o.capture.empty()) {
+        if (!write_capture(o.capture, captured)) {
+            printf("  capture         cannot write %s\n", o.capture.c_str());
+            return 1;
+        }
+        printf("  capture         %zu %s records -> %s\n", captured.size(),
+               o.capture_mode == DALI_CAPTURE_WINDOW ? "window" : "frame", o.capture.c_str());
+    }
+    return 0;
+}
+
+//-------------------------------------------------
+// responder for query mode: answer every 16-bit forward frame after 7 ms
+struct Responder {
+    Dali* dali;
+    int64_t reply_at_us;
+    uint8_t reply;
+    uint64_t answered;
+};
+
+static void responder_tick(SimNode& node, void* ctx)
+{
+    Responder* r = (Responder*)ctx;
+    SimBus* bus = SimBus::active;
+    uint8_t rx[4];
+    if (r->reply_at_us < 0) {
+        if (r->dali->rx(rx) == 16) {
+            r->reply = rx[1] ^ 0x5A;
+            r->reply_at_us = bus->now_us() + 7000;
+        }
+    } else if (bus->now_us() >= r->reply_at_us) {
+        if (r->dali->tx(&r->reply, 8) == DALI_OK) {
+            r->reply_at_us = -1;
+            r->answered++;
+        }
+    }
+    (void)node;
+}
+
+struct QueryStats {
+    uint64_t ok, wrong, no_reply, other;
+};
+
+static void count_reply(QueryStats& st, int16_t rv, uint8_t expect)
+{
+    if (rv == expect)
+        st.ok++;
+    else if (rv >= 0)
+        st.wrong++;
+    else if (rv == -DALI_RESULT_NO_REPLY)
+        st.no_reply++;
+    else
+        st.other++;
+}
+
+// one query submitted with tx_async()
+struct AsyncQuery {
+    QueryStats* st;
+    uint8_t expect;
+    bool done;
+};
+
+static void async_done(int16_t handle, int16_t result, void* ctx)
+{
+    AsyncQuery* q = (AsyncQuery*)ctx;
+    count_reply(*q->st, result, q->expect);
+    q->done = true;
+    (void)handle;
+}
+
+static int mode_query(const Options& o)
+{
+    SimBus bus(o.seed);
+    Dali master, gear;
+    SimNodeConfig mcfg, gcfg;
+    mcfg.jitter_us = gcfg.jitter_us = o.jitter;
+    mcfg.noise = gcfg.noise = o.noise;
+    mcfg.skew = o.rx_skew;
+    mcfg.edge = o.edge;
+    gcfg.skew = o.skew;
+    bus.add_node(&master, mcfg);
+    int g = bus.add_node(&gear, gcfg);
+    Responder resp = { &gear, -1, 0, 0 };
+    bus.node(g).on_tick = responder_tick;
+    bus.node(g).ctx = &resp;
+
+    QueryStats st = { 0, 0, 0, 0 };
+    int64_t stall_us = 0; // longest time the main loop did not get to run
+    double t0 = wall_s();
+    int64_t sim0 = bus.now_us();
+    if (!o.async) {
+        for (int f = 0; f < o.frames; f++) {
+            uint8_t a = (uint8_t)((bus.rng()() % 64) << 1 | 1);
+            uint8_t c = (uint8_t)bus.rng()();
+            int64_t t = bus.now_us();
+            count_reply(st, master.tx_wait_rx(a, c), c ^ 0x5A);
+            stall_us = std::max(stall_us, bus.now_us() - t);
+        }
+    } else {
+        std::vector<AsyncQuery> q(o.frames);
+        int submitted = 0, done = 0;
+        while (done < o.frames) {
+            int64_t t = bus.now_us();
+            master.service();
+            while (done < submitted && q[done].done)
+                done++;
+            while (submitted < o.frames && master.xfer_pending() < o.async) {
+                uint8_t a = (uint8_t)((bus.rng()() % 64) << 1 | 1);
+                uint8_t c = (uint8_t)bus.rng()();
+                q[submitted] = { &st, (uint8_t)(c ^ 0x5A), false };
+                if (master.tx_async(a, c, async_done, &q[submitted]) < 0)
+                    break;
+                submitted++;
+            }
+            stall_us = std::max(stall_us, bus.now_us() - t);
+            bus.run_for_us(1000); // the rest of the main loop: web server, MQTT
+        }
+    }
+    double wall = wall_s() - t0;
+    double sim = (bus.now_us() - sim0) / 1e6;
+    printf("mode=query frames=%d gear_skew=%+.3f master_skew=%+.3f jitter=%.1fus noise=%g %s\n",
+           o.frames, o.skew, o.rx_skew, o.jitter, o.noise, o.async ? "async" : "blocking");
+    printf("  bus time        %.3f s  (%.1f transactions/s)\n", sim, o.frames / sim);
+    printf("  correct reply   %llu  wrong %llu  no reply %llu  other error %llu\n",
+           (unsigned long long)st.ok, (unsigned long long)st.wrong,
+           (unsigned long long)st.no_reply, (unsigned long long)st.other);
+    printf("  error rate      %.4f%%\n", 100.0 * (o.frames - st.ok) / o.frames);
+    printf("  main loop stall %.2f ms max\n", stall_us / 1000.0);
+    printf("  master ISR      %.0f timer() + %.0f edge() calls/s\n",
+           bus.node(0).ticks / sim, bus.node(0).edges / sim);
+    printf("  host sim speed  %.0fx real time\n", sim / wall);
+    return 0;
+}
+
+//-------------------------------------------------
+// control gear for throughput mode: answers queries to its short address with
+// the level of the last DAPC, like esp32_dali_ballast
+struct Gear {
+    Dali* dali;
+    uint8_t level;
+    uint64_t answered;
+};
+
+static void gear_tick(SimNode& node, void* ctx)
+{
+    Gear* g = (Gear*)ctx;
+    uint8_t rx[4];
+    int64_t end_us;
+    g->dali->service();
+    while (g->dali->rx(rx, nullptr, &end_us) > 2) {
+        if (!(rx[0] & 1))
+            g->level = rx[1]; // DAPC
+        else if (rx[1] == DALI_QUERY_ACTUAL_LEVEL && g->dali->reply(g->level, end_us) >= 0)
+            g->answered++;
+    }
+    (void)node;
+}
+
+struct MixStats {
+    uint64_t sent, ok, bad;
+};
+
+// command f of the mix: 3 DAPC, then QUERY ACTUAL LEVEL expecting the last level
+static bool mix_is_query(int f)
+{
+    return (f & 3) == 3;
+}
+
+static uint8_t mix_level(int f)
+{
+    return (uint8_t)(f * 37 % 254);
+}
+
+static void mix_done(int16_t handle, int16_t result, void* ctx)
+{
+    MixStats* st = (MixStats*)ctx;
+    if (result < 0)
+        st->bad++;
+    else
+        st->ok++;
+    (void)handle;
+}
+
+static int16_t mix_submit(Dali& master, int f, MixStats* st)
+{
+    if (mix_is_query(f))
+        return master.cmd_async(DALI_QUERY_ACTUAL_LEVEL, 0, mix_done, st);
+    return master.set_level_async(mix_level(f), 0, mix_done, st);
+}
+
+static int mode_throughput(const Options& o)
+{
+    const char* names[] = { "old bridge pacing", "blocking cmd()", "pipelined" };
+    int inflight = o.async ? o.async : 8;
+    printf("mode=throughput frames=%d (every 4th a query) jitter=%.1fus noise=%g in-flight=%d\n",
+           o.frames, o.jitter, o.noise, inflight);
+    for (int run = 0; run < 3; run++) {
+        SimBus bus(o.seed);
+        Dali master, gear;
+        SimNodeConfig mcfg, gcfg;
+        mcfg.jitter_us = gcfg.jitter_us = o.jitter;
+        mcfg.noise = gcfg.noise = o.noise;
+        mcfg.edge = o.edge;
+        gcfg.skew = o.skew;
+        bus.add_node(&master, mcfg);
+        int g = bus.add_node(&gear, gcfg);
+        Gear gr = { &gear, 0, 0 };
+        bus.node(g).on_tick = gear_tick;
+        bus.node(g).ctx = &gr;
+
+        MixStats st = { 0, 0, 0 };
+        uint64_t wrong = 0;
+        int64_t sim0 = bus.now_us();
+        if (run == 0) {
+            // every frame waits out the reply window, the queue waits for
+            // BUS_IDLE_TIMEOUT_MS (150 ms) of quiet after each command
+            for (int f = 0; f < o.frames; f++) {
+                uint8_t d0 = mix_is_query(f) ? 1 : 0, d1 = mix_is_query(f) ? DALI_QUERY_ACTUAL_LEVEL : mix_level(f);
+                int16_t rv = master.tx_wait_rx(d0, d1);
+                if (mix_is_query(f) ? rv != mix_level(f - 1) : rv != -DALI_RESULT_NO_REPLY)
+                    wrong++;
+                st.sent++;
+                bus.run_for_us(150000);
+            }
+        } else if (run == 1) {
+            for (int f = 0; f < o.frames; f++) {
+                int16_t rv = mix_is_query(f) ? master.cmd(DALI_QUERY_ACTUAL_LEVEL, 0) : (master.set_level(mix_level(f), 0), 0);
+                if (mix_is_query(f) && rv != mix_level(f - 1))
+                    wrong++;
+                st.sent++;
+            }
+        } else {
+            int f = 0;
+            while (f < o.frames || master.xfer_pending()) {
+                master.service();
+                while (f < o.frames && master.xfer_pending() < inflight && mix_submit(master, f, &st) >= 0)
+                    f++;
+                bus.run_for_us(1000); // the rest of the main loop
+            }
+            master.service();
+            st.sent = f;
+            wrong = st.bad;
+        }
+        double sim = (bus.now_us() - sim0) / 1e6;
+        printf("  %-18s %7.1f frames/s  (%.2f s bus time, %llu queries answered, %llu wrong)\n",
+               names[run], st.sent / sim, sim, (unsigned long long)gr.answered, (unsigned long long)wrong);
+    }
+    return 0;
+}
+
+//-------------------------------------------------
+// one user command of contend mode
+struct UserCmd {
+    int64_t submit_us;
+    int64_t done_us;
+    int16_t result;
+};
+
+static void user_done(int16_t handle, int16_t result, void* ctx)
+{
+    UserCmd* u = (UserCmd*)ctx;
+    u->done_us = SimBus::active->now_us();
+    u->result = result;
+    (void)handle;
+}
+
+static int mode_contend(const Options& o)
+{
+    printf("mode=contend user commands=%d jitter=%.1fus noise=%g\n", o.frames, o.jitter, o.noise);
+    for (int run = 0; run < 2; run++) {
+        uint8_t poll_prio = run ? DALI_PRIORITY_POLL : DALI_PRIORITY_CONFIG;
+        uint8_t user_prio = run ? DALI_PRIORITY_USER : DALI_PRIORITY_CONFIG;
+        SimBus bus(o.seed);
+        Dali poller, user, gear;
+        SimNodeConfig cfg;
+        cfg.jitter_us = o.jitter;
+        cfg.noise = o.noise;
+        cfg.edge = o.edge;
+        bus.add_node(&poller, cfg);
+        bus.add_node(&user, cfg);
+        SimNodeConfig gcfg;
+        gcfg.skew = o.skew;
+        int g = bus.add_node(&gear, gcfg);
+        Gear gr = { &gear, 0, 0 };
+        bus.node(g).on_tick = gear_tick;
+        bus.node(g).ctx = &gr;
+
+        MixStats polls = { 0, 0, 0 };
+        std::vector<UserCmd> u(o.frames);
+        int submitted = 0;
+        int64_t next_us = bus.now_us() + 100000;
+        int64_t sim0 = bus.now_us();
+        while (submitted < o.frames || user.xfer_pending()) {
+            poller.service();
+            user.service();
+            while (poller.xfer_pending() < 4 && poller.cmd_async(DALI_QUERY_ACTUAL_LEVEL, 0, mix_done, &polls, poll_prio) >= 0)
+                polls.sent++;
+            if (submitted < o.frames && bus.now_us() >= next_us) {
+                u[submitted] = { bus.now_us(), -1, 0 };
+                if (user.set_level_async(mix_level(submitted), 0, user_done, &u[submitted], user_prio) >= 0)
+                    submitted++;
+                next_us = bus.now_us() + 50000 + bus.rng()() % 200000;
+            }
+            bus.run_for_us(1000);
+        }
+        double sim = (bus.now_us() - sim0) / 1e6;
+        std::vector<int64_t> lat;
+        uint64_t failed = 0;
+        for (const UserCmd& c : u) {
+            if (c.result < 0)
+                failed++;
+            else
+                lat.push_back(c.done_us - c.submit_us);
+        }
+        std::sort(lat.begin(), lat.end());
+        double mean = 0;
+        for (int64_t l : lat)
+            mean += l;
+        mean = lat.empty() ? 0 : mean / lat.size();
+        printf("  %s (poll %d, user %d)\n", run ? "priorities" : "same priority", poll_prio, user_prio);
+        printf("    user command latency  mean %.1f ms  p95 %.1f ms  max %.1f ms  failed %llu\n",
+               mean / 1000.0, lat.empty() ? 0 : lat[lat.size() * 95 / 100] / 1000.0,
+               lat.empty() ? 0 : lat.back() / 1000.0, (unsigned long long)failed);
+        printf("    polling               %.1f queries/s  (%llu answered, %llu failed)\n",
+               polls.ok / sim, (unsigned long long)polls.ok, (unsigned long long)polls.bad);
+        printf("    collisions            poller %u  user %u\n", poller.xfer_collisions, user.xfer_collisions);
+    }
+    return 0;
+}
+
+//-------------------------------------------------
+// control gear for config mode: DTR0, max level and scenes, with send-twice
+// configuration commands taking effect on the second of two identical frames
+// within 100 ms with no frame in between
+struct ConfigGear {
+    Dali* dali;
+    uint8_t dtr0, level, max_level;
+    uint8_t scene[16];
+    uint8_t last[2];
+    int64_t last_end_us; // first frame of a possible pair, -1 = none
+};
+
+static void config_gear_tick(SimNode& node, void* ctx)
+{
+    ConfigGear* g = (ConfigGear*)ctx;
+    uint8_t rx[4];
+    int64_t end_us;
+    g->dali->service();
+    uint8_t len;
+    while ((len = g->dali->rx(rx, nullptr, &end_us)) > 2) {
+        bool pair = len == 16 && g->last_end_us >= 0 && rx[0] == g->last[0] && rx[1] == g->last[1]
+            && end_us - g->last_end_us <= DALI_TWICE_MAX_US;
+        g->last_end_us = -1;
+        if (len != 16)
+            continue;
+        if (rx[0] == (uint8_t)DALI_DATA_TRANSFER_REGISTER0) {
+            g->dtr0 = rx[1];
+            continue;
+        }
+        if (rx[0] != 0x01 && rx[0] != 0xFF)
+            continue; // short address 0 or broadcast
+        if (!(rx[0] & 1) || rx[0] == 0xFE) {
+            g->level = rx[1];
+            continue;
+        }
+        uint8_t c = rx[1];
+        if (c >= 0x20 && c <= 0x81) { // configuration command: needs the pair
+            if (!pair) {
+                g->last[0] = rx[0];
+                g->last[1] = rx[1];
+                g->last_end_us = end_us;
+            } else if (c == (uint8_t)DALI_SET_MAX_LEVEL) {
+                g->max_level = g->dtr0;
+            } else if (c >= (uint8_t)DALI_SET_SCENE0 && c < (uint8_t)DALI_SET_SCENE0 + 16) {
+                g->scene[c - (uint8_t)DALI_SET_SCENE0] = g->dtr0;
+            }
+        } else if (c == DALI_QUERY_CONTENT_DTR0) {
+            g->dali->reply(g->dtr0, end_us);
+        } else if (c == DALI_QUERY_MAX_LEVEL) {
+            g->dali->reply(g->max_level, end_us);
+        } else if (c >= DALI_QUERY_SCENE0_LEVEL && c < DALI_QUERY_SCENE0_LEVEL + 16) {
+            g->dali->reply(g->scene[c - DALI_QUERY_SCENE0_LEVEL], end_us);
+        } else if (c == DALI_QUERY_ACTUAL_LEVEL) {
+            g->dali->reply(g->level, end_us);
+        }
+    }
+    (void)node;
+}
+
+// one frame of a configuration push the way the driver used to send it
+static int16_t config_frame(Dali& m, int how, uint16_t cmd, uint8_t arg)
+{
+    uint8_t d[2];
+    if (cmd & 0x0100) {
+        d[0] = (uint8_t)cmd;
+        d[1] = arg;
+    } else {
+        d[0] = 0x01; // short address 0
+        d[1] = (uint8_t)cmd;
+    }
+    uint8_t copies = (cmd & 0x0200) ? 2 : 1;
+    int16_t rv = 0;
+    for (uint8_t i = 0; i < copies; i++) {
+        // how 0: every frame waits out the reply window, 1: only queries
+        bool query = !(cmd & 0x0100) && (uint8_t)cmd >= 0x90;
+        rv = m.xfer_wait(m.submit(d, 16, (query || how == 0 ? DALI_XFER_REPLY : 0) | DALI_XFER_PRIORITY(DALI_PRIORITY_CONFIG)));
+    }
+    return rv;
+}
+
+// Dali::_set_value() with the frames sent by config_frame()
+static uint8_t config_push(Dali& m, int how, uint16_t setcmd, uint16_t getcmd, uint8_t v)
+{
+    if (how == 2) {
+        if (setcmd == DALI_SET_MAX_LEVEL)
+            return m.set_max_level(v, 0);
+        return m.set_scene_level(setcmd - DALI_SET_SCENE0, v, 0);
+    }
+    if (config_frame(m, how, getcmd, 0) == v)
+        return 0;
+    config_frame(m, how, DALI_DATA_TRANSFER_REGISTER0, v);
+    if (config_frame(m, how, DALI_QUERY_CONTENT_DTR0, 0) != v)
+        return 1;
+    config_frame(m, how, setcmd, 0);
+    if (config_frame(m, how, getcmd, 0) != v)
+        return 2;
+    return 0;
+}
+
+// config mode background master: one query at a time, 0..40 ms apart
+struct ConfigPoller {
+    MixStats st;
+    int64_t next_us;
+};
+
+static void config_poll_done(int16_t handle, int16_t result, void* ctx)
+{
+    ConfigPoller* p = (ConfigPoller*)ctx;
+    mix_done(handle, result, &p->st);
+    p->next_us = SimBus::active->now_us() + SimBus::active->rng()() % 40000;
+}
+
+static void config_poll_tick(SimNode& node, void* ctx)
+{
+    ConfigPoller* p = (ConfigPoller*)ctx;
+    node.dali->service();
+    if (!node.dali->xfer_pending() && p->next_us >= 0 && SimBus::active->now_us() >= p->next_us) {
+        p->next_us = -1;
+        node.dali->cmd_async(DALI_QUERY_ACTUAL_LEVEL, 0, config_poll_done, p, DALI_PRIORITY_USER);
+    }
+}
+
+static int mode_config(const Options& o)
+{
+    const char* names[] = { "reply wait per frame", "two queued frames", "atomic pair" };
+    printf("mode=config pushes=%d jitter=%.1fus noise=%g\n", o.frames, o.jitter, o.noise);
+    for (int poll = 0; poll < 2; poll++) {
+        printf("  %s\n", poll ? "with a second master polling at user priority" : "quiet bus");
+        for (int how = 0; how < 3; how++) {
+            SimBus bus(o.seed);
+            Dali master, poller, gear;
+            SimNodeConfig cfg;
+            cfg.jitter_us = o.jitter;
+            cfg.noise = o.noise;
+            cfg.edge = o.edge;
+            bus.add_node(&master, cfg);
+            int p = bus.add_node(&poller, cfg);
+            int g = bus.add_node(&gear, cfg);
+            ConfigGear gr;
+            memset(&gr, 0, sizeof(gr));
+            gr.dali = &gear;
+            gr.max_level = 254;
+            gr.last_end_us = -1;
+            bus.node(g).on_tick = config_gear_tick;
+            bus.node(g).ctx = &gr;
+            ConfigPoller polls = { { 0, 0, 0 }, 0 };
+            if (poll) {
+                // driven from its own tick, the master's blocking calls run the bus
+                bus.node(p).on_tick = config_poll_tick;
+                bus.node(p).ctx = &polls;
+            }
+
+            uint64_t failed = 0;
+            int64_t sim0 = bus.now_us();
+            for (int f = 0; f < o.frames; f++) {
+                uint8_t v = (uint8_t)(1 + bus.rng()() % 253);
+                uint16_t setcmd = DALI_SET_MAX_LEVEL, getcmd = DALI_QUERY_MAX_LEVEL;
+                if (f & 1) {
+                    uint8_t sc = f / 2 % 16;
+                    setcmd = DALI_SET_SCENE0 + sc;
+                    getcmd = DALI_QUERY_SCENE0_LEVEL + sc;
+                }
+                if (config_push(master, how, setcmd, getcmd, v))
+                    failed++;
+            }
+            double sim = (bus.now_us() - sim0) / 1e6;
+            printf("    %-21s %6.1f ms/push  %5.1f pushes/s  failed %llu",
+                   names[how], 1000.0 * sim / o.frames, o.frames / sim, (unsigned long long)failed);
+            if (poll)
+                printf("  (%llu polls answered)", (unsigned long long)polls.st.ok);
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+//-------------------------------------------------
+// control gear for commission and scan mode: the addressing commands of
+// IEC 62386-102 (INITIALISE, RANDOMISE, SEARCHADDR, COMPARE, WITHDRAW,
+// PROGRAM SHORT ADDRESS, QUERY SHORT ADDRESS) and the queries of the scan,
+// counting the forward frames it sees
+struct SearchGear {
+    Dali* dali;
+    uint32_t random;
+    uint32_t search;
+    uint8_t short_addr; // 0xFF = none
+    bool initialised, withdrawn;
+    uint64_t frames;
+    double miss_withdraw; // probability of ignoring a WITHDRAW
+};
+
+static void search_gear_tick(SimNode& node, void* ctx)
+{
+    SearchGear* g = (SearchGear*)ctx;
+    uint8_t rx[4];
+    int64_t end_us;
+    g->dali->service();
+    uint8_t len;
+    while ((len = g->dali->rx(rx, nullptr, &end_us)) > 2) {
+        if (len != 16)
+            continue; // other gear answering
+        g->frames++;
+        bool selected = g->initialised && g->random == g->search;
+        if (rx[0] < 0xA0 || rx[0] >= 0xFE) { // address byte
+            bool me = (rx[0] >> 1) == 0x7F || (rx[0] < 0x80 && (rx[0] >> 1) == g->short_addr);
+            if (!me || !(rx[0] & 1))
+                continue;
+            if (rx[1] == DALI_QUERY_STATUS)
+                g->dali->reply(0x00, end_us);
+            else if (rx[1] == DALI_QUERY_CONTROL_GEAR_PRESENT)
+                g->dali->reply(0xFF, end_us);
+            else if (rx[1] == DALI_QUERY_MIN_LEVEL)
+                g->dali->reply(0x01, end_us);
+            else if (rx[1] == DALI_QUERY_MAX_LEVEL)
+                g->dali->reply(0xFE, end_us);
+            continue; // QUERY LAMP FAILURE: no
+        }
+        switch (rx[0]) {
+        case (uint8_t)DALI_TERMINATE:
+            g->initialised = false;
+            break;
+        case (uint8_t)DALI_INITIALISE:
+            if (rx[1] == 0x00 || (rx[1] == 0xFF && g->short_addr == 0xFF) || rx[1] == (uint8_t)(g->short_addr << 1 | 1)) {
+                g->initialised = true;
+                g->withdrawn = false;
+            }
+            break;
+        case (uint8_t)DALI_RANDOMISE:
+            if (g->initialised)
+                g->random = SimBus::active->rng()() & 0xFFFFFF;
+            break;
+        case (uint8_t)DALI_COMPARE:
+            if (g->initialised && !g->withdrawn && g->random <= g->search)
+                g->dali->reply(0xFF, end_us);
+            break;
+        case (uint8_t)DALI_WITHDRAW:
+            if (selected && std::uniform_real_distribution<double>(0.0, 1.0)(SimBus::active->rng()) >= g->miss_withdraw)
+                g->withdrawn = true;
+            break;
+        case (uint8_t)DALI_SEARCHADDRH:
+            g->search = (g->search & 0x00FFFF) | (uint32_t)rx[1] << 16;
+            break;
+        case (uint8_t)DALI_SEARCHADDRM:
+            g->search = (g->search & 0xFF00FF) | (uint32_t)rx[1] << 8;
+            break;
+        case (uint8_t)DALI_SEARCHADDRL:
+            g->search = (g->search & 0xFFFF00) | rx[1];
+            break;
+        case (uint8_t)DALI_PROGRAM_SHORT_ADDRESS:
+            if (selected)
+                g->short_addr = (rx[1] == 0xFF) ? 0xFF : (rx[1] >> 1) & 0x3F;
+            break;
+        case (uint8_t)DALI_QUERY_SHORT_ADDRESS:
+            if (selected && !g->withdrawn)
+                g->dali->reply(g->short_addr == 0xFF ? 0xFF : g->short_addr << 1 | 1, end_us);
+            break;
+        }
+    }
+    (void)node;
+}
+
+// one frame the way the bridge's commissioning sent it, with its pause after every frame
+static int16_t old_bridge_cmd(Dali& m, uint16_t cmd, uint8_t arg)
+{
+    int16_t rv = m.cmd(cmd, arg);
+    SimBus::active->run_for_us(50000); // DALI_MIN_INTERVAL_MS
+    return rv;
+}
+
+static uint8_t old_bridge_compare(Dali& m, uint32_t adr)
+{
+    old_bridge_cmd(m, DALI_SEARCHADDRH, adr >> 16);
+    old_bridge_cmd(m, DALI_SEARCHADDRM, adr >> 8);
+    old_bridge_cmd(m, DALI_SEARCHADDRL, adr);
+    int16_t rv = old_bridge_cmd(m, DALI_COMPARE, 0x00);
+    return rv != -DALI_RESULT_NO_REPLY;
+}
+
+// the search of the bridge's commissionDevices() before the bounded search,
+// with the command codes it meant to send (it cut them to 8 bits) and no
+// reply to COMPARE taken as no (it took it as yes)
+static void old_bridge_commission(Dali& m, int devices)
+{
+    std::vector<uint32_t> found;
+    for (;;) {
+        uint32_t addr = 0;
+        for (uint32_t i = 0; i < 24; i++) {
+            uint32_t bit = 1 << (23 - i);
+            addr |= bit;
+            if (old_bridge_compare(m, addr))
+                addr &= ~bit;
+        }
+        if (!old_bridge_compare(m, addr))
+            addr++;
+        if (!old_bridge_compare(m, addr) || (int)found.size() >= devices + 1)
+            break;
+        found.push_back(addr);
+        old_bridge_cmd(m, DALI_WITHDRAW, 0x00);
+    }
+    old_bridge_cmd(m, DALI_INITIALISE, 0x00);
+    SimBus::active->run_for_us(100000);
+    for (size_t i = 0; i < found.size() && i < 64; i++) {
+        old_bridge_cmd(m, DALI_SEARCHADDRH, found[i] >> 16);
+        old_bridge_cmd(m, DALI_SEARCHADDRM, found[i] >> 8);
+        old_bridge_cmd(m, DALI_SEARCHADDRL, found[i]);
+        old_bridge_cmd(m, DALI_PROGRAM_SHORT_ADDRESS, (i << 1) | 1);
+        SimBus::active->run_for_us(200000);
+    }
+}
+
+// Dali::find_addr() before the bounded search: a full search from the top,
+// sending only the search address bytes that changed
+static uint32_t restart_find_addr(Dali& m)
+{
+    uint32_t adr = 0x800000;
+    uint32_t addsub = 0x400000;
+    uint32_t adr_last = adr;
+    m.set_searchaddr(adr);
+    while (addsub) {
+        m.set_searchaddr_diff(adr, adr_last);
+        adr_last = adr;
+        if (m.compare())
+            adr -= addsub;
+        else
+            adr += addsub;
+        addsub >>= 1;
+    }
+    m.set_searchaddr_diff(adr, adr_last);
+    adr_last = adr;
+    if (!m.compare()) {
+        adr++;
+        m.set_searchaddr_diff(adr, adr_last);
+    }
+    return adr;
+}
+
+static int mode_commission(const Options& o)
+{
+    const char* names[] = { "old bridge search", "restart, changed bytes", "bounded search" };
+    std::vector<int> counts = { 1, 4, 16, 64 };
+    if (o.devices >= 0)
+        counts = { o.devices };
+    printf("mode=commission skew=%+.3f jitter=%.1fus noise=%g miss-withdraw=%g\n", o.skew, o.jitter, o.noise, o.miss_withdraw);
+    printf("  devices  search                   frames  frames/dev  bus time  s/dev   addressed   host s\n");
+    for (int n : counts) {
+        for (int how = 0; how < 3; how++) {
+            SimBus bus(o.seed);
+            Dali master;
+            std::vector<Dali> gear(n);
+            std::vector<SearchGear> gr(n);
+            SimNodeConfig mcfg, gcfg;
+            mcfg.jitter_us = gcfg.jitter_us = o.jitter;
+            mcfg.noise = gcfg.noise = o.noise;
+            gcfg.skew = o.skew;
+            bus.add_node(&master, mcfg);
+            for (int i = 0; i < n; i++) {
+                gr[i] = { &gear[i], 0, 0, 0xFF, false, false, 0, o.miss_withdraw };
+                int g = bus.add_node(&gear[i], gcfg);
+                bus.node(g).on_tick = search_gear_tick;
+                bus.node(g).ctx = &gr[i];
+            }
+
+            double t0 = wall_s();
+            int64_t sim0 = bus.now_us();
+            master.cmd(DALI_INITIALISE, 0x00);
+            master.cmd(DALI_RANDOMISE, 0x00);
+            bus.run_for_us(100000);
+            if (how == 0) {
+                old_bridge_commission(master, n);
+            } else {
+                DaliSearch search;
+                master.search_begin(&search);
+                for (uint8_t sa = 0; sa < 64; sa++) {
+                    uint32_t adr = how == 1 ? restart_find_addr(master) : master.find_addr(&search);
+                    if (adr > 0xFFFFFF)
+                        break;
+                    master.program_short_address(sa);
+                    if (how == 1)
+                        master.cmd(DALI_WITHDRAW, 0x00);
+                    else
+                        master.withdraw(&search);
+                }
+            }
+            master.cmd(DALI_TERMINATE, 0x00);
+            double sim = (bus.now_us() - sim0) / 1e6;
+            double wall = wall_s() - t0;
+
+            // every gear got its own address below n
+            uint64_t seen = 0;
+            int ok = 0;
+            for (int i = 0; i < n; i++)
+                if (gr[i].short_addr < n && !(seen & (1ULL << gr[i].short_addr))) {
+                    seen |= 1ULL << gr[i].short_addr;
+                    ok++;
+                }
+            uint64_t frames = gr[0].frames;
+            printf("  %7d  %-22s %8llu  %10.1f  %7.1fs  %5.2f  %4d / %-4d %7.2f\n", n, names[how],
+                   (unsigned long long)frames, (double)frames / n, sim, sim / n, ok, n, wall);
+        }
+    }
+    return 0;
+}
+
+//-------------------------------------------------
+// counts the forward frames on the bus
+struct Monitor {
+    Dali* dali;
+    uint64_t frames;
+};
+
+static void monitor_tick(SimNode& node, void* ctx)
+{
+    Monitor* m = (Monitor*)ctx;
+    uint8_t rx[4];
+    uint8_t len;
+    m->dali->service();
+    while ((len = m->dali->rx(rx)) > 2)
+        if (len == 16)
+            m->frames++;
+    (void)node;
+}
+
+struct ScanQuery {
+    int16_t result;
+    bool done;
+};
+
+static void scan_done(int16_t handle, int16_t result, void* ctx)
+{
+    ScanQuery* q = (ScanQuery*)ctx;
+    q->result = result;
+    q->done = true;
+    (void)handle;
+}
+
+// one scan query from the bridge's DALI task: queued at polling priority,
+// the task looks for the result every 1 ms
+static int16_t scan_query(SimBus& bus, Dali& m, uint16_t cmd, uint8_t adr)
+{
+    ScanQuery q = { 0, false };
+    while (m.cmd_async(cmd, adr, scan_done, &q, DALI_PRIORITY_POLL) < 0)
+        bus.run_for_us(1000);
+    while (!q.done) {
+        bus.run_for_us(1000);
+        m.service();
+    }
+    return q.result;
+}
+
+static bool scan_answered(int16_t rv)
+{
+    return rv >= 0 || rv == -DALI_RESULT_COLLISION || rv == -DALI_RESULT_INVALID_REPLY;
+}
+
+static int mode_scan(const Options& o)
+{
+    const char* names[] = { "sweep, 3 tries", "random address search", "broadcast + sweep" };
+    std::vector<int> counts = { 0, 5, 30, 64 };
+    if (o.devices >= 0)
+        counts = { o.devices };
+    printf("mode=scan skew=%+.3f jitter=%.1fus noise=%g\n", o.skew, o.jitter, o.noise);
+    printf("  devices  scan                     frames  bus time   found   host s\n");
+    for (int n : counts) {
+        // the same short and random addresses for every scan
+        std::mt19937 gen(o.seed);
+        std::vector<uint8_t> addrs(64);
+        for (int i = 0; i < 64; i++)
+            addrs[i] = i;
+        std::shuffle(addrs.begin(), addrs.end(), gen);
+        std::vector<uint32_t> randoms(n);
+        for (int i = 0; i < n; i++)
+            randoms[i] = gen() & 0xFFFFFF;
+
+        for (int how = 0; how < 3; how++) {
+            SimBus bus(o.seed);
+            Dali master, monitor;
+            std::vector<Dali> gear(n);
+            std::vector<SearchGear> gr(n);
+            SimNodeConfig mcfg, gcfg;
+            mcfg.jitter_us = gcfg.jitter_us = o.jitter;
+            mcfg.noise = gcfg.noise = o.noise;
+            gcfg.skew = o.skew;
+            bus.add_node(&master, mcfg);
+            Monitor mon = { &monitor, 0 };
+            int m = bus.add_node(&monitor, mcfg);
+            bus.node(m).on_tick = monitor_tick;
+            bus.node(m).ctx = &mon;
+            for (int i = 0; i < n; i++) {
+                gr[i] = { &gear[i], randoms[i], 0, addrs[i], false, false, 0, 0.0 };
+                int g = bus.add_node(&gear[i], gcfg);
+                bus.node(g).on_tick = search_gear_tick;
+                bus.node(g).ctx = &gr[i];
+            }
+
+            double t0 = wall_s();
+            int64_t sim0 = bus.now_us();
+            uint64_t found = 0;
+            if (how == 0) {
+                for (uint8_t a = 0; a < 64; a++) {
+                    int16_t rv = -1;
+                    for (int t = 0; t < 3 && rv < 0; t++)
+                        rv = scan_query(bus, master, DALI_QUERY_STATUS, a);
+                    if (rv < 0)
+                        continue;
+                    found |= 1ULL << a;
+                    scan_query(bus, master, DALI_QUERY_LAMP_FAILURE, a);
+                    scan_query(bus, master, DALI_QUERY_MIN_LEVEL, a);
+                    scan_query(bus, master, DALI_QUERY_MAX_LEVEL, a);
+                }
+            } else {
+                bool any = false;
+                for (int t = 0; t < 2 && !any; t++)
+                    any = scan_answered(scan_query(bus, master, DALI_QUERY_CONTROL_GEAR_PRESENT, 0xFF));
+                if (any && how == 1) {
+                    master.cmd(DALI_INITIALISE, 0x00);
+                    DaliSearch search;
+                    master.search_begin(&search);
+                    while (master.find_addr(&search) <= 0xFFFFFF) {
+                        int16_t rv = master.cmd(DALI_QUERY_SHORT_ADDRESS, 0x00);
+                        if (rv >= 0 && rv != 0xFF)
+                            found |= 1ULL << ((rv >> 1) & 0x3F);
+                        master.withdraw(&search);
+                    }
+                    master.cmd(DALI_TERMINATE, 0x00);
+                    for (uint8_t a = 0; a < 64; a++)
+                        if (found & (1ULL << a)) {
+                            scan_query(bus, master, DALI_QUERY_STATUS, a);
+                            scan_query(bus, master, DALI_QUERY_MIN_LEVEL, a);
+                            scan_query(bus, master, DALI_QUERY_MAX_LEVEL, a);
+                        }
+                } else if (any) {
+                    for (uint8_t a = 0; a < 64; a++) {
+                        int16_t rv = scan_query(bus, master, DALI_QUERY_STATUS, a);
+                        if (!scan_answered(rv))
+                            continue;
+                        // a garbled status needs activity on MIN or MAX LEVEL
+                        bool seen = rv >= 0;
+                        seen |= scan_answered(scan_query(bus, master, DALI_QUERY_MIN_LEVEL, a));
+                        seen |= scan_answered(scan_query(bus, master, DALI_QUERY_MAX_LEVEL, a));
+                        if (seen)
+                            found |= 1ULL << a;
+                    }
+                }
+            }
+            double sim = (bus.now_us() - sim0) / 1e6;
+            double wall = wall_s() - t0;
+
+            uint64_t expect = 0;
+            for (int i = 0; i < n; i++)
+                expect |= 1ULL << addrs[i];
+            printf("  %7d  %-22s %8llu  %7.1fs  %2d / %-2d%s %7.2f\n", n, names[how],
+                   (unsigned long long)mon.frames, sim, __builtin_popcountll(found), n,
+                   found == expect ? "  " : " !", wall);
+        }
+    }
+    return 0;
+}
+
+//-------------------------------------------------
+static int mode_collide(const Options& o)
+{
+    SimBus bus(o.seed);
+    Dali a, b, listener;
+    SimNodeConfig ca, cb, cl;
+    ca.jitter_us = cb.jitter_us = cl.jitter_us = o.jitter;
+    ca.noise = cb.noise = cl.noise = o.noise;
+    cb.skew = o.skew;
+    bus.add_node(&a, ca);
+    bus.add_node(&b, cb);
+    bus.add_node(&listener, cl);
+    a.txcollisionhandling = DALI_TX_COLLISSION_ON;
+    b.txcollisionhandling = DALI_TX_COLLISSION_ON;
+
+    uint64_t both = 0, one = 0, none = 0, heard_err = 0, heard_frame = 0;
+    uint8_t da[4], db[4], rx[4];
+    for (int f = 0; f < o.frames; f++) {
+        for (int i = 0; i < 4; i++) {
+            da[i] = bus.rng()() & 0xFF;
+            db[i] = bus.rng()() & 0xFF;
+        }
+        if (same_bits(da, db, o.bits))
+            db[0] ^= 0x80;
+        bus.run_for_us(o.gap_ms * 1000);
+        while (a.tx(da, o.bits) != DALI_OK)
+            bus.step();
+        b.tx(db, o.bits);
+        uint8_t ra = DALI_RESULT_TRANSMITTING, rb = DALI_RESULT_TRANSMITTING;
+        uint8_t ca_ = 0, cb_ = 0;
+        for (int i = 0; i < 2000 && (ra == DALI_RESULT_TRANSMITTING || rb == DALI_RESULT_TRANSMITTING); i++) {
+            bus.step();
+            if (ra == DALI_RESULT_TRANSMITTING) {
+                ra = a.tx_state();
+                ca_ |= (ra == DALI_RESULT_COLLISION);
+            }
+            if (rb == DALI_RESULT_TRANSMITTING) {
+                rb = b.tx_state();
+                cb_ |= (rb == DALI_RESULT_COLLISION);
+            }
+        }
+        bus.run_for_us(4000);
+        a.rx(rx);
+        b.rx(rx);
+        uint8_t len = listener.rx(rx);
+        if (len == 2)
+            heard_err++;
+        else if (len > 2)
+            heard_frame++;
+        if (ca_ && cb_) both++;
+        else if (ca_ || cb_) one++;
+        else none++;
+    }
+    printf("mode=collide bits=%d frames=%d skew=%+.3f jitter=%.1fus noise=%g\n",
+           o.bits, o.frames, o.skew, o.jitter, o.noise);
+    printf("  detected by both %llu  by one %llu  undetected %llu\n",
+           (unsigned long long)both, (unsigned long long)one, (unsigned long long)none);
+    printf("  listener saw     %llu decode errors, %llu (garbled) frames\n",
+           (unsigned long long)heard_err, (unsigned long long)heard_frame);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    if (!parse(argc, argv, o)) {
+        usage();
+        return 2;
+    }
+    if (o.mode == "stream")
+        return mode_stream(o);
+    if (o.mode == "query")
+        return mode_query(o);
+    if (o.mode == "collide")
+        return mode_collide(o);
+    if (o.mode == "throughput")
+        return mode_throughput(o);
+    if (o.mode == "contend")
+        return mode_contend(o);
+    if (o.mode == "config")
+        return mode_config(o);
+    if (o.mode == "commission")
+        return mode_commission(o);
+    if (o.mode == "scan")
+        return mode_scan(o);
+    usage();
+    return 2;
+}
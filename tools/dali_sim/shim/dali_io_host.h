@@ -0,0 +1,15 @@
+// Host shim for the DaliIo bus policy of project_dali_lib: every node drives
+// and samples the simulated wire (sim_bus.cpp, acting on SimBus::cur).
+#pragma once
+
+#include <stdint.h>
+
+uint8_t sim_bus_is_high();
+void sim_bus_set_low();
+void sim_bus_set_high();
+
+struct DaliIo {
+    static inline uint8_t is_high() { return sim_bus_is_high(); }
+    static inline void set_low() { sim_bus_set_low(); }
+    static inline void set_high() { sim_bus_set_high(); }
+};
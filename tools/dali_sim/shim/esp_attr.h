@@ -0,0 +1,6 @@
+// Host shim for the ESP-IDF attribute macros used by project_dali_lib.
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define FORCE_INLINE_ATTR static inline __attribute__((always_inline))
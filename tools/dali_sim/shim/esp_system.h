@@ -0,0 +1,2 @@
+// Host shim: nothing from esp_system.h is needed by the driver on the host.
+#pragma once
@@ -0,0 +1,4 @@
+// Host shim: there is no task watchdog on the host.
+#pragma once
+
+static inline void esp_task_wdt_reset() {}
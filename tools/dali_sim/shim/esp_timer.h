@@ -0,0 +1,7 @@
+// Host shim: esp_timer_get_time() reads the virtual clock of the simulated bus.
+// Calls made outside a timer tick advance the simulation, so the driver's
+// busy-wait loops (tx_wait, tx_wait_rx) make progress on the host.
+#pragma once
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
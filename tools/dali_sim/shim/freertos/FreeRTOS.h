@@ -0,0 +1,6 @@
+// Host shim: 1 kHz tick, as configured for the ESP32 Arduino core.
+#pragma once
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
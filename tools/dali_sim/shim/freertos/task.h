@@ -0,0 +1,5 @@
+// Host shim: vTaskDelay() advances the simulated bus instead of sleeping.
+#pragma once
+#include "FreeRTOS.h"
+
+void vTaskDelay(TickType_t ticks);
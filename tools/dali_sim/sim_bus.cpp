@@ -0,0 +1,172 @@
+#include "sim_bus.h"
+
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+SimBus* SimBus::active = nullptr;
+
+//-------------------------------------------------
+// bus IO: the DaliIo policy (shim/dali_io_host.h) is shared by all nodes, so
+// the bus remembers which node is being serviced and these act on it.
+uint8_t sim_bus_is_high()
+{
+    SimBus* bus = SimBus::active;
+    uint8_t level = bus->wire_is_high();
+    SimNode* n = bus->cur;
+    if (n && n->cfg.noise > 0 && bus->unit(bus->gen) < n->cfg.noise)
+        level = !level;
+    return level;
+}
+
+void sim_bus_set_low()
+{
+    SimBus::active->cur->drive_low = true;
+}
+
+void sim_bus_set_high()
+{
+    SimBus::active->cur->drive_low = false;
+}
+
+// the simulated timer is never really stopped, step() just skips timer()
+// while the driver reports it as stopped
+static void sim_timer_start()
+{
+}
+
+static void sim_timer_stop()
+{
+}
+
+SimBus::SimBus(uint32_t seed)
+    : cur(nullptr), now_ns(0), last_wire(1), ticks(0), gen(seed), unit(0.0, 1.0)
+{
+    active = this;
+}
+
+int SimBus::add_node(Dali* dali, const SimNodeConfig& cfg)
+{
+    SimNode n;
+    n.dali = dali;
+    n.cfg = cfg;
+    n.drive_low = false;
+    n.ticks = 0;
+    n.edges = 0;
+    n.on_tick = nullptr;
+    n.ctx = nullptr;
+    // random phase so the nodes do not sample in lock-step
+    n.next_tick_ns = now_ns + (int64_t)(unit(gen) * SIM_TICK_NS);
+    nodes.push_back(n);
+
+    cur = &nodes.back();
+    if (cfg.edge)
+        dali->begin(sim_timer_start, sim_timer_stop);
+    else
+        dali->begin();
+    cur = nullptr;
+    return (int)nodes.size() - 1;
+}
+
+uint8_t SimBus::wire_is_high() const
+{
+    for (const SimNode& n : nodes)
+        if (n.drive_low)
+            return 0;
+    return 1;
+}
+
+int64_t SimBus::_period_ns(const SimNode& n)
+{
+    double p = SIM_TICK_NS * (1.0 + n.cfg.skew);
+    if (n.cfg.jitter_us > 0)
+        p += (unit(gen) * 2.0 - 1.0) * n.cfg.jitter_us * 1000.0;
+    if (p < 1000)
+        p = 1000;
+    return (int64_t)p;
+}
+
+void SimBus::step()
+{
+    if (nodes.empty()) {
+        now_ns += SIM_TICK_NS;
+        return;
+    }
+    SimNode* n = &nodes[0];
+    for (SimNode& c : nodes)
+        if (c.next_tick_ns < n->next_tick_ns)
+            n = &c;
+
+    now_ns = n->next_tick_ns;
+    n->next_tick_ns += _period_ns(*n);
+    if (!n->cfg.edge || n->dali->timer_running()) {
+        cur = n;
+        n->dali->timer();
+        cur = nullptr;
+        n->ticks++;
+        ticks++;
+    }
+
+    // deliver wire changes to the edge capture receivers
+    uint8_t wire = wire_is_high();
+    if (wire != last_wire) {
+        last_wire = wire;
+        for (SimNode& c : nodes) {
+            if (!c.cfg.edge)
+                continue;
+            cur = &c;
+            c.dali->edge(wire);
+            cur = nullptr;
+            c.edges++;
+        }
+    }
+
+    // time stands still for the hook as well, so it can call the driver
+    // (submit(), reply()) like the ISR code it stands in for
+    if (n->on_tick) {
+        cur = n;
+        n->on_tick(*n, n->ctx);
+        cur = nullptr;
+    }
+}
+
+void SimBus::run_until_us(int64_t t_us)
+{
+    int64_t t_ns = t_us * 1000;
+    while (!nodes.empty()) {
+        int64_t next = nodes[0].next_tick_ns;
+        for (const SimNode& c : nodes)
+            if (c.next_tick_ns < next)
+                next = c.next_tick_ns;
+        if (next > t_ns)
+            break;
+        step();
+    }
+    if (now_ns < t_ns)
+        now_ns = t_ns;
+}
+
+void SimBus::run_for_us(int64_t us)
+{
+    run_until_us(now_us() + us);
+}
+
+//-------------------------------------------------
+// shims
+
+int64_t esp_timer_get_time()
+{
+    SimBus* bus = SimBus::active;
+    if (!bus)
+        return 0;
+    // inside timer() (ISR context) time stands still; from the "main loop"
+    // every call lets the bus make progress by one node tick
+    if (!bus->in_tick())
+        bus->step();
+    return bus->now_us();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (SimBus::active)
+        SimBus::active->run_for_us((int64_t)ticks * 1000);
+}
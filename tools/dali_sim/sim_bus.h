@@ -0,0 +1,76 @@
+// Virtual DALI bus for running the Dali driver on Linux.
+//
+// Every node wraps one Dali instance. The wire is open-collector: it is low
+// whenever any node drives it low. Each node has its own DALI_SAMPLE_HZ sample
+// clock (1200 baud, 9600 Hz at 8x) with an optional static skew and per-tick jitter,
+// and its reads of the wire can be corrupted with random noise. Nodes are
+// serviced in time order, so a node running 10% slow really transmits 10% slow
+// bits to the others. Nodes using the edge capture receiver get edge() calls
+// at the exact time the wire changes (without noise), and their timer() is
+// only called while the driver keeps it running.
+#ifndef SIM_BUS_H
+#define SIM_BUS_H
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+
+#include "project_dali_lib.h"
+
+#define SIM_TICK_NS (1000000000 / DALI_SAMPLE_HZ) // 104167 ns at 8x
+
+struct SimNodeConfig {
+    double skew = 0.0;      // clock error, e.g. +0.10 = ticks 10% slow, -0.10 = 10% fast
+    double jitter_us = 0.0; // uniform +/- jitter applied to every tick
+    double noise = 0.0;     // probability that a single bus sample reads inverted
+    bool edge = false;      // use the edge capture receiver: edge() on wire changes, timer() only while running
+};
+
+struct SimNode {
+    Dali* dali;
+    SimNodeConfig cfg;
+    int64_t next_tick_ns;
+    bool drive_low;
+    uint64_t ticks;         // timer() calls
+    uint64_t edges;         // edge() calls
+    void (*on_tick)(SimNode& node, void* ctx); // called after each timer() of this node
+    void* ctx;
+};
+
+class SimBus {
+public:
+    explicit SimBus(uint32_t seed = 1);
+
+    // attach a driver to the wire; calls dali->begin(), the driver reaches the wire through DaliIo
+    int add_node(Dali* dali, const SimNodeConfig& cfg = SimNodeConfig());
+    SimNode& node(int i) { return nodes[i]; }
+    int node_count() const { return (int)nodes.size(); }
+
+    void step();                     // service the next due node tick
+    void run_for_us(int64_t us);     // advance virtual time
+    void run_until_us(int64_t t_us);
+    int64_t now_us() const { return now_ns / 1000; }
+    int64_t now_ns_() const { return now_ns; }
+    bool in_tick() const { return cur != nullptr; }
+
+    uint8_t wire_is_high() const;    // raw wire level, without noise
+    uint64_t total_ticks() const { return ticks; }
+    std::mt19937& rng() { return gen; }
+
+    // hooks for the shims and the DaliIo functions
+    static SimBus* active;
+    SimNode* cur;
+
+private:
+    std::vector<SimNode> nodes;
+    int64_t now_ns;
+    uint8_t last_wire;
+    uint64_t ticks;
+    std::mt19937 gen;
+    std::uniform_real_distribution<double> unit;
+
+    int64_t _period_ns(const SimNode& n);
+    friend uint8_t sim_bus_is_high();
+};
+
+#endif